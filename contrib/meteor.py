@@ -5,10 +5,16 @@
 # --eval_meas extern:eos=false,run=/path/to/lamtram/contrib/meteor.py
 #
 # For external scoring, Lamtram opens the specified "run" executable as a sub-
-# process and sends one output/reference pair at a time to score.  Lamtram sends
-# a line to stdin in the form
+# process and sends it output/reference pairs to score.  Lamtram sends lines to
+# stdin in the form
 # system output ||| reference translation
-# and reads a line from stdout that should contain a single float for the score.
+# and reads a line from stdout for each, in order, that should contain a single
+# float for the score.  Several lines may be sent before any score is read, so
+# the scores should be written (and flushed) as each line is read.  Options:
+# workers=N: run N copies of the executable at once (default 1)
+# pipeline=N: send up to N lines to each copy before reading (default 16)
+# timeout=SECONDS: restart a copy that takes longer to answer (default none)
+# Copies that exit are restarted and their unscored lines are sent again.
 
 import os
 import subprocess
@@ -0,0 +1,123 @@
+#include <lamtram/async-evaluator.h>
+#include <lamtram/macros.h>
+#include <dynet/globals.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+using namespace std;
+using namespace lamtram;
+
+bool lamtram::WriteStats(int fd, const LLStats & stats) {
+  int ints[3] = {stats.words_, stats.unk_, stats.correct_};
+  return write(fd, ints, sizeof(ints)) == sizeof(ints) &&
+         write(fd, &stats.loss_, sizeof(stats.loss_)) == sizeof(stats.loss_);
+}
+
+bool lamtram::ReadStats(int fd, LLStats & stats) {
+  int ints[3];
+  if(read(fd, ints, sizeof(ints)) != sizeof(ints) ||
+     read(fd, &stats.loss_, sizeof(stats.loss_)) != sizeof(stats.loss_))
+    return false;
+  stats.words_ = ints[0]; stats.unk_ = ints[1]; stats.correct_ = ints[2];
+  return true;
+}
+
+inline bool WaitWorker(pid_t pid) {
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+AsyncEvaluator::~AsyncEvaluator() {
+  if(!IsRunning()) return;
+  // Don't throw from the destructor, but don't leave workers behind
+  try {
+    LLStats stats(0);
+    Collect(stats);
+    Finish(false);
+  } catch(std::exception & e) {
+    cerr << e.what() << endl;
+  }
+}
+
+void AsyncEvaluator::Start(int num_workers, int num_steps, int vocab,
+                           const std::function<void(int, LLStats &)> & eval,
+                           const std::function<void()> & save) {
+  if(IsRunning()) THROW_ERROR("Cannot start an evaluation before the previous one is finished");
+  num_workers = std::max(1, std::min(num_workers, num_steps));
+  int save_fd[2];
+  if(pipe(save_fd) != 0) THROW_ERROR("Could not create a pipe for evaluation");
+  for(int w = 0; w < num_workers; w++) {
+    unsigned seed = (*dynet::rndeng)();
+    int fd[2];
+    if(pipe(fd) != 0) THROW_ERROR("Could not create a pipe for evaluation worker " << w);
+    pid_t pid = fork();
+    if(pid < 0) THROW_ERROR("Could not fork evaluation worker " << w);
+    if(pid == 0) {
+      close(fd[0]);
+      close(save_fd[1]);
+      dynet::rndeng->seed(seed);
+      LLStats my_stats(vocab);
+      int ret = 0;
+      try {
+        for(int i = w; i < num_steps; i += num_workers)
+          eval(i, my_stats);
+      } catch(std::exception & e) {
+        cerr << "Evaluation worker " << w << " failed: " << e.what() << endl;
+        ret = 1;
+      }
+      // Nothing is written on failure, so the parent notices
+      if(ret == 0 && !WriteStats(fd[1], my_stats)) ret = 1;
+      close(fd[1]);
+      // The first worker waits to hear whether its parameters are the best
+      char do_save = 0;
+      if(w == 0 && read(save_fd[0], &do_save, 1) == 1 && do_save && ret == 0) {
+        try {
+          save();
+        } catch(std::exception & e) {
+          cerr << "Evaluation worker could not save the model: " << e.what() << endl;
+          ret = 1;
+        }
+      }
+      _exit(ret);
+    }
+    close(fd[1]);
+    pids_.push_back(pid);
+    stats_fds_.push_back(fd[0]);
+  }
+  close(save_fd[0]);
+  save_fd_ = save_fd[1];
+}
+
+void AsyncEvaluator::Collect(LLStats & stats) {
+  bool failed = false;
+  for(size_t w = 0; w < stats_fds_.size(); w++) {
+    LLStats my_stats(stats.vocab_);
+    if(ReadStats(stats_fds_[w], my_stats))
+      stats += my_stats;
+    else
+      failed = true;
+    close(stats_fds_[w]);
+  }
+  stats_fds_.clear();
+  for(size_t w = 1; w < pids_.size(); w++)
+    failed = !WaitWorker(pids_[w]) || failed;
+  pids_.resize(std::min(pids_.size(), (size_t)1));
+  if(failed) {
+    Finish(false);
+    THROW_ERROR("Evaluation worker failed, dying...");
+  }
+}
+
+void AsyncEvaluator::Finish(bool save) {
+  if(!IsRunning()) return;
+  char do_save = save;
+  bool failed = (write(save_fd_, &do_save, 1) != 1);
+  close(save_fd_);
+  failed = !WaitWorker(pids_[0]) || failed;
+  pids_.clear();
+  if(failed && save) THROW_ERROR("Could not save the model in the evaluation worker, dying...");
+}
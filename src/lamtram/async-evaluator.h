@@ -0,0 +1,46 @@
+#pragma once
+
+#include <lamtram/ll-stats.h>
+#include <sys/types.h>
+#include <functional>
+#include <vector>
+
+namespace lamtram {
+
+// Write and read the statistics of a worker process through a pipe,
+// returning false on failure
+bool WriteStats(int fd, const LLStats & stats);
+bool ReadStats(int fd, LLStats & stats);
+
+// A class to evaluate the development set in forked worker processes. Each
+// worker sees the parameters as they were when it was forked, so the parent
+// can keep training while they run. Once the statistics are collected, the
+// first worker can be asked to save its copy of the model.
+class AsyncEvaluator {
+
+public:
+    AsyncEvaluator() { }
+    ~AsyncEvaluator();
+
+    bool IsRunning() const { return pids_.size() > 0; }
+
+    // Fork up to num_workers processes that call eval(i, stats) for the
+    // num_steps minibatches, and wait in the first worker to call save()
+    void Start(int num_workers, int num_steps, int vocab,
+               const std::function<void(int, LLStats &)> & eval,
+               const std::function<void()> & save);
+
+    // Wait for all workers to finish, adding their statistics to stats
+    void Collect(LLStats & stats);
+
+    // Tell the first worker whether to save the model, and wait for it
+    void Finish(bool save);
+
+protected:
+    std::vector<pid_t> pids_;
+    std::vector<int> stats_fds_;
+    int save_fd_;
+
+};
+
+}
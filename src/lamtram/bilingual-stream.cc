@@ -0,0 +1,136 @@
+#include <lamtram/bilingual-stream.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/macros.h>
+#include <dynet/dict.h>
+#include <dynet/globals.h>
+#include <algorithm>
+#include <numeric>
+
+using namespace std;
+using namespace lamtram;
+
+inline size_t OutputLength(const Sentence & trg) { return trg.size(); }
+inline size_t OutputLength(int trg) { return 1; }
+
+inline void ParseOutput(dynet::Dict & vocab, const string & line, Sentence & trg) {
+  trg = ParseWords(vocab, line, true);
+  if(trg.size() == 1) THROW_ERROR("Empty line found in target training data");
+}
+inline void ParseOutput(dynet::Dict & vocab, const string & line, int & trg) {
+  trg = vocab.convert(line);
+}
+
+template <class OutputType>
+BilingualStream<OutputType>::BilingualStream(const vector<string> & files_src,
+                                             const vector<string> & files_trg,
+                                             dynet::Dict & vocab_src, dynet::Dict & vocab_trg,
+                                             size_t buffer_size, size_t minibatch_size) :
+    files_src_(files_src), files_trg_(files_trg), vocab_src_(vocab_src), vocab_trg_(vocab_trg),
+    buffer_size_(buffer_size), minibatch_size_(minibatch_size), num_sents_(0),
+    file_id_(0), done_reading_(false), rng_((*dynet::rndeng)()), curr_pos_(0) {
+  if(files_src_.size() != files_trg_.size())
+    THROW_ERROR("Number of source and target training files don't match: " << files_src_.size() << " != " << files_trg_.size());
+  if(buffer_size_ == 0)
+    THROW_ERROR("Buffer size for streaming training data must be larger than zero");
+}
+
+template <class OutputType>
+BilingualStream<OutputType>::~BilingualStream() {
+  if(next_.valid()) next_.wait();
+}
+
+template <class OutputType>
+bool BilingualStream<OutputType>::ReadPair(Sentence & src, OutputType & trg) {
+  string line_src, line_trg;
+  while(true) {
+    if(in_trg_.get() == nullptr) {
+      if(file_id_ == files_trg_.size()) return false;
+      in_src_.reset(new ifstream(files_src_[file_id_]));
+      if(!*in_src_) THROW_ERROR("Could not find training file: " << files_src_[file_id_]);
+      in_trg_.reset(new ifstream(files_trg_[file_id_]));
+      if(!*in_trg_) THROW_ERROR("Could not find training file: " << files_trg_[file_id_]);
+    }
+    bool has_src = (bool)getline(*in_src_, line_src), has_trg = (bool)getline(*in_trg_, line_trg);
+    if(has_src != has_trg)
+      THROW_ERROR("Training files have different numbers of lines: " << files_src_[file_id_] << ", " << files_trg_[file_id_]);
+    if(has_trg) break;
+    in_src_.reset(); in_trg_.reset();
+    ++file_id_;
+  }
+  src = ParseWords(vocab_src_, line_src, false);
+  if(src.size() == 0) THROW_ERROR("Empty line found in " << files_src_[file_id_]);
+  ParseOutput(vocab_trg_, line_trg, trg);
+  return true;
+}
+
+template <class OutputType>
+size_t BilingualStream<OutputType>::ScanFiles() {
+  if(next_.valid()) next_.wait();
+  in_src_.reset(); in_trg_.reset(); file_id_ = 0;
+  Sentence src;
+  OutputType trg;
+  for(num_sents_ = 0; ReadPair(src, trg); ++num_sents_) { }
+  return num_sents_;
+}
+
+template <class OutputType>
+void BilingualStream<OutputType>::Reset() {
+  if(next_.valid()) next_.wait();
+  curr_.clear(); curr_pos_ = 0;
+  in_src_.reset(); in_trg_.reset(); file_id_ = 0;
+  done_reading_ = false;
+  next_ = std::async(std::launch::async, &BilingualStream<OutputType>::ReadBuffer, this);
+}
+
+template <class OutputType>
+typename BilingualStream<OutputType>::Buffer BilingualStream<OutputType>::ReadBuffer() {
+  vector<Sentence> srcs;
+  vector<OutputType> trgs;
+  Sentence src;
+  OutputType trg;
+  while(srcs.size() < buffer_size_ && ReadPair(src, trg)) {
+    srcs.push_back(src);
+    trgs.push_back(trg);
+  }
+  if(srcs.size() < buffer_size_) done_reading_ = true;
+  // Sort by length and split into minibatches, in the same way as in-memory training data
+  vector<size_t> ids(srcs.size());
+  iota(ids.begin(), ids.end(), 0);
+  if(minibatch_size_ > 1) {
+    sort(ids.begin(), ids.end(), [&](size_t i1, size_t i2) {
+      if(srcs[i2].size() != srcs[i1].size()) return srcs[i2].size() < srcs[i1].size();
+      return OutputLength(trgs[i2]) < OutputLength(trgs[i1]);
+    });
+  }
+  Buffer ret;
+  size_t max_len = 0;
+  bool start_new = true;
+  for(size_t id : ids) {
+    if(start_new) { ret.resize(ret.size()+1); max_len = 0; start_new = false; }
+    max_len = max(max_len, srcs[id].size() + OutputLength(trgs[id]));
+    ret.rbegin()->first.push_back(srcs[id]);
+    ret.rbegin()->second.push_back(trgs[id]);
+    start_new = ((ret.rbegin()->second.size()+1) * max_len > minibatch_size_);
+  }
+  shuffle(ret.begin(), ret.end(), rng_);
+  return ret;
+}
+
+template <class OutputType>
+bool BilingualStream<OutputType>::NextMinibatch(vector<Sentence> & src, vector<OutputType> & trg) {
+  while(curr_pos_ == curr_.size()) {
+    if(!next_.valid()) return false;
+    curr_ = next_.get();
+    curr_pos_ = 0;
+    if(!done_reading_)
+      next_ = std::async(std::launch::async, &BilingualStream<OutputType>::ReadBuffer, this);
+  }
+  src = std::move(curr_[curr_pos_].first);
+  trg = std::move(curr_[curr_pos_].second);
+  ++curr_pos_;
+  return true;
+}
+
+// Instantiate
+template class lamtram::BilingualStream<Sentence>;
+template class lamtram::BilingualStream<int>;
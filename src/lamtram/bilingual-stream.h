@@ -0,0 +1,72 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace dynet {
+class Dict;
+}
+
+namespace lamtram {
+
+// A class to read bilingual training data lazily from a list of shards.
+// Sentences are read into a buffer of bounded size, sorted by length, split
+// into minibatches, and shuffled. The next buffer is read on a background
+// thread while the current one is being trained on.
+template <class OutputType>
+class BilingualStream {
+
+public:
+    BilingualStream(const std::vector<std::string> & files_src,
+                    const std::vector<std::string> & files_trg,
+                    dynet::Dict & vocab_src, dynet::Dict & vocab_trg,
+                    size_t buffer_size, size_t minibatch_size);
+    ~BilingualStream();
+
+    // Read through all of the data once, adding words to the vocabularies if
+    // they are not frozen. Returns the number of sentences.
+    size_t ScanFiles();
+
+    // Start reading again from the beginning of the data
+    void Reset();
+
+    // Get the next minibatch, returning false at the end of the data
+    bool NextMinibatch(std::vector<Sentence> & src, std::vector<OutputType> & trg);
+
+    size_t GetNumSents() const { return num_sents_; }
+
+protected:
+
+    typedef std::vector<std::pair<std::vector<Sentence>, std::vector<OutputType> > > Buffer;
+
+    // Read the next buffer of data, and split it into minibatches
+    Buffer ReadBuffer();
+
+    // Read a single sentence pair, moving to the next shard if necessary
+    bool ReadPair(Sentence & src, OutputType & trg);
+
+    std::vector<std::string> files_src_, files_trg_;
+    dynet::Dict & vocab_src_;
+    dynet::Dict & vocab_trg_;
+    size_t buffer_size_, minibatch_size_, num_sents_;
+
+    // The reading state, only touched by the thread filling the next buffer
+    std::shared_ptr<std::ifstream> in_src_, in_trg_;
+    size_t file_id_;
+    bool done_reading_;
+    std::mt19937 rng_;
+
+    // The current buffer and the one being read
+    Buffer curr_;
+    size_t curr_pos_;
+    std::future<Buffer> next_;
+
+};
+
+}
@@ -0,0 +1,121 @@
+#include <lamtram/binary-corpus.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/macros.h>
+#include <dynet/dict.h>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+using namespace std;
+using namespace lamtram;
+
+// The layout of the file is:
+//  header: magic string followed by the counts below
+//  int32_t  tokens[num_tokens]       (padded to a multiple of 8 bytes)
+//  uint64_t offsets[num_sents+1]     (start of each sentence in tokens)
+//  uint64_t file_ends[num_files]     (number of sentences up to the end of each file)
+//  the vocabulary in WriteDict format
+struct BinaryCorpusHeader {
+  char magic[16];
+  uint64_t num_sents, num_tokens, num_files, vocab_start;
+};
+static const char * BINARY_CORPUS_MAGIC = "lamtram_corp_01";
+
+void BinaryCorpus::Binarize(const vector<string> & files_in, bool add_end,
+                            dynet::Dict & vocab, const string & file_out) {
+  ofstream out(file_out, ios::binary);
+  if(!out) THROW_ERROR("Could not open output file: " << file_out);
+  BinaryCorpusHeader header;
+  memset(&header, 0, sizeof(header));
+  strcpy(header.magic, BINARY_CORPUS_MAGIC);
+  out.write((const char*)&header, sizeof(header));
+  // Write the tokens as they are read, and keep the offsets
+  vector<uint64_t> offsets(1, 0), file_ends;
+  string line;
+  for(const string & file : files_in) {
+    ifstream in(file);
+    if(!in) THROW_ERROR("Could not find training file: " << file);
+    int line_no = 0;
+    while(getline(in, line)) {
+      line_no++;
+      Sentence sent = ParseWords(vocab, line, add_end);
+      if(sent.size() == (add_end ? 1 : 0))
+        THROW_ERROR("Empty line found in " << file << " at " << line_no << endl);
+      vector<int32_t> tokens(sent.begin(), sent.end());
+      out.write((const char*)tokens.data(), sizeof(int32_t)*tokens.size());
+      offsets.push_back(*offsets.rbegin() + tokens.size());
+    }
+    file_ends.push_back(offsets.size()-1);
+  }
+  header.num_sents = offsets.size()-1;
+  header.num_tokens = *offsets.rbegin();
+  header.num_files = file_ends.size();
+  if(header.num_tokens % 2) {
+    int32_t pad = 0;
+    out.write((const char*)&pad, sizeof(pad));
+  }
+  out.write((const char*)offsets.data(), sizeof(uint64_t)*offsets.size());
+  out.write((const char*)file_ends.data(), sizeof(uint64_t)*file_ends.size());
+  header.vocab_start = out.tellp();
+  WriteDict(vocab, out);
+  out.seekp(0);
+  out.write((const char*)&header, sizeof(header));
+  if(!out) THROW_ERROR("Error writing to " << file_out);
+}
+
+void BinaryCorpus::Load(const string & file_in, dynet::Dict & vocab,
+                        vector<Sentence> & sents, vector<int> & file_ids) {
+  boost::iostreams::mapped_file_source mapped;
+  try {
+    mapped.open(file_in);
+  } catch(std::exception & e) {
+    THROW_ERROR("Could not open binary corpus " << file_in << ": " << e.what());
+  }
+  const char * data = mapped.data();
+  BinaryCorpusHeader header;
+  if(mapped.size() < sizeof(header))
+    THROW_ERROR("Binary corpus is too short: " << file_in);
+  memcpy(&header, data, sizeof(header));
+  if(strncmp(header.magic, BINARY_CORPUS_MAGIC, sizeof(header.magic)) != 0)
+    THROW_ERROR("Expecting a binary corpus of version " << BINARY_CORPUS_MAGIC << " in " << file_in);
+  // Check that the arrays fit before the vocabulary, without overflowing
+  uint64_t size = mapped.size();
+  if(header.vocab_start > size || header.num_tokens > size || header.num_sents > size || header.num_files > size ||
+     sizeof(header) + sizeof(int32_t) * (header.num_tokens + header.num_tokens % 2) +
+     sizeof(uint64_t) * (header.num_sents + 1 + header.num_files) > header.vocab_start)
+    THROW_ERROR("Binary corpus is corrupted: " << file_in);
+  const int32_t * tokens = (const int32_t*)(data + sizeof(header));
+  const uint64_t * offsets = (const uint64_t*)(tokens + header.num_tokens + header.num_tokens % 2);
+  const uint64_t * file_ends = offsets + header.num_sents + 1;
+  if(offsets[0] != 0 || offsets[header.num_sents] != header.num_tokens)
+    THROW_ERROR("Binary corpus is corrupted: " << file_in);
+  // Map the IDs in the corpus' vocabulary to the passed vocabulary
+  istringstream vocab_in(string(data + header.vocab_start, mapped.size() - header.vocab_start));
+  std::shared_ptr<dynet::Dict> corpus_vocab(ReadDict(vocab_in));
+  const vector<string> & words = corpus_vocab->get_words();
+  vector<WordId> id_map(words.size());
+  bool same_ids = true;
+  for(size_t i = 0; i < words.size(); i++) {
+    id_map[i] = vocab.convert(words[i]);
+    same_ids = same_ids && (id_map[i] == (WordId)i);
+  }
+  // Copy out the sentences
+  sents.reserve(sents.size() + header.num_sents);
+  file_ids.reserve(file_ids.size() + header.num_sents);
+  int file_id = 0;
+  for(uint64_t i = 0; i < header.num_sents; i++) {
+    while(file_id < (int)header.num_files && file_ends[file_id] <= i) file_id++;
+    if(offsets[i] > offsets[i+1] || offsets[i+1] > header.num_tokens)
+      THROW_ERROR("Binary corpus is corrupted: " << file_in);
+    sents.push_back(Sentence(tokens + offsets[i], tokens + offsets[i+1]));
+    for(WordId & wid : *sents.rbegin()) {
+      if(wid < 0 || wid >= (WordId)id_map.size())
+        THROW_ERROR("Binary corpus has a word ID out of its vocabulary: " << file_in);
+      if(!same_ids) wid = id_map[wid];
+    }
+    file_ids.push_back(file_id);
+  }
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <string>
+#include <vector>
+
+namespace dynet {
+class Dict;
+}
+
+namespace lamtram {
+
+// A corpus stored as contiguous 32-bit word IDs with a table of sentence
+// offsets, followed by its vocabulary. This is created once from text by
+// lamtram-binarize, and memory mapped when training so the text doesn't
+// need to be tokenized again.
+class BinaryCorpus {
+
+public:
+
+    // Convert one or more text files into a single binary corpus, adding the
+    // words to the vocabulary
+    static void Binarize(const std::vector<std::string> & files_in, bool add_end,
+                         dynet::Dict & vocab, const std::string & file_out);
+
+    // Load all sentences in a binary corpus, converting its words into IDs
+    // in vocab. file_ids is set to the input file that each sentence came from.
+    static void Load(const std::string & file_in, dynet::Dict & vocab,
+                     std::vector<Sentence> & sents, std::vector<int> & file_ids);
+
+};
+
+}
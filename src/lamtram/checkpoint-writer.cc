@@ -0,0 +1,86 @@
+#include <lamtram/checkpoint-writer.h>
+#include <lamtram/macros.h>
+#include <dynet/model.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+using namespace lamtram;
+
+CheckpointWriter::CheckpointWriter(const std::string & file, const std::string & format, bool async, int keep) :
+      file_(file), format_(format), async_(async), keep_(keep) {
+  if(format_ != "text" && format_ != "binary" && format_ != "int8" && format_ != "fp16")
+    THROW_ERROR("Illegal model format: " << format_);
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  // Don't throw from the destructor, but make sure the last model is written
+  try { Wait(); } catch(std::exception & e) { cerr << e.what() << endl; }
+}
+
+void CheckpointWriter::Wait() {
+  if(pending_.valid()) pending_.get();
+}
+
+void CheckpointWriter::Write(const std::string & header, const dynet::Model & mod) {
+  Wait();
+  if(format_ == "text" && text_model_.get() == nullptr) {
+    // The text archive needs a model with the same structure, so copy it once
+    stringstream ss;
+    ModelUtils::WriteModelText(ss, mod);
+    text_model_.reset(new dynet::Model);
+    ModelUtils::ReadModelText(ss, *text_model_);
+  }
+  ModelSnapshot snap;
+  ModelUtils::SnapshotModel(mod, snap);
+  if(async_)
+    pending_ = std::async(std::launch::async, &CheckpointWriter::WriteFile, this, header, std::move(snap));
+  else
+    WriteFile(header, snap);
+}
+
+void CheckpointWriter::WriteTmpFile(const std::string & tmp_file, const std::string & header, const ModelSnapshot & snap) {
+  ofstream out(tmp_file.c_str());
+  if(!out) THROW_ERROR("Could not open output file: " << tmp_file);
+  out << header;
+  if(format_ == "text") {
+    ModelUtils::RestoreSnapshot(snap, *text_model_);
+    ModelUtils::WriteModelText(out, *text_model_);
+  } else {
+    ModelUtils::WriteSnapshotBinary(out, snap, (format_ == "binary" ? "float" : format_));
+  }
+  out.close();
+  if(!out) THROW_ERROR("Could not write output file: " << tmp_file);
+}
+
+void CheckpointWriter::WriteFile(const std::string & header, const ModelSnapshot & snap) {
+  string tmp_file = file_ + ".tmp";
+  // Don't leave a partial model behind if anything fails
+  try {
+    WriteTmpFile(tmp_file, header, snap);
+    if(keep_ > 0) {
+      // Shift file.1 ... file.(keep-1) back by one, and link the current file
+      // as file.1 so that file itself always exists
+      for(int i = keep_ - 1; i > 0; i--) {
+        string from = file_ + "." + to_string(i), to = file_ + "." + to_string(i+1);
+        if(access(from.c_str(), F_OK) == 0 && rename(from.c_str(), to.c_str()) != 0)
+          THROW_ERROR("Could not rename " << from << " to " << to << ": " << strerror(errno));
+      }
+      string prev = file_ + ".1";
+      if(access(file_.c_str(), F_OK) == 0) {
+        unlink(prev.c_str());
+        if(link(file_.c_str(), prev.c_str()) != 0)
+          THROW_ERROR("Could not keep the previous model as " << prev << ": " << strerror(errno));
+      }
+    }
+    if(rename(tmp_file.c_str(), file_.c_str()) != 0)
+      THROW_ERROR("Could not rename " << tmp_file << " to " << file_ << ": " << strerror(errno));
+  } catch(...) {
+    unlink(tmp_file.c_str());
+    throw;
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <lamtram/model-utils.h>
+#include <future>
+#include <memory>
+#include <string>
+
+namespace dynet {
+class Model;
+}
+
+namespace lamtram {
+
+// A class to write model checkpoints to a file. Each checkpoint is written
+// to a temporary file that is then renamed over the output, so the output
+// is always a complete model. If async is true, the parameter values are
+// copied into memory and written on a background thread while training
+// continues. Text format models are serialized from a private copy of the
+// model, which is made once on the first write and then only has its values
+// updated from the snapshot. If keep is larger than zero, the previous
+// checkpoints are kept as file.1 (the most recent) to file.keep.
+class CheckpointWriter {
+
+public:
+    CheckpointWriter(const std::string & file, const std::string & format, bool async, int keep);
+    ~CheckpointWriter();
+
+    // Write header (the vocabularies and model specification) followed by
+    // the parameters of mod, after the previous checkpoint has been written
+    void Write(const std::string & header, const dynet::Model & mod);
+
+    // Wait until the last checkpoint has been written
+    void Wait();
+
+protected:
+    // Write the file and move the older checkpoints, on the background thread
+    void WriteFile(const std::string & header, const ModelSnapshot & snap);
+    void WriteTmpFile(const std::string & tmp_file, const std::string & header, const ModelSnapshot & snap);
+
+    std::string file_, format_;
+    // The copy of the model that text format snapshots are restored into
+    std::shared_ptr<dynet::Model> text_model_;
+    bool async_;
+    int keep_;
+    std::future<void> pending_;
+
+};
+
+}
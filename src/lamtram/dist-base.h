@@ -35,9 +35,15 @@ public:
 
   // Add stats from one sentence at training time for count-based models
   virtual void add_stats(const Sentence & sent) = 0;
-
-  // Perform any final calculations on the stats
-  virtual void finalize_stats() { }
+  // Add stats from many sentences, using up to num_threads threads if the
+  // model supports it
+  virtual void add_corpus_stats(const std::vector<Sentence> & sents, int num_threads = 1) {
+    for(const auto & sent : sents) add_stats(sent);
+  }
+
+  // Perform any final calculations on the stats, using up to num_threads
+  // threads if the model supports it
+  virtual void finalize_stats(int num_threads = 1) { }
 
   // Get the length of n-gram context that this model expects
   virtual size_t get_ctxt_len() const { return ctxt_len_; }
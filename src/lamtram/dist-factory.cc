@@ -27,6 +27,13 @@ DistPtr DistFactory::create_dist(const std::string & sig) {
 }
 
 DistPtr DistFactory::from_file(const std::string & file_name, DictPtr dict) {
+  // Binary n-gram models are memory mapped instead of read
+  string binary_sig = DistNgram::get_binary_sig(file_name);
+  if(binary_sig != "") {
+    std::shared_ptr<DistNgram> ret(new DistNgram(binary_sig));
+    ret->read_binary(dict, file_name);
+    return ret;
+  }
   InputFileStream in(file_name);
   if(!in) THROW_ERROR("Could not open " << file_name);
   string line;
@@ -0,0 +1,253 @@
+#include <lamtram/dist-ngram-disk.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/macros.h>
+#include <dynet/dict.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <queue>
+
+using namespace std;
+using namespace lamtram;
+
+// The largest number of runs merged at once
+#define DIST_NGRAM_DISK_FANIN 64
+
+// Reads a file of n-grams of one length in order, where each record is the
+// words of an n-gram followed by its count
+class NgramFileReader {
+public:
+  NgramFileReader(const std::string & file, size_t len) : words(len), count(0), done(false), in_(file, ios::binary) {
+    if(!in_) THROW_ERROR("Could not open n-gram file: " << file);
+    next();
+  }
+  void next() {
+    in_.read((char*)words.data(), sizeof(WordId) * words.size());
+    in_.read((char*)&count, sizeof(count));
+    done = !in_;
+  }
+  // Whether the current n-gram starts with ctxt
+  bool starts_with(const Sentence & ctxt) const {
+    return !done && equal(ctxt.begin(), ctxt.end(), words.begin());
+  }
+  Sentence words;
+  int count;
+  bool done;
+protected:
+  std::ifstream in_;
+};
+
+inline void write_ngram(std::ostream & out, const Sentence & words, int count) {
+  out.write((const char*)words.data(), sizeof(WordId) * words.size());
+  out.write((const char*)&count, sizeof(count));
+}
+
+DistNgramDisk::DistNgramDisk(const std::string & sig, const std::string & tmp_dir, size_t max_ngrams) :
+      DistNgram(sig), tmp_dir_(tmp_dir), max_ngrams_(max_ngrams), runs_(ngram_len_+1) {
+  if(max_ngrams_ == 0) THROW_ERROR("DistNgramDisk must be able to hold at least one n-gram");
+}
+
+DistNgramDisk::~DistNgramDisk() {
+  for(const auto & file : files_)
+    unlink(file.c_str());
+}
+
+std::string DistNgramDisk::new_file() const {
+  string file = tmp_dir_ + "/lamtram-ngram.XXXXXX";
+  int fd = mkstemp(&file[0]);
+  if(fd == -1) THROW_ERROR("Could not create a temporary file in " << tmp_dir_);
+  close(fd);
+  files_.push_back(file);
+  return file;
+}
+
+void DistNgramDisk::add_stats(const Sentence & sent) {
+  if(count_files_.size() != 0) THROW_ERROR("Cannot add stats to DistNgramDisk after finalizing them");
+  for_each_ngram(sent, [this](const Sentence & ngram) { counts_[ngram]++; });
+  if(counts_.size() >= max_ngrams_)
+    spill(counts_, runs_);
+}
+
+void DistNgramDisk::add_corpus_stats(const std::vector<Sentence> & sents, int num_threads) {
+  DistBase::add_corpus_stats(sents);
+}
+
+void DistNgramDisk::spill(NgramCounts & counts, std::vector<std::vector<std::string> > & runs) {
+  vector<vector<const NgramCounts::value_type*> > ngrams(runs.size());
+  for(const auto & cnt : counts)
+    ngrams[cnt.first.size()].push_back(&cnt);
+  for(size_t len = 0; len < ngrams.size(); len++) {
+    if(ngrams[len].size() == 0) continue;
+    sort(ngrams[len].begin(), ngrams[len].end(),
+         [](const NgramCounts::value_type * a, const NgramCounts::value_type * b) { return a->first < b->first; });
+    string file = new_file();
+    ofstream out(file, ios::binary);
+    for(auto cnt : ngrams[len])
+      write_ngram(out, cnt->first, cnt->second);
+    if(!out) THROW_ERROR("Could not write n-grams to " << file);
+    runs[len].push_back(file);
+  }
+  NgramCounts().swap(counts);
+}
+
+std::string DistNgramDisk::merge_runs(std::vector<std::string> runs, size_t len) {
+  if(runs.size() == 0) return new_file();
+  while(runs.size() > 1) {
+    vector<string> next_runs;
+    for(size_t i = 0; i < runs.size(); i += DIST_NGRAM_DISK_FANIN) {
+      vector<string> files(runs.begin() + i, runs.begin() + min(i + DIST_NGRAM_DISK_FANIN, runs.size()));
+      next_runs.push_back(files.size() == 1 ? files[0] : merge_files(files, len));
+    }
+    runs.swap(next_runs);
+  }
+  return runs[0];
+}
+
+std::string DistNgramDisk::merge_files(const std::vector<std::string> & files, size_t len) {
+  vector<shared_ptr<NgramFileReader> > readers;
+  for(const auto & file : files)
+    readers.push_back(make_shared<NgramFileReader>(file, len));
+  // A queue of the readers with the smallest n-gram first
+  auto later = [&](int a, int b) { return readers[b]->words < readers[a]->words; };
+  priority_queue<int, vector<int>, decltype(later)> queue(later);
+  for(size_t i = 0; i < readers.size(); i++)
+    if(!readers[i]->done) queue.push(i);
+  string file = new_file();
+  ofstream out(file, ios::binary);
+  Sentence ngram;
+  int count = 0;
+  bool has_ngram = false;
+  while(!queue.empty()) {
+    int id = queue.top();
+    queue.pop();
+    NgramFileReader & reader = *readers[id];
+    if(has_ngram && reader.words == ngram) {
+      count += reader.count;
+    } else {
+      if(has_ngram) write_ngram(out, ngram, count);
+      ngram = reader.words;
+      count = reader.count;
+      has_ngram = true;
+    }
+    reader.next();
+    if(!reader.done) queue.push(id);
+  }
+  if(has_ngram) write_ngram(out, ngram, count);
+  if(!out) THROW_ERROR("Could not write n-grams to " << file);
+  // The merged runs are not needed any more
+  readers.clear();
+  for(const auto & run : files)
+    unlink(run.c_str());
+  return file;
+}
+
+void DistNgramDisk::finalize_stats(int num_threads) {
+  spill(counts_, runs_);
+  count_files_.resize(ngram_len_+1);
+  for(size_t len = 1; len <= ngram_len_; len++)
+    count_files_[len] = merge_runs(runs_[len], len);
+  runs_.clear();
+  value_files_ = count_files_;
+  // With Kneser-Ney, every n-gram of two words or more adds one to the
+  // continuation count of itself without its first word
+  if(smoothing_ == SMOOTH_MKN && ngram_len_ != 1) {
+    for(size_t len = 2; len <= ngram_len_; len++) {
+      NgramCounts conts;
+      vector<vector<string> > cont_runs(len);
+      for(NgramFileReader in(count_files_[len], len); !in.done; in.next()) {
+        conts[Sentence(in.words.begin()+1, in.words.end())]++;
+        if(conts.size() >= max_ngrams_)
+          spill(conts, cont_runs);
+      }
+      spill(conts, cont_runs);
+      value_files_[len-1] = merge_runs(cont_runs[len-1], len-1);
+    }
+  }
+  // Get scores for discounting if necessary
+  if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
+    vector<vector<size_t> > cnt_fofs(ngram_len_, vector<size_t>(5));
+    for(size_t len = 1; len <= ngram_len_; len++)
+      for(NgramFileReader in(value_files_[len], len); !in.done; in.next())
+        if(in.count > 0 && in.count <= 4)
+          cnt_fofs[len-1][in.count]++;
+    vector<vector<float> > fofs(ngram_len_, vector<float>(5));
+    for(size_t i = 0; i < ngram_len_; i++)
+      for(size_t j = 0; j < 5; j++)
+        fofs[i][j] = cnt_fofs[i][j];
+    calc_discounts(fofs);
+  }
+}
+
+// The contexts of each length are those that were counted, and those that
+// are the start of a longer n-gram. Their statistics are collected from the
+// longer n-grams that follow them, which are next to each other when sorted.
+void DistNgramDisk::write(DictPtr dict, std::ostream & out) const {
+  if(count_files_.size() == 0) THROW_ERROR("Cannot write DistNgramDisk before finalizing the stats");
+  bool use_kn = (smoothing_ == SMOOTH_MKN && ngram_len_ != 1);
+  // The number of n-grams comes before them, so write them to a file first
+  string body_file = new_file();
+  size_t num_ngrams = 0, num_ctxts = 0;
+  {
+    ofstream body(body_file);
+    vector<int> next_vals;
+    for(size_t len = 0; len < ngram_len_; len++) {
+      shared_ptr<NgramFileReader> counted, values;
+      if(len != 0) {
+        counted = make_shared<NgramFileReader>(count_files_[len], len);
+        values = (use_kn ? make_shared<NgramFileReader>(value_files_[len], len) : counted);
+      }
+      NgramFileReader next(value_files_[len+1], len+1);
+      while((counted && !counted->done) || !next.done) {
+        // Take the smaller of the next counted n-gram and next context
+        Sentence ctxt;
+        if(!next.done)
+          ctxt.assign(next.words.begin(), next.words.begin() + len);
+        if(counted && !counted->done && (next.done || counted->words < ctxt))
+          ctxt = counted->words;
+        DistNgramCounts cnts;
+        if(values && !values->done && values->words == ctxt) {
+          cnts.first = values->count;
+          values->next();
+        }
+        if(counted && !counted->done && counted->words == ctxt && counted != values)
+          counted->next();
+        next_vals.clear();
+        for( ; next.starts_with(ctxt); next.next()) {
+          cnts.second += next.count;
+          if(next.count > 0) {
+            cnts.third++;
+            next_vals.push_back(next.count);
+          }
+        }
+        body << PrintWords(*dict, ctxt) << '\t' << cnts.first << ' ' << cnts.second << ' ' << cnts.third;
+        if(smoothing_ != SMOOTH_LIN) {
+          float disc_cnt = cnts.second;
+          for(int val : next_vals)
+            disc_cnt -= discounts_[len][min(3,val)];
+          body << ' ' << disc_cnt;
+        }
+        body << '\n';
+        num_ngrams++;
+        num_ctxts++;
+      }
+    }
+    for(NgramFileReader in(count_files_[ngram_len_], ngram_len_); !in.done; in.next()) {
+      body << PrintWords(*dict, in.words) << '\t' << in.count << '\n';
+      num_ngrams++;
+    }
+    if(!body) THROW_ERROR("Could not write n-grams to " << body_file);
+  }
+  write_header(out);
+  out << "mapping " << num_ngrams << ' ' << num_ctxts << '\n';
+  {
+    ifstream body(body_file);
+    if(num_ngrams != 0) out << body.rdbuf();
+  }
+  unlink(body_file.c_str());
+  out << '\n';
+}
+
+void DistNgramDisk::read(DictPtr dict, std::istream & in) {
+  THROW_ERROR("Models trained by DistNgramDisk must be read by DistNgram");
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <lamtram/dist-ngram.h>
+
+namespace lamtram {
+
+// An n-gram distribution that is trained with a bounded amount of memory,
+// for corpora with more n-grams than fit in memory. The n-grams are counted
+// in memory until there are max_ngrams of them, then written to disk as one
+// sorted run per length. Finalizing merges the runs into a sorted file of
+// counts for each length, and finds the Kneser-Ney continuation counts by
+// sorting the n-grams without their first word in the same way. The model
+// is then streamed out of these files in the same format and order as
+// DistNgram::write(), to be read back with DistNgram. The distributions
+// themselves can't be calculated by this class.
+class DistNgramDisk : public DistNgram {
+
+public:
+  // Temporary files are created in tmp_dir, and removed on destruction
+  DistNgramDisk(const std::string & sig, const std::string & tmp_dir, size_t max_ngrams);
+  virtual ~DistNgramDisk();
+
+  // Add stats from one sentence, writing them to disk when there are too many
+  virtual void add_stats(const Sentence & sent) override;
+  // Add the sentences one at a time, as the memory is limited
+  virtual void add_corpus_stats(const std::vector<Sentence> & sents, int num_threads = 1) override;
+
+  // Merge the runs, and calculate the continuation counts and discounts
+  virtual void finalize_stats(int num_threads = 1) override;
+
+  // Write the model, which can only be read by DistNgram
+  virtual void write(DictPtr dict, std::ostream & str) const override;
+  virtual void read(DictPtr dict, std::istream & str) override;
+
+protected:
+  typedef std::unordered_map<Sentence, int> NgramCounts;
+
+  // Write counts to one sorted run for each length, and clear them
+  void spill(NgramCounts & counts, std::vector<std::vector<std::string> > & runs);
+  // Merge the sorted runs of n-grams of length len into one, summing the
+  // counts of the same n-gram
+  std::string merge_runs(std::vector<std::string> runs, size_t len);
+  std::string merge_files(const std::vector<std::string> & files, size_t len);
+  // Create an empty file in tmp_dir_
+  std::string new_file() const;
+
+  std::string tmp_dir_;
+  size_t max_ngrams_;
+  // The counts since the last spill, and the runs of each length
+  NgramCounts counts_;
+  std::vector<std::vector<std::string> > runs_;
+  // After finalizing, the counts of each length, and the values that the
+  // statistics of their contexts are calculated from, which are the counts
+  // or the Kneser-Ney continuation counts
+  std::vector<std::string> count_files_, value_files_;
+  // All the files that have been created
+  mutable std::vector<std::string> files_;
+
+};
+
+}
@@ -2,12 +2,18 @@
 #include <boost/range/algorithm/max_element.hpp>
 #include <boost/range/algorithm/min_element.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <dynet/dict.h>
 #include <lamtram/macros.h>
 #include <lamtram/dist-ngram.h>
 #include <lamtram/dict-utils.h>
 #include <lamtram/string-util.h>
 #include <lamtram/counts.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <future>
 #include <math.h>
 
 #define EOS_ID 0
@@ -20,7 +26,8 @@ using namespace lamtram;
 // 1) ngram
 // 2) lin/mabs/mkn: where "lin" means linear, "mabs" means modified absolute
 //    discounting, and "mkn" means modified kneser ney
-DistNgram::DistNgram(const std::string & sig) : DistBase(sig) {
+DistNgram::DistNgram(const std::string & sig) :
+      DistBase(sig), ctxt_data_(NULL), disc_ctxt_data_(NULL), num_ctxts_(0) {
   // Split and sanity check signature
   std::vector<std::string> strs;
   boost::split(strs,sig,boost::is_any_of("_"));
@@ -61,6 +68,18 @@ inline WordId get_sym(const Sentence & sent, int pos) {
   return pos >= 0 ? sent[pos] : 0;
 }
 
+// Run func(thread) for each thread, directly if there is only one
+inline void run_threads(int num_threads, const std::function<void(int)> & func) {
+  if(num_threads == 1) {
+    func(0);
+    return;
+  }
+  vector<future<void> > futures;
+  for(int thread = 0; thread < num_threads; thread++)
+    futures.push_back(async(launch::async, func, thread));
+  for(auto & fut : futures) fut.get();
+}
+
 int DistNgram::get_ctxt_id(const Sentence & ngram) {
   auto it = mapping_.find(ngram);
   if(it != mapping_.end()) {
@@ -73,116 +92,299 @@ int DistNgram::get_ctxt_id(const Sentence & ngram) {
     return ret;
   }
 }
-int DistNgram::get_tmp_ctxt_id(const Sentence & ngram) {
-  auto it = mapping_.find(ngram);
-  if(it != mapping_.end()) return it->second;
-  auto it2 = tmp_mapping_.find(ngram);
-  if(it2 != tmp_mapping_.end()) return it2->second;
-  int ret = ctxt_cnts_.size();
-  ctxt_cnts_.push_back(DistNgramCounts());
-  if(smoothing_ == SMOOTH_MKN) aux_cnts_.push_back(0);
-  tmp_mapping_.insert(it, make_pair(ngram, ret));
-  return ret;
-}
 int DistNgram::get_existing_ctxt_id(const Sentence & ngram) const {
+  if(mapping_.size() == 0) {
+    const int * id = table_.find(ngram);
+    return id ? *id : -1;
+  }
   auto it = mapping_.find(ngram);
   return it != mapping_.end() ? it->second : -1;
 }
 
-// Add stats from one sentence at training time for count-based models
-void DistNgram::add_stats(const Sentence & sent) {
+void DistNgram::freeze_mapping(int num_threads) {
+  table_.clear();
+  // Reserve the exact size of each length, then move the n-grams into the
+  // table, freeing each from the map as it is added so that the two never
+  // both hold all of the n-grams
+  vector<size_t> len_sizes;
+  for(const auto & ngram : mapping_) {
+    if(ngram.first.size() >= len_sizes.size()) len_sizes.resize(ngram.first.size()+1, 0);
+    len_sizes[ngram.first.size()]++;
+  }
+  for(size_t len = 0; len < len_sizes.size(); len++)
+    if(len_sizes[len]) table_.reserve(len, len_sizes[len]);
+  for(auto it = mapping_.begin(); it != mapping_.end(); ) {
+    table_.add(it->first, it->second);
+    it = mapping_.erase(it);
+  }
+  std::unordered_map<Sentence, int>().swap(mapping_);
+  table_.finalize(num_threads);
+}
+
+void DistNgram::for_each_ngram(const Sentence & sent, const std::function<void(const Sentence &)> & func) const {
   for(size_t i = 0; i < sent.size(); i++) {
     Sentence ngram(1, sent[i]);
     // for each context, add if necessary
     for(int j = ctxt_pos_.size(); j >= 0; j--) {
-      if(j == 0) {
-        mapping_[ngram]++;
-      } else {
-        if(smoothing_ != SMOOTH_MKN)
-          ctxt_cnts_[get_ctxt_id(ngram)].first++;
-        else if(j != ctxt_pos_.size())
-          aux_cnts_[get_ctxt_id(ngram)]++;
+      func(ngram);
+      if(j != 0)
         ngram.insert(ngram.begin(), get_sym(sent, i-ctxt_pos_[j-1]));
-      }
     }
   }
 }
 
-inline Sentence get_prev_ctxt(Sentence sent) {
-  assert(sent.size() > 0);
-  sent.resize(sent.size()-1);
-  return sent;
+void DistNgram::add_count(const Sentence & ngram, int count) {
+  if(ngram.size() == ngram_len_) {
+    mapping_[ngram] += count;
+  } else if(smoothing_ != SMOOTH_MKN) {
+    ctxt_cnts_[get_ctxt_id(ngram)].first += count;
+  } else {
+    // Unigrams are only counted by their continuations
+    int id = get_ctxt_id(ngram);
+    if(ngram.size() != 1) aux_cnts_[id] += count;
+  }
+}
+
+// Add stats from one sentence at training time for count-based models
+void DistNgram::add_stats(const Sentence & sent) {
+  if(table_.size() != 0) THROW_ERROR("Cannot add stats to DistNgram after finalizing them");
+  for_each_ngram(sent, [this](const Sentence & ngram) { add_count(ngram, 1); });
+}
+
+void DistNgram::add_corpus_stats(const std::vector<Sentence> & sents, int num_threads) {
+  if(table_.size() != 0) THROW_ERROR("Cannot add stats to DistNgram after finalizing them");
+  num_threads = max(1, min(num_threads, (int)sents.size()));
+  if(num_threads == 1) {
+    DistBase::add_corpus_stats(sents);
+    return;
+  }
+  // Count the n-grams of each part of the corpus separately
+  typedef std::unordered_map<Sentence, int> NgramCounts;
+  vector<NgramCounts> counts(num_threads);
+  run_threads(num_threads, [&](int thread) {
+    size_t begin = sents.size() * thread / num_threads, end = sents.size() * (thread+1) / num_threads;
+    for(size_t i = begin; i < end; i++)
+      for_each_ngram(sents[i], [&](const Sentence & ngram) { counts[thread][ngram]++; });
+  });
+  // Merge pairs of parts in parallel until only one is left
+  for(int step = 1; step < num_threads; step *= 2) {
+    int num_merges = (num_threads - step + 2*step - 1) / (2*step);
+    run_threads(num_merges, [&](int merge) {
+      NgramCounts & to = counts[merge*2*step], & from = counts[merge*2*step + step];
+      if(to.size() < from.size()) to.swap(from);
+      for(const auto & cnt : from)
+        to[cnt.first] += cnt.second;
+      NgramCounts().swap(from);
+    });
+  }
+  // Add the merged counts
+  for(const auto & cnt : counts[0])
+    add_count(cnt.first, cnt.second);
+}
+
+void DistNgram::for_each_ctxt(size_t len, int num_threads, const CtxtFunc & func) const {
+  size_t num = table_.size(len);
+  if(num == 0) return;
+  auto same_ctxt = [&](size_t a, size_t b) {
+    const WordId *words_a = table_.get_words(len, a), *words_b = table_.get_words(len, b);
+    return equal(words_a, words_a + len - 1, words_b);
+  };
+  // Split the n-grams into equal parts, and move each boundary forward to the
+  // first n-gram with a new context
+  num_threads = max(1, min(num_threads, (int)num));
+  vector<size_t> bounds(1, 0);
+  for(int thread = 1; thread < num_threads; thread++) {
+    size_t pos = max(bounds.back(), num * thread / num_threads);
+    while(pos > 0 && pos < num && same_ctxt(pos-1, pos)) pos++;
+    bounds.push_back(pos);
+  }
+  bounds.push_back(num);
+  run_threads(num_threads, [&](int thread) {
+    size_t begin = bounds[thread];
+    while(begin < bounds[thread+1]) {
+      size_t end = begin + 1;
+      while(end < bounds[thread+1] && same_ctxt(begin, end)) end++;
+      func(thread, table_.get_words(len, begin), begin, end);
+      begin = end;
+    }
+  });
 }
-inline Sentence get_next_ctxt(Sentence sent) {
-  assert(sent.size() > 0);
-  sent.erase(sent.begin());
-  return sent;
+
+void DistNgram::add_missing_ctxts(size_t num_ctxts, int num_threads) {
+  bool use_kn = (smoothing_ == SMOOTH_MKN && ngram_len_ != 1);
+  vector<vector<Sentence> > missing(num_threads);
+  auto check_ctxt = [&](int thread, const WordId * ctxt, size_t len) {
+    if(table_.find(ctxt, len) == NULL)
+      missing[thread].push_back(Sentence(ctxt, ctxt + len));
+  };
+  for(size_t len = 1; len <= ngram_len_; len++) {
+    for_each_ctxt(len, num_threads, [&](int thread, const WordId * ctxt, size_t begin, size_t end) {
+      // The context of every counted n-gram is needed for the denominators,
+      // but only that of the longest n-grams with Kneser-Ney
+      if(!use_kn || len == ngram_len_)
+        check_ctxt(thread, ctxt, len-1);
+      // And with Kneser-Ney, the context of the n-gram without its first word
+      // is needed for the continuation counts
+      if(use_kn && len > 1) {
+        for(size_t pos = begin; pos < end; pos++) {
+          int value = table_.get_value(len, pos);
+          if(len == ngram_len_ || aux_cnts_[value])
+            check_ctxt(thread, table_.get_words(len, pos) + 1, len-2);
+        }
+      }
+    });
+  }
+  // Number the missing contexts in sorted order
+  vector<Sentence> all_missing;
+  for(auto & part : missing)
+    all_missing.insert(all_missing.end(), part.begin(), part.end());
+  sort(all_missing.begin(), all_missing.end());
+  all_missing.erase(unique(all_missing.begin(), all_missing.end()), all_missing.end());
+  for(const auto & ctxt : all_missing) {
+    table_.add(ctxt, ctxt_cnts_.size());
+    ctxt_cnts_.push_back(DistNgramCounts());
+  }
+  table_.finalize(num_threads);
 }
 
-void DistNgram::finalize_stats() {
+// All the passes over the n-grams go through the contexts in sorted order,
+// and each context is only updated by the thread handling the n-grams that
+// follow it, so the float sums are always done in the same order.
+void DistNgram::finalize_stats(int num_threads) {
+  num_threads = max(1, num_threads);
+  freeze_mapping(num_threads);
+  // The contexts after num_ctxts were never counted, and are only added so
+  // their counts can be collected
+  size_t num_ctxts = ctxt_cnts_.size();
+  add_missing_ctxts(num_ctxts, num_threads);
+  auto get_ctxt_id = [&](const WordId * ctxt, size_t len) {
+    const int * id = table_.find(ctxt, len);
+    if(id == NULL) THROW_ERROR("Missing context in DistNgram: " << Sentence(ctxt, ctxt + len));
+    return *id;
+  };
+  auto get_value = [&](size_t len, size_t pos) {
+    int value = table_.get_value(len, pos);
+    return (len == ngram_len_ ? value : ctxt_cnts_[value].first);
+  };
   // Add the counts to the denominator
   if(smoothing_ != SMOOTH_MKN || ngram_len_ == 1) {
-    for(const auto & ngram : mapping_) {
-      int value = (ngram.first.size() == ngram_len_ ? ngram.second : ctxt_cnts_[ngram.second].first);
-      int id = get_tmp_ctxt_id(get_prev_ctxt(ngram.first));
-      ctxt_cnts_[id].second += value;
-      ctxt_cnts_[id].third++;
+    for(size_t len = 1; len <= ngram_len_; len++) {
+      for_each_ctxt(len, num_threads, [&](int thread, const WordId * ctxt, size_t begin, size_t end) {
+        int total = 0, types = 0;
+        for(size_t pos = begin; pos < end; pos++) {
+          if(len != ngram_len_ && (size_t)table_.get_value(len, pos) >= num_ctxts) continue;
+          total += get_value(len, pos);
+          types++;
+        }
+        if(types == 0) return;
+        DistNgramCounts & cnts = ctxt_cnts_[get_ctxt_id(ctxt, len-1)];
+        cnts.second += total;
+        cnts.third += types;
+      });
     }
   } else {
-    for(const auto & ngram : mapping_) {
-      if(ngram.first.size() == ngram_len_) {
-        int id = get_tmp_ctxt_id(get_prev_ctxt(ngram.first));
-        ctxt_cnts_[id].second += ngram.second;
-        ctxt_cnts_[id].third++;
-      }
-      if(ngram.first.size() == ngram_len_ || aux_cnts_[ngram.second]) {
-        Sentence next_ctxt = get_next_ctxt(ngram.first);
-        int val = ++ctxt_cnts_[get_tmp_ctxt_id(next_ctxt)].first;
-        int prev_next = get_tmp_ctxt_id(get_prev_ctxt(next_ctxt));
-        ++ctxt_cnts_[prev_next].second;
-        if(val == 1) ++ctxt_cnts_[prev_next].third;
-      }
+    for_each_ctxt(ngram_len_, num_threads, [&](int thread, const WordId * ctxt, size_t begin, size_t end) {
+      DistNgramCounts & cnts = ctxt_cnts_[get_ctxt_id(ctxt, ngram_len_-1)];
+      for(size_t pos = begin; pos < end; pos++)
+        cnts.second += table_.get_value(ngram_len_, pos);
+      cnts.third += end - begin;
+    });
+    // Find the n-gram without its first word for each n-gram that continues
+    // it, then count the continuations of each
+    vector<vector<int> > next_ids(num_threads);
+    for(size_t len = 2; len <= ngram_len_; len++) {
+      for_each_ctxt(len, num_threads, [&](int thread, const WordId * ctxt, size_t begin, size_t end) {
+        for(size_t pos = begin; pos < end; pos++) {
+          int value = table_.get_value(len, pos);
+          if(len == ngram_len_ || ((size_t)value < num_ctxts && aux_cnts_[value]))
+            next_ids[thread].push_back(get_ctxt_id(table_.get_words(len, pos) + 1, len-1));
+        }
+      });
+    }
+    // Each thread only increments the ids in its own range
+    run_threads(num_threads, [&](int thread) {
+      int begin = ctxt_cnts_.size() * thread / num_threads, end = ctxt_cnts_.size() * (thread+1) / num_threads;
+      for(const auto & ids : next_ids)
+        for(int id : ids)
+          if(id >= begin && id < end)
+            ctxt_cnts_[id].first++;
+    });
+    vector<vector<int> >().swap(next_ids);
+    // Add the continuation counts to the denominator of their contexts
+    for(size_t len = 1; len < ngram_len_; len++) {
+      for_each_ctxt(len, num_threads, [&](int thread, const WordId * ctxt, size_t begin, size_t end) {
+        int total = 0, types = 0;
+        for(size_t pos = begin; pos < end; pos++) {
+          int value = get_value(len, pos);
+          total += value;
+          types += (value != 0);
+        }
+        if(types == 0) return;
+        DistNgramCounts & cnts = ctxt_cnts_[get_ctxt_id(ctxt, len-1)];
+        cnts.second += total;
+        cnts.third += types;
+      });
     }
   }
-  // Restore the temporary contexts
-  for(const auto & tmp : tmp_mapping_)
-    mapping_[tmp.first] = tmp.second;
-  tmp_mapping_.clear();
   // Get scores for discounting if necessary
   if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
-    vector<vector<float> > fofs(ngram_len_, vector<float>(5));
-    for(const auto & ngram : mapping_) {
-      int value = (ngram.first.size() == ngram_len_ ? ngram.second : ctxt_cnts_[ngram.second].first);
-      if(value > 0 && value <= 4)
-        fofs[ngram.first.size()-1][value]++;
-    }
-    discounts_ = vector<vector<float> >(ngram_len_, vector<float>(4));
-    for(size_t i = 0; i < fofs.size(); i++) {
-      float Y = fofs[i][1] / float(fofs[i][1] + 2*fofs[i][2]);
-      discounts_[i][1] = 1 - 2.0*Y*fofs[i][2]/fofs[i][1];
-      discounts_[i][2] = 2 - 3.0*Y*fofs[i][3]/fofs[i][2];
-      discounts_[i][3] = 3 - 4.0*Y*fofs[i][4]/fofs[i][3];
-      for(size_t j = 1; j < 4; j++) {
-        if(discounts_[i][j] < 0) {
-          cerr << "WARNING: negative discount=" << discounts_[i][j] << ". Setting to 0.5." << endl;
-          discounts_[i][j] = 0.5;
+    vector<vector<vector<size_t> > > thread_fofs(num_threads, vector<vector<size_t> >(ngram_len_, vector<size_t>(5)));
+    for(size_t len = 1; len <= ngram_len_; len++) {
+      for_each_ctxt(len, num_threads, [&](int thread, const WordId * ctxt, size_t begin, size_t end) {
+        for(size_t pos = begin; pos < end; pos++) {
+          int value = get_value(len, pos);
+          if(value > 0 && value <= 4)
+            thread_fofs[thread][len-1][value]++;
         }
-      }
+      });
     }
+    vector<vector<float> > fofs(ngram_len_, vector<float>(5));
+    for(auto & part : thread_fofs)
+      for(size_t i = 0; i < ngram_len_; i++)
+        for(size_t j = 0; j < 5; j++)
+          fofs[i][j] += part[i][j];
+    calc_discounts(fofs);
     // Perform discounting
     disc_ctxt_cnts_.resize(ctxt_cnts_.size());
-    for(const auto & ngram : mapping_) {
-      int value;
-      if(ngram.first.size() == ngram_len_) {
-        value = ngram.second;
-      } else {
-        value = ctxt_cnts_[ngram.second].first;
-        disc_ctxt_cnts_[ngram.second] += ctxt_cnts_[ngram.second].second;
-      }
-      if(value > 0) {
-        int id = get_existing_ctxt_id(get_prev_ctxt(ngram.first));
-        assert(id != -1);
-        disc_ctxt_cnts_[id] -= discounts_[ngram.first.size()-1][min(3,value)];
+    for(size_t id = 0; id < ctxt_cnts_.size(); id++)
+      disc_ctxt_cnts_[id] = ctxt_cnts_[id].second;
+    for(size_t len = 1; len <= ngram_len_; len++) {
+      for_each_ctxt(len, num_threads, [&](int thread, const WordId * ctxt, size_t begin, size_t end) {
+        float * disc_cnt = NULL;
+        for(size_t pos = begin; pos < end; pos++) {
+          int value = get_value(len, pos);
+          if(value <= 0) continue;
+          if(disc_cnt == NULL) disc_cnt = &disc_ctxt_cnts_[get_ctxt_id(ctxt, len-1)];
+          *disc_cnt -= discounts_[len-1][min(3,value)];
+        }
+      });
+    }
+  }
+  // The auxiliary counts are only needed until the stats are finalized
+  std::vector<int>().swap(aux_cnts_);
+  use_vectors();
+}
+
+void DistNgram::use_vectors() {
+  ctxt_data_ = ctxt_cnts_.data();
+  disc_ctxt_data_ = (smoothing_ != SMOOTH_LIN ? disc_ctxt_cnts_.data() : NULL);
+  num_ctxts_ = ctxt_cnts_.size();
+  mapped_.reset();
+}
+
+// Calculate the modified discounts of each length from the number of
+// n-grams seen once to four times
+void DistNgram::calc_discounts(const std::vector<std::vector<float> > & fofs) {
+  discounts_ = vector<vector<float> >(ngram_len_, vector<float>(4));
+  for(size_t i = 0; i < fofs.size(); i++) {
+    float Y = fofs[i][1] / float(fofs[i][1] + 2*fofs[i][2]);
+    discounts_[i][1] = 1 - 2.0*Y*fofs[i][2]/fofs[i][1];
+    discounts_[i][2] = 2 - 3.0*Y*fofs[i][3]/fofs[i][2];
+    discounts_[i][3] = 3 - 4.0*Y*fofs[i][4]/fofs[i][3];
+    for(size_t j = 1; j < 4; j++) {
+      if(discounts_[i][j] < 0) {
+        cerr << "WARNING: negative discount=" << discounts_[i][j] << ". Setting to 0.5." << endl;
+        discounts_[i][j] = 0.5;
       }
     }
   }
@@ -200,7 +402,7 @@ void DistNgram::calc_ctxt_feats(const Sentence & ctxt, float* feats_out) const {
   int ctxt_size = (smoothing_ == SMOOTH_LIN ? 3 : 4);
   for(int j = ctxt_pos_.size(); j >= 0; j--) {
     int id = get_existing_ctxt_id(ngram);
-    if(id == -1 || ctxt_cnts_[id].second == 0) {
+    if(id == -1 || ctxt_data_[id].second == 0) {
       for(int j2 = j; j2 >= 0; j2--) {
         *(feats_out++) = 1.f;
         for(size_t i = 1; i < ctxt_size; i++) *(feats_out++) = 0.f;
@@ -208,10 +410,10 @@ void DistNgram::calc_ctxt_feats(const Sentence & ctxt, float* feats_out) const {
       break;
     } else {
       *(feats_out++) = 0.f;
-      *(feats_out++) = log(ctxt_cnts_[id].second);
-      *(feats_out++) = log(ctxt_cnts_[id].third);
+      *(feats_out++) = log(ctxt_data_[id].second);
+      *(feats_out++) = log(ctxt_data_[id].third);
       if(smoothing_ != SMOOTH_LIN)
-        *(feats_out++) = log(disc_ctxt_cnts_[id]);
+        *(feats_out++) = log(disc_ctxt_data_[id]);
     }
     if(j != 0)
       ngram.insert(ngram.begin(), ctxt[ctxt.size()-ctxt_pos_[j-1]]);
@@ -234,28 +436,28 @@ void DistNgram::calc_word_dists(const Sentence & ngram,
   float base_prob = (*ngram.rbegin() != UNK_ID ? 1.0 : unk_prob);
   Sentence this_ngram(1, *ngram.rbegin()), this_ctxt;
   for(int j = ctxt_pos_.size(); j >= 0; j--) {
-    auto ngram_it = mapping_.find(this_ngram);
-    auto context_it = mapping_.find(this_ctxt);
-    if(ngram_it == mapping_.end()) {
-      float my_prob = (context_it != mapping_.end() ? 0.0 : uniform_prob * base_prob);
+    const int * ngram_val = table_.find(this_ngram);
+    const int * context_id = table_.find(this_ctxt);
+    if(ngram_val == NULL) {
+      float my_prob = (context_id != NULL ? 0.0 : uniform_prob * base_prob);
       // cerr << "my_prob: " << my_prob << endl;
       write_vec[write_offset++] = my_prob;
     } else {
-      if(context_it == mapping_.end())
+      if(context_id == NULL)
         THROW_ERROR("ngram ("<<this_ngram<<") exists but ctxt (" << this_ctxt << ") doesn't");
-      int value = (j == 0 ? ngram_it->second : ctxt_cnts_[ngram_it->second].first);
+      int value = (j == 0 ? *ngram_val : ctxt_data_[*ngram_val].first);
       if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
         // assert(discounts_.size() > this_ctxt.size());
-        // assert(disc_ctxt_cnts_.size() > context_it->second);
-        write_vec[write_offset++] = (value-discounts_[this_ctxt.size()][min(value,3)])/disc_ctxt_cnts_[context_it->second] * base_prob;
+        // assert(disc_ctxt_cnts_.size() > *context_id);
+        write_vec[write_offset++] = (value-discounts_[this_ctxt.size()][min(value,3)])/disc_ctxt_data_[*context_id] * base_prob;
         // if(write_vec[write_offset-1] > 1.001) {
         //   cerr << "this_ctxt: " << this_ctxt << endl;
-        //   cerr << "value_absmkn: (" << value << "-" << discounts_[this_ctxt.size()][min(value,3)] << ")/" << disc_ctxt_cnts_[context_it->second] << " * " << base_prob << endl;
+        //   cerr << "value_absmkn: (" << value << "-" << discounts_[this_ctxt.size()][min(value,3)] << ")/" << disc_ctxt_cnts_[*context_id] << " * " << base_prob << endl;
         //   THROW_ERROR("Bad probability");
         // }
       } else {
-        // cerr << "value_lin: " << value << "/" << (float)ctxt_cnts_[context_it->second].second * base_prob << endl;
-        write_vec[write_offset++] = value/(float)ctxt_cnts_[context_it->second].second * base_prob;
+        // cerr << "value_lin: " << value << "/" << (float)ctxt_cnts_[*context_id].second * base_prob << endl;
+        write_vec[write_offset++] = value/(float)ctxt_data_[*context_id].second * base_prob;
       }
     }
     if(j != 0) {
@@ -309,42 +511,34 @@ void DistNgram::calc_all_word_dists(const Sentence & ctxt_ngram,
   float *write_ptr = (heuristics_?&temp_vec[0]:&trg_dense[dense_offset]);
   memset(write_ptr, 0, data_len*sizeof(float));
   // Loop through all the contexts
-  Sentence this_ngram(1, 0), this_ctxt;
+  Sentence this_ctxt;
   for(int j = ctxt_pos_.size(); j >= 0; j--) {
-    auto context_it = mapping_.find(this_ctxt);
+    const int * context_id = table_.find(this_ctxt);
     int offset = ctxt_pos_.size()-j;
     // If the context is not found, overwrite the remainder with uniform
     // probabilities and terminate
-    if(context_it == mapping_.end()) {
+    if(context_id == NULL) {
       float *beg = write_ptr;
       for(int wid = 0; wid < vocab_size; wid++, beg += ngram_len)
         for(int oid = offset; oid < ngram_len; oid++)
           beg[oid] = uniform_prob;
       break;
     }
-    // TODO: This would be much better as prefix search
-    for(int wid = 0; wid < vocab_size; wid++) {
-      *this_ngram.rbegin() = wid;
-      auto ngram_it = mapping_.find(this_ngram);
-      if(ngram_it != mapping_.end()) {
-        int value = (j == 0 ? ngram_it->second : ctxt_cnts_[ngram_it->second].first);
-        if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
-          write_ptr[wid*ngram_len+offset] = (value-discounts_[this_ctxt.size()][min(value,3)])/disc_ctxt_cnts_[context_it->second];
-          // if(write_ptr[wid*ngram_len+offset] > 1.001) {
-          //   cerr << "this_ctxt: " << this_ctxt << endl;
-          //   cerr << "value_absmkn: (" << value << "-" << discounts_[this_ctxt.size()][min(value,3)] << ")/" << disc_ctxt_cnts_[context_it->second] << endl;
-          //   THROW_ERROR("Bad probability");
-          // }
-        } else {
-          // cerr << "value_lin: " << value << "/" << (float)ctxt_cnts_[context_it->second].second << endl;
-          write_ptr[wid*ngram_len+offset] = value/(float)ctxt_cnts_[context_it->second].second;
-        }
+    // The words following the context are next to each other in the table
+    size_t this_len = this_ctxt.size()+1;
+    pair<size_t,size_t> range = table_.find_range(this_ctxt.data(), this_ctxt.size());
+    for(size_t pos = range.first; pos < range.second; pos++) {
+      int wid = table_.get_words(this_len, pos)[this_len-1];
+      if(wid >= vocab_size) continue;
+      int value = (j == 0 ? table_.get_value(this_len, pos) : ctxt_data_[table_.get_value(this_len, pos)].first);
+      if(smoothing_ == SMOOTH_MABS || smoothing_ == SMOOTH_MKN) {
+        write_ptr[wid*ngram_len+offset] = (value-discounts_[this_ctxt.size()][min(value,3)])/disc_ctxt_data_[*context_id];
+      } else {
+        write_ptr[wid*ngram_len+offset] = value/(float)ctxt_data_[*context_id].second;
       }
     }
-    if(j != 0) {
-      this_ngram.insert(this_ngram.begin(), ctxt_ngram[ctxt_ngram.size()-ctxt_pos_[j-1]]);
+    if(j != 0)
       this_ctxt.insert(this_ctxt.begin(), ctxt_ngram[ctxt_ngram.size()-ctxt_pos_[j-1]]);
-    }
   }
   // Convert into heuristics if necessary
   if(heuristics_) {
@@ -378,7 +572,7 @@ void DistNgram::calc_all_word_dists(const Sentence & ctxt_ngram,
 
 // Read/write model. If dict is null, use numerical ids, otherwise strings.
 #define DIST_NGRAM_VERSION "distngram_v2"
-void DistNgram::write(DictPtr dict, std::ostream & out) const {
+void DistNgram::write_header(std::ostream & out) const {
   out << DIST_NGRAM_VERSION << '\n';
   if(smoothing_ != SMOOTH_LIN) {
     out << "discounts " << discounts_.size() << '\n';
@@ -386,16 +580,23 @@ void DistNgram::write(DictPtr dict, std::ostream & out) const {
       out << discount[1] << ' ' << discount[2] << ' ' << discount[3] << '\n';
     out << '\n';
   }
-  out << "mapping " << mapping_.size() << ' ' << ctxt_cnts_.size() << '\n';
-  for(auto & map_elem : mapping_) {
-    out << PrintWords(*dict, map_elem.first) << '\t';
-    if(map_elem.first.size() == ngram_len_) {
-      out << map_elem.second;
-    } else {
-      out << ctxt_cnts_[map_elem.second].first << ' ' << ctxt_cnts_[map_elem.second].second << ' ' << ctxt_cnts_[map_elem.second].third;
-      if(disc_ctxt_cnts_.size() != 0) out << ' ' << disc_ctxt_cnts_[map_elem.second];
+}
+void DistNgram::write(DictPtr dict, std::ostream & out) const {
+  write_header(out);
+  out << "mapping " << table_.size() << ' ' << num_ctxts_ << '\n';
+  for(size_t len = 0; len < table_.get_num_lens(); len++) {
+    for(size_t pos = 0; pos < table_.size(len); pos++) {
+      const WordId * words = table_.get_words(len, pos);
+      int value = table_.get_value(len, pos);
+      out << PrintWords(*dict, Sentence(words, words+len)) << '\t';
+      if(len == ngram_len_) {
+        out << value;
+      } else {
+        out << ctxt_data_[value].first << ' ' << ctxt_data_[value].second << ' ' << ctxt_data_[value].third;
+        if(disc_ctxt_data_ != NULL) out << ' ' << disc_ctxt_data_[value];
+      }
+      out << '\n';
     }
-    out << '\n';
   }
   out << '\n';
 }
@@ -432,7 +633,7 @@ void DistNgram::read(DictPtr dict, std::istream & in) {
     getline_or_die(in, line);
     istringstream iss(line); iss >> strid >> size >> size2;
     if(strid != "mapping") THROW_ERROR("Bad format of mapping: " << line << endl);
-    mapping_.reserve(size*1.1);
+    table_.clear();
     ctxt_cnts_.reserve(size2);
     if(smoothing_ != SMOOTH_LIN) disc_ctxt_cnts_.reserve(size2);
     for(int i = 0; i < size; i++) {
@@ -443,17 +644,203 @@ void DistNgram::read(DictPtr dict, std::istream & in) {
       Sentence ngram = ParseWords(*dict, words, false);
       for(pos1 = 0; pos1 < (int)words.size() && (ngram[pos1] != 1 || words[pos1] == "<unk>"); pos1++);
       if(pos1 != words.size()) continue;
-      if(mapping_.find(ngram) != mapping_.end())
-        THROW_ERROR("Found duplicate entry for ngram " << ngram << " at: " << line << endl);
       if(ngram.size() == ngram_len_) {
-        mapping_[ngram] = stoi(strs[1]);
+        table_.add(ngram, stoi(strs[1]));
       } else {
-        mapping_[ngram] = ctxt_cnts_.size();
+        table_.add(ngram, ctxt_cnts_.size());
         istringstream iss(strs[1]);
         iss >> cnt1 >> cnt2 >> cnt3; ctxt_cnts_.push_back(DistNgramCounts(cnt1,cnt2,cnt3));
         if(smoothing_ != SMOOTH_LIN) { iss >> cnt4; disc_ctxt_cnts_.push_back(cnt4); }
       }
     }
+    table_.finalize();
+    use_vectors();
     getline_expected(in, "");
   }
 }
+
+// The layout of the binary format is:
+//  header: magic string followed by the sizes below
+//  char     sig[sig_len]
+//  float    discounts[ngram_len][4]            (if not linear)
+//  for each length len from 0 to num_lens-1:
+//   uint64_t num, num_starts
+//   int32_t  words[num*len]                    (the sorted n-grams)
+//   int32_t  values[num]
+//   uint32_t starts[num_starts]                (see NgramTable)
+//  DistNgramCounts ctxt_cnts[num_ctxts]
+//  float    disc_ctxt_cnts[num_ctxts]          (if not linear)
+//  the vocabulary in WriteDict format
+// where each array is padded to a multiple of 8 bytes.
+struct DistNgramBinaryHeader {
+  char magic[16];
+  uint64_t sig_len, num_lens, num_ctxts, vocab_start;
+};
+static const char * DIST_NGRAM_BINARY_MAGIC = "lamtram_dist_01";
+static_assert(sizeof(DistNgramCounts) == 3 * sizeof(int32_t), "DistNgramCounts must be packed to be written in binary");
+
+inline void write_padded(std::ostream & out, const void * data, size_t size) {
+  static const char zeros[8] = {0};
+  out.write((const char*)data, size);
+  out.write(zeros, (8 - size % 8) % 8);
+}
+// Take the next padded array of num values out of a mapped file
+template <class T>
+inline const T * take_padded(const char * & pos, const char * end, size_t num) {
+  size_t size = sizeof(T) * num;
+  if(size > (size_t)(end - pos)) THROW_ERROR("Binary DistNgram is truncated");
+  const T * ret = (const T *)pos;
+  pos += min(size + (8 - size % 8) % 8, (size_t)(end - pos));
+  return ret;
+}
+
+void DistNgram::write_binary(DictPtr dict, std::ostream & out) const {
+  std::streampos start = out.tellp();
+  string sig = get_sig();
+  DistNgramBinaryHeader header;
+  memset(&header, 0, sizeof(header));
+  strcpy(header.magic, DIST_NGRAM_BINARY_MAGIC);
+  header.sig_len = sig.size();
+  header.num_lens = table_.get_num_lens();
+  header.num_ctxts = num_ctxts_;
+  out.write((const char*)&header, sizeof(header));
+  write_padded(out, sig.data(), sig.size());
+  if(smoothing_ != SMOOTH_LIN) {
+    vector<float> discounts;
+    for(auto & discount : discounts_)
+      discounts.insert(discounts.end(), discount.begin(), discount.end());
+    write_padded(out, discounts.data(), sizeof(float) * discounts.size());
+  }
+  for(size_t len = 0; len < table_.get_num_lens(); len++) {
+    uint64_t sizes[2] = {table_.size(len), table_.get_num_starts(len)};
+    write_padded(out, sizes, sizeof(sizes));
+    write_padded(out, table_.get_words(len), sizeof(WordId) * len * sizes[0]);
+    write_padded(out, table_.get_values(len), sizeof(int) * sizes[0]);
+    write_padded(out, table_.get_starts(len), sizeof(unsigned) * sizes[1]);
+  }
+  write_padded(out, ctxt_data_, sizeof(DistNgramCounts) * num_ctxts_);
+  if(smoothing_ != SMOOTH_LIN)
+    write_padded(out, disc_ctxt_data_, sizeof(float) * num_ctxts_);
+  header.vocab_start = out.tellp() - start;
+  WriteDict(*dict, out);
+  std::streampos end = out.tellp();
+  out.seekp(start);
+  out.write((const char*)&header, sizeof(header));
+  out.seekp(end);
+  if(!out) THROW_ERROR("Error writing binary DistNgram");
+}
+
+std::string DistNgram::get_binary_sig(const std::string & file) {
+  ifstream in(file, ios::binary);
+  DistNgramBinaryHeader header;
+  if(!in.read((char*)&header, sizeof(header)) ||
+     strncmp(header.magic, DIST_NGRAM_BINARY_MAGIC, sizeof(header.magic)) != 0 ||
+     header.sig_len > 1024)
+    return "";
+  string sig(header.sig_len, ' ');
+  if(!in.read(&sig[0], sig.size())) return "";
+  return sig;
+}
+
+void DistNgram::read_binary(DictPtr dict, const std::string & file) {
+  shared_ptr<boost::iostreams::mapped_file_source> mapped(new boost::iostreams::mapped_file_source);
+  try {
+    mapped->open(file);
+  } catch(std::exception & e) {
+    THROW_ERROR("Could not open binary DistNgram " << file << ": " << e.what());
+  }
+  const char * data = mapped->data(), * end = data + mapped->size();
+  DistNgramBinaryHeader header;
+  if(mapped->size() < sizeof(header))
+    THROW_ERROR("Binary DistNgram is too short: " << file);
+  memcpy(&header, data, sizeof(header));
+  if(strncmp(header.magic, DIST_NGRAM_BINARY_MAGIC, sizeof(header.magic)) != 0)
+    THROW_ERROR("Expecting a binary DistNgram of version " << DIST_NGRAM_BINARY_MAGIC << " in " << file);
+  if(header.vocab_start > mapped->size())
+    THROW_ERROR("Binary DistNgram is corrupted: " << file);
+  const char * pos = data + sizeof(header), * vocab_pos = data + header.vocab_start;
+  string sig(take_padded<char>(pos, vocab_pos, header.sig_len), header.sig_len);
+  if(sig != get_sig())
+    THROW_ERROR("Signature of binary DistNgram " << sig << " doesn't match " << get_sig());
+  if(smoothing_ != SMOOTH_LIN) {
+    const float * discounts = take_padded<float>(pos, vocab_pos, 4 * ngram_len_);
+    discounts_.resize(ngram_len_);
+    for(size_t i = 0; i < ngram_len_; i++)
+      discounts_[i].assign(discounts + 4*i, discounts + 4*(i+1));
+  }
+  vector<uint64_t> nums, nums_starts;
+  vector<const WordId*> words;
+  vector<const int*> values;
+  vector<const unsigned*> starts;
+  for(size_t len = 0; len < header.num_lens; len++) {
+    const uint64_t * sizes = take_padded<uint64_t>(pos, vocab_pos, 2);
+    nums.push_back(sizes[0]);
+    nums_starts.push_back(sizes[1]);
+    words.push_back(take_padded<WordId>(pos, vocab_pos, len * sizes[0]));
+    values.push_back(take_padded<int>(pos, vocab_pos, sizes[0]));
+    starts.push_back(take_padded<unsigned>(pos, vocab_pos, sizes[1]));
+  }
+  const DistNgramCounts * ctxt_cnts = take_padded<DistNgramCounts>(pos, vocab_pos, header.num_ctxts);
+  const float * disc_ctxt_cnts = (smoothing_ != SMOOTH_LIN ? take_padded<float>(pos, vocab_pos, header.num_ctxts) : NULL);
+  // Map the ids in the file's vocabulary to dict
+  istringstream vocab_in(string(vocab_pos, end - vocab_pos));
+  std::shared_ptr<dynet::Dict> file_vocab(ReadDict(vocab_in));
+  const vector<string> & vocab_words = file_vocab->get_words();
+  vector<WordId> id_map(vocab_words.size());
+  bool same_ids = true;
+  for(size_t i = 0; i < vocab_words.size(); i++) {
+    id_map[i] = dict->convert(vocab_words[i]);
+    same_ids = same_ids && (id_map[i] == (WordId)i);
+  }
+  table_.clear();
+  ctxt_cnts_.clear();
+  disc_ctxt_cnts_.clear();
+  if(same_ids) {
+    // Use the file in place, after checking that the context ids and the
+    // positions of the first words can't point outside of the arrays
+    for(size_t len = 0; len < header.num_lens; len++) {
+      if(len < ngram_len_)
+        for(size_t i = 0; i < nums[len]; i++)
+          if(values[len][i] < 0 || (uint64_t)values[len][i] >= header.num_ctxts)
+            THROW_ERROR("Binary DistNgram is corrupted: " << file);
+      for(size_t i = 0; i < nums_starts[len]; i++)
+        if(starts[len][i] > nums[len] || (i > 0 && starts[len][i] < starts[len][i-1]))
+          THROW_ERROR("Binary DistNgram is corrupted: " << file);
+    }
+    for(size_t len = 0; len < header.num_lens; len++)
+      table_.set_arrays(len, nums[len], words[len], values[len], nums_starts[len], starts[len]);
+    ctxt_data_ = ctxt_cnts;
+    disc_ctxt_data_ = disc_ctxt_cnts;
+    num_ctxts_ = header.num_ctxts;
+    mapped_ = mapped;
+  } else {
+    // Convert the words and sort them again, skipping n-grams with words
+    // that are unknown in dict, as when reading text
+    for(size_t len = 0; len < header.num_lens; len++) {
+      Sentence ngram(len);
+      for(size_t i = 0; i < nums[len]; i++) {
+        size_t j;
+        for(j = 0; j < len; j++) {
+          WordId wid = words[len][i*len+j];
+          if(wid < 0 || (size_t)wid >= id_map.size())
+            THROW_ERROR("Binary DistNgram is corrupted: " << file);
+          ngram[j] = id_map[wid];
+          if(ngram[j] == UNK_ID && vocab_words[wid] != "<unk>") break;
+        }
+        if(j != len) continue;
+        int value = values[len][i];
+        if(len == ngram_len_) {
+          table_.add(ngram, value);
+        } else {
+          if(value < 0 || (uint64_t)value >= header.num_ctxts)
+            THROW_ERROR("Binary DistNgram is corrupted: " << file);
+          table_.add(ngram, ctxt_cnts_.size());
+          ctxt_cnts_.push_back(ctxt_cnts[value]);
+          if(disc_ctxt_cnts != NULL) disc_ctxt_cnts_.push_back(disc_ctxt_cnts[value]);
+        }
+      }
+    }
+    table_.finalize();
+    use_vectors();
+  }
+}
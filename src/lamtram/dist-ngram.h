@@ -1,13 +1,17 @@
 #pragma once
 
+#include <functional>
 #include <iostream>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <lamtram/sentence.h>
 #include <lamtram/dist-base.h>
+#include <lamtram/ngram-table.h>
 #include <lamtram/hashes.h>
 
+namespace boost { namespace iostreams { class mapped_file_source; } }
+
 namespace lamtram {
 
 struct DistNgramCounts {
@@ -40,9 +44,12 @@ public:
 
   // Add stats from one sentence at training time for count-based models
   virtual void add_stats(const Sentence & sent) override;
+  // Count separate parts of the corpus in separate threads, then merge them
+  virtual void add_corpus_stats(const std::vector<Sentence> & sents, int num_threads = 1) override;
 
-  // Perform finalization on stats
-  virtual void finalize_stats() override;
+  // Perform finalization on stats. The result does not depend on the number
+  // of threads, or on the order the n-grams were added in.
+  virtual void finalize_stats(int num_threads = 1) override;
 
   // Get the number of ctxtual features we can expect from this model
   virtual size_t get_ctxt_size() const override;
@@ -72,11 +79,19 @@ public:
   virtual void write(DictPtr dict, std::ostream & str) const override;
   virtual void read(DictPtr dict, std::istream & str) override;
 
+  // Write/read the model in a binary format with the sorted arrays of
+  // n-grams and counts, and the vocabulary. If the words have the same ids in
+  // dict, the file is memory mapped and used in place, so reading costs
+  // almost nothing and processes reading the same file share its memory.
+  void write_binary(DictPtr dict, std::ostream & out) const;
+  void read_binary(DictPtr dict, const std::string & file);
+  // The signature of a binary model file, or "" if it is not one
+  static std::string get_binary_sig(const std::string & file);
+
   // Create the context
   int get_ctxt_id(const Sentence & ngram);
-  int get_tmp_ctxt_id(const Sentence & ngram);
   int get_existing_ctxt_id(const Sentence & ngram) const;
-  
+
 
 protected:
 
@@ -97,13 +112,44 @@ protected:
   //    - The full count to ctxt_cnts_[ab].ctxt_true
   //   - One to ctxt_cnts_[b].ctxt_true and ctxt_cnts_[bc]
 
+  // Call func on each n-gram ending at each position of sent, shortest first
+  void for_each_ngram(const Sentence & sent, const std::function<void(const Sentence &)> & func) const;
+  // Add count occurrences of an n-gram
+  void add_count(const Sentence & ngram, int count);
+
+  // Move the mapping into the table once training is finished
+  void freeze_mapping(int num_threads);
+  // Add the contexts that finalize_stats() needs but were never counted
+  void add_missing_ctxts(size_t num_ctxts, int num_threads);
+  // Call func(thread, ctxt, begin, end) for each context of the n-grams of
+  // length len in the table, where [begin, end) are the positions of the
+  // n-grams with that context. The contexts are split over up to num_threads
+  // threads, so each is only handled by one.
+  typedef std::function<void(int, const WordId *, size_t, size_t)> CtxtFunc;
+  void for_each_ctxt(size_t len, int num_threads, const CtxtFunc & func) const;
+  // Calculate discounts_ from the counts of counts one to four of each length
+  void calc_discounts(const std::vector<std::vector<float> > & fofs);
+  // Write the version and discounts that come before the n-grams
+  void write_header(std::ostream & out) const;
+  // Look up the context counts in ctxt_cnts_ and disc_ctxt_cnts_
+  void use_vectors();
+
   // A mapping from either counts or positions in the count array, depending
-  // on whether the n-gram is the longest allowed.
-  std::unordered_map<Sentence, int> mapping_, tmp_mapping_;
+  // on whether the n-gram is the longest allowed. This is only used while
+  // collecting stats, and is then moved into table_, which holds the same
+  // values in much less memory and is used for all lookups after training.
+  std::unordered_map<Sentence, int> mapping_;
+  NgramTable table_;
   // Counts for word context, etc
   std::vector<DistNgramCounts> ctxt_cnts_;
   // Discounted counts
   std::vector<float> disc_ctxt_cnts_;
+  // The counts and discounted counts used once training is finished, which
+  // point into the vectors above or into a memory mapped file
+  const DistNgramCounts * ctxt_data_;
+  const float * disc_ctxt_data_;
+  size_t num_ctxts_;
+  std::shared_ptr<boost::iostreams::mapped_file_source> mapped_;
   // Discounts
   std::vector<std::vector<float> > discounts_;
   // Auxilliary counts only used when calculating KN
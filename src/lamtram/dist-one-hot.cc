@@ -33,7 +33,7 @@ void DistOneHot::add_stats(const Sentence & sent) {
   }
 }
 
-void DistOneHot::finalize_stats() {
+void DistOneHot::finalize_stats(int num_threads) {
 }
 
 // Get the number of ctxtual features we can expect from this model
@@ -27,7 +27,7 @@ public:
   virtual void add_stats(const Sentence & sent) override;
 
   // Perform finalization on stats
-  virtual void finalize_stats() override;
+  virtual void finalize_stats(int num_threads = 1) override;
 
   // Get the number of ctxtual features we can expect from this model
   virtual size_t get_ctxt_size() const override;
@@ -12,12 +12,29 @@
 #include <lamtram/sentence.h>
 #include <lamtram/dist-base.h>
 #include <lamtram/dist-factory.h>
+#include <lamtram/dist-ngram-disk.h>
 #include <lamtram/dict-utils.h>
 
 using namespace std;
 using namespace lamtram;
 namespace po = boost::program_options;
 
+// The number of sentences read before counting them
+#define DIST_TRAIN_BLOCK_SIZE 1000000
+
+// Write a model in text or binary format
+inline void WriteModel(const DistPtr & dist, const DictPtr & dict, const std::string & format, std::ostream & out) {
+  if(format == "binary") {
+    const DistNgram * ngram = dynamic_cast<const DistNgram*>(dist.get());
+    if(ngram == NULL)
+      THROW_ERROR("Only n-gram distributions can be written in binary: " << dist->get_sig());
+    ngram->write_binary(dict, out);
+  } else {
+    out << dist->get_sig() << endl;
+    dist->write(dict, out);
+  }
+}
+
 int DistTrain::main(int argc, char** argv) {
   po::options_description desc("*** lamtram-train (by Graham Neubig) ***");
   desc.add_options()
@@ -25,7 +42,12 @@ int DistTrain::main(int argc, char** argv) {
     ("vocab_file", po::value<string>()->default_value(""), "Vocab file")
     ("train_file", po::value<string>()->default_value(""), "Training file")
     ("model_out", po::value<string>()->default_value(""), "File to write the model to")
+    ("model_format", po::value<string>()->default_value("text"), "Format to write the model in: text/binary (n-gram models only, memory mapped when loaded)")
+    ("model_in", po::value<string>()->default_value(""), "Instead of training, read this model and write it to --model_out, to convert it to another format")
     ("sig", po::value<string>()->default_value("ngram_lin_1_2_3"), "Signature for the language model")
+    ("threads", po::value<int>()->default_value(1), "Number of threads to count and finalize the statistics with")
+    ("tmp_dir", po::value<string>()->default_value(""), "If set, count n-grams with bounded memory, writing sorted runs of them to files in this directory")
+    ("max_ngrams", po::value<int>()->default_value(10000000), "With --tmp_dir, the number of n-grams to hold in memory before writing them out")
     ("verbose", po::value<int>()->default_value(0), "How much verbose output to print")
     ;
   boost::program_options::variables_map vm_;
@@ -37,7 +59,16 @@ int DistTrain::main(int argc, char** argv) {
   }
 
   // Open output file
-  ofstream model_out(vm_["model_out"].as<string>());
+  string model_format = vm_["model_format"].as<string>();
+  if(model_format != "text" && model_format != "binary")
+    THROW_ERROR("Bad model_format (must be text/binary): " << model_format);
+  if(model_format == "binary" && vm_["tmp_dir"].as<string>() != "")
+    THROW_ERROR("Models trained with --tmp_dir can only be written as text, and converted with --model_in");
+  if(vm_["threads"].as<int>() > 1 && vm_["tmp_dir"].as<string>() != "")
+    THROW_ERROR("--threads cannot be combined with --tmp_dir, which counts on a single thread");
+  if(vm_["max_ngrams"].as<int>() <= 0)
+    THROW_ERROR("--max_ngrams must be positive, but got: " << vm_["max_ngrams"].as<int>());
+  ofstream model_out(vm_["model_out"].as<string>(), ios::binary);
   if(!model_out)
     THROW_ERROR("Could not write to output file: " << vm_["model_out"].as<string>());
 
@@ -56,22 +87,36 @@ int DistTrain::main(int argc, char** argv) {
     dict->set_unk("<unk>");
   }
 
-  // Create the model
-  DistPtr dist(DistFactory::create_dist(vm_["sig"].as<string>()));
+  // Create the model, or read it to convert it
+  DistPtr dist;
+  if(vm_["model_in"].as<string>() != "") {
+    dist = DistFactory::from_file(vm_["model_in"].as<string>(), dict);
+    WriteModel(dist, dict, model_format, model_out);
+    return 0;
+  } else if(vm_["tmp_dir"].as<string>() != "")
+    dist.reset(new DistNgramDisk(vm_["sig"].as<string>(), vm_["tmp_dir"].as<string>(), vm_["max_ngrams"].as<int>()));
+  else
+    dist = DistFactory::create_dist(vm_["sig"].as<string>());
 
-  // Read in the data
+  // Read in the data, counting each block of sentences over all the threads
+  int num_threads = vm_["threads"].as<int>();
   {
     ifstream train_file(vm_["train_file"].as<string>());
     if(!train_file) THROW_ERROR("Couldn't open file: " << vm_["train_file"].as<string>());
+    vector<Sentence> sents;
     while(getline(train_file, line)) {
-      dist->add_stats(ParseWords(*dict, line, true));
+      sents.push_back(ParseWords(*dict, line, true));
+      if(sents.size() == DIST_TRAIN_BLOCK_SIZE) {
+        dist->add_corpus_stats(sents, num_threads);
+        sents.clear();
+      }
     }
+    dist->add_corpus_stats(sents, num_threads);
   }
-  dist->finalize_stats();
+  dist->finalize_stats(num_threads);
 
   // Write the model
-  model_out << dist->get_sig() << endl;
-  dist->write(dict, model_out);
+  WriteModel(dist, dict, model_format, model_out);
 
   return 0;
 }
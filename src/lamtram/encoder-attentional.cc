@@ -1,5 +1,6 @@
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/macros.h>
+#include <lamtram/mlp-attention.h>
 #include <lamtram/builder-factory.h>
 #include <dynet/model.h>
 #include <dynet/nodes.h>
@@ -27,7 +28,7 @@ ExternAttentional::ExternAttentional(const std::vector<LinearEncoderPtr> & encod
                    const DictPtr & vocab_src, const DictPtr & vocab_trg,
                    dynet::Model & mod)
     : ExternCalculator(0), encoders_(encoders),
-      attention_type_(attention_type), attention_hist_(attention_hist), hidden_size_(0), state_size_(state_size), lex_type_(lex_type) {
+      attention_type_(attention_type), attention_hist_(attention_hist), hidden_size_(0), state_size_(state_size), lex_type_(lex_type), sent_batch_(1) {
 
   for(auto & enc : encoders)
     context_size_ += enc->GetNumNodes();
@@ -142,28 +143,36 @@ void ExternAttentional::Write(std::ostream & out) {
 void ExternAttentional::InitializeSentence(
       const Sentence & sent_src, bool train, dynet::ComputationGraph & cg) {
 
-  // First get the states in a digestable format
-  vector<vector<dynet::Expression> > hs_sep;
-  for(auto & enc : encoders_) {
-    enc->BuildSentGraph(sent_src, true, train, cg);
-    hs_sep.push_back(enc->GetWordStates());
-    assert(hs_sep[0].size() == hs_sep.rbegin()->size());
-  }
-  sent_len_ = hs_sep[0].size();
-  // Concatenate them if necessary
-  vector<dynet::Expression> hs_comb;
-  if(encoders_.size() == 1) {
-    hs_comb = hs_sep[0];
+  vector<dynet::Expression> cached;
+  if(!train && encoder_cache_.Find(sent_src, cg, cached, &sent_len_)) {
+    // Use the states of a previously encoded sentence
+    i_h_ = cached[0];
+    i_h_last_ = cached[1];
   } else {
-    for(int i : boost::irange(0, sent_len_)) {
-      vector<dynet::Expression> vars;
-      for(int j : boost::irange(0, (int)encoders_.size()))
-        vars.push_back(hs_sep[j][i]);
-      hs_comb.push_back(concatenate(vars));
+    // First get the states in a digestable format
+    vector<vector<dynet::Expression> > hs_sep;
+    for(auto & enc : encoders_) {
+      enc->BuildSentGraph(sent_src, true, train, cg);
+      hs_sep.push_back(enc->GetWordStates());
+      assert(hs_sep[0].size() == hs_sep.rbegin()->size());
     }
+    sent_len_ = hs_sep[0].size();
+    // Concatenate them if necessary
+    vector<dynet::Expression> hs_comb;
+    if(encoders_.size() == 1) {
+      hs_comb = hs_sep[0];
+    } else {
+      for(int i : boost::irange(0, sent_len_)) {
+        vector<dynet::Expression> vars;
+        for(int j : boost::irange(0, (int)encoders_.size()))
+          vars.push_back(hs_sep[j][i]);
+        hs_comb.push_back(concatenate(vars));
+      }
+    }
+    i_h_ = concatenate_cols(hs_comb);
+    i_h_last_ = *hs_comb.rbegin();
+    if(!train) encoder_cache_.Add(sent_src, {i_h_, i_h_last_}, sent_len_);
   }
-  i_h_ = concatenate_cols(hs_comb);
-  i_h_last_ = *hs_comb.rbegin();
 
   // Create an identity with shape
   if(hidden_size_) {
@@ -196,6 +205,9 @@ void ExternAttentional::InitializeSentence(
     i_lexicon_ = input(cg, {(unsigned int)lex_size_, (unsigned int)sent_len_}, lex_ids, lex_data, lex_alpha_);
   }
 
+  i_h_all_ = i_h_; i_ehid_hpart_all_ = i_ehid_hpart_; i_lexicon_all_ = i_lexicon_;
+  sent_batch_ = 1;
+
 }
 
 void ExternAttentional::InitializeSentence(
@@ -258,6 +270,18 @@ void ExternAttentional::InitializeSentence(
     i_lexicon_ = input(cg, dynet::Dim({(unsigned int)lex_size_, (unsigned int)sent_len_}, (unsigned int)sent_src.size()), lex_ids, lex_data, lex_alpha_);
   }
 
+  i_h_all_ = i_h_; i_ehid_hpart_all_ = i_ehid_hpart_; i_lexicon_all_ = i_lexicon_;
+  sent_batch_ = sent_src.size();
+
+}
+
+void ExternAttentional::SelectBatch(const std::vector<unsigned> & ids) {
+  // A single sentence is broadcast over the whole batch
+  if(sent_batch_ == 1) return;
+  i_h_ = pick_batch_elems(i_h_all_, ids);
+  i_ehid_hpart_ = pick_batch_elems(i_ehid_hpart_all_, ids);
+  if(i_lexicon_all_.pg != nullptr)
+    i_lexicon_ = pick_batch_elems(i_lexicon_all_, ids);
 }
 
 dynet::Expression ExternAttentional::GetEmptyContext(dynet::ComputationGraph & cg) const {
@@ -280,14 +304,21 @@ dynet::Expression ExternAttentional::CreateContext(
     if(state_in.size()) {
       // i_ehid_state_W_ is {hidden_size, state_size}, state_in is {state_size, 1}
       dynet::Expression i_ehid_spart = i_ehid_state_W_ * *state_in.rbegin();
+#ifndef HAVE_CUDA
+      // Score all hypotheses in the batch against i_ehid_hpart_ in one node
+      i_e = MLPAttention(i_ehid_hpart_, i_ehid_spart, i_e_ehid_W_);
+#else
       i_ehid = affine_transform({i_ehid_hpart_, i_ehid_spart, i_sent_len_});
+#endif
     } else {
       i_ehid = i_ehid_hpart_;
     }
-    // Run through nonlinearity
-    dynet::Expression i_ehid_out = tanh({i_ehid});
-    // i_e_ehid_W_ is {1, hidden_size}, i_ehid_out is {hidden_size, sent_len}
-    i_e = transpose(i_e_ehid_W_ * i_ehid_out);
+    if(i_ehid.pg != nullptr) {
+      // Run through nonlinearity
+      dynet::Expression i_ehid_out = tanh({i_ehid});
+      // i_e_ehid_W_ is {1, hidden_size}, i_ehid_out is {hidden_size, sent_len}
+      i_e = transpose(i_e_ehid_W_ * i_ehid_out);
+    }
   // Bilinear/dot product
   } else {
     assert(state_in.size() > 0);
@@ -402,6 +433,28 @@ dynet::Expression EncoderAttentional::SampleTrgSentences(const Sentence & sent_s
   if(&cg != curr_graph_)
     THROW_ERROR("Initialized computation graph and passed comptuation graph don't match."); 
   std::vector<dynet::Expression> decoder_in = GetEncodedState(sent_src, train, cg);
+  return decoder_->SampleTrgSentences(extern_calc_.get(), decoder_in, {sent_trg}, num_samples, max_len, train, cg, samples);
+}
+
+dynet::Expression EncoderAttentional::SampleTrgSentences(const std::vector<Sentence> & sent_src,
+                                                             const std::vector<const Sentence*> & sent_trg,
+                                                             int num_samples,
+                                                             int max_len,
+                                                             bool train,
+                                                             dynet::ComputationGraph & cg,
+                                                             vector<Sentence> & samples) {
+  if(sent_src.size() == 1)
+    return SampleTrgSentences(sent_src[0], sent_trg[0], num_samples, max_len, train, cg, samples);
+  if(&cg != curr_graph_)
+    THROW_ERROR("Initialized computation graph and passed comptuation graph don't match."); 
+  // Encode each source once, then repeat its states for each of its samples
+  std::vector<dynet::Expression> decoder_in = GetEncodedState(sent_src, train, cg);
+  vector<unsigned> ids;
+  for(size_t i = 0; i < sent_src.size(); i++)
+    ids.insert(ids.end(), num_samples, i);
+  for(auto & in : decoder_in)
+    in = pick_batch_elems(in, ids);
+  extern_calc_->SelectBatch(ids);
   return decoder_->SampleTrgSentences(extern_calc_.get(), decoder_in, sent_trg, num_samples, max_len, train, cg, samples);
 }
 
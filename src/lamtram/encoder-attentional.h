@@ -6,6 +6,7 @@
 #include <lamtram/neural-lm.h>
 #include <lamtram/extern-calculator.h>
 #include <lamtram/mapping.h>
+#include <lamtram/encoder-cache.h>
 #include <dynet/dynet.h>
 #include <vector>
 #include <iostream>
@@ -37,6 +38,9 @@ public:
     virtual void InitializeSentence(const Sentence & sent, bool train, dynet::ComputationGraph & cg) override;
     virtual void InitializeSentence(const std::vector<Sentence> & sent, bool train, dynet::ComputationGraph & cg) override;
 
+    // Select the initialized sentences used in subsequent calls
+    virtual void SelectBatch(const std::vector<unsigned> & ids) override;
+
     // Create a variable encoding the context
     virtual dynet::Expression CreateContext(
         // const Sentence & sent, int loc,
@@ -57,9 +61,23 @@ public:
     int GetHiddenSize() const { return hidden_size_; }
     int GetStateSize() const { return state_size_; }
     int GetContextSize() const { return context_size_; }
+    const MultipleIdMappingPtr & GetLexMapping() const { return lex_mapping_; }
+    EncoderCache & GetEncoderCache() { return encoder_cache_; }
 
     dynet::Expression GetState() { return i_h_last_; }
 
+    // The attention type and parameters, for running attention without a graph
+    const std::string & GetAttentionType() const { return attention_type_; }
+    const std::string & GetAttentionHist() const { return attention_hist_; }
+    const std::string & GetLexType() const { return lex_type_; }
+    const dynet::Parameter & GetStateWeights() const { return p_ehid_state_W_; }
+    const dynet::Parameter & GetScoreWeights() const { return p_e_ehid_W_; }
+    const dynet::Parameter & GetAlignSumWeight() const { return p_align_sum_W_; }
+    // The {context_size, sent_len} states of the initialized sentence, and
+    // their part of the attention scores (i_ehid_hpart_)
+    const dynet::Expression & GetWordStates() const { return i_h_; }
+    const dynet::Expression & GetWordStatesPart() const { return i_ehid_hpart_; }
+
     // Reading/writing functions
     static ExternAttentional* Read(std::istream & in, const DictPtr & vocab_src, const DictPtr & vocab_trg, dynet::Model & model);
     void Write(std::ostream & out);
@@ -98,6 +116,11 @@ protected:
     dynet::Expression i_ehid_hpart_;
     dynet::Expression i_sent_len_;
     dynet::Expression i_lexicon_;
+    // The encoded values for all initialized sentences, and their number
+    dynet::Expression i_h_all_, i_ehid_hpart_all_, i_lexicon_all_;
+    int sent_batch_;
+    // The encodings of recent sentences when not training
+    EncoderCache encoder_cache_;
 
 private:
     // A pointer to the current computation graph.
@@ -151,6 +174,15 @@ public:
                                              bool train,
                                              dynet::ComputationGraph & cg,
                                              std::vector<Sentence> & samples);    
+    // Sample num_samples sentences for each source sentence in one batch, and
+    // return the probabilities with the samples of each source next to each other
+    dynet::Expression SampleTrgSentences(const std::vector<Sentence> & sent_src,
+                                             const std::vector<const Sentence*> & sent_trg,
+                                             int num_samples,
+                                             int max_len,
+                                             bool train,
+                                             dynet::ComputationGraph & cg,
+                                             std::vector<Sentence> & samples);
 
     template <class SentData>
     std::vector<dynet::Expression> GetEncodedState(
@@ -0,0 +1,44 @@
+#include <lamtram/encoder-cache.h>
+#include <dynet/dynet.h>
+#include <dynet/tensor.h>
+
+using namespace std;
+using namespace lamtram;
+
+void EncoderCache::Add(const Sentence & sent, const std::vector<dynet::Expression> & exprs, int length) {
+  if(size_ <= 0) return;
+  auto it = cache_.find(sent);
+  if(it == cache_.end()) {
+    // Remove the least recently used sentence
+    if((int)cache_.size() >= size_) {
+      cache_.erase(order_.back());
+      order_.pop_back();
+    }
+    order_.push_front(sent);
+    it = cache_.insert(make_pair(sent, Entry())).first;
+  } else {
+    order_.erase(it->second.order_it);
+    order_.push_front(sent);
+  }
+  Entry & entry = it->second;
+  entry.order_it = order_.begin();
+  entry.length = length;
+  entry.values.clear();
+  for(auto & expr : exprs) {
+    const dynet::Tensor & val = expr.pg->incremental_forward(expr);
+    entry.values.push_back(make_pair(val.d, dynet::as_vector(val)));
+  }
+}
+
+bool EncoderCache::Find(const Sentence & sent, dynet::ComputationGraph & cg, std::vector<dynet::Expression> & exprs, int * length) {
+  if(size_ <= 0) return false;
+  auto it = cache_.find(sent);
+  if(it == cache_.end()) return false;
+  // Move the sentence to the front
+  order_.splice(order_.begin(), order_, it->second.order_it);
+  exprs.clear();
+  for(auto & val : it->second.values)
+    exprs.push_back(dynet::expr::input(cg, val.first, val.second));
+  if(length != nullptr) *length = it->second.length;
+  return true;
+}
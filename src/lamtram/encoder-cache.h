@@ -0,0 +1,53 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <lamtram/hashes.h>
+#include <dynet/dim.h>
+#include <dynet/expr.h>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace lamtram {
+
+// Keeps the values of the encoder outputs for recently encoded source
+// sentences, so later computation graphs can use them as constants instead
+// of running the encoder again (e.g. when rescoring an n-best list). When
+// full, the least recently used sentence is removed.
+class EncoderCache {
+
+public:
+  EncoderCache() : size_(0) { }
+
+  // The maximum number of sentences to keep, 0 disables the cache
+  int GetSize() const { return size_; }
+  void SetSize(int size) { size_ = size; cache_.clear(); order_.clear(); }
+
+  // Calculate the values of exprs and add them to the cache for sent, along
+  // with the length of its encoding
+  void Add(const Sentence & sent, const std::vector<dynet::Expression> & exprs, int length = 0);
+
+  // If sent is cached, add its values to cg as exprs, set length if given,
+  // and return true
+  bool Find(const Sentence & sent, dynet::ComputationGraph & cg, std::vector<dynet::Expression> & exprs, int * length = nullptr);
+
+  // Batches of sentences are not cached
+  void Add(const std::vector<Sentence> & sents, const std::vector<dynet::Expression> & exprs, int length = 0) { }
+  bool Find(const std::vector<Sentence> & sents, dynet::ComputationGraph & cg, std::vector<dynet::Expression> & exprs, int * length = nullptr) { return false; }
+
+protected:
+  struct Entry {
+    std::vector<std::pair<dynet::Dim, std::vector<float> > > values;
+    int length;
+    std::list<Sentence>::iterator order_it;
+  };
+
+  int size_;
+  std::unordered_map<Sentence, Entry> cache_;
+  // The cached sentences, most recently used first
+  std::list<Sentence> order_;
+
+};
+
+}
@@ -37,18 +37,25 @@ void EncoderDecoder::NewGraph(dynet::ComputationGraph & cg) {
 template <class SentData>
 std::vector<dynet::Expression> EncoderDecoder::GetEncodedState(
                   const SentData & sent_src, bool train, dynet::ComputationGraph & cg) {
-  // Perform encoding with each encoder
-  vector<dynet::Expression> inputs;
-  for(auto & enc : encoders_) {
-    enc->BuildSentGraph(sent_src, true, train, cg);
-    for(auto & id : enc->GetFinalHiddenLayers())
-      inputs.push_back(id);
-  }
-  // Perform transformation
   dynet::Expression i_combined;
-  assert(inputs.size() > 0);
-  if(inputs.size() == 1) { i_combined = inputs[0]; }
-  else           { i_combined = concatenate(inputs); }
+  vector<dynet::Expression> cached;
+  if(!train && encoder_cache_.Find(sent_src, cg, cached)) {
+    // Use the states of a previously encoded sentence
+    i_combined = cached[0];
+  } else {
+    // Perform encoding with each encoder
+    vector<dynet::Expression> inputs;
+    for(auto & enc : encoders_) {
+      enc->BuildSentGraph(sent_src, true, train, cg);
+      for(auto & id : enc->GetFinalHiddenLayers())
+        inputs.push_back(id);
+    }
+    // Perform transformation
+    assert(inputs.size() > 0);
+    if(inputs.size() == 1) { i_combined = inputs[0]; }
+    else           { i_combined = concatenate(inputs); }
+    if(!train) encoder_cache_.Add(sent_src, {i_combined});
+  }
   dynet::Expression i_decin = affine_transform({i_enc2dec_b_, i_enc2dec_W_, i_combined});
   // Perform transformation
   vector<dynet::Expression> decoder_in(decoder_->GetNumLayers() * decoder_->GetLayerMultiplier());
@@ -111,6 +118,27 @@ dynet::Expression EncoderDecoder::SampleTrgSentences(const Sentence & sent_src,
     THROW_ERROR("Initialized computation graph and passed comptuation graph don't match."); 
   // Perform encoding with each encoder
   vector<dynet::Expression> decoder_in = GetEncodedState(sent_src, train, cg);
+  return decoder_->SampleTrgSentences(NULL, decoder_in, {sent_trg}, num_samples, max_len, train, cg, samples);
+}
+
+dynet::Expression EncoderDecoder::SampleTrgSentences(const vector<Sentence> & sent_src,
+                                                         const vector<const Sentence*> & sent_trg,
+                                                         int num_samples,
+                                                         int max_len,
+                                                         bool train,
+                                                         dynet::ComputationGraph & cg,
+                                                         vector<Sentence> & samples) {
+  if(sent_src.size() == 1)
+    return SampleTrgSentences(sent_src[0], sent_trg[0], num_samples, max_len, train, cg, samples);
+  if(&cg != curr_graph_)
+    THROW_ERROR("Initialized computation graph and passed comptuation graph don't match."); 
+  // Encode each source once, then repeat its state for each of its samples
+  vector<dynet::Expression> decoder_in = GetEncodedState(sent_src, train, cg);
+  vector<unsigned> ids;
+  for(size_t i = 0; i < sent_src.size(); i++)
+    ids.insert(ids.end(), num_samples, i);
+  for(auto & in : decoder_in)
+    in = pick_batch_elems(in, ids);
   return decoder_->SampleTrgSentences(NULL, decoder_in, sent_trg, num_samples, max_len, train, cg, samples);
 }
 
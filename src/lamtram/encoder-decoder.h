@@ -4,6 +4,7 @@
 #include <lamtram/ll-stats.h>
 #include <lamtram/linear-encoder.h>
 #include <lamtram/neural-lm.h>
+#include <lamtram/encoder-cache.h>
 #include <dynet/dynet.h>
 #include <vector>
 #include <iostream>
@@ -54,6 +55,15 @@ public:
                                              bool train,
                                              dynet::ComputationGraph & cg,
                                              std::vector<Sentence> & samples);
+    // Sample num_samples sentences for each source sentence in one batch, and
+    // return the probabilities with the samples of each source next to each other
+    dynet::Expression SampleTrgSentences(const std::vector<Sentence> & sent_src,
+                                             const std::vector<const Sentence*> & sent_trg,
+                                             int num_samples,
+                                             int max_len,
+                                             bool train,
+                                             dynet::ComputationGraph & cg,
+                                             std::vector<Sentence> & samples);
 
     template <class SentData>
     std::vector<dynet::Expression> GetEncodedState(
@@ -79,6 +89,7 @@ public:
     int GetWordrepSize() const { return wordrep_size_; }
     int GetUnkSrc() const { return unk_src_; }
     int GetUnkTrg() const { return unk_trg_; }
+    EncoderCache & GetEncoderCache() { return encoder_cache_; }
 
     // Setters
     void SetDropout(float dropout) {
@@ -106,6 +117,9 @@ protected:
     dynet::Expression i_enc2dec_W_;
     dynet::Expression i_enc2dec_b_;
 
+    // The encodings of recent sentences when not training
+    EncoderCache encoder_cache_;
+
 private:
     // A pointer to the current computation graph.
     // This is only used for sanity checking to make sure NewGraph
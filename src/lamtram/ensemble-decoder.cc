@@ -1,5 +1,6 @@
 #include <lamtram/ensemble-decoder.h>
 #include <lamtram/macros.h>
+#include <lamtram/top-k.h>
 #include <dynet/nodes.h>
 #include <boost/range/irange.hpp>
 #include <cfloat>
@@ -10,7 +11,7 @@ using namespace dynet::expr;
 
 
 EnsembleDecoder::EnsembleDecoder(const vector<EncoderDecoderPtr> & encdecs, const vector<EncoderAttentionalPtr> & encatts, const vector<NeuralLMPtr> & lms)
-      : encdecs_(encdecs), encatts_(encatts), word_pen_(0.f), unk_pen_(1.f), size_limit_(2000), beam_size_(1), ensemble_operation_("sum") {
+      : encdecs_(encdecs), encatts_(encatts), word_pen_(0.f), unk_pen_(1.f), size_limit_(2000), beam_size_(1), beam_cands_(0), batch_beam_(false), shortlist_trans_(0), ensemble_operation_("sum") {
   if(encdecs.size() + encatts.size() + lms.size() == 0)
     THROW_ERROR("Cannot decode with no models!");
   for(auto & ed : encdecs) {
@@ -29,7 +30,8 @@ EnsembleDecoder::EnsembleDecoder(const vector<EncoderDecoderPtr> & encdecs, cons
   unk_log_prob_ = -log(lms_[0]->GetVocabSize());
 }
 
-vector<vector<Expression> > EnsembleDecoder::GetInitialStates(const Sentence & sent_src, dynet::ComputationGraph & cg) {
+template <class SentData>
+vector<vector<Expression> > EnsembleDecoder::GetInitialStates(const SentData & sent_src, dynet::ComputationGraph & cg) {
   vector<vector<Expression> > last_state(encdecs_.size() + encatts_.size() + lms_.size());
   int id = 0;
   for(auto & tm : encdecs_)
@@ -39,6 +41,11 @@ vector<vector<Expression> > EnsembleDecoder::GetInitialStates(const Sentence & s
   return last_state;
 }
 
+template
+vector<vector<Expression> > EnsembleDecoder::GetInitialStates<Sentence>(const Sentence & sent_src, dynet::ComputationGraph & cg);
+template
+vector<vector<Expression> > EnsembleDecoder::GetInitialStates<vector<Sentence> >(const vector<Sentence> & sent_src, dynet::ComputationGraph & cg);
+
 Expression EnsembleDecoder::EnsembleProbs(const std::vector<Expression> & in, dynet::ComputationGraph & cg) {
   if(in.size() == 1) return in[0];
   return average(in);
@@ -169,6 +176,10 @@ inline int GetWord(const Sentence & vec, int t) { return vec[t]; }
 
 template <class Sent, class Stat, class WordStat>
 void EnsembleDecoder::CalcSentLL(const Sentence & sent_src, const Sent & sent_trg, Stat & ll, WordStat & wordll) {
+  if(engines_.size()) {
+    CalcSentLLGraphFree(sent_src, sent_trg, ll, wordll);
+    return;
+  }
   // First initialize states and do encoding as necessary
   dynet::ComputationGraph cg;
   for(auto & tm : encdecs_) tm->NewGraph(cg);
@@ -211,6 +222,60 @@ void EnsembleDecoder::CalcSentLL<Sentence,LLStats,vector<float> >(const Sentence
 template
 void EnsembleDecoder::CalcSentLL<vector<Sentence>,vector<LLStats>,vector<vector<float> > >(const Sentence & sent_src, const vector<Sentence> & sent_trg, vector<LLStats> & ll, vector<vector<float> > & wordll);
 
+std::vector<unsigned> EnsembleDecoder::CreateShortlist(const std::vector<Sentence> & sent_srcs) const {
+  vector<unsigned> ret;
+  if(shortlist_words_.size() == 0 && shortlist_trans_ == 0) return ret;
+  ret.push_back(0);
+  if(unk_id_ >= 0) ret.push_back(unk_id_);
+  ret.insert(ret.end(), shortlist_words_.begin(), shortlist_words_.end());
+  // Add the most probable translations of every source word
+  vector<pair<WordId,float> > trans;
+  auto more_probable = [](const pair<WordId,float> & a, const pair<WordId,float> & b) { return a.second > b.second; };
+  for(auto & encatt : encatts_) {
+    const MultipleIdMappingPtr & lex = encatt->GetExternAttentional().GetLexMapping();
+    if(lex.get() == nullptr) continue;
+    for(auto & sent : sent_srcs) {
+      for(WordId wid : sent) {
+        auto it = lex->find(wid);
+        if(it == lex->end()) continue;
+        trans = it->second;
+        size_t num_trans = min(trans.size(), (size_t)shortlist_trans_);
+        partial_sort(trans.begin(), trans.begin() + num_trans, trans.end(), more_probable);
+        for(size_t i = 0; i < num_trans; i++)
+          ret.push_back(trans[i].first);
+      }
+    }
+  }
+  sort(ret.begin(), ret.end());
+  ret.erase(unique(ret.begin(), ret.end()), ret.end());
+  return ret;
+}
+
+// Sets a shortlist on the softmaxes of all models while in scope. If any of
+// them doesn't support shortlists, the shortlist is cleared and the full
+// vocabulary is used.
+class ShortlistScope {
+public:
+  ShortlistScope(const vector<NeuralLMPtr> & lms, vector<unsigned> & shortlist) : lms_(lms) {
+    for(auto & lm : lms_) {
+      if(!lm->GetSoftmax().SetShortlist(shortlist)) {
+        if(shortlist.size())
+          cerr << "WARNING: Softmax " << lm->GetSoftmax().GetSig() << " does not support shortlists, using the full vocabulary" << endl;
+        shortlist.clear();
+        break;
+      }
+    }
+    if(shortlist.size() == 0) Clear();
+  }
+  ~ShortlistScope() { Clear(); }
+  void Clear() {
+    for(auto & lm : lms_)
+      lm->GetSoftmax().SetShortlist(vector<unsigned>());
+  }
+protected:
+  const vector<NeuralLMPtr> & lms_;
+};
+
 EnsembleDecoderHypPtr EnsembleDecoder::Generate(const Sentence & sent_src) {
   auto nbest = GenerateNbest(sent_src, 1);
   return (nbest.size() > 0 ? nbest[0] : EnsembleDecoderHypPtr());
@@ -218,11 +283,19 @@ EnsembleDecoderHypPtr EnsembleDecoder::Generate(const Sentence & sent_src) {
 
 std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::GenerateNbest(const Sentence & sent_src, int nbest_size) {
 
+  if(engines_.size())
+    return GenerateNbestGraphFree(sent_src, nbest_size);
+  if(batch_beam_)
+    return GenerateNbest(vector<Sentence>(1, sent_src), nbest_size)[0];
+
   // First initialize states
   dynet::ComputationGraph cg;
   for(auto & tm : encdecs_) tm->NewGraph(cg);
   for(auto & tm : encatts_) tm->NewGraph(cg);
   for(auto & lm : lms_) lm->NewGraph(cg);
+  vector<unsigned> shortlist = CreateShortlist(vector<Sentence>(1, sent_src));
+  ShortlistScope shortlist_scope(lms_, shortlist);
+  int unk_idx = (shortlist.size() ? lower_bound(shortlist.begin(), shortlist.end(), (unsigned)unk_id_) - shortlist.begin() : unk_id_);
 
   // The n-best hypotheses
   vector<EnsembleDecoderHypPtr> nbest;
@@ -234,13 +307,21 @@ std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::GenerateNbest(const Sentence
   vector<EnsembleDecoderHypPtr> curr_beam(1, 
       EnsembleDecoderHypPtr(new EnsembleDecoderHyp(
           0.0, GetInitialStates(sent_src, cg), last_externs[0], last_sums[0], Sentence(), Sentence())));
-  int bid;
   Expression empty_idx;
 
+  // The word penalty is added to all words but the sentence end, and the unk
+  // penalty after it to the unknown word
+  vector<pair<int,float> > pen_adjust(1, make_pair(0, 0.f));
+  if(unk_id_ >= 0) {
+    if(unk_idx != 0) pen_adjust.push_back(make_pair(unk_idx, word_pen_));
+    pen_adjust.push_back(make_pair(unk_idx, unk_pen_ * unk_log_prob_));
+  }
+
   // Perform decoding
   for(int sent_len = 0; sent_len <= size_limit_; sent_len++) {
-    // This vector will hold the best IDs
-    vector<tuple<dynet::real,int,int,int> > next_beam_id(beam_size_+1, tuple<dynet::real,int,int,int>(-DBL_MAX,-1,-1,-1));
+    // This will hold the best IDs
+    TopK next_beam_id(beam_size_, beam_cands_ > 0 ? beam_cands_ : beam_size_);
+    vector<WordId> best_aligns(curr_beam.size(), -1);
     // Go through all the hypothesis IDs
     for(int hypid = 0; hypid < (int)curr_beam.size(); hypid++) {
       EnsembleDecoderHypPtr curr_hyp = curr_beam[hypid];
@@ -260,40 +341,33 @@ std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::GenerateNbest(const Sentence
       } else {
         THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
       }
-      // Add the word/unk penalty
-      vector<dynet::real> softmax = as_vector(cg.incremental_forward(i_logprob));
-      if(word_pen_ != 0.f) {
-        for(size_t i = 1; i < softmax.size(); i++)
-          softmax[i] += word_pen_;
-      }
-      if(unk_id_ >= 0) softmax[unk_id_] += unk_pen_ * unk_log_prob_;
       // Find the best aligned source, if any alignments exists
-      WordId best_align = -1;
       if(i_aligns.size() != 0) {
         dynet::Expression ens_align = sum(i_aligns);
         vector<dynet::real> align = as_vector(cg.incremental_forward(ens_align));
-        best_align = 0;
+        best_aligns[hypid] = 0;
         for(size_t aid = 0; aid < align.size(); aid++)
-          if(align[aid] > align[best_align])
-            best_align = aid;
-      }
-      // Find the best IDs
-      for(int wid = 0; wid < (int)softmax.size(); wid++) {
-        dynet::real my_score = curr_hyp->GetScore() + softmax[wid];
-        for(bid = beam_size_; bid > 0 && my_score > std::get<0>(next_beam_id[bid-1]); bid--)
-          next_beam_id[bid] = next_beam_id[bid-1];
-        next_beam_id[bid] = tuple<dynet::real,int,int,int>(my_score,hypid,wid,best_align);
+          if(align[aid] > align[best_aligns[hypid]])
+            best_aligns[hypid] = aid;
       }
+      // Find the best IDs, with the word/unk penalty, directly from the values
+      const dynet::Tensor & softmax = cg.incremental_forward(i_logprob);
+      const dynet::real * softmax_v = softmax.v;
+#ifdef HAVE_CUDA
+      // The values are on the device, so copy them to the host first
+      vector<dynet::real> softmax_host = as_vector(softmax);
+      softmax_v = softmax_host.data();
+#endif
+      next_beam_id.AddRow(hypid, softmax_v, softmax.d.size(), curr_hyp->GetScore(), word_pen_, pen_adjust);
     }
     // Create the new hypotheses
     vector<EnsembleDecoderHypPtr> next_beam;
-    for(int i = 0; i < beam_size_; i++) {
-      dynet::real score = std::get<0>(next_beam_id[i]);
-      int hypid = std::get<1>(next_beam_id[i]);
-      int wid = std::get<2>(next_beam_id[i]);
-      int aid = std::get<3>(next_beam_id[i]);
-      // cerr << "Adding " << wid << " @ beam " << i << ": score=" << std::get<0>(next_beam_id[i]) - curr_beam[hypid]->GetScore() << endl;
-      if(hypid == -1) break;
+    for(const TopKEntry & entry : next_beam_id.Get()) {
+      dynet::real score = entry.score;
+      int hypid = entry.row;
+      int wid = (shortlist.size() ? shortlist[entry.col] : entry.col);
+      int aid = best_aligns[hypid];
+      // cerr << "Adding " << wid << ": score=" << score - curr_beam[hypid]->GetScore() << endl;
       Sentence next_sent = curr_beam[hypid]->GetSentence();
       next_sent.push_back(wid);
       Sentence next_align = curr_beam[hypid]->GetAlignment();
@@ -317,3 +391,369 @@ std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::GenerateNbest(const Sentence
   return nbest;
   // return vector<EnsembleDecoderHypPtr>(0);
 }
+
+bool EnsembleDecoder::SetGraphFree(bool graph_free, const std::string & quant) {
+  engines_.clear();
+  if(!graph_free) return true;
+  // The decoders of attentional models run attention with the engine
+  vector<const ExternAttentional*> attentions(lms_.size(), nullptr);
+  for(size_t j = 0; j < encatts_.size(); j++)
+    attentions[encdecs_.size() + j] = encatts_[j]->GetExternAttentionalPtr().get();
+  for(size_t j = 0; j < lms_.size(); j++)
+    if(!NeuralLMEngine::IsSupported(*lms_[j], attentions[j]))
+      return false;
+  for(size_t j = 0; j < lms_.size(); j++) {
+    engines_.push_back(NeuralLMEnginePtr(new NeuralLMEngine(*lms_[j], attentions[j])));
+    engines_.back()->Quantize(quant);
+  }
+  return true;
+}
+
+void EnsembleDecoder::InitializeGraphFree(const Sentence & sent_src, std::vector<Eigen::MatrixXf> & states) {
+  // Encode the source in a computation graph, and start the decoders from
+  // the values of the encoded states and attend over those of the words
+  vector<Eigen::MatrixXf> init_states(engines_.size());
+  if(encdecs_.size() + encatts_.size() > 0) {
+    dynet::ComputationGraph cg;
+    for(auto & tm : encdecs_) tm->NewGraph(cg);
+    for(auto & tm : encatts_) tm->NewGraph(cg);
+    vector<vector<Expression> > encoded = GetInitialStates(sent_src, cg);
+    for(size_t j = 0; j < encdecs_.size() + encatts_.size(); j++) {
+      init_states[j] = NeuralLMEngine::CopyMatrix(cg.incremental_forward(concatenate(encoded[j])));
+      if(j >= encdecs_.size()) {
+        const ExternAttentional & attention = *encatts_[j - encdecs_.size()]->GetExternAttentionalPtr();
+        engines_[j]->SetSource(NeuralLMEngine::CopyMatrix(cg.incremental_forward(attention.GetWordStates())),
+                               NeuralLMEngine::CopyMatrix(cg.incremental_forward(attention.GetWordStatesPart())));
+      }
+    }
+  }
+  states.resize(engines_.size());
+  for(size_t j = 0; j < engines_.size(); j++) {
+    states[j] = Eigen::MatrixXf::Zero(engines_[j]->GetStateSize(), 1);
+    if(init_states[j].size())
+      states[j].topRows(init_states[j].rows()) = init_states[j];
+  }
+}
+
+const Eigen::MatrixXf & EnsembleDecoder::EnsembleGraphFree(const std::vector<Eigen::MatrixXf> & log_probs, Eigen::MatrixXf & ens_probs) const {
+  if(engines_.size() == 1)
+    return log_probs[0];
+  if(ensemble_operation_ == "sum") {
+    ens_probs = log_probs[0].array().exp().matrix();
+    for(size_t j = 1; j < engines_.size(); j++)
+      ens_probs.array() += log_probs[j].array().exp();
+    ens_probs = (ens_probs.array() / engines_.size()).log().matrix();
+  } else if(ensemble_operation_ == "logsum") {
+    ens_probs = log_probs[0];
+    for(size_t j = 1; j < engines_.size(); j++)
+      ens_probs += log_probs[j];
+    ens_probs /= engines_.size();
+    NeuralLMEngine::LogSoftmax(ens_probs);
+  } else {
+    THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
+  }
+  return ens_probs;
+}
+
+void EnsembleDecoder::CalcSentLLGraphFree(const Sentence & sent_src, const Sentence & sent_trg, LLStats & ll, std::vector<float> & wordll) {
+  for(auto & engine : engines_) engine->SetShortlist(vector<unsigned>());
+  vector<Eigen::MatrixXf> states, next_states(engines_.size()), log_probs(engines_.size());
+  InitializeGraphFree(sent_src, states);
+  Eigen::MatrixXf ens_probs;
+  vector<Sentence> sents(1, sent_trg);
+  for(int t = 0; t < (int)sent_trg.size(); t++) {
+    for(size_t j = 0; j < engines_.size(); j++)
+      engines_[j]->Forward(sents, t, states[j], next_states[j], log_probs[j]);
+    float word_ll = EnsembleGraphFree(log_probs, ens_probs)(sent_trg[t], 0);
+    ll.loss_ -= word_ll;
+    if(sent_trg[t] == unk_id_)
+      ++ll.unk_;
+    wordll.push_back(word_ll);
+    states.swap(next_states);
+  }
+  ll.words_ += sent_trg.size();
+}
+void EnsembleDecoder::CalcSentLLGraphFree(const Sentence & sent_src, const std::vector<Sentence> & sent_trg, std::vector<LLStats> & ll, std::vector<std::vector<float> > & wordll) {
+  for(size_t i = 0; i < sent_trg.size(); i++)
+    CalcSentLLGraphFree(sent_src, sent_trg[i], ll[i], wordll[i]);
+}
+
+std::vector<EnsembleDecoderHypPtr> EnsembleDecoder::GenerateNbestGraphFree(const Sentence & sent_src, int nbest_size) {
+
+  if(ensemble_operation_ != "sum" && ensemble_operation_ != "logsum")
+    THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
+  vector<unsigned> shortlist = CreateShortlist(vector<Sentence>(1, sent_src));
+  for(auto & engine : engines_) engine->SetShortlist(shortlist);
+  int unk_idx = (shortlist.size() ? lower_bound(shortlist.begin(), shortlist.end(), (unsigned)unk_id_) - shortlist.begin() : unk_id_);
+
+  // The n-best hypotheses
+  vector<EnsembleDecoderHypPtr> nbest;
+
+  // The hypotheses hold no expressions, their states are the columns of
+  // states, in the same order as the beam
+  vector<vector<Expression> > empty_states(lms_.size());
+  vector<Expression> empty_exprs(lms_.size());
+  vector<EnsembleDecoderHypPtr> curr_beam(1,
+      EnsembleDecoderHypPtr(new EnsembleDecoderHyp(0.0, empty_states, empty_exprs, empty_exprs, Sentence(), Sentence())));
+  vector<Eigen::MatrixXf> states(engines_.size()), live_states(engines_.size()), next_states(engines_.size()), log_probs(engines_.size());
+  InitializeGraphFree(sent_src, states);
+  Eigen::MatrixXf ens_probs, ens_aligns;
+
+  // The word penalty is added to all words but the sentence end, and the unk
+  // penalty after it to the unknown word
+  vector<pair<int,float> > pen_adjust(1, make_pair(0, 0.f));
+  if(unk_id_ >= 0) {
+    if(unk_idx != 0) pen_adjust.push_back(make_pair(unk_idx, word_pen_));
+    pen_adjust.push_back(make_pair(unk_idx, unk_pen_ * unk_log_prob_));
+  }
+
+  // Perform decoding
+  for(int sent_len = 0; sent_len <= size_limit_; sent_len++) {
+    // Gather the hypotheses that haven't finished yet
+    vector<int> live_ids, live_pos(curr_beam.size(), -1);
+    vector<Sentence> live_sents;
+    for(int hypid = 0; hypid < (int)curr_beam.size(); hypid++) {
+      const Sentence & sent = curr_beam[hypid]->GetSentence();
+      if(sent_len != 0 && *sent.rbegin() == 0) continue;
+      live_pos[hypid] = live_ids.size();
+      live_ids.push_back(hypid);
+      live_sents.push_back(sent);
+    }
+    // Perform the forward step on all models
+    for(size_t j = 0; j < engines_.size(); j++) {
+      live_states[j].resize(states[j].rows(), live_ids.size());
+      for(size_t k = 0; k < live_ids.size(); k++)
+        live_states[j].col(k) = states[j].col(live_ids[k]);
+      engines_[j]->Forward(live_sents, sent_len, live_states[j], next_states[j], log_probs[j]);
+    }
+    // Ensemble the log probabilities
+    const Eigen::MatrixXf & ens_logprob = EnsembleGraphFree(log_probs, ens_probs);
+    // Find the best aligned source of each hypothesis, if any model attends
+    vector<WordId> best_aligns(live_ids.size(), -1);
+    ens_aligns.resize(0, 0);
+    for(auto & engine : engines_) {
+      if(!engine->HasAttention()) continue;
+      if(ens_aligns.size() == 0) ens_aligns = engine->GetAlignments();
+      else                       ens_aligns += engine->GetAlignments();
+    }
+    for(size_t k = 0; k < live_ids.size() && ens_aligns.size(); k++)
+      ens_aligns.col(k).maxCoeff(&best_aligns[k]);
+    // Find the best IDs, with the word/unk penalty
+    TopK next_beam_id(beam_size_, beam_cands_ > 0 ? beam_cands_ : beam_size_);
+    for(size_t k = 0; k < live_ids.size(); k++)
+      next_beam_id.AddRow(live_ids[k], ens_logprob.data() + k * ens_logprob.rows(), ens_logprob.rows(), curr_beam[live_ids[k]]->GetScore(), word_pen_, pen_adjust);
+    // Create the new hypotheses, and copy their states
+    const vector<TopKEntry> & best = next_beam_id.Get();
+    for(size_t j = 0; j < engines_.size(); j++)
+      states[j].resize(states[j].rows(), best.size());
+    vector<EnsembleDecoderHypPtr> next_beam;
+    for(size_t i = 0; i < best.size(); i++) {
+      const TopKEntry & entry = best[i];
+      int hypid = entry.row;
+      int wid = (shortlist.size() ? shortlist[entry.col] : entry.col);
+      for(size_t j = 0; j < engines_.size(); j++)
+        states[j].col(i) = next_states[j].col(live_pos[hypid]);
+      Sentence next_sent = curr_beam[hypid]->GetSentence();
+      next_sent.push_back(wid);
+      Sentence next_align = curr_beam[hypid]->GetAlignment();
+      next_align.push_back(best_aligns[live_pos[hypid]]);
+      EnsembleDecoderHypPtr hyp(new EnsembleDecoderHyp(entry.score, empty_states, empty_exprs, empty_exprs, next_sent, next_align));
+      if(wid == 0 || sent_len == size_limit_)
+        nbest.push_back(hyp);
+      next_beam.push_back(hyp);
+    }
+    curr_beam = next_beam;
+    // Check if we're done with search
+    if(nbest.size() != 0) {
+      sort(nbest.begin(), nbest.end());
+      if(nbest.size() > nbest_size)
+        nbest.resize(nbest_size);
+      if(nbest.size() == nbest_size && (next_beam.size() == 0 || (*nbest.rbegin())->GetScore() >= next_beam[0]->GetScore()))
+        return nbest;
+    }
+  }
+  cerr << "WARNING: Generated sentence size exceeded " << size_limit_ << ". Truncating." << endl;
+  return nbest;
+}
+
+// Pick the batch elements in ids from every non-empty expression
+inline Expression PickBatchElems(const Expression & expr, const vector<unsigned> & ids) {
+  return (expr.pg != nullptr ? pick_batch_elems(expr, ids) : expr);
+}
+inline vector<Expression> PickBatchElems(const vector<Expression> & exprs, const vector<unsigned> & ids) {
+  vector<Expression> ret(exprs.size());
+  for(size_t i = 0; i < exprs.size(); i++)
+    ret[i] = PickBatchElems(exprs[i], ids);
+  return ret;
+}
+
+std::vector<std::vector<EnsembleDecoderHypPtr> > EnsembleDecoder::GenerateNbest(const std::vector<Sentence> & sent_srcs, int nbest_size) {
+
+  if(engines_.size()) {
+    std::vector<std::vector<EnsembleDecoderHypPtr> > ret;
+    for(auto & sent_src : sent_srcs)
+      ret.push_back(GenerateNbestGraphFree(sent_src, nbest_size));
+    return ret;
+  }
+
+  // First initialize states
+  dynet::ComputationGraph cg;
+  for(auto & tm : encdecs_) tm->NewGraph(cg);
+  for(auto & tm : encatts_) tm->NewGraph(cg);
+  for(auto & lm : lms_) lm->NewGraph(cg);
+  int num_sents = sent_srcs.size();
+  vector<unsigned> shortlist = CreateShortlist(sent_srcs);
+  ShortlistScope shortlist_scope(lms_, shortlist);
+  int unk_idx = (shortlist.size() ? lower_bound(shortlist.begin(), shortlist.end(), (unsigned)unk_id_) - shortlist.begin() : unk_id_);
+
+  // The n-best hypotheses for each sentence, and whether search is finished
+  vector<vector<EnsembleDecoderHypPtr> > nbests(num_sents);
+  vector<bool> done(num_sents, false);
+
+  // The states are held here in batched form instead of in the hypotheses.
+  // Batch element i of the last step's output is referenced by the hypotheses
+  // in curr_beams through curr_pos.
+  vector<vector<Expression> > last_states = GetInitialStates(sent_srcs, cg), next_states(lms_.size());
+  vector<Expression> last_externs(lms_.size()), next_externs(lms_.size());
+  vector<Expression> last_sums(lms_.size()), next_sums(lms_.size());
+  vector<vector<Expression> > empty_states;
+  vector<Expression> empty_exprs;
+  vector<vector<EnsembleDecoderHypPtr> > curr_beams(num_sents);
+  vector<vector<unsigned> > curr_pos(num_sents);
+  for(int s = 0; s < num_sents; s++) {
+    curr_beams[s].push_back(EnsembleDecoderHypPtr(new EnsembleDecoderHyp(
+          0.0, empty_states, empty_exprs, empty_exprs, Sentence(), Sentence())));
+    curr_pos[s].push_back(s);
+  }
+  unsigned last_batch = num_sents;
+  vector<pair<int,float> > pen_adjust(1, make_pair(0, 0.f));
+  if(unk_id_ >= 0) {
+    if(unk_idx != 0) pen_adjust.push_back(make_pair(unk_idx, word_pen_));
+    pen_adjust.push_back(make_pair(unk_idx, unk_pen_ * unk_log_prob_));
+  }
+
+  // Perform decoding
+  for(int sent_len = 0; sent_len <= size_limit_; sent_len++) {
+    // Gather the unfinished hypotheses of all unfinished sentences into a single batch
+    vector<pair<int,int> > batch_hyps;
+    vector<vector<int> > hyp_batch(num_sents);
+    vector<unsigned> batch_pos, batch_srcs;
+    vector<Sentence> batch_sents;
+    for(int s = 0; s < num_sents; s++) {
+      if(done[s]) continue;
+      size_t start = batch_hyps.size();
+      hyp_batch[s].resize(curr_beams[s].size(), -1);
+      for(int hypid = 0; hypid < (int)curr_beams[s].size(); hypid++) {
+        const Sentence & sent = curr_beams[s][hypid]->GetSentence();
+        if(sent_len != 0 && *sent.rbegin() == 0) continue;
+        hyp_batch[s][hypid] = batch_hyps.size();
+        batch_hyps.push_back(make_pair(s, hypid));
+        batch_pos.push_back(curr_pos[s][hypid]);
+        batch_srcs.push_back(s);
+        batch_sents.push_back(sent);
+      }
+      if(batch_hyps.size() == start)
+        done[s] = true;
+    }
+    if(batch_hyps.size() == 0) return nbests;
+    // Re-arrange the states of the last step to line up with the batch
+    bool in_order = (batch_pos.size() == last_batch);
+    for(size_t i = 0; in_order && i < batch_pos.size(); i++)
+      in_order = (batch_pos[i] == i);
+    if(!in_order) {
+      for(int j : boost::irange(0, (int)lms_.size())) {
+        last_states[j] = PickBatchElems(last_states[j], batch_pos);
+        last_externs[j] = PickBatchElems(last_externs[j], batch_pos);
+        last_sums[j] = PickBatchElems(last_sums[j], batch_pos);
+      }
+    }
+    for(auto & ext : externs_)
+      if(ext.get() != nullptr) ext->SelectBatch(batch_srcs);
+    // Perform the forward step on all models
+    vector<Expression> i_softmaxes, i_aligns;
+    for(int j : boost::irange(0, (int)lms_.size()))
+      i_softmaxes.push_back( lms_[j]->Forward(batch_sents, sent_len, externs_[j].get(), ensemble_operation_ == "logsum", last_states[j], last_externs[j], last_sums[j], next_states[j], next_externs[j], next_sums[j], cg, i_aligns) );
+    // Ensemble and calculate the likelihood
+    Expression i_softmax, i_logprob;
+    if(ensemble_operation_ == "sum") {
+      i_softmax = EnsembleProbs(i_softmaxes, cg);
+      i_logprob = log({i_softmax});
+    } else if(ensemble_operation_ == "logsum") {
+      i_logprob = EnsembleLogProbs(i_softmaxes, cg);
+    } else {
+      THROW_ERROR("Bad ensembling operation: " << ensemble_operation_ << endl);
+    }
+    // Find the best aligned source for each hypothesis, if any alignments exist
+    vector<WordId> best_aligns(batch_hyps.size(), -1);
+    if(i_aligns.size() != 0) {
+      dynet::Expression ens_align = sum(i_aligns);
+      vector<dynet::real> align = as_vector(cg.incremental_forward(ens_align));
+      size_t align_size = align.size() / batch_hyps.size();
+      for(size_t b = 0; b < batch_hyps.size(); b++) {
+        const dynet::real * my_align = &align[b*align_size];
+        best_aligns[b] = 0;
+        for(size_t aid = 0; aid < align_size; aid++)
+          if(my_align[aid] > my_align[best_aligns[b]])
+            best_aligns[b] = aid;
+      }
+    }
+    // Find the best IDs for each sentence over all of its hypotheses in the
+    // batch, with the word/unk penalty, directly from the values
+    const dynet::Tensor & softmax = cg.incremental_forward(i_logprob);
+    size_t vocab_size = softmax.d.size() / batch_hyps.size();
+    const dynet::real * softmax_v = softmax.v;
+#ifdef HAVE_CUDA
+    // The values are on the device, so copy them to the host first
+    vector<dynet::real> softmax_host = as_vector(softmax);
+    softmax_v = softmax_host.data();
+#endif
+    vector<TopK> next_beam_ids(num_sents, TopK(beam_size_, beam_cands_ > 0 ? beam_cands_ : beam_size_));
+    vector<vector<WordId> > hyp_aligns(num_sents);
+    for(size_t b = 0; b < batch_hyps.size(); b++) {
+      int s = batch_hyps[b].first, hypid = batch_hyps[b].second;
+      next_beam_ids[s].AddRow(hypid, softmax_v + b*vocab_size, vocab_size, curr_beams[s][hypid]->GetScore(), word_pen_, pen_adjust);
+      hyp_aligns[s].resize(curr_beams[s].size(), -1);
+      hyp_aligns[s][hypid] = best_aligns[b];
+    }
+    // Create the new hypotheses
+    for(int s = 0; s < num_sents; s++) {
+      if(done[s]) continue;
+      vector<EnsembleDecoderHypPtr> next_beam;
+      vector<unsigned> next_pos;
+      vector<EnsembleDecoderHypPtr> & nbest = nbests[s];
+      for(const TopKEntry & entry : next_beam_ids[s].Get()) {
+        dynet::real score = entry.score;
+        int hypid = entry.row;
+        int wid = (shortlist.size() ? shortlist[entry.col] : entry.col);
+        int aid = hyp_aligns[s][hypid];
+        Sentence next_sent = curr_beams[s][hypid]->GetSentence();
+        next_sent.push_back(wid);
+        Sentence next_align = curr_beams[s][hypid]->GetAlignment();
+        next_align.push_back(aid);
+        EnsembleDecoderHypPtr hyp(new EnsembleDecoderHyp(score, empty_states, empty_exprs, empty_exprs, next_sent, next_align));
+        if(wid == 0 || sent_len == size_limit_) 
+          nbest.push_back(hyp);
+        next_beam.push_back(hyp);
+        next_pos.push_back(hyp_batch[s][hypid]);
+      }
+      curr_beams[s] = next_beam;
+      curr_pos[s] = next_pos;
+      // Check if we're done with search
+      if(nbest.size() != 0) {
+        sort(nbest.begin(), nbest.end());
+        if(nbest.size() > nbest_size)
+          nbest.resize(nbest_size);
+        if(nbest.size() == nbest_size && (next_beam.size() == 0 || (*nbest.rbegin())->GetScore() >= next_beam[0]->GetScore()))
+          done[s] = true;
+      }
+    }
+    last_states = next_states;
+    last_externs = next_externs;
+    last_sums = next_sums;
+    last_batch = batch_hyps.size();
+    if(find(done.begin(), done.end(), false) == done.end())
+      return nbests;
+  }
+  cerr << "WARNING: Generated sentence size exceeded " << size_limit_ << ". Truncating." << endl;
+  return nbests;
+}
@@ -3,6 +3,7 @@
 #include <lamtram/encoder-decoder.h>
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/neural-lm.h>
+#include <lamtram/neural-lm-engine.h>
 #include <lamtram/extern-calculator.h>
 #include <dynet/tensor.h>
 #include <dynet/dynet.h>
@@ -10,6 +11,8 @@
 
 namespace lamtram {
 
+class LLStats;
+
 class EnsembleDecoderHyp {
 public:
     EnsembleDecoderHyp(float score, const std::vector<std::vector<dynet::Expression> > & states, const std::vector<dynet::Expression> & externs, const std::vector<dynet::Expression> & sums, const Sentence & sent, const Sentence & align) :
@@ -55,7 +58,12 @@ public:
     EnsembleDecoderHypPtr Generate(const Sentence & sent_src);
     std::vector<EnsembleDecoderHypPtr> GenerateNbest(const Sentence & sent_src, int nbest);
 
-    std::vector<std::vector<dynet::Expression> > GetInitialStates(const Sentence & sent_src, dynet::ComputationGraph & cg);
+    // Perform beam search for several sentences at once, with all live hypotheses
+    // of each step packed into one minibatch
+    std::vector<std::vector<EnsembleDecoderHypPtr> > GenerateNbest(const std::vector<Sentence> & sent_srcs, int nbest);
+
+    template <class SentData>
+    std::vector<std::vector<dynet::Expression> > GetInitialStates(const SentData & sent_src, dynet::ComputationGraph & cg);
     
     template <class Sent, class Stat, class WordLik>
     void AddLik(const Sent & sent, const dynet::Expression & expr, const std::vector<dynet::Expression> & exprs, Stat & ll, WordLik & wordll);
@@ -81,17 +89,63 @@ public:
     void SetBeamSize(int beam_size) { beam_size_ = beam_size; }
     int GetSizeLimit() const { return size_limit_; }
     void SetSizeLimit(int size_limit) { size_limit_ = size_limit; }
+    // Keep the encodings of this many recent source sentences in each model
+    void SetEncoderCache(int size) {
+      for(auto & tm : encdecs_) tm->GetEncoderCache().SetSize(size);
+      for(auto & tm : encatts_) tm->GetExternAttentionalPtr()->GetEncoderCache().SetSize(size);
+    }
+
+    int GetBeamCands() const { return beam_cands_; }
+    void SetBeamCands(int beam_cands) { beam_cands_ = beam_cands; }
+    bool GetBatchBeam() const { return batch_beam_; }
+    void SetBatchBeam(bool batch_beam) { batch_beam_ = batch_beam; }
+
+    // Generate and calculate likelihoods with NeuralLMEngines on copies of the
+    // decoders' current weights instead of computation graphs, with the weight
+    // matrices stored
+    // as quant ("float", "int8" or "fp16"). Sources are still encoded with a
+    // graph, whose values start the decoders and are attended over.
+    // Returns false (and keeps using graphs) if a model isn't supported.
+    bool SetGraphFree(bool graph_free, const std::string & quant = "float");
+    bool GetGraphFree() const { return engines_.size() > 0; }
+
+    // Only score a shortlist of target words when generating: the sentence end,
+    // unknown word, the passed words (e.g. the most frequent ones), and the
+    // num_trans most probable translations of each source word according to
+    // the lexicons of attentional models.
+    void SetShortlist(const std::vector<WordId> & words, int num_trans) {
+      shortlist_words_ = words;
+      shortlist_trans_ = num_trans;
+    }
+    // Create the sorted shortlist for the source sentences, empty if not used
+    std::vector<unsigned> CreateShortlist(const std::vector<Sentence> & sent_srcs) const;
 
 protected:
+    // Perform beam search with the NeuralLMEngines
+    std::vector<EnsembleDecoderHypPtr> GenerateNbestGraphFree(const Sentence & sent_src, int nbest);
+    // Calculate the likelihood of the target sentences with the NeuralLMEngines
+    void CalcSentLLGraphFree(const Sentence & sent_src, const Sentence & sent_trg, LLStats & ll, std::vector<float> & wordll);
+    void CalcSentLLGraphFree(const Sentence & sent_src, const std::vector<Sentence> & sent_trg, std::vector<LLStats> & ll, std::vector<std::vector<float> > & wordll);
+    // Encode the source if necessary, and create the initial state of each engine
+    void InitializeGraphFree(const Sentence & sent_src, std::vector<Eigen::MatrixXf> & states);
+    // Ensemble the log probabilities of the engines, in ens_probs if there
+    // is more than one engine
+    const Eigen::MatrixXf & EnsembleGraphFree(const std::vector<Eigen::MatrixXf> & log_probs, Eigen::MatrixXf & ens_probs) const;
+
     std::vector<EncoderDecoderPtr> encdecs_;
     std::vector<EncoderAttentionalPtr> encatts_;
     std::vector<NeuralLMPtr> lms_;
     std::vector<ExternCalculatorPtr> externs_;
+    std::vector<NeuralLMEnginePtr> engines_;
     float word_pen_;
     float unk_pen_, unk_log_prob_;
     int unk_id_;
     int size_limit_;
     int beam_size_;
+    int beam_cands_;
+    bool batch_beam_;
+    std::vector<WordId> shortlist_words_;
+    int shortlist_trans_;
     std::string ensemble_operation_;
 
 };
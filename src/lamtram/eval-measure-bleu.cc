@@ -2,6 +2,7 @@
 #include <lamtram/eval-measure-bleu.h>
 #include <lamtram/macros.h>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <cmath>
 #include <cfloat>
 
@@ -24,12 +25,42 @@ EvalMeasureBleu::NgramStats * EvalMeasureBleu::ExtractNgrams(const Sentence & se
     return all_ngrams;
 }
 
-std::shared_ptr<EvalMeasureBleu::NgramStats> EvalMeasureBleu::GetCachedStats(const Sentence & sent, int cache_id) {
-    if(cache_id == INT_MAX) return std::shared_ptr<NgramStats>(ExtractNgrams(sent));
+// Compare n-gram a of sentence sa to n-gram b of sentence sb, first by hash,
+// then by length, and only then by the words
+inline int CompareNgrams(const BleuNgram & a, const Sentence & sa, const BleuNgram & b, const Sentence & sb) {
+    if(a.key != b.key) return (a.key < b.key ? -1 : 1);
+    if(a.len != b.len) return (a.len < b.len ? -1 : 1);
+    for(int k = 0; k < a.len; k++)
+        if(sa[a.pos+k] != sb[b.pos+k])
+            return (sa[a.pos+k] < sb[b.pos+k] ? -1 : 1);
+    return 0;
+}
+
+void EvalMeasureBleu::SortNgrams(const Sentence & sentence, std::vector<BleuNgram> & ngrams) const {
+    ngrams.clear();
+    int sent_len = sentence.size();
+    for(int i = 0; i < sent_len; i++) {
+        // FNV-1a over the words of each n-gram starting at i
+        uint64_t key = 14695981039346656037ULL;
+        for(int k = 0; k < ngram_order_ && i+k < sent_len; k++) {
+            key = (key ^ (uint32_t)sentence[i+k]) * 1099511628211ULL;
+            BleuNgram ngram = {key, i, k+1};
+            ngrams.push_back(ngram);
+        }
+    }
+    std::sort(ngrams.begin(), ngrams.end(), [&](const BleuNgram & a, const BleuNgram & b) {
+        return CompareNgrams(a, sentence, b, sentence) < 0;
+    });
+}
+
+std::shared_ptr<BleuSentNgrams> EvalMeasureBleu::GetCachedStats(const Sentence & sent, int cache_id) {
     StatsCache::const_iterator it = cache_.find(cache_id);
     if(it == cache_.end()) {
-        std::shared_ptr<NgramStats> new_stats(ExtractNgrams(sent));
-        cache_.insert(make_pair(cache_id, new_stats));
+        std::shared_ptr<BleuSentNgrams> new_stats(new BleuSentNgrams);
+        new_stats->sent = sent;
+        SortNgrams(sent, new_stats->ngrams);
+        if(cache_id != INT_MAX)
+            cache_.insert(make_pair(cache_id, new_stats));
         return new_stats;
     } else {
         return it->second;
@@ -37,13 +68,68 @@ std::shared_ptr<EvalMeasureBleu::NgramStats> EvalMeasureBleu::GetCachedStats(con
 }
 
 std::shared_ptr<EvalStats> EvalMeasureBleu::CalculateStats(const Sentence & ref, const Sentence & sys) const {
-    std::shared_ptr<NgramStats> ref_s(ExtractNgrams(ref)), sys_s(ExtractNgrams(sys));
-    return CalculateStats(*ref_s, ref.size(), *sys_s, sys.size());
+    // Buffers reused between calls on the same thread
+    static thread_local std::vector<BleuNgram> ref_ngrams, sys_ngrams;
+    SortNgrams(ref, ref_ngrams);
+    SortNgrams(sys, sys_ngrams);
+    return CalculateStats(ref, ref_ngrams, sys, sys_ngrams);
 }
 
 // Measure the score of the sys output according to the ref
 std::shared_ptr<EvalStats> EvalMeasureBleu::CalculateStats(const Sentence & ref, const Sentence & sys, int ref_cache_id, int sys_cache_id) {
-    return CalculateStats(*GetCachedStats(ref, ref_cache_id), ref.size(), *GetCachedStats(sys, sys_cache_id), sys.size());
+    // Without caching, use the thread's buffers in the const version
+    if(ref_cache_id == INT_MAX && sys_cache_id == INT_MAX)
+        return static_cast<const EvalMeasureBleu&>(*this).CalculateStats(ref, sys);
+    std::shared_ptr<BleuSentNgrams> ref_s = GetCachedStats(ref, ref_cache_id), sys_s = GetCachedStats(sys, sys_cache_id);
+    return CalculateStats(ref_s->sent, ref_s->ngrams, sys_s->sent, sys_s->ngrams);
+}
+
+std::vector<EvalStatsPtr> EvalMeasureBleu::CalculateCachedStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                const std::vector<int> & ref_cache_ids,
+                int num_threads) {
+    if(refs.size() != syss.size() || refs.size() != ref_cache_ids.size())
+        THROW_ERROR("Mismatched number of references, outputs and cache ids in CalculateCachedStatsBatch: " << refs.size() << ", " << syss.size() << ", " << ref_cache_ids.size());
+    // Fill the cache on this thread, so the scoring threads don't modify it
+    vector<std::shared_ptr<BleuSentNgrams> > ref_s(refs.size());
+    for(size_t i = 0; i < refs.size(); i++)
+        ref_s[i] = GetCachedStats(*refs[i], ref_cache_ids[i]);
+    vector<EvalStatsPtr> ret(refs.size());
+    RunBatch(refs.size(), num_threads, [&](size_t i) {
+        static thread_local std::vector<BleuNgram> sys_ngrams;
+        SortNgrams(*syss[i], sys_ngrams);
+        ret[i] = CalculateStats(ref_s[i]->sent, ref_s[i]->ngrams, *syss[i], sys_ngrams);
+    });
+    return ret;
+}
+
+std::shared_ptr<EvalStats> EvalMeasureBleu::CalculateStats(const Sentence & ref, const std::vector<BleuNgram> & ref_ngrams,
+                                                           const Sentence & sys, const std::vector<BleuNgram> & sys_ngrams) const {
+    vector<EvalStatsDataType> vals(3*ngram_order_);
+    for (int i =0; i<ngram_order_; i++) {
+        vals[3*i] = 0;
+        vals[3*i+1] = max((int)sys.size()-i,0);
+        vals[3*i+2] = max((int)ref.size()-i,0);
+    }
+    // Walk through both sorted lists, adding the smaller count of each
+    // n-gram that appears in both
+    size_t i = 0, j = 0;
+    while(i < ref_ngrams.size() && j < sys_ngrams.size()) {
+        int cmp = CompareNgrams(ref_ngrams[i], ref, sys_ngrams[j], sys);
+        if(cmp < 0) {
+            i++;
+        } else if(cmp > 0) {
+            j++;
+        } else {
+            size_t i_end = i+1, j_end = j+1;
+            while(i_end < ref_ngrams.size() && CompareNgrams(ref_ngrams[i_end], ref, ref_ngrams[i], ref) == 0) i_end++;
+            while(j_end < sys_ngrams.size() && CompareNgrams(sys_ngrams[j_end], sys, sys_ngrams[j], sys) == 0) j_end++;
+            vals[3*(ref_ngrams[i].len-1)] += min(i_end-i, j_end-j);
+            i = i_end; j = j_end;
+        }
+    }
+    return CreateStats(vals);
 }
 
 std::shared_ptr<EvalStats> EvalMeasureBleu::CalculateStats(const NgramStats & ref_ngrams, int ref_len,
@@ -63,6 +149,10 @@ std::shared_ptr<EvalStats> EvalMeasureBleu::CalculateStats(const NgramStats & re
             vals[3* (it->first.size()-1)] += min(ref_it->second,it->second);
         }
     }
+    return CreateStats(vals);
+}
+
+EvalStatsPtr EvalMeasureBleu::CreateStats(std::vector<EvalStatsDataType> & vals) const {
     // Create the stats for this sentence
     EvalStatsPtr ret(new EvalStatsBleu(vals, smooth_val_, prec_weight_, mean_, inverse_, calc_brev_));
     // If we are using sentence based, take the average immediately
@@ -12,7 +12,9 @@
 //  CICLING 13
 
 #include <lamtram/eval-measure.h>
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <vector>
 
 namespace lamtram {
@@ -59,6 +61,19 @@ private:
     bool calc_brev_;
 };
 
+// An n-gram in a sentence, identified by a 64-bit hash of its words, its
+// length, and its start position to tell apart n-grams with the same hash
+typedef struct {
+    uint64_t key;
+    int pos, len;
+} BleuNgram;
+
+// A sentence with all of its n-grams, sorted so identical n-grams are adjacent
+typedef struct {
+    Sentence sent;
+    std::vector<BleuNgram> ngrams;
+} BleuSentNgrams;
+
 class EvalMeasureBleu : public EvalMeasure {
 
 public:
@@ -66,8 +81,8 @@ public:
     // NgramStats are a mapping between ngrams and the number of occurrences
     typedef std::map<std::vector<WordId>,int> NgramStats;
 
-    // A cache to hold the stats
-    typedef std::map<int,std::shared_ptr<NgramStats> > StatsCache;
+    // A cache to hold the stats of sentences by id
+    typedef std::map<int,std::shared_ptr<BleuSentNgrams> > StatsCache;
 
     EvalMeasureBleu(int ngram_order = 4, float smooth_val = 0,
                     BleuScope scope = CORPUS, float prec_weight = 1.0,
@@ -81,6 +96,22 @@ public:
                 const Sentence & sys,
                 int ref_cache_id = INT_MAX,
                 int sys_cache_id = INT_MAX);
+    virtual EvalStatsPtr CalculateCachedStats(
+                const Sentence & ref,
+                const Sentence & sys,
+                int ref_cache_id = INT_MAX,
+                int sys_cache_id = INT_MAX) {
+        return CalculateStats(ref, sys, ref_cache_id, sys_cache_id);
+    }
+    using EvalMeasure::CalculateCachedStats;
+
+    // Find the sorted n-grams of each reference once, then score the outputs
+    // against them in parallel
+    virtual std::vector<EvalStatsPtr> CalculateCachedStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                const std::vector<int> & ref_cache_ids,
+                int num_threads = 1);
     
     // Calculate the stats for a single sentence
     virtual std::shared_ptr<EvalStats> CalculateStats(
@@ -91,16 +122,27 @@ public:
     virtual EvalStatsPtr ReadStats(
                 const std::string & file);
 
-    // Calculate the stats with cached n-grams
+    // Calculate the stats with n-grams extracted by ExtractNgrams, which
+    // gives the same results as the faster sorted n-grams
     std::shared_ptr<EvalStats> CalculateStats(
                         const NgramStats & ref_ngrams,
                         int ref_len,
                         const NgramStats & sys_ngrams,
                         int sys_len) const; 
 
+    // Calculate the stats with n-grams sorted by SortNgrams
+    std::shared_ptr<EvalStats> CalculateStats(
+                        const Sentence & ref,
+                        const std::vector<BleuNgram> & ref_ngrams,
+                        const Sentence & sys,
+                        const std::vector<BleuNgram> & sys_ngrams) const;
+
     // Calculate the n-gram statistics necessary for BLEU in advance
     NgramStats * ExtractNgrams(const Sentence & sentence) const;
 
+    // Find all n-grams of sentence and sort them into ngrams, reusing its memory
+    void SortNgrams(const Sentence & sentence, std::vector<BleuNgram> & ngrams) const;
+
     // Clear the ngram cache
     virtual void ClearCache() { cache_.clear(); }
 
@@ -128,7 +170,10 @@ protected:
     bool calc_brev_;
 
     // Get the stats that are in a cache
-    std::shared_ptr<NgramStats> GetCachedStats(const Sentence & sent, int cache_id);
+    std::shared_ptr<BleuSentNgrams> GetCachedStats(const Sentence & sent, int cache_id);
+
+    // Create the stats from the matching n-grams and lengths
+    EvalStatsPtr CreateStats(std::vector<EvalStatsDataType> & vals) const;
 
 };
 
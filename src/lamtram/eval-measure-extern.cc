@@ -2,9 +2,16 @@
 #include <lamtram/macros.h>
 #include <dynet/dict.h>
 #include <boost/algorithm/string.hpp>
-#include <boost/iostreams/device/file_descriptor.hpp>
-#include <boost/iostreams/stream.hpp>
 #include <boost/lexical_cast.hpp>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <iostream>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // External scoring code is adapted from Moses, which is also LGPL 2.1:
 // github.com/moses-smt/mosesdecoder/blob/master/mert/MeteorScorer.cpp
@@ -12,15 +19,39 @@
 using namespace std;
 using namespace lamtram;
 using namespace boost;
-using namespace boost::iostreams;
 
 #define CHILD_STDIN_READ pipefds_input[0]
 #define CHILD_STDIN_WRITE pipefds_input[1]
 #define CHILD_STDOUT_READ pipefds_output[0]
 #define CHILD_STDOUT_WRITE pipefds_output[1]
 
+// The number of times the program may fail on a line before giving up
+#define EXTERN_MAX_FAILS 3
+
+inline double CurrentSeconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Write to a pipe without being killed by SIGPIPE if the reader has exited,
+// returning -1 with errno EPIPE instead
+inline ssize_t WriteNoSigpipe(int fd, const char * data, size_t size) {
+    sigset_t pipe_set, old_set;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    ssize_t ret = write(fd, data, size);
+    if(ret < 0 && errno == EPIPE) {
+        // Discard the SIGPIPE raised by this write
+        struct timespec zero = {0, 0};
+        sigtimedwait(&pipe_set, NULL, &zero);
+        errno = EPIPE;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+    return ret;
+}
+
 EvalMeasureExtern::EvalMeasureExtern(const std::string & config, const dynet::Dict & vocab)
-                        : vocab_(vocab), run_(""), eos_(false) {
+                        : vocab_(vocab), run_(""), eos_(false), num_workers_(1), pipeline_(16), timeout_(0) {
     if(config.length() == 0) THROW_ERROR("Required for external measure: run");
     for(const EvalMeasure::StringPair & strs : EvalMeasure::ParseConfig(config)) {
         if(strs.first == "run") {
@@ -32,12 +63,31 @@ EvalMeasureExtern::EvalMeasureExtern(const std::string & config, const dynet::Di
                 eos_ = false;
             else
                 THROW_ERROR("Bad eos value: " << strs.second);
+        } else if(strs.first == "workers") {
+            num_workers_ = boost::lexical_cast<int>(strs.second);
+        } else if(strs.first == "pipeline") {
+            pipeline_ = boost::lexical_cast<int>(strs.second);
+        } else if(strs.first == "timeout") {
+            timeout_ = boost::lexical_cast<float>(strs.second);
         } else {
             THROW_ERROR("Bad configuration string: " << config);
         }
     }
     if(run_ == "") THROW_ERROR("Required for external measure: run");
+    if(num_workers_ < 1) THROW_ERROR("Bad number of external measure workers: " << num_workers_);
+    if(pipeline_ < 1) THROW_ERROR("Bad external measure pipeline size: " << pipeline_);
 
+    workers_.resize(num_workers_);
+    for(ExternWorker & worker : workers_)
+        StartWorker(worker);
+}
+
+EvalMeasureExtern::~EvalMeasureExtern() {
+    for(ExternWorker & worker : workers_)
+        StopWorker(worker, false);
+}
+
+void EvalMeasureExtern::StartWorker(ExternWorker & worker) const {
     // Create pipes for process communication
     int pipe_status;
     int pipefds_input[2];
@@ -50,47 +100,174 @@ EvalMeasureExtern::EvalMeasureExtern(const std::string & config, const dynet::Di
     if (pipe_status == -1) {
         THROW_ERROR("Error creating pipe");
     }
+    // The parent's ends are non-blocking, and are not inherited by the
+    // other workers, which would keep them from seeing the end of input
+    for(int fd : {CHILD_STDIN_WRITE, CHILD_STDOUT_READ}) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
     // Fork
     pid_t pid;
     pid = fork();
-    if (pid == pid_t(0)) {
+    if (pid == pid_t(-1)) {
+        THROW_ERROR("Error forking external measure " << run_);
+    } else if (pid == pid_t(0)) {
         // Child's IO
         dup2(CHILD_STDIN_READ, 0);
         dup2(CHILD_STDOUT_WRITE, 1);
-        close(CHILD_STDIN_WRITE);
-        close(CHILD_STDOUT_READ);
+        close(CHILD_STDIN_READ);
+        close(CHILD_STDOUT_WRITE);
         // Execute external command: the format is executable followed by args
         // followed by null.  In this case, the only arg is the executable
         // itself (conventionally passed as arg0)
         execl(run_.c_str(), run_.c_str(), (char*) NULL);
-        THROW_ERROR("Continued after execl");
+        cerr << "Could not run external measure " << run_ << endl;
+        _exit(1);
     }
     // Parent's IO
     close(CHILD_STDIN_READ);
     close(CHILD_STDOUT_WRITE);
-    // IO streams for process communication
-    to_child_buffer_.reset(new stream_buffer<file_descriptor_sink>(CHILD_STDIN_WRITE, file_descriptor_flags::close_handle));
-    from_child_buffer_.reset(new stream_buffer<file_descriptor_source>(CHILD_STDOUT_READ, file_descriptor_flags::close_handle));
-    to_child_.reset(new ostream(to_child_buffer_.get()));
-    from_child_.reset(new istream(from_child_buffer_.get()));
+    worker.pid = pid;
+    worker.to_fd = CHILD_STDIN_WRITE;
+    worker.from_fd = CHILD_STDOUT_READ;
+    worker.to_buf.clear();
+    worker.from_buf.clear();
+    worker.in_flight.clear();
+    worker.last_active = CurrentSeconds();
 }
 
-// Measure the score of the sys output according to the ref
-std::shared_ptr<EvalStats> EvalMeasureExtern::CalculateStats(const Sentence & ref, const Sentence & sys) const {
+void EvalMeasureExtern::StopWorker(ExternWorker & worker, bool kill_worker) const {
+    if(worker.pid == -1) return;
+    // Closing stdin lets the program finish by itself
+    if(worker.to_fd != -1)
+        close(worker.to_fd);
+    close(worker.from_fd);
+    if(kill_worker)
+        kill(worker.pid, SIGKILL);
+    waitpid(worker.pid, NULL, 0);
+    worker.pid = -1;
+}
+
+std::string EvalMeasureExtern::MakeLine(const Sentence & ref, const Sentence & sys) const {
     int offset = eos_ ? 0 : 1;
     vector<string> sys_words;
-    for (int i = 0; i < sys.size() - offset; ++i)
+    for (int i = 0; i < (int)sys.size() - offset; ++i)
         sys_words.push_back(vocab_.convert(sys[i]));
     vector<string> ref_words;
-    for (int i = 0; i < ref.size() - offset; ++i)
+    for (int i = 0; i < (int)ref.size() - offset; ++i)
         ref_words.push_back(vocab_.convert(ref[i]));
-    //cerr << "TO ||| " << boost::algorithm::join(sys_words, " ") << " ||| " << boost::algorithm::join(ref_words, " ") << endl;
-    *to_child_ << boost::algorithm::join(sys_words, " ") << " ||| " << boost::algorithm::join(ref_words, " ") << endl;
-    string from_line;
-    getline(*from_child_, from_line);
-    //cerr << "FROM ||| " << from_line << endl;
-    EvalStatsDataType score = lexical_cast<float>(from_line);
-    return std::shared_ptr<EvalStats>(new EvalStatsExtern(score));
+    return boost::algorithm::join(sys_words, " ") + " ||| " + boost::algorithm::join(ref_words, " ") + "\n";
+}
+
+// Measure the score of the sys output according to the ref
+std::shared_ptr<EvalStats> EvalMeasureExtern::CalculateStats(const Sentence & ref, const Sentence & sys) const {
+    return CalculateStatsBatch(vector<const Sentence*>(1, &ref), vector<const Sentence*>(1, &sys))[0];
+}
+
+// Hand out lines to the workers as they answer, and read and write all of
+// their pipes as they become ready
+std::vector<EvalStatsPtr> EvalMeasureExtern::CalculateStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                int num_threads) const {
+    if(refs.size() != syss.size())
+        THROW_ERROR("Mismatched number of references and outputs in CalculateStatsBatch: " << refs.size() << " != " << syss.size());
+    // Workers left with lines by an earlier error are restarted
+    for(ExternWorker & worker : workers_) {
+        if(worker.in_flight.size() || worker.to_buf.size() || worker.from_buf.size() || worker.to_fd == -1) {
+            StopWorker(worker, true);
+            StartWorker(worker);
+        }
+    }
+    vector<string> lines(refs.size());
+    for(size_t i = 0; i < refs.size(); i++)
+        lines[i] = MakeLine(*refs[i], *syss[i]);
+    vector<EvalStatsPtr> ret(refs.size());
+    vector<int> fails(refs.size(), 0);
+    deque<int> todo;
+    for(int i = 0; i < (int)refs.size(); i++)
+        todo.push_back(i);
+    size_t num_done = 0;
+    vector<struct pollfd> fds;
+    char buf[4096];
+    while(num_done < ret.size()) {
+        // Give each worker lines up to the pipeline size
+        for(ExternWorker & worker : workers_) {
+            if(worker.in_flight.size() == 0)
+                worker.last_active = CurrentSeconds();
+            while((int)worker.in_flight.size() < pipeline_ && todo.size() > 0) {
+                int id = todo.front(); todo.pop_front();
+                worker.to_buf += lines[id];
+                worker.in_flight.push_back(id);
+            }
+        }
+        // Wait until some pipe is ready, checking for timeouts regularly
+        fds.clear();
+        for(ExternWorker & worker : workers_) {
+            fds.push_back({worker.from_fd, (short)(worker.in_flight.size() ? POLLIN : 0), 0});
+            fds.push_back({worker.to_fd, (short)(worker.to_buf.size() ? POLLOUT : 0), 0});
+        }
+        if(poll(fds.data(), fds.size(), timeout_ > 0 ? 100 : -1) < 0 && errno != EINTR)
+            THROW_ERROR("Error waiting for external measure " << run_);
+        for(size_t w = 0; w < workers_.size(); w++) {
+            ExternWorker & worker = workers_[w];
+            const char * failure = NULL;
+            // Write what the pipe will take
+            if(fds[2*w+1].revents & (POLLOUT | POLLERR | POLLHUP)) {
+                ssize_t num_written = WriteNoSigpipe(worker.to_fd, worker.to_buf.data(), worker.to_buf.size());
+                if(num_written > 0) {
+                    worker.to_buf.erase(0, num_written);
+                } else if(num_written < 0 && errno == EPIPE) {
+                    // The program stopped reading, but its answers so far
+                    // are read before it is restarted
+                    close(worker.to_fd);
+                    worker.to_fd = -1;
+                } else if(num_written < 0 && errno != EAGAIN && errno != EINTR) {
+                    failure = "could not write";
+                }
+            }
+            // Read the available answers
+            if(!failure && (fds[2*w].revents & (POLLIN | POLLERR | POLLHUP))) {
+                ssize_t num_read = read(worker.from_fd, buf, sizeof(buf));
+                if(num_read > 0) {
+                    worker.from_buf.append(buf, num_read);
+                    size_t end;
+                    while((end = worker.from_buf.find('\n')) != string::npos) {
+                        string from_line = worker.from_buf.substr(0, end);
+                        worker.from_buf.erase(0, end+1);
+                        if(worker.in_flight.size() == 0)
+                            THROW_ERROR("Unexpected output from external measure " << run_ << ": " << from_line);
+                        EvalStatsDataType score;
+                        try {
+                            score = lexical_cast<float>(boost::algorithm::trim_copy(from_line));
+                        } catch(boost::bad_lexical_cast & e) {
+                            THROW_ERROR("Bad score from external measure " << run_ << ": " << from_line);
+                        }
+                        ret[worker.in_flight.front()].reset(new EvalStatsExtern(score));
+                        worker.in_flight.pop_front();
+                        num_done++;
+                        worker.last_active = CurrentSeconds();
+                    }
+                } else if(num_read == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    failure = "exited";
+                }
+            }
+            if(!failure && timeout_ > 0 && worker.in_flight.size() && CurrentSeconds() - worker.last_active > timeout_)
+                failure = "timed out";
+            // Restart failed workers, and send their lines again. The first
+            // line is the one the program was working on, and is given up
+            // on if it keeps failing.
+            if(failure) {
+                cerr << "External measure " << run_ << " " << failure << ", restarting" << endl;
+                if(worker.in_flight.size() && ++fails[worker.in_flight.front()] >= EXTERN_MAX_FAILS)
+                    THROW_ERROR("External measure " << run_ << " failed " << EXTERN_MAX_FAILS << " times on: " << lines[worker.in_flight.front()]);
+                todo.insert(todo.begin(), worker.in_flight.begin(), worker.in_flight.end());
+                StopWorker(worker, true);
+                StartWorker(worker);
+            }
+        }
+    }
+    return ret;
 }
 
 // Read in the stats
@@ -4,8 +4,8 @@
 #include <lamtram/sentence.h>
 #include <lamtram/eval-measure.h>
 #include <dynet/dict.h>
-#include <boost/iostreams/device/file_descriptor.hpp>
-#include <boost/iostreams/stream.hpp>
+#include <sys/types.h>
+#include <deque>
 #include <vector>
 
 namespace lamtram {
@@ -24,23 +24,61 @@ public:
 
 };
 
+// Scores sentences with an external program. Each line sent to the program
+// is "system output ||| reference", and it answers each with a line holding
+// the score, in order. The program is run as a pool of workers (workers=N),
+// and up to pipeline=N lines are sent to each one before its answers are
+// read, so the programs are never left waiting. A worker that exits or does
+// not answer within timeout=SECONDS is restarted and its lines are resent.
 class EvalMeasureExtern : public EvalMeasure {
 
 public:
 
     EvalMeasureExtern(const std::string & str, const dynet::Dict & vocab);
+    ~EvalMeasureExtern();
 
     // Calculate the stats for a single sentence
     virtual std::shared_ptr<EvalStats> CalculateStats(
                 const Sentence & ref,
                 const Sentence & sys) const;
 
+    // Calculate the stats of many sentences with the pool of workers. The
+    // number of threads is ignored, as the workers run in parallel.
+    virtual std::vector<EvalStatsPtr> CalculateStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                int num_threads = 1) const;
+
     // Calculate the stats for a single sentence
     virtual EvalStatsPtr ReadStats(
                 const std::string & file);
 
+    // The workers are shared, so only one batch can be sent at a time
+    virtual bool IsThreadSafe() const { return false; }
+
 protected:
 
+    // One running copy of the external program
+    struct ExternWorker {
+        ExternWorker() : pid(-1), to_fd(-1), from_fd(-1), last_active(0) { }
+        pid_t pid;
+        // The ends of the pipes to its stdin and from its stdout
+        int to_fd, from_fd;
+        // Text waiting to be written, and a partly read line
+        std::string to_buf, from_buf;
+        // The ids of the lines sent but not yet answered, in order
+        std::deque<int> in_flight;
+        // The time of the last answer or write, in seconds
+        double last_active;
+    };
+
+    // Start and stop the program of a worker
+    void StartWorker(ExternWorker & worker) const;
+    void StopWorker(ExternWorker & worker, bool kill_worker) const;
+
+    // The line sent to the program for a sentence
+    std::string MakeLine(const Sentence & ref, const Sentence & sys) const;
+
     // Target vocabulary to generate sys/ref strings
     const dynet::Dict & vocab_;
 
@@ -51,11 +89,13 @@ protected:
     // measures aren't expecting it.
     bool eos_;
 
-    // External measure child process communication
-    std::shared_ptr<boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_sink>> to_child_buffer_;
-    std::shared_ptr<boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_source>> from_child_buffer_;
-    std::shared_ptr<std::ostream> to_child_;
-    std::shared_ptr<std::istream> from_child_;
+    // The number of workers, the lines sent to each before reading, and the
+    // seconds to wait for an answer (0 to wait forever)
+    int num_workers_, pipeline_;
+    float timeout_;
+
+    // External measure child processes
+    mutable std::vector<ExternWorker> workers_;
 
 };
 
@@ -79,6 +79,49 @@ EvalStatsPtr EvalMeasureInterp::CalculateStats(const Sentence & ref, const Sente
     return EvalStatsPtr(new EvalStatsInterp(stats, coeffs_));
 }
 
+bool EvalMeasureInterp::IsThreadSafe() const {
+    for(const std::shared_ptr<EvalMeasure> & meas : measures_)
+        if(!meas->IsThreadSafe())
+            return false;
+    return true;
+}
+
+std::vector<EvalStatsPtr> EvalMeasureInterp::CalculateStatsBatch(
+            const std::vector<const Sentence*> & refs, const std::vector<const Sentence*> & syss, int num_threads) const {
+    vector<vector<EvalStatsPtr> > meas_stats;
+    for(const std::shared_ptr<EvalMeasure> & meas : measures_)
+        meas_stats.push_back(meas->CalculateStatsBatch(refs, syss, num_threads));
+    vector<EvalStatsPtr> ret(refs.size());
+    for(size_t i = 0; i < refs.size(); i++) {
+        vector<EvalStatsPtr> stats;
+        for(const vector<EvalStatsPtr> & ms : meas_stats)
+            stats.push_back(ms[i]);
+        ret[i].reset(new EvalStatsInterp(stats, coeffs_));
+    }
+    return ret;
+}
+
+std::vector<EvalStatsPtr> EvalMeasureInterp::CalculateCachedStatsBatch(
+            const std::vector<const Sentence*> & refs, const std::vector<const Sentence*> & syss,
+            const std::vector<int> & ref_cache_ids, int num_threads) {
+    vector<vector<EvalStatsPtr> > meas_stats;
+    for(std::shared_ptr<EvalMeasure> & meas : measures_)
+        meas_stats.push_back(meas->CalculateCachedStatsBatch(refs, syss, ref_cache_ids, num_threads));
+    vector<EvalStatsPtr> ret(refs.size());
+    for(size_t i = 0; i < refs.size(); i++) {
+        vector<EvalStatsPtr> stats;
+        for(const vector<EvalStatsPtr> & ms : meas_stats)
+            stats.push_back(ms[i]);
+        ret[i].reset(new EvalStatsInterp(stats, coeffs_));
+    }
+    return ret;
+}
+
+void EvalMeasureInterp::ClearCache() {
+    for(std::shared_ptr<EvalMeasure> & meas : measures_)
+        meas->ClearCache();
+}
+
 EvalStatsPtr EvalMeasureInterp::CalculateCachedStats(
             const std::vector<Sentence> & refs, const std::vector<Sentence> & syss, int ref_cache_id, int sys_cache_id) {
     typedef std::shared_ptr<EvalMeasure> EvalMeasPtr;
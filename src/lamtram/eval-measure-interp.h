@@ -61,10 +61,26 @@ public:
                 int ref_cache_id = INT_MAX,
                 int sys_cache_id = INT_MAX);
 
+    // Calculate the stats of each measure over the whole batch, so measures
+    // with their own batch processing keep it
+    virtual std::vector<EvalStatsPtr> CalculateStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                int num_threads = 1) const;
+    virtual std::vector<EvalStatsPtr> CalculateCachedStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                const std::vector<int> & ref_cache_ids,
+                int num_threads = 1);
+
     // Calculate the stats for a single sentence
     virtual EvalStatsPtr ReadStats(
                 const std::string & file);
 
+    virtual bool IsThreadSafe() const;
+
+    virtual void ClearCache();
+
 protected:
     std::vector<std::shared_ptr<EvalMeasure> > measures_;
     std::vector<float> coeffs_;
@@ -2,6 +2,7 @@
 #include <lamtram/eval-measure-ribes.h>
 #include <lamtram/macros.h>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <cmath>
 
 using namespace std;
@@ -23,63 +24,73 @@ std::shared_ptr<EvalStats> EvalMeasureRibes::CalculateStats(const Sentence & ref
     float bp = min(1.0, exp(1.0 - 1.0 * ref.size()/sys.size())); 
     
     // determine which ref. word corresponds to each sysothesis word
-    // list for ref. word indices
-    vector<int> intlist;
+    // list for ref. word indices. The buffers are kept between calls on
+    // each thread.
+    static thread_local vector<int> intlist, left_ref, left_sys, right_ref, right_sys;
+    static thread_local vector<pair<WordId,int> > ref_count, sys_count;
+    intlist.clear();
     
-    // Find the positions of each word in each of the sentences
-    std::unordered_map<WordId, vector<int> > ref_count, sys_count;
+    // Find the positions of each word in each of the sentences, sorted by
+    // word and then position
+    ref_count.resize(ref.size());
     for(int i = 0; i < (int)ref.size(); i++)
-        ref_count[ref[i]].push_back(i);
+        ref_count[i] = make_pair(ref[i], i);
+    sort(ref_count.begin(), ref_count.end());
+    sys_count.resize(sys.size());
     for(int i = 0; i < (int)sys.size(); i++)
-        sys_count[sys[i]].push_back(i);
+        sys_count[i] = make_pair(sys[i], i);
+    sort(sys_count.begin(), sys_count.end());
+    typedef vector<pair<WordId,int> >::const_iterator PosIter;
+    auto find_word = [](const vector<pair<WordId,int> > & counts, WordId wid) {
+        return equal_range(counts.begin(), counts.end(), make_pair(wid, 0),
+                           [](const pair<WordId,int> & a, const pair<WordId,int> & b) { return a.first < b.first; });
+    };
+    auto assign_pos = [](vector<int> & pos, const pair<PosIter,PosIter> & range) {
+        pos.clear();
+        for(auto it = range.first; it != range.second; ++it)
+            pos.push_back(it->second);
+    };
     
     for(int i = 0; i < (int)sys.size(); i++) {
         // If sys[i] doesn't exist in the reference, go to the next word
-        if(ref_count.find(sys[i]) == ref_count.end())
+        auto ref_match = find_word(ref_count, sys[i]);
+        if(ref_match.first == ref_match.second)
             continue;
         // Get matched words
-        const vector<int> & ref_match = ref_count[sys[i]];
-        const vector<int> & sys_match = sys_count[sys[i]];
+        auto sys_match = find_word(sys_count, sys[i]);
 
         // if we can determine one-to-one word correspondence by only unigram
         // one-to-one correspondence
-        if (ref_match.size() == 1 && sys_match.size() == 1) {
-            intlist.push_back(ref_match[0]);
+        if (ref_match.second - ref_match.first == 1 && sys_match.second - sys_match.first == 1) {
+            intlist.push_back(ref_match.first->second);
         // if not, we consider context words
         } else {
-            // These vectors store all hypotheses that are still matching on the right or left
-            vector<int> left_ref = ref_match, left_sys = sys_match,
-                        right_ref = ref_match, right_sys = sys_match;
+            // These vectors store all hypotheses that are still matching on
+            // the right or left, and are filtered in place
+            assign_pos(left_ref, ref_match); assign_pos(left_sys, sys_match);
+            assign_pos(right_ref, ref_match); assign_pos(right_sys, sys_match);
             for(int window = 1; window < max(i, (int)sys.size()-i); window++) {
                 // Update the possible hypotheses on the left
                 if(window <= i) {
-                    vector<int> new_left_ref, new_left_sys;
-                    for(int j : left_ref)
-                        if(window <= j && ref[j-window] == sys[i-window])
-                            new_left_ref.push_back(j);
-                    for(int j : left_sys)
-                        if(window <= j && sys[j-window] == sys[i-window])
-                            new_left_sys.push_back(j);
-                    if(new_left_ref.size() == 1 && new_left_sys.size() == 1) {
-                        intlist.push_back(new_left_ref[0]);
+                    left_ref.erase(remove_if(left_ref.begin(), left_ref.end(),
+                        [&](int j) { return !(window <= j && ref[j-window] == sys[i-window]); }), left_ref.end());
+                    left_sys.erase(remove_if(left_sys.begin(), left_sys.end(),
+                        [&](int j) { return !(window <= j && sys[j-window] == sys[i-window]); }), left_sys.end());
+                    if(left_ref.size() == 1 && left_sys.size() == 1) {
+                        intlist.push_back(left_ref[0]);
                         break;
                     }
-                    left_ref = new_left_ref; left_sys = new_left_sys;
                 }
                 // Update the possible hypotheses on the right
                 if(i+window < (int)sys.size()) {
-                    vector<int> new_right_ref, new_right_sys;
-                    for(int j : right_ref)
-                        if(j+window < (int)ref.size() && ref[j+window] == sys[i+window])
-                            new_right_ref.push_back(j);
-                    for(int j : right_sys)
-                        if(j+window < (int)sys.size() && sys[j+window] == sys[i+window])
-                            new_right_sys.push_back(j);
-                    if(new_right_ref.size() == 1 && new_right_sys.size() == 1) {
-                        intlist.push_back(new_right_ref[0]);
+                    right_ref.erase(remove_if(right_ref.begin(), right_ref.end(),
+                        [&](int j) { return !(j+window < (int)ref.size() && ref[j+window] == sys[i+window]); }), right_ref.end());
+                    right_sys.erase(remove_if(right_sys.begin(), right_sys.end(),
+                        [&](int j) { return !(j+window < (int)sys.size() && sys[j+window] == sys[i+window]); }), right_sys.end());
+                    if(right_ref.size() == 1 && right_sys.size() == 1) {
+                        intlist.push_back(right_ref[0]);
                         break;
                     }
-                    right_ref = new_right_ref; right_sys = new_right_sys;
                 }
             }
         }
@@ -2,27 +2,74 @@
 #include <lamtram/eval-measure-wer.h>
 #include <lamtram/macros.h>
 #include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <cstdint>
 
 using namespace std;
 using namespace lamtram;
 using namespace boost;
 
-// Calculate Levenshtein Distance
+// Calculate Levenshtein Distance with the bit-parallel algorithm of Myers
+// (1999), in the blocked form of Hyyro (2003). Each 64-bit word holds the
+// vertical deltas (+1/-1) of 64 rows of the DP table over the reference,
+// so one column of the table is calculated with a few word operations per
+// block. The scratch space is kept between calls on each thread.
 int EvalMeasureWer::EditDistance(const Sentence & ref, const Sentence & sys) const {
-    int rs = ref.size()+1, ss = sys.size()+1;
-    vector<int> dists(rs*ss);
-    for(int i = 0; i < rs; i++)
-        dists[i*ss] = i;
-    for(int j = 1; j < ss; j++)
-        dists[j] = j;
-    for(int i = 1; i < rs; i++)
-        for(int j = 1; j < ss; j++) {
-            dists[i*ss+j] =
-                min(
-                    min(dists[(i-1)*ss+j]+1, dists[i*ss+j-1]+1),
-                    dists[(i-1)*ss+j-1] + (ref[i-1] == sys[j-1] ? 0 : 1));
+    int m = ref.size(), n = sys.size();
+    if(m == 0 || n == 0)
+        return m + n;
+    int num_blocks = (m + 63) / 64;
+    // The match masks of each distinct word in the reference. Word IDs are
+    // indices into the vocabulary, so the mask of each word is found in a
+    // table indexed by ID, which is reset to -1 after use.
+    static thread_local vector<int> word_masks;
+    static thread_local vector<uint64_t> peq, pv, mv;
+    peq.clear();
+    for(int i = 0; i < m; i++) {
+        if(ref[i] >= (int)word_masks.size())
+            word_masks.resize(ref[i]+1, -1);
+        int & mask = word_masks[ref[i]];
+        if(mask < 0) {
+            mask = peq.size();
+            peq.resize(mask + num_blocks, 0);
         }
-    return dists[rs*ss-1];
+        peq[mask + i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    // The first column is 0..m, so all vertical deltas are +1
+    pv.assign(num_blocks, ~(uint64_t)0);
+    mv.assign(num_blocks, 0);
+    const uint64_t last_bit = (uint64_t)1 << ((m - 1) % 64);
+    int score = m;
+    for(int j = 0; j < n; j++) {
+        int mask = (sys[j] < (int)word_masks.size() ? word_masks[sys[j]] : -1);
+        const uint64_t * eqs = (mask >= 0 ? &peq[mask] : nullptr);
+        // The first row is 0..n, so the horizontal delta entering the top
+        // block is +1
+        int hin = 1;
+        for(int b = 0; b < num_blocks; b++) {
+            uint64_t eq = (eqs ? eqs[b] : 0), p = pv[b], mm = mv[b];
+            uint64_t hin_neg = (hin < 0 ? 1 : 0), hin_pos = (hin > 0 ? 1 : 0);
+            uint64_t xv = eq | mm;
+            eq |= hin_neg;
+            uint64_t xh = (((eq & p) + p) ^ p) | eq;
+            uint64_t ph = mm | ~(xh | p);
+            uint64_t mh = p & xh;
+            if(b == num_blocks - 1) {
+                // Only the row of the last reference word is needed
+                if(ph & last_bit) score++;
+                else if(mh & last_bit) score--;
+            } else {
+                hin = (int)(ph >> 63) - (int)(mh >> 63);
+            }
+            ph = (ph << 1) | hin_pos;
+            mh = (mh << 1) | hin_neg;
+            pv[b] = mh | ~(xv | ph);
+            mv[b] = ph & xv;
+        }
+    }
+    for(WordId wid : ref)
+        word_masks[wid] = -1;
+    return score;
 }
 
 // Measure the score of the sys output according to the ref
@@ -40,6 +40,7 @@ public:
 
 protected:
 
+    // The Levenshtein distance between ref and sys
     int EditDistance(const Sentence & ref, const Sentence & sys) const;
     
     // WER is better when it is lower, so for tuning we want to be able to
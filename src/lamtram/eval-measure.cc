@@ -4,6 +4,7 @@
 #include <boost/algorithm/string.hpp>
 
 #include <fstream>
+#include <future>
 #include <map>
 #include <math.h>
 
@@ -103,3 +104,30 @@ vector<EvalMeasure::StringPair> EvalMeasure::ParseConfig(const string & str) {
     }
     return ret;
 }
+
+void EvalMeasure::RunBatch(size_t size, int num_threads, const std::function<void(size_t)> & func) const {
+    // Each thread takes every num_threads'th item, so long and short
+    // sentences are spread evenly
+    auto run_range = [&](size_t start, size_t step) {
+        for(size_t i = start; i < size; i += step)
+            func(i);
+    };
+    if(!IsThreadSafe()) num_threads = 1;
+    num_threads = max(1, min(num_threads, (int)size));
+    vector<std::future<void> > futures;
+    for(int t = 1; t < num_threads; t++)
+        futures.push_back(std::async(std::launch::async, run_range, t, num_threads));
+    run_range(0, num_threads);
+    for(auto & f : futures) f.get();
+}
+
+std::vector<EvalStatsPtr> EvalMeasure::CalculateStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                int num_threads) const {
+    if(refs.size() != syss.size())
+        THROW_ERROR("Mismatched number of references and outputs in CalculateStatsBatch: " << refs.size() << " != " << syss.size());
+    vector<EvalStatsPtr> ret(refs.size());
+    RunBatch(refs.size(), num_threads, [&](size_t i) { ret[i] = CalculateStats(*refs[i], *syss[i]); });
+    return ret;
+}
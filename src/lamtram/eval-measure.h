@@ -4,6 +4,7 @@
 #include <lamtram/sentence.h>
 #include <cfloat>
 #include <climits>
+#include <functional>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -110,6 +111,24 @@ public:
         return CalculateCachedStats(refs[factor_],syss[factor_],ref_cache_id,sys_cache_id);
     }
 
+    // Calculate the stats of each pair (*refs[i], *syss[i]), spreading the
+    // pairs over up to num_threads threads if the measure is thread safe
+    virtual std::vector<EvalStatsPtr> CalculateStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                int num_threads = 1) const;
+
+    // Calculate the stats like CalculateStatsBatch, with refs[i] cached as
+    // ref_cache_ids[i] so that references scored against several outputs
+    // are only processed once
+    virtual std::vector<EvalStatsPtr> CalculateCachedStatsBatch(
+                const std::vector<const Sentence*> & refs,
+                const std::vector<const Sentence*> & syss,
+                const std::vector<int> & ref_cache_ids,
+                int num_threads = 1) {
+        return CalculateStatsBatch(refs, syss, num_threads);
+    }
+
     // Calculate the stats for a single sentence
     virtual EvalStatsPtr ReadStats(
                 const std::string & file) = 0;
@@ -120,8 +139,15 @@ public:
     // Clear the cache
     virtual void ClearCache() { }
 
+    // Whether CalculateStats() can be called from several threads at once
+    virtual bool IsThreadSafe() const { return true; }
+
 protected:
 
+    // Call func(i) for each i < size, spread over up to num_threads threads
+    // if the measure is thread safe
+    void RunBatch(size_t size, int num_threads, const std::function<void(size_t)> & func) const;
+
     // Which factore to calculate over
     int factor_;
 
@@ -20,6 +20,10 @@ public:
     virtual void InitializeSentence(const Sentence & sent, bool train, dynet::ComputationGraph & cg) { }
     virtual void InitializeSentence(const std::vector<Sentence> & sent, bool train, dynet::ComputationGraph & cg) { }
 
+    // Select which of the initialized sentences each element of the batch
+    // passed to subsequent calls to CreateContext corresponds to
+    virtual void SelectBatch(const std::vector<unsigned> & ids) { }
+
     // Create a variable encoding the context
     virtual dynet::Expression CreateContext(
         // const Sentence & sent, int loc,
@@ -1,16 +1,18 @@
 #pragma once
 
-// TODO: Could probably do much better here
+#include <cstdint>
+#include <vector>
+
 namespace std {
+  // Mix in one element at a time with a multiplicative hash, rather than
+  // one byte at a time
   template <class T> struct hash<std::vector<T> > {
     size_t operator()(const std::vector<T>  & x) const
     {
-      size_t hash = 5381;
-      const char* c = (const char*)&x[0];
-      const char* end = (const char*)&x[x.size()];
-      while(c != end)
-        hash = ((hash << 5) + hash) + *(c++);
-      return hash;
+      uint64_t hash = x.size();
+      for(const T & val : x)
+        hash = (hash ^ (uint64_t)std::hash<T>()(val)) * 0x9e3779b97f4a7c15ULL;
+      return (size_t)(hash ^ (hash >> 32));
     }
   };
   template <class T1, class T2> struct hash<std::pair<T1,T2> > {
@@ -0,0 +1,8 @@
+#include <lamtram/lamtram-binarize.h>
+
+using namespace lamtram;
+
+int main(int argc, char** argv) {
+    LamtramBinarize binarize;
+    return binarize.main(argc, argv);
+}
@@ -0,0 +1,58 @@
+#include <lamtram/lamtram-binarize.h>
+#include <lamtram/binary-corpus.h>
+#include <lamtram/macros.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/string-util.h>
+#include <lamtram/timer.h>
+#include <boost/program_options.hpp>
+#include <dynet/dict.h>
+#include <iostream>
+#include <memory>
+
+using namespace std;
+using namespace lamtram;
+namespace po = boost::program_options;
+
+int LamtramBinarize::main(int argc, char** argv) {
+  po::options_description desc("*** lamtram-binarize (by Graham Neubig) ***");
+  desc.add_options()
+    ("help", "Produce help message")
+    ("train_trg", po::value<string>()->default_value(""), "Training files, possibly separated by pipes")
+    ("train_src", po::value<string>()->default_value(""), "Training source files for TMs, possibly separated by pipes")
+    ("wildcards", po::value<string>()->default_value(""), "Wildcards to be used in loading training files")
+    ("bin_out", po::value<string>()->default_value(""), "Prefix of the binarized corpus, PREFIX.trg and PREFIX.src will be written")
+    ;
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);   
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 1;
+  }
+
+  vector<string> wildcards = Tokenize(vm["wildcards"].as<string>(), "|");
+  vector<string> files_trg, files_src;
+  if(vm["train_trg"].as<string>() != "")
+    files_trg = TokenizeWildcarded(vm["train_trg"].as<string>(), wildcards, "|");
+  if(vm["train_src"].as<string>() != "")
+    files_src = TokenizeWildcarded(vm["train_src"].as<string>(), wildcards, "|");
+  string bin_out = vm["bin_out"].as<string>();
+  if(!files_trg.size())
+    THROW_ERROR("Must specify a training file with --train_trg");
+  if(files_src.size() && files_src.size() != files_trg.size())
+    THROW_ERROR("The number of source and target training files must be the same");
+  if(bin_out == "")
+    THROW_ERROR("Must specify an output prefix with --bin_out");
+
+  Timer time;
+  DictPtr vocab_trg(CreateNewDict());
+  BinaryCorpus::Binarize(files_trg, true, *vocab_trg, bin_out + ".trg");
+  cerr << "Wrote " << bin_out << ".trg, vocab=" << vocab_trg->size() << ", time=" << time.Elapsed() << endl;
+  if(files_src.size()) {
+    DictPtr vocab_src(CreateNewDict());
+    BinaryCorpus::Binarize(files_src, false, *vocab_src, bin_out + ".src");
+    cerr << "Wrote " << bin_out << ".src, vocab=" << vocab_src->size() << ", time=" << time.Elapsed() << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+namespace lamtram {
+
+// Convert text training corpora into the binary format read by
+// lamtram-train --train_bin
+class LamtramBinarize {
+
+public:
+  LamtramBinarize() { }
+
+  int main(int argc, char** argv);
+
+};
+
+}
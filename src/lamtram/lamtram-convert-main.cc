@@ -0,0 +1,11 @@
+
+#include <lamtram/lamtram-convert.h>
+#include <dynet/init.h>
+
+using namespace lamtram;
+
+int main(int argc, char** argv) {
+    dynet::initialize(argc, argv);
+    LamtramConvert convert;
+    return convert.main(argc, argv);
+}
@@ -0,0 +1,184 @@
+#include <lamtram/lamtram-convert.h>
+#include <lamtram/macros.h>
+#include <lamtram/model-utils.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/neural-lm.h>
+#include <lamtram/encoder-decoder.h>
+#include <lamtram/encoder-attentional.h>
+#include <lamtram/encoder-classifier.h>
+#include <lamtram/ensemble-decoder.h>
+#include <lamtram/eval-measure-bleu.h>
+#include <boost/program_options.hpp>
+#include <dynet/model.h>
+#include <dynet/dict.h>
+#include <iostream>
+#include <fstream>
+#include <memory>
+
+using namespace std;
+using namespace lamtram;
+namespace po = boost::program_options;
+
+// Create a decoder for a single model
+typedef shared_ptr<EnsembleDecoder> EnsembleDecoderPtr;
+inline EnsembleDecoderPtr CreateDecoder(const shared_ptr<EncoderDecoder> & model) {
+  return EnsembleDecoderPtr(new EnsembleDecoder(vector<EncoderDecoderPtr>(1, model), vector<EncoderAttentionalPtr>(), vector<NeuralLMPtr>()));
+}
+inline EnsembleDecoderPtr CreateDecoder(const shared_ptr<EncoderAttentional> & model) {
+  return EnsembleDecoderPtr(new EnsembleDecoder(vector<EncoderDecoderPtr>(), vector<EncoderAttentionalPtr>(1, model), vector<NeuralLMPtr>()));
+}
+inline EnsembleDecoderPtr CreateDecoder(const shared_ptr<NeuralLM> & model) {
+  return EnsembleDecoderPtr(new EnsembleDecoder(vector<EncoderDecoderPtr>(), vector<EncoderAttentionalPtr>(), vector<NeuralLMPtr>(1, model)));
+}
+inline EnsembleDecoderPtr CreateDecoder(const shared_ptr<EncoderClassifier> & model) {
+  THROW_ERROR("Evaluating converted models is not supported for classifiers");
+}
+
+// Read one sentence per line
+inline vector<Sentence> LoadSents(const string & file, dynet::Dict & vocab, bool add_end) {
+  ifstream in(file);
+  if(!in) THROW_ERROR("Could not open evaluation file: " << file);
+  vector<Sentence> ret;
+  string line;
+  while(getline(in, line))
+    ret.push_back(ParseWords(vocab, line, add_end));
+  return ret;
+}
+
+// Remove the sentence end, if any
+inline Sentence StripEnd(Sentence sent) {
+  if(sent.size() && *sent.rbegin() == 0) sent.pop_back();
+  return sent;
+}
+
+void LamtramConvert::CompareModels(EnsembleDecoder & orig, EnsembleDecoder & conv, int vocab_size,
+                                   const vector<Sentence> & srcs, const vector<Sentence> & trgs,
+                                   bool translate, const string & format) {
+  if(srcs.size() != trgs.size())
+    THROW_ERROR("Evaluation source and target sizes don't match: " << srcs.size() << " != " << trgs.size());
+  // Evaluate the converted model with the kernels that "lamtram --graph_free
+  // true --quantize" runs, and the original one with the same code in float
+  string quant = (format == "int8" || format == "fp16" ? format : "float");
+  if(conv.SetGraphFree(true, quant)) {
+    orig.SetGraphFree(true, "float");
+    cerr << "Comparing with --graph_free true: original with --quantize float, converted with --quantize " << quant << endl;
+  } else {
+    cerr << "WARNING: --graph_free does not support this model, so it can't be decoded with --quantize. "
+         << "Comparing with computation graphs over the stored weights converted back to float, which doesn't quantize the inputs like --quantize int8 does" << endl;
+  }
+  EnsembleDecoder* decoders[2] = {&orig, &conv};
+  const char* names[2] = {"original", "converted"};
+  float ppls[2], bleus[2];
+  EvalMeasureBleu bleu;
+  for(int i = 0; i < 2; i++) {
+    LLStats ll(vocab_size);
+    vector<float> word_lls;
+    for(size_t j = 0; j < trgs.size(); j++)
+      decoders[i]->CalcSentLL<Sentence,LLStats,vector<float> >(srcs[j], trgs[j], ll, word_lls);
+    ppls[i] = ll.CalcPPL();
+    cerr << names[i] << ": ppl=" << ppls[i];
+    if(translate) {
+      EvalStatsPtr stats;
+      for(size_t j = 0; j < srcs.size(); j++) {
+        EnsembleDecoderHypPtr hyp = decoders[i]->Generate(srcs[j]);
+        EvalStatsPtr sent_stats = bleu.CalculateStats(StripEnd(trgs[j]), hyp.get() ? StripEnd(hyp->GetSentence()) : Sentence());
+        if(stats.get() == nullptr) stats = sent_stats;
+        else stats->PlusEquals(*sent_stats);
+      }
+      bleus[i] = (stats.get() != nullptr ? stats->ConvertToScore() : 0.f);
+      cerr << ", bleu=" << bleus[i];
+    }
+    cerr << endl;
+  }
+  cerr << "delta: ppl=" << ppls[1] - ppls[0];
+  if(translate) cerr << ", bleu=" << bleus[1] - bleus[0];
+  cerr << endl;
+}
+
+template <class ModelType>
+void LamtramConvert::ConvertBilingual(const string & file_in, const string & file_out, const string & format) {
+  shared_ptr<dynet::Model> mod;
+  DictPtr vocab_src, vocab_trg;
+  shared_ptr<ModelType> model(ModelUtils::LoadBilingualModel<ModelType>(file_in, mod, vocab_src, vocab_trg));
+  ofstream out(file_out);
+  if(!out) THROW_ERROR("Could not open output file: " << file_out);
+  WriteDict(*vocab_src, out);
+  WriteDict(*vocab_trg, out);
+  model->Write(out);
+  ModelUtils::WriteModel(out, *mod, format);
+  out.close();
+  if(eval_trg_ != "") {
+    shared_ptr<dynet::Model> conv_mod;
+    DictPtr conv_src, conv_trg;
+    shared_ptr<ModelType> conv_model(ModelUtils::LoadBilingualModel<ModelType>(file_out, conv_mod, conv_src, conv_trg));
+    CompareModels(*CreateDecoder(model), *CreateDecoder(conv_model), vocab_trg->size(),
+                  LoadSents(eval_src_, *vocab_src, false), LoadSents(eval_trg_, *vocab_trg, true), true, format);
+  }
+}
+
+template <class ModelType>
+void LamtramConvert::ConvertMonolingual(const string & file_in, const string & file_out, const string & format) {
+  shared_ptr<dynet::Model> mod;
+  DictPtr vocab_trg;
+  shared_ptr<ModelType> model(ModelUtils::LoadMonolingualModel<ModelType>(file_in, mod, vocab_trg));
+  ofstream out(file_out);
+  if(!out) THROW_ERROR("Could not open output file: " << file_out);
+  WriteDict(*vocab_trg, out);
+  model->Write(out);
+  ModelUtils::WriteModel(out, *mod, format);
+  out.close();
+  if(eval_trg_ != "") {
+    shared_ptr<dynet::Model> conv_mod;
+    DictPtr conv_trg;
+    shared_ptr<ModelType> conv_model(ModelUtils::LoadMonolingualModel<ModelType>(file_out, conv_mod, conv_trg));
+    vector<Sentence> trgs = LoadSents(eval_trg_, *vocab_trg, true);
+    CompareModels(*CreateDecoder(model), *CreateDecoder(conv_model), vocab_trg->size(),
+                  vector<Sentence>(trgs.size()), trgs, false, format);
+  }
+}
+
+int LamtramConvert::main(int argc, char** argv) {
+  po::options_description desc("*** lamtram-convert (by Graham Neubig) ***");
+  desc.add_options()
+    ("help", "Produce help message")
+    ("model_in", po::value<string>()->default_value(""), "Model file to read, in format \"{encdec,encatt,enccls,nlm}=filename\"")
+    ("model_out", po::value<string>()->default_value(""), "File to write the converted model to")
+    ("model_format", po::value<string>()->default_value("binary"), "Format to write the model parameters in (text/binary/int8/fp16), where int8 and fp16 store the weight matrices in binary with reduced precision (they are converted back to float when loaded, and only \"lamtram --graph_free true --quantize\" multiplies with them at that precision)")
+    ("eval_src", po::value<string>()->default_value(""), "Source sentences to compare the BLEU of the original and converted translation models on")
+    ("eval_trg", po::value<string>()->default_value(""), "Target sentences to compare the perplexity (and BLEU) of the original and converted models on")
+    ;
+  po::variables_map vm;
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);   
+  if (vm.count("help")) {
+    cout << desc << endl;
+    return 1;
+  }
+
+  string model_in = vm["model_in"].as<string>(), model_out = vm["model_out"].as<string>();
+  string format = vm["model_format"].as<string>();
+  if(model_out == "")
+    THROW_ERROR("Must specify a model output file with --model_out");
+  if(format != "text" && format != "binary" && format != "int8" && format != "fp16")
+    THROW_ERROR("Model format must be text, binary, int8 or fp16, but got: " << format);
+  eval_src_ = vm["eval_src"].as<string>();
+  eval_trg_ = vm["eval_trg"].as<string>();
+  size_t eqpos = model_in.find('=');
+  if(eqpos == string::npos)
+    THROW_ERROR("Bad model type. Must specify encdec=, encatt=, enccls=, or nlm= before model name." << endl << model_in);
+  string type = model_in.substr(0, eqpos), file = model_in.substr(eqpos+1);
+
+  if(type == "encdec") {
+    ConvertBilingual<EncoderDecoder>(file, model_out, format);
+  } else if(type == "encatt") {
+    ConvertBilingual<EncoderAttentional>(file, model_out, format);
+  } else if(type == "enccls") {
+    ConvertBilingual<EncoderClassifier>(file, model_out, format);
+  } else if(type == "nlm") {
+    ConvertMonolingual<NeuralLM>(file, model_out, format);
+  } else {
+    THROW_ERROR("Bad model type. Must specify encdec=, encatt=, enccls=, or nlm= before model name." << endl << model_in);
+  }
+
+  return 0;
+}
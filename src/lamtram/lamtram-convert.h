@@ -0,0 +1,39 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+class EnsembleDecoder;
+
+class LamtramConvert {
+
+public:
+  LamtramConvert() { }
+
+  int main(int argc, char** argv);
+
+protected:
+
+  // Load a model of a particular type and write it in the specified format
+  template <class ModelType>
+  void ConvertBilingual(const std::string & file_in, const std::string & file_out, const std::string & format);
+  template <class ModelType>
+  void ConvertMonolingual(const std::string & file_in, const std::string & file_out, const std::string & format);
+
+  // Report the perplexity (and BLEU if translate) on the evaluation data
+  // with the original and converted models, and their difference. If the
+  // models can be decoded without graphs, the converted one is evaluated
+  // with the weights multiplied at the precision of format
+  void CompareModels(EnsembleDecoder & orig, EnsembleDecoder & conv, int vocab_size,
+                     const std::vector<Sentence> & srcs, const std::vector<Sentence> & trgs,
+                     bool translate, const std::string & format);
+
+  // Files to evaluate the converted model on
+  std::string eval_src_, eval_trg_;
+
+};
+
+}
@@ -1,11 +1,22 @@
-
 #include <lamtram/lamtram-train.h>
 #include <dynet/init.h>
+#include <cstdlib>
+#include <string>
 
 using namespace lamtram;
 
 int main(int argc, char** argv) {
-    dynet::initialize(argc, argv);
+    // Training with several workers needs the parameters in shared memory
+    bool shared_parameters = false;
+    const std::string opt = "--train_workers";
+    for(int i = 1; i < argc; i++) {
+      std::string arg(argv[i]);
+      if(arg == opt && i+1 < argc)
+        shared_parameters = (atoi(argv[i+1]) > 1);
+      else if(arg.compare(0, opt.size()+1, opt + "=") == 0)
+        shared_parameters = (atoi(arg.c_str() + opt.size()+1) > 1);
+    }
+    dynet::initialize(argc, argv, shared_parameters);
     LamtramTrain train;
     return train.main(argc, argv);
 }
@@ -11,6 +11,10 @@
 #include <lamtram/loss-stats.h>
 #include <lamtram/eval-measure.h>
 #include <lamtram/eval-measure-loader.h>
+#include <lamtram/bilingual-stream.h>
+#include <lamtram/binary-corpus.h>
+#include <lamtram/checkpoint-writer.h>
+#include <lamtram/async-evaluator.h>
 #include <dynet/dynet.h>
 #include <dynet/dict.h>
 #include <dynet/globals.h>
@@ -21,6 +25,9 @@
 #include <boost/algorithm/string.hpp>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
 #include <string>
 
 using namespace std;
@@ -36,6 +43,8 @@ int LamtramTrain::main(int argc, char** argv) {
     ("dev_trg", po::value<string>()->default_value(""), "Development files")
     ("train_src", po::value<string>()->default_value(""), "Training source files for TMs, possibly separated by pipes")
     ("dev_src", po::value<string>()->default_value(""), "Development source file for TMs")
+    ("dev_minibatch_size", po::value<int>()->default_value(-1), "Number of words per mini-batch when evaluating the development set (-1 for the same as minibatch_size)")
+    ("dev_workers", po::value<int>()->default_value(0), "If larger than zero, evaluate the development set in this many forked processes against a copy of the parameters while training continues, updating the learning rate and best model when the results arrive (CPU ml training only)")
     ("model_out", po::value<string>()->default_value(""), "File to write the model to")
     ("model_type", po::value<string>()->default_value("nlm"), "Model type (Neural LM nlm, Encoder Decoder encdec, Attentional Model encatt, or Encoder Classifier enccls)")
     ("layer_size", po::value<int>()->default_value(512), "The default size of all hidden layers (word rep, hidden state, mlp attention, mlp softmax) if not specified otherwise")
@@ -44,6 +53,8 @@ int LamtramTrain::main(int argc, char** argv) {
     ("attention_lex", po::value<string>()->default_value("none"), "Use a lexicon (e.g. \"prior:file=/path/to/file:alpha=0.001\")")
     ("attention_type", po::value<string>()->default_value("mlp:0"), "Type of attention score (mlp:NUM/bilin/dot)")
     ("cls_layers", po::value<string>()->default_value(""), "Descriptor for classifier layers, nodes1:nodes2:...")
+    ("checkpoint_async", po::value<bool>()->default_value(true), "Copy the parameters into memory and write the model file in the background while training continues")
+    ("checkpoint_keep", po::value<int>()->default_value(0), "Keep the previous n models written to model_out as model_out.1 (the most recent) to model_out.n")
     ("context", po::value<int>()->default_value(2), "Amount of context information to use")
     ("dropout", po::value<float>()->default_value(0.0), "Dropout rate during training")
     ("encoder_types", po::value<string>()->default_value("for|rev"), "The type of encoder, multiple separated by a pipe (for=forward, rev=reverse)")
@@ -54,20 +65,27 @@ int LamtramTrain::main(int argc, char** argv) {
     ("layers", po::value<string>()->default_value("lstm:0:1"), "Descriptor for hidden layers, type:num_units:num_layers")
     ("learning_criterion", po::value<string>()->default_value("ml"), "The criterion to use for learning (ml/minrisk)")
     ("learning_rate", po::value<float>()->default_value(0.001), "Learning rate")
+    ("minibatch_bucket", po::value<bool>()->default_value(false), "Group sentences of the same source and target lengths into mini-batches re-formed every epoch, limiting the padded source and target words to minibatch_size (TMs only)")
     ("minibatch_size", po::value<int>()->default_value(1), "Number of words per mini-batch")
     ("minrisk_dedup", po::value<bool>()->default_value(true), "Whether to deduplicate samples for min risk training")
     ("minrisk_include_ref", po::value<bool>()->default_value(false), "Whether to include the reference in every sample for min risk training")
+    ("minrisk_minibatch", po::value<int>()->default_value(1), "The number of source sentences to sample for in one batch and update together in min risk training")
     ("minrisk_max_len", po::value<int>()->default_value(200), "Limit on the max length of sentences")
     ("minrisk_num_samples", po::value<int>()->default_value(50), "The number of samples to perform for minimum risk training")
     ("minrisk_scaling", po::value<float>()->default_value(0.005), "The scaling factor for min risk training")
+    ("minrisk_threads", po::value<int>()->default_value(1), "The number of threads to score the samples of min risk training with (external measures use their own workers)")
+    ("model_format", po::value<string>()->default_value("text"), "Format to write the model parameters in (text/binary), reading accepts either")
     ("model_in", po::value<string>()->default_value(""), "If resuming training, read the model in")
     ("rate_decay", po::value<float>()->default_value(0.5), "Learning rate decay when dev perplexity gets worse")
     ("rate_thresh",  po::value<float>()->default_value(1e-5), "Threshold for the learning rate")
     ("scheduled_samp", po::value<float>()->default_value(0.f), "If set to 1 or more, perform scheduled sampling where the selected value is the number of iterations after which the sampling value reaches 0.5")
     ("seed", po::value<int>()->default_value(0), "Random seed (default 0 -> changes every time)")
-    ("softmax", po::value<string>()->default_value("multilayer:0:full"), "The type of softmax to use (full/hinge/hier/mod/multilayer) see softmax_factory.h for details")
+    ("softmax", po::value<string>()->default_value("multilayer:0:full"), "The type of softmax to use (full/hinge/hier/mod/multilayer/sampled) see softmax_factory.h for details")
+    ("train_bin", po::value<string>()->default_value(""), "Prefix of a training corpus binarized with lamtram-binarize, used instead of --train_trg/--train_src")
+    ("train_workers", po::value<int>()->default_value(1), "Number of processes to train in parallel on CPU, updating shared parameters without locking (ml training only)")
     ("train_weights", po::value<string>()->default_value(""), "Training instance weights for TMs, possibly separated by pipes")
     ("train_kickout_keep", po::value<string>()->default_value(""), "Instance-level keep rates for kickout (TMs only), possibly separated by pipes")
+    ("train_stream_buffer", po::value<int>()->default_value(0), "If larger than zero, stream the training data (TMs only) instead of loading it all, shuffling minibatches within buffers of this many sentences")
     ("trainer", po::value<string>()->default_value("adam"), "Training algorithm (sgd/momentum/adagrad/adadelta)")
     ("verbose", po::value<int>()->default_value(0), "How much verbose output to print")
     ("wildcards", po::value<string>()->default_value(""), "Wildcards to be used in loading training files")
@@ -106,7 +124,12 @@ int LamtramTrain::main(int argc, char** argv) {
   try { train_files_trg_ = TokenizeWildcarded(vm_["train_trg"].as<string>(), wildcards_, "|"); } catch(std::exception & e) { }
   try { dev_file_trg_ = vm_["dev_trg"].as<string>(); } catch(std::exception & e) { }
   try { model_out_file_ = vm_["model_out"].as<string>(); } catch(std::exception & e) { }
-  if(!train_files_trg_.size())
+  train_bin_ = vm_["train_bin"].as<string>();
+  if(train_bin_.size() && (train_files_trg_.size() || vm_["train_stream_buffer"].as<int>() > 0))
+    THROW_ERROR("--train_bin cannot be combined with --train_trg or --train_stream_buffer");
+  if(train_bin_.size() && model_type == "enccls")
+    THROW_ERROR("--train_bin is not supported for classifiers");
+  if(!train_files_trg_.size() && !train_bin_.size())
     THROW_ERROR("Must specify a training file with --train_trg");
   if(!model_out_file_.size())
     THROW_ERROR("Must specify a model output file with --model_out");
@@ -124,7 +147,7 @@ int LamtramTrain::main(int argc, char** argv) {
     if (train_kickout_keep_string != "")
       train_files_kickout_keep_ = TokenizeWildcarded(train_kickout_keep_string, wildcards_, "|");
   } catch(std::exception & e) { }
-  if(use_src && ((!train_files_src_.size()) || (dev_file_trg_.size() && !dev_file_src_.size())))
+  if(use_src && ((!train_files_src_.size() && !train_bin_.size()) || (dev_file_trg_.size() && !dev_file_src_.size())))
     THROW_ERROR("The specified model requires a source file to train, specify source files using train_src.");
 
   // Save some variables
@@ -134,10 +157,35 @@ int LamtramTrain::main(int argc, char** argv) {
   context_ = vm_["context"].as<int>();
   model_in_file_ = vm_["model_in"].as<string>();
   model_out_file_ = vm_["model_out"].as<string>();
+  model_format_ = vm_["model_format"].as<string>();
+  if(model_format_ != "text" && model_format_ != "binary")
+    THROW_ERROR("Model format must be text or binary, but got: " << model_format_);
   eval_every_ = vm_["eval_every"].as<int>();
   softmax_sig_ = vm_["softmax"].as<string>();
   scheduled_samp_ = vm_["scheduled_samp"].as<float>();
   dropout_ = vm_["dropout"].as<float>();
+  train_workers_ = vm_["train_workers"].as<int>();
+  dev_workers_ = vm_["dev_workers"].as<int>();
+  dev_minibatch_size_ = vm_["dev_minibatch_size"].as<int>();
+  if(dev_minibatch_size_ == -1) dev_minibatch_size_ = vm_["minibatch_size"].as<int>();
+#ifdef HAVE_CUDA
+  if(dev_workers_ > 0)
+    THROW_ERROR("--dev_workers is not supported on GPUs");
+#endif
+  if(dev_workers_ > 0 && (train_workers_ > 1 || vm_["train_stream_buffer"].as<int>() > 0))
+    THROW_ERROR("--dev_workers cannot be combined with --train_workers or --train_stream_buffer");
+  if(dev_workers_ > 0 && vm_["learning_criterion"].as<string>() != "ml")
+    THROW_ERROR("--dev_workers is only supported with maximum likelihood training");
+  if(train_workers_ > 1 && vm_["train_stream_buffer"].as<int>() > 0)
+    THROW_ERROR("--train_workers cannot be combined with --train_stream_buffer");
+  if(vm_["minibatch_bucket"].as<bool>()) {
+    if(model_type == "nlm")
+      THROW_ERROR("--minibatch_bucket is only supported when training translation models");
+    if(vm_["train_stream_buffer"].as<int>() > 0)
+      THROW_ERROR("--minibatch_bucket cannot be combined with --train_stream_buffer");
+    if(vm_["learning_criterion"].as<string>() != "ml")
+      THROW_ERROR("--minibatch_bucket is only supported with maximum likelihood training");
+  }
 
   // Perform appropriate training
   if(model_type == "nlm")           TrainLM();
@@ -185,7 +233,16 @@ inline size_t CalcSize(const Sentence & src, const Sentence & trg) {
 inline size_t CalcSize(const Sentence & src, int trg) {
   return src.size()+1;
 }
+inline size_t CalcTrgSize(const Sentence & trg) { return trg.size(); }
+inline size_t CalcTrgSize(int trg) { return 1; }
 
+// Divide the training data into minibatches of about max_size words.
+// If bucket is false, sort by length and close a batch when the next would
+// likely overflow it. If bucket is true, sentences with the same source and
+// target lengths are shuffled before sorting, so batches are re-formed every
+// time this is called, and a batch is closed before its padded source and
+// target words (the batch size times the longest source plus the longest
+// target) would exceed max_size.
 template <class OutputType>
 inline size_t CreateMinibatches(const std::vector<Sentence> & train_src,
                               const std::vector<OutputType> & train_trg,
@@ -193,6 +250,7 @@ inline size_t CreateMinibatches(const std::vector<Sentence> & train_src,
                               const std::vector<float> & train_weights,
                               const std::vector<float> & train_kickout_keep,
                               size_t max_size,
+                              bool bucket,
                               std::vector<std::vector<Sentence> > & train_src_minibatch,
                               std::vector<std::vector<OutputType> > & train_trg_minibatch,
                               std::vector<std::vector<OutputType> > & train_cache_minibatch,
@@ -204,13 +262,33 @@ inline size_t CreateMinibatches(const std::vector<Sentence> & train_src,
   train_weights_minibatch.clear();
   std::vector<size_t> train_ids(train_trg.size());
   std::iota(train_ids.begin(), train_ids.end(), 0);
-  if(max_size > 1)
+  if(bucket && max_size > 1) {
+    std::shuffle(train_ids.begin(), train_ids.end(), *dynet::rndeng);
+    stable_sort(train_ids.begin(), train_ids.end(), DoubleLength<OutputType>(train_src, train_trg));
+  } else if(max_size > 1) {
     sort(train_ids.begin(), train_ids.end(), DoubleLength<OutputType>(train_src, train_trg));
+  }
   std::vector<Sentence> train_src_next;
   std::vector<OutputType> train_trg_next, train_cache_next;
   std::vector<float> train_weights_next;
-  size_t max_len = 0;
-  size_t kicked = 0;
+  size_t max_len = 0, max_src = 0, max_trg = 0;
+  size_t kicked = 0, real_words = 0, padded_words = 0;
+  auto close_minibatch = [&]() {
+    padded_words += train_trg_next.size() * (max_src + max_trg);
+    train_src_minibatch.push_back(train_src_next);
+    train_src_next.clear();
+    train_trg_minibatch.push_back(train_trg_next);
+    train_trg_next.clear();
+    if(train_cache.size()) {
+      train_cache_minibatch.push_back(train_cache_next);
+      train_cache_next.clear();
+    }
+    if(train_weights.size()) {
+      train_weights_minibatch.push_back(train_weights_next);
+      train_weights_next.clear();
+    }
+    max_len = max_src = max_trg = 0;
+  };
   for(size_t i = 0; i < train_ids.size(); i++) {
     // Apply kickout: skip sentence if rand [0,1] above keep rate
     if(train_kickout_keep.size()) {
@@ -219,38 +297,30 @@ inline size_t CreateMinibatches(const std::vector<Sentence> & train_src,
         continue;
       }
     }
+    size_t src_len = train_src[train_ids[i]].size(), trg_len = CalcTrgSize(train_trg[train_ids[i]]);
+    if(bucket && train_trg_next.size() &&
+       (train_trg_next.size()+1) * (max(max_src, src_len) + max(max_trg, trg_len)) > max_size)
+      close_minibatch();
     max_len = max(max_len, CalcSize(train_src[train_ids[i]], train_trg[train_ids[i]]));
+    max_src = max(max_src, src_len);
+    max_trg = max(max_trg, trg_len);
+    real_words += src_len + trg_len;
     train_src_next.push_back(train_src[train_ids[i]]);
     train_trg_next.push_back(train_trg[train_ids[i]]);
     if(train_cache.size())
       train_cache_next.push_back(train_cache[train_ids[i]]);
     if(train_weights.size())
       train_weights_next.push_back(train_weights[train_ids[i]]);
-    if((train_trg_next.size()+1) * max_len > max_size) {
-      train_src_minibatch.push_back(train_src_next);
-      train_src_next.clear();
-      train_trg_minibatch.push_back(train_trg_next);
-      train_trg_next.clear();
-      if(train_cache.size()) {
-        train_cache_minibatch.push_back(train_cache_next);
-        train_cache_next.clear();
-      }
-      if(train_weights.size()) {
-        train_weights_minibatch.push_back(train_weights_next);
-        train_weights_next.clear();
-      }
-      max_len = 0;
-    }
+    if(!bucket && (train_trg_next.size()+1) * max_len > max_size)
+      close_minibatch();
   }
-  if(train_trg_next.size()) {
-    train_src_minibatch.push_back(train_src_next);
-    train_trg_minibatch.push_back(train_trg_next);
-  }
-  if(train_cache_next.size()) train_cache_minibatch.push_back(train_cache_next);
-  if(train_weights_next.size()) train_weights_minibatch.push_back(train_weights_next);
+  if(train_trg_next.size())
+    close_minibatch();
   // Create a sentence list for this minibatch
   train_ids_minibatch.resize(train_src_minibatch.size());
   std::iota(train_ids_minibatch.begin(), train_ids_minibatch.end(), 0);
+  if(max_size > 1 && padded_words > 0)
+    cerr << "*** Minibatches: " << train_src_minibatch.size() << " batches, " << real_words << " of " << padded_words << " padded words used (efficiency " << real_words * 100.0 / padded_words << "%)" << endl;
   // Return total size (sentences)
   if(train_kickout_keep.size()) {
     cerr << "*** Kickout: " << train_ids.size() - kicked << " of " << train_ids.size() << " instances retained" << endl;
@@ -306,10 +376,7 @@ void LamtramTrain::TrainLM() {
   // Read the training files
   vector<Sentence> train_trg, dev_trg, train_cache;
   vector<int> train_trg_ids;
-  for(size_t i = 0; i < train_files_trg_.size(); i++) {
-    LoadFile(train_files_trg_[i], true, *vocab_trg, train_trg);
-    train_trg_ids.resize(train_trg.size(), i);
-  }
+  LoadTrainFiles(train_files_trg_, ".trg", true, *vocab_trg, train_trg, train_trg_ids);
   if(!vocab_trg->is_frozen()) { vocab_trg->freeze(); vocab_trg->set_unk("<unk>"); }
   if(dev_file_trg_.size()) LoadFile(dev_file_trg_, true, *vocab_trg, dev_trg);
   if(train_files_weights_.size())
@@ -332,8 +399,7 @@ void LamtramTrain::TrainLM() {
   vector<vector<Sentence> > train_trg_minibatch, train_cache_minibatch, dev_trg_minibatch, dev_cache_minibatch;
   vector<Sentence> empty_minibatch;
   CreateMinibatches(train_trg, train_cache, vm_["minibatch_size"].as<int>(), train_trg_minibatch, train_cache_minibatch);
-  // CreateMinibatches(dev_trg, empty_minibatch, vm_["minibatch_size"].as<int>(), dev_trg_minibatch, dev_cache_minibatch);
-  CreateMinibatches(dev_trg, empty_minibatch, 1, dev_trg_minibatch, dev_cache_minibatch);
+  CreateMinibatches(dev_trg, empty_minibatch, dev_minibatch_size_, dev_trg_minibatch, dev_cache_minibatch);
   
   // TODO: Learning rate
   dynet::real learning_rate = vm_["learning_rate"].as<float>();
@@ -351,6 +417,25 @@ void LamtramTrain::TrainLM() {
   float epoch_frac = 0.f, samp_prob = 0.f;
   int epoch = 0;
   std::shuffle(train_ids.begin(), train_ids.end(), *dynet::rndeng);
+  // Evaluate one development minibatch, and write the model
+  auto eval_dev = [&](int i, LLStats & ll) {
+    dynet::ComputationGraph cg;
+    nlm->NewGraph(cg);
+    dynet::Expression loss_exp = nlm->BuildSentGraph(dev_trg_minibatch[i], empty_minibatch, nullptr, NULL, empty_hist, 0.f, false, cg, ll);
+    ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+  };
+  auto save_model = [&]() {
+    // Write the model (TODO: move this to a separate file?)
+    ostringstream out;
+    WriteDict(*vocab_trg, out);
+    // vocab_trg->Write(out);
+    nlm->Write(out);
+    WriteCheckpoint(out.str(), *model);
+  };
+  // The development set evaluated in the background with --dev_workers
+  AsyncEvaluator dev_eval;
+  int dev_epoch = 0;
+  Timer dev_time;
   while(true) {
     // Start the training
     LLStats train_ll(nlm->GetVocabSize()), dev_ll(nlm->GetVocabSize());
@@ -365,7 +450,35 @@ void LamtramTrain::TrainLM() {
         sent_loc = 0;
         last_print = 0;
         ++epoch;
-        if(epoch >= epochs_) return;
+        if(epoch >= epochs_) {
+          FinishDevEval(dev_eval, dev_ll, best_loss);
+          return;
+        }
+      }
+      if(train_workers_ > 1) {
+        // Split the minibatches up to the next evaluation over the workers
+        int start = loc, round_sents = 0;
+        for(; loc < (int)train_ids.size() && curr_sent_loc + round_sents < eval_every_; ++loc)
+          round_sents += train_trg_minibatch[train_ids[loc]].size();
+        float start_frac = epoch_frac;
+        HogwildTraining(loc - start, *trainer, [&](int i, LLStats & ll) {
+          int id = train_ids[start + i];
+          float my_samp_prob = 0.f;
+          if(scheduled_samp_)
+            my_samp_prob = 1/(1+exp((start_frac + (float)i/train_ids.size() - scheduled_samp_)/scheduled_samp_));
+          dynet::ComputationGraph cg;
+          nlm->NewGraph(cg);
+          dynet::Expression loss_exp = nlm->BuildSentGraph(train_trg_minibatch[id], (train_cache_minibatch.size() ? train_cache_minibatch[id] : empty_minibatch), nullptr, NULL, empty_hist, my_samp_prob, true, cg, ll);
+          ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+          cg.backward(loss_exp);
+          trainer->update();
+        }, train_ll);
+        sent_loc += round_sents;
+        curr_sent_loc += round_sents;
+        epoch_frac += (float)(loc - start)/train_ids.size();
+        float elapsed = time.Elapsed();
+        cerr << "Epoch " << epoch+1 << " sent " << sent_loc << ": " << train_ll.PrintStats() << ", rate=" << learning_scale*learning_rate << ", time=" << elapsed << " (" << train_ll.words_/elapsed << " w/s)" << endl;
+        continue;
       }
       if(scheduled_samp_) {
         float val = (epoch_frac-scheduled_samp_)/scheduled_samp_;
@@ -389,16 +502,20 @@ void LamtramTrain::TrainLM() {
         if(epochs_ == epoch) break;
       }
     }
-    // Measure development perplexity
-    if(do_dev) {
+    // Measure development perplexity, or with --dev_workers use the results
+    // of the evaluation started at the end of the previous round
+    bool have_loss = true;
+    if(do_dev && dev_workers_ > 0) {
+      have_loss = dev_eval.IsRunning();
+      if(have_loss) {
+        dev_eval.Collect(dev_ll);
+        cerr << "Epoch " << dev_epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_scale*learning_rate << ", time=" << dev_time.Elapsed() << " (in background)" << endl;
+      }
+    } else if(do_dev) {
       time = Timer();
       nlm->SetDropout(0.f);
-      for(auto & sent : dev_trg_minibatch) {
-        dynet::ComputationGraph cg;
-        nlm->NewGraph(cg);
-        dynet::Expression loss_exp = nlm->BuildSentGraph(sent, empty_minibatch, nullptr, NULL, empty_hist, 0.f, false, cg, dev_ll);
-        dev_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
-      }
+      for(int i : boost::irange(0, (int)dev_trg_minibatch.size()))
+        eval_dev(i, dev_ll);
       float elapsed = time.Elapsed();
       cerr << "Epoch " << epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_scale*learning_rate << ", time=" << elapsed << " (" << dev_ll.words_/elapsed << " w/s)" << endl;
     }
@@ -408,26 +525,30 @@ void LamtramTrain::TrainLM() {
     // Check the learning rate
     if(last_loss != last_loss)
       THROW_ERROR("Likelihood is not a number, dying...");
-    dynet::real my_loss = do_dev ? dev_ll.loss_ : train_ll.loss_;
-    if(my_loss > last_loss) {
-      learning_scale *= rate_decay_;
-    }
-    last_loss = my_loss;
-    if(best_loss > my_loss) {
-      // Open the output stream
-      ofstream out(model_out_file_.c_str());
-      if(!out) THROW_ERROR("Could not open output file: " << model_out_file_);
-      cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
-      // Write the model (TODO: move this to a separate file?)
-      WriteDict(*vocab_trg, out);
-      // vocab_trg->Write(out);
-      nlm->Write(out);
-      ModelUtils::WriteModelText(out, *model);
-      best_loss = my_loss;
+    if(have_loss) {
+      dynet::real my_loss = do_dev ? dev_ll.loss_ : train_ll.loss_;
+      if(my_loss > last_loss) {
+        learning_scale *= rate_decay_;
+      }
+      last_loss = my_loss;
+      if(best_loss > my_loss) {
+        cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
+        // The evaluation workers still have the evaluated parameters
+        if(dev_eval.IsRunning()) dev_eval.Finish(true);
+        else                     save_model();
+        best_loss = my_loss;
+      }
+      dev_eval.Finish(false);
     }
     // If the rate is less than the threshold
     if(learning_scale*learning_rate < rate_thresh_)
       break;
+    // Evaluate the current parameters while training continues
+    if(do_dev && dev_workers_ > 0) {
+      nlm->SetDropout(0.f);
+      dev_epoch = epoch; dev_time = Timer();
+      StartDevEval(dev_eval, dev_trg_minibatch.size(), nlm->GetVocabSize(), eval_dev, save_model);
+    }
   }
 }
 
@@ -452,16 +573,13 @@ void LamtramTrain::TrainEncDec() {
   vector<Sentence> train_trg, dev_trg, train_src, dev_src, train_cache_ids;
   vector<int> train_trg_ids, train_src_ids;
   vector<float> train_weights, train_kickout_keep;
-  for(size_t i = 0; i < train_files_trg_.size(); i++) {
-    LoadFile(train_files_trg_[i], true, *vocab_trg, train_trg);
-    train_trg_ids.resize(train_trg.size(), i);
-  }
+  std::shared_ptr<BilingualStream<Sentence> > train_stream = OpenTrainStream<Sentence>(*vocab_src, *vocab_trg);
+  if(train_stream.get() == nullptr)
+    LoadTrainFiles(train_files_trg_, ".trg", true, *vocab_trg, train_trg, train_trg_ids);
   if(!vocab_trg->is_frozen()) { vocab_trg->freeze(); vocab_trg->set_unk("<unk>"); }
   if(dev_file_trg_.size()) LoadFile(dev_file_trg_, true, *vocab_trg, dev_trg);
-  for(size_t i = 0; i < train_files_src_.size(); i++) {
-    LoadFile(train_files_src_[i], false, *vocab_src, train_src);
-    train_src_ids.resize(train_src.size(), i);
-  }
+  if(train_stream.get() == nullptr)
+    LoadTrainFiles(train_files_src_, ".src", false, *vocab_src, train_src, train_src_ids);
   if(!vocab_src->is_frozen()) { vocab_src->freeze(); vocab_src->set_unk("<unk>"); }
   if(dev_file_src_.size()) LoadFile(dev_file_src_, false, *vocab_src, dev_src);
   for(size_t i = 0; i < train_files_weights_.size(); i++)
@@ -505,7 +623,8 @@ void LamtramTrain::TrainEncDec() {
                       *vocab_src,
                       *vocab_trg,
                       *model,
-                      *encdec);
+                      *encdec,
+                      train_stream.get());
   } else if(crit == "minrisk") {
     // Get the evaluator
     std::shared_ptr<EvalMeasure> eval(EvalMeasureLoader::CreateMeasureFromString(vm_["eval_meas"].as<string>(), *vocab_trg));
@@ -536,16 +655,13 @@ void LamtramTrain::TrainEncAtt() {
   vector<Sentence> train_trg, dev_trg, train_src, dev_src, train_cache_ids;
   vector<int> train_trg_ids, train_src_ids;
   vector<float> train_weights, train_kickout_keep;
-  for(size_t i = 0; i < train_files_trg_.size(); i++) {
-    LoadFile(train_files_trg_[i], true, *vocab_trg, train_trg);
-    train_trg_ids.resize(train_trg.size(), i);
-  }
+  std::shared_ptr<BilingualStream<Sentence> > train_stream = OpenTrainStream<Sentence>(*vocab_src, *vocab_trg);
+  if(train_stream.get() == nullptr)
+    LoadTrainFiles(train_files_trg_, ".trg", true, *vocab_trg, train_trg, train_trg_ids);
   if(!vocab_trg->is_frozen()) { vocab_trg->freeze(); vocab_trg->set_unk("<unk>"); }
   if(dev_file_trg_.size()) LoadFile(dev_file_trg_, true, *vocab_trg, dev_trg);
-  for(size_t i = 0; i < train_files_src_.size(); i++) {
-    LoadFile(train_files_src_[i], false, *vocab_src, train_src);
-    train_src_ids.resize(train_src.size(), i);
-  }
+  if(train_stream.get() == nullptr)
+    LoadTrainFiles(train_files_src_, ".src", false, *vocab_src, train_src, train_src_ids);
   if(!vocab_src->is_frozen()) { vocab_src->freeze(); vocab_src->set_unk("<unk>"); }
   if(dev_file_src_.size()) LoadFile(dev_file_src_, false, *vocab_src, dev_src);
   for(size_t i = 0; i < train_files_weights_.size(); i++)
@@ -588,7 +704,8 @@ void LamtramTrain::TrainEncAtt() {
                       *vocab_src,
                       *vocab_trg,
                       *model,
-                      *encatt);
+                      *encatt,
+                      train_stream.get());
   } else if(crit == "minrisk") {
     // Get the evaluator
     std::shared_ptr<EvalMeasure> eval(EvalMeasureLoader::CreateMeasureFromString(vm_["eval_meas"].as<string>(), *vocab_trg));
@@ -619,16 +736,15 @@ void LamtramTrain::TrainEncCls() {
   vector<int> train_trg, dev_trg;
   vector<int> train_trg_ids, train_src_ids;
   vector<float> train_weights, train_kickout_keep;
-  for(size_t i = 0; i < train_files_trg_.size(); i++) {
+  std::shared_ptr<BilingualStream<int> > train_stream = OpenTrainStream<int>(*vocab_src, *vocab_trg);
+  for(size_t i = 0; train_stream.get() == nullptr && i < train_files_trg_.size(); i++) {
     LoadLabels(train_files_trg_[i], *vocab_trg, train_trg);
     train_trg_ids.resize(train_trg.size(), i);
   }
   vocab_trg->freeze();
   if(dev_file_trg_.size()) LoadLabels(dev_file_trg_, *vocab_trg, dev_trg);
-  for(size_t i = 0; i < train_files_src_.size(); i++) {
-    LoadFile(train_files_src_[i], false, *vocab_src, train_src);
-    train_src_ids.resize(train_src.size(), i);
-  }
+  if(train_stream.get() == nullptr)
+    LoadTrainFiles(train_files_src_, ".src", false, *vocab_src, train_src, train_src_ids);
   if(!vocab_src->is_frozen()) { vocab_src->freeze(); vocab_src->set_unk("<unk>"); }
   if(dev_file_src_.size()) LoadFile(dev_file_src_, false, *vocab_src, dev_src);
   if(train_files_weights_.size())
@@ -664,7 +780,8 @@ void LamtramTrain::TrainEncCls() {
                     *vocab_src,
                     *vocab_trg,
                     *model,
-                    *enccls);
+                    *enccls,
+                    train_stream.get());
 }
 
 template<class ModelType, class OutputType>
@@ -678,7 +795,8 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
                                      const dynet::Dict & vocab_src,
                                      const dynet::Dict & vocab_trg,
                                      dynet::Model & model,
-                                     ModelType & encdec) {
+                                     ModelType & encdec,
+                                     BilingualStream<OutputType> * train_stream) {
 
   // Sanity checks
   assert(train_src.size() == train_trg.size());
@@ -696,24 +814,31 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
   vector<Sentence> empty_minibatch;
   std::vector<OutputType> empty_cache;
   size_t minibatch_size = vm_["minibatch_size"].as<int>();
+  bool minibatch_bucket = vm_["minibatch_bucket"].as<bool>();
   size_t train_instances = CreateMinibatches(train_src,
                                              train_trg,
                                              train_cache,
                                              train_weights,
                                              train_kickout_keep,
                                              minibatch_size,
+                                             minibatch_bucket,
                                              train_src_minibatch,
                                              train_trg_minibatch,
                                              train_cache_minibatch,
                                              train_weights_minibatch,
                                              train_ids_minibatch);
+  if(train_stream != nullptr) {
+    train_instances = train_stream->GetNumSents();
+    train_stream->Reset();
+  }
   if(vm_["eval_every"].as<int>() == -1) eval_every_ = train_instances;
   CreateMinibatches(dev_src,
                     dev_trg,
                     empty_cache,
                     dev_weights,
                     dev_kickout_keep,
-                    1,
+                    dev_minibatch_size_,
+                    false,
                     dev_src_minibatch,
                     dev_trg_minibatch,
                     dev_cache_minibatch,
@@ -737,6 +862,28 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
   float epoch_frac = 0.f, samp_prob = 0.f;
   // Shuffle minibatches
   std::shuffle(train_ids_minibatch.begin(), train_ids_minibatch.end(), *dynet::rndeng);
+  // The current minibatch when streaming
+  vector<Sentence> stream_src;
+  vector<OutputType> stream_trg;
+  // Evaluate one development minibatch, and write the model
+  auto eval_dev = [&](int i, LLStats & ll) {
+    dynet::ComputationGraph cg;
+    encdec.NewGraph(cg);
+    dynet::Expression loss_exp = encdec.BuildSentGraph(dev_src_minibatch[i], dev_trg_minibatch[i], empty_cache, nullptr, 0.f, false, cg, ll);
+    ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+  };
+  auto save_model = [&]() {
+    // Write the model (TODO: move this to a separate file?)
+    ostringstream out;
+    WriteDict(vocab_src, out);
+    WriteDict(vocab_trg, out);
+    encdec.Write(out);
+    WriteCheckpoint(out.str(), model);
+  };
+  // The development set evaluated in the background with --dev_workers
+  AsyncEvaluator dev_eval;
+  int dev_epoch = 0;
+  Timer dev_time;
   while(true) {
     // Start the training
     LLStats train_ll(vocab_trg.size()), dev_ll(vocab_trg.size());
@@ -744,14 +891,30 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
     Timer time;
     encdec.SetDropout(dropout_);
     for(int curr_sent_loc = 0; curr_sent_loc < eval_every_; ) {
-      if(loc == (int)train_ids_minibatch.size()) {
-        if(train_kickout_keep.size()) {
+      if(train_stream != nullptr) {
+        if(!train_stream->NextMinibatch(stream_src, stream_trg)) {
+          // Start reading the data again for the next epoch
+          train_stream->Reset();
+          loc = 0;
+          sent_loc = 0;
+          last_print = 0;
+          ++epoch;
+          if(epoch >= epochs_) {
+            FinishDevEval(dev_eval, dev_ll, best_loss);
+            return;
+          }
+          continue;
+        }
+      } else if(loc == (int)train_ids_minibatch.size()) {
+        // Kickout and bucketing change the minibatches every epoch
+        if(train_kickout_keep.size() || minibatch_bucket) {
           train_instances = CreateMinibatches(train_src,
                                               train_trg,
                                               train_cache,
                                               train_weights,
                                               train_kickout_keep,
                                               minibatch_size,
+                                              minibatch_bucket,
                                               train_src_minibatch,
                                               train_trg_minibatch,
                                               train_cache_minibatch,
@@ -766,7 +929,43 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
         sent_loc = 0;
         last_print = 0;
         ++epoch;
-        if(epoch >= epochs_) return;
+        if(epoch >= epochs_) {
+          FinishDevEval(dev_eval, dev_ll, best_loss);
+          return;
+        }
+      }
+      if(train_workers_ > 1 && train_stream == nullptr) {
+        // Split the minibatches up to the next evaluation over the workers
+        int start = loc, round_sents = 0;
+        for(; loc < (int)train_ids_minibatch.size() && curr_sent_loc + round_sents < eval_every_; ++loc)
+          round_sents += train_trg_minibatch[train_ids_minibatch[loc]].size();
+        float start_frac = epoch_frac;
+        HogwildTraining(loc - start, *trainer, [&](int i, LLStats & ll) {
+          size_t id = train_ids_minibatch[start + i];
+          float my_samp_prob = 0.f;
+          if(scheduled_samp_)
+            my_samp_prob = 1/(1+exp((start_frac + (float)i/train_ids_minibatch.size() - scheduled_samp_)/scheduled_samp_));
+          dynet::ComputationGraph cg;
+          encdec.NewGraph(cg);
+          dynet::Expression loss_exp = encdec.BuildSentGraph(
+              train_src_minibatch[id],
+              train_trg_minibatch[id],
+              (train_cache_minibatch.size() ? train_cache_minibatch[id] : empty_cache),
+              (train_weights_minibatch.size() ? &train_weights_minibatch[id] : nullptr),
+              my_samp_prob,
+              true,
+              cg,
+              ll);
+          ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
+          cg.backward(loss_exp);
+          trainer->update(learning_scale);
+        }, train_ll);
+        sent_loc += round_sents;
+        curr_sent_loc += round_sents;
+        epoch_frac += (float)(loc - start)/train_ids_minibatch.size();
+        float elapsed = time.Elapsed();
+        cerr << "Epoch " << epoch+1 << " sent " << sent_loc << ": " << train_ll.PrintStats() << ", rate=" << learning_scale*learning_rate << ", time=" << elapsed << " (" << train_ll.words_/elapsed << " w/s)" << endl;
+        continue;
       }
       dynet::ComputationGraph cg;
       encdec.NewGraph(cg);
@@ -775,18 +974,20 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
         float val = (epoch_frac-scheduled_samp_)/scheduled_samp_;
         samp_prob = 1/(1+exp(val));
       }
+      const vector<Sentence> & batch_src = (train_stream != nullptr ? stream_src : train_src_minibatch[train_ids_minibatch[loc]]);
+      const vector<OutputType> & batch_trg = (train_stream != nullptr ? stream_trg : train_trg_minibatch[train_ids_minibatch[loc]]);
       dynet::Expression loss_exp = encdec.BuildSentGraph(
-          train_src_minibatch[train_ids_minibatch[loc]],
-          train_trg_minibatch[train_ids_minibatch[loc]],
+          batch_src,
+          batch_trg,
           (train_cache_minibatch.size() ? train_cache_minibatch[train_ids_minibatch[loc]] : empty_cache),
           (train_weights_minibatch.size() ? &train_weights_minibatch[train_ids_minibatch[loc]] : nullptr),
           samp_prob,
           true,
           cg,
           train_ll);
-      sent_loc += train_trg_minibatch[train_ids_minibatch[loc]].size();
-      curr_sent_loc += train_trg_minibatch[train_ids_minibatch[loc]].size();
-      epoch_frac += 1.f/train_ids_minibatch.size();
+      sent_loc += batch_trg.size();
+      curr_sent_loc += batch_trg.size();
+      epoch_frac += (train_stream != nullptr ? (float)batch_trg.size()/train_instances : 1.f/train_ids_minibatch.size());
       // cg.PrintGraphviz();
       train_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
       cg.backward(loss_exp);
@@ -799,18 +1000,20 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
         if(epochs_ == epoch) break;
       }
     }
-    // Measure development perplexity
-    if(do_dev) {
+    // Measure development perplexity, or with --dev_workers use the results
+    // of the evaluation started at the end of the previous round
+    bool have_loss = true;
+    if(do_dev && dev_workers_ > 0) {
+      have_loss = dev_eval.IsRunning();
+      if(have_loss) {
+        dev_eval.Collect(dev_ll);
+        cerr << "Epoch " << dev_epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_scale*learning_rate << ", time=" << dev_time.Elapsed() << " (in background)" << endl;
+      }
+    } else if(do_dev) {
       time = Timer();
-      std::vector<OutputType> empty_cache;
       encdec.SetDropout(0.f);
-      for(int i : boost::irange(0, (int)dev_src_minibatch.size())) {
-        dynet::ComputationGraph cg;
-        encdec.NewGraph(cg);
-        // encdec.BuildSentGraph(dev_src[i], dev_trg[i], empty_cache, false, cg, dev_ll);
-        dynet::Expression loss_exp = encdec.BuildSentGraph(dev_src_minibatch[i], dev_trg_minibatch[i], empty_cache, nullptr, 0.f, false, cg, dev_ll);
-        dev_ll.loss_ += as_scalar(cg.incremental_forward(loss_exp));
-      }
+      for(int i : boost::irange(0, (int)dev_src_minibatch.size()))
+        eval_dev(i, dev_ll);
       float elapsed = time.Elapsed();
       cerr << "Epoch " << epoch+1 << " dev: " << dev_ll.PrintStats() << ", rate=" << learning_scale*learning_rate << ", time=" << elapsed << " (" << dev_ll.words_/elapsed << " w/s)" << endl;
     }
@@ -820,64 +1023,92 @@ void LamtramTrain::BilingualTraining(const vector<Sentence> & train_src,
     // Check the learning rate
     if(last_loss != last_loss)
       THROW_ERROR("Likelihood is not a number, dying...");
-    dynet::real my_loss = do_dev ? dev_ll.loss_ : train_ll.loss_;
-    if(my_loss > last_loss)
-      learning_scale *= rate_decay_;
-    last_loss = my_loss;
-    // Open the output stream
-    if(best_loss > my_loss) {
-      ofstream out(model_out_file_.c_str());
-      if(!out) THROW_ERROR("Could not open output file: " << model_out_file_);
-      cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
-      // Write the model (TODO: move this to a separate file?)
-      WriteDict(vocab_src, out);
-      WriteDict(vocab_trg, out);
-      encdec.Write(out);
-      ModelUtils::WriteModelText(out, model);
-      best_loss = my_loss;
-      evals_since_improvement = 0;
-    } else {
-      ++evals_since_improvement;
-      if(early_stop != -1 && evals_since_improvement == early_stop) {
-        cerr << "No improvement in " << evals_since_improvement << " evals, stopping early" << endl;
-        break;
+    if(have_loss) {
+      dynet::real my_loss = do_dev ? dev_ll.loss_ : train_ll.loss_;
+      if(my_loss > last_loss)
+        learning_scale *= rate_decay_;
+      last_loss = my_loss;
+      // Open the output stream
+      if(best_loss > my_loss) {
+        cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
+        // The evaluation workers still have the evaluated parameters
+        if(dev_eval.IsRunning()) dev_eval.Finish(true);
+        else                     save_model();
+        best_loss = my_loss;
+        evals_since_improvement = 0;
+      } else {
+        dev_eval.Finish(false);
+        ++evals_since_improvement;
+        if(early_stop != -1 && evals_since_improvement == early_stop) {
+          cerr << "No improvement in " << evals_since_improvement << " evals, stopping early" << endl;
+          break;
+        }
       }
     }
     // If the rate is less than the threshold
     if(learning_scale * learning_rate < rate_thresh_)
       break;
+    // Evaluate the current parameters while training continues
+    if(do_dev && dev_workers_ > 0) {
+      encdec.SetDropout(0.f);
+      dev_epoch = epoch; dev_time = Timer();
+      StartDevEval(dev_eval, dev_src_minibatch.size(), vocab_trg.size(), eval_dev, save_model);
+    }
   }
 }
 
-inline dynet::Expression CalcRisk(const Sentence & ref,
-                                      const vector<Sentence> & trg_samples,
-                                      dynet::Expression trg_log_probs,
-                                      const EvalMeasure & eval,
+// Score the samples of each sentence against its reference. If dedup is
+// true, duplicate samples are not scored, and are given a mask of FLT_MAX.
+// The samples of all sentences are scored together, split over num_threads
+// threads if the measure allows it.
+inline void ScoreSamples(const vector<const Sentence*> & refs,
+                         const vector<vector<Sentence> > & samples,
+                         EvalMeasure & eval,
+                         bool dedup,
+                         int num_threads,
+                         vector<vector<float> > & eval_scores,
+                         vector<vector<float> > & masks) {
+    vector<pair<size_t,size_t> > todo;
+    eval_scores.resize(samples.size());
+    masks.resize(samples.size());
+    for(size_t s = 0; s < samples.size(); s++) {
+        eval_scores[s].assign(samples[s].size(), 0.f);
+        masks[s].assign(samples[s].size(), 0.f);
+        set<Sentence> sent_dup;
+        for(size_t i = 0; i < samples[s].size(); i++) {
+            if(!dedup || sent_dup.insert(samples[s][i]).second)
+                todo.push_back(make_pair(s, i));
+            else
+                masks[s][i] = FLT_MAX;
+        }
+    }
+    vector<const Sentence*> todo_refs, todo_syss;
+    vector<int> todo_ref_ids;
+    for(const pair<size_t,size_t> & si : todo) {
+        todo_refs.push_back(refs[si.first]);
+        todo_ref_ids.push_back(si.first);
+        todo_syss.push_back(&samples[si.first][si.second]);
+    }
+    // Each reference is cached by its position in this batch, so it is only
+    // processed once for all of its samples
+    eval.ClearCache();
+    vector<EvalStatsPtr> stats = eval.CalculateCachedStatsBatch(todo_refs, todo_syss, todo_ref_ids, num_threads);
+    for(size_t j = 0; j < todo.size(); j++)
+        eval_scores[todo[j].first][todo[j].second] = stats[j]->ConvertToScore();
+}
+
+inline dynet::Expression CalcRisk(dynet::Expression trg_log_probs,
+                                      const vector<float> & eval_scores,
+                                      const vector<float> & mask,
                                       float scaling,
-                                      bool dedup,
                                       dynet::ComputationGraph & cg) {
     // If scaling the distribution do it
     if(scaling != 1.f)
         trg_log_probs = trg_log_probs * scaling;
-    vector<float> trg_log_probs_vec = as_vector(trg_log_probs.value());
-    vector<float> eval_scores(trg_samples.size(), 0.f);
-    set<Sentence> sent_dup;
-    vector<float> mask(trg_samples.size(), 0.f);
-    for(size_t i = 0; i < trg_samples.size(); i++) {
-        auto it = sent_dup.find(trg_samples[i]);
-        if(it != sent_dup.end()) { 
-            mask[i] = FLT_MAX;
-        } else {
-            eval_scores[i] = eval.CalculateStats(ref, trg_samples[i])->ConvertToScore();
-            sent_dup.insert(trg_samples[i]);
-        }
-        // cerr << "i=" << i << ", tlp=" << trg_log_probs_vec[i] << ", eval=" << eval_scores[i] << ", len=" << trg_samples[i].size() << endl;
-    }
-    // cerr << "---------------------" << endl;
-    if(sent_dup.size() != trg_samples.size())
-        trg_log_probs = trg_log_probs + input(cg, dynet::Dim({(unsigned int)trg_samples.size()}), mask);
+    if(std::find(mask.begin(), mask.end(), FLT_MAX) != mask.end())
+        trg_log_probs = trg_log_probs + input(cg, dynet::Dim({(unsigned int)mask.size()}), mask);
     // Calculate expected and return loss
-    return -input(cg, dynet::Dim({1, (unsigned int)trg_samples.size()}), eval_scores) * softmax(trg_log_probs);
+    return -input(cg, dynet::Dim({1, (unsigned int)eval_scores.size()}), eval_scores) * softmax(trg_log_probs);
 }
 
 // Performs minimimum risk training according to the following paper:
@@ -891,7 +1122,7 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
                                    const vector<Sentence> & dev_trg,
                                    const dynet::Dict & vocab_src,
                                    const dynet::Dict & vocab_trg,
-                                   const EvalMeasure & eval,
+                                   EvalMeasure & eval,
                                    dynet::Model & model,
                                    ModelType & encdec) {
 
@@ -905,6 +1136,10 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
   float scaling = vm_["minrisk_scaling"].as<float>();
   bool include_ref = vm_["minrisk_include_ref"].as<bool>();
   bool dedup = vm_["minrisk_dedup"].as<bool>();
+  int minibatch_sents = vm_["minrisk_minibatch"].as<int>();
+  int num_threads = vm_["minrisk_threads"].as<int>();
+  if(minibatch_sents < 1)
+    THROW_ERROR("--minrisk_minibatch must be at least one");
 
   // Find the span of the folds
   vector<pair<int,int> > fold_id_spans;
@@ -929,6 +1164,31 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
   bool do_dev = dev_src.size() != 0;
   int loc = train_ids.size(), epoch = -1, sent_loc = 0, last_print = 0;
   float epoch_frac = 0.f;
+  // Sample translations of the sentences ids, and sum up their risk
+  auto build_risk = [&](const vector<Sentence> & srcs, const vector<Sentence> & trgs,
+                        const vector<int> & ids, dynet::ComputationGraph & cg) {
+    vector<Sentence> batch_srcs(ids.size());
+    vector<const Sentence*> refs(ids.size()), answers(ids.size());
+    for(size_t j = 0; j < ids.size(); j++) {
+      batch_srcs[j] = srcs[ids[j]];
+      refs[j] = &trgs[ids[j]];
+      answers[j] = (include_ref ? refs[j] : NULL);
+    }
+    // Sample for all sentences in one batch, then split the samples by sentence
+    vector<Sentence> all_samples;
+    dynet::Expression all_log_probs = encdec.SampleTrgSentences(batch_srcs, answers, num_samples, max_len, true, cg, all_samples);
+    vector<vector<Sentence> > trg_samples(ids.size());
+    for(size_t j = 0; j < ids.size(); j++)
+      trg_samples[j].assign(all_samples.begin() + j*num_samples, all_samples.begin() + (j+1)*num_samples);
+    vector<vector<float> > eval_scores, masks;
+    ScoreSamples(refs, trg_samples, eval, dedup, num_threads, eval_scores, masks);
+    vector<dynet::Expression> risks;
+    for(size_t j = 0; j < ids.size(); j++) {
+      dynet::Expression trg_log_probs = (ids.size() == 1 ? all_log_probs : pickrange(all_log_probs, j*num_samples, (j+1)*num_samples));
+      risks.push_back(CalcRisk(trg_log_probs, eval_scores[j], masks[j], scaling, cg));
+    }
+    return sum(risks);
+  };
   while(true) {
     // Start the training
     LossStats train_loss, dev_loss;
@@ -945,25 +1205,25 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
         ++epoch;
         if(epoch >= epochs_) return;
       }
+      // Take up to minrisk_minibatch sentences from the same fold
+      int fold_id = train_fold_ids[train_ids[loc]];
+      vector<int> batch_ids;
+      for(; loc < (int)train_ids.size() && (int)batch_ids.size() < minibatch_sents && train_fold_ids[train_ids[loc]] == fold_id; ++loc)
+        batch_ids.push_back(train_ids[loc]);
       // Create the graph
       dynet::ComputationGraph cg;
-      encdec.GetDecoderPtr()->GetSoftmax().UpdateFold(train_fold_ids[train_ids[loc]]+1);
+      encdec.GetDecoderPtr()->GetSoftmax().UpdateFold(fold_id+1);
       encdec.NewGraph(cg);
       // Sample sentences
-      std::vector<Sentence> trg_samples;
-      dynet::Expression trg_log_probs = encdec.SampleTrgSentences(train_src[train_ids[loc]], 
-                                                                      (include_ref ? &train_trg[train_ids[loc]] : NULL),
-                                                                      num_samples, max_len, true, cg, trg_samples);
-      dynet::Expression trg_loss = CalcRisk(train_trg[train_ids[loc]], trg_samples, trg_log_probs, eval, scaling, dedup, cg);
+      dynet::Expression trg_loss = build_risk(train_src, train_trg, batch_ids, cg);
       // Increment
-      sent_loc++; curr_sent_loc++;
-      epoch_frac += 1.f/train_src.size(); 
+      sent_loc += batch_ids.size(); curr_sent_loc += batch_ids.size();
+      epoch_frac += (float)batch_ids.size()/train_src.size();
       train_loss.loss_ += as_scalar(cg.incremental_forward(trg_loss));
-      train_loss.sents_++;
+      train_loss.sents_ += batch_ids.size();
       // cg.PrintGraphviz();
       cg.backward(trg_loss);
       trainer->update(learning_scale);
-      ++loc;
       if(sent_loc / 100 != last_print || curr_sent_loc >= eval_every_ || epochs_ == epoch) {
         last_print = sent_loc / 100;
         float elapsed = time.Elapsed();
@@ -975,17 +1235,16 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
     if(do_dev) {
       time = Timer();
       encdec.SetDropout(0.f);
-      for(int i : boost::irange(0, (int)dev_src.size())) {
+      for(int start = 0; start < (int)dev_src.size(); start += minibatch_sents) {
+          vector<int> batch_ids;
+          for(int i = start; i < (int)dev_src.size() && i < start + minibatch_sents; i++)
+            batch_ids.push_back(i);
           dynet::ComputationGraph cg;
           encdec.NewGraph(cg);
           // Sample sentences
-          std::vector<Sentence> trg_samples;
-          Expression trg_log_probs = encdec.SampleTrgSentences(dev_src[i], 
-                                                               (include_ref ? &dev_trg[i] : NULL),
-                                                               num_samples, max_len, true, cg, trg_samples);
-          dynet::Expression loss_exp = CalcRisk(dev_trg[i], trg_samples, trg_log_probs, eval, scaling, dedup, cg);
+          dynet::Expression loss_exp = build_risk(dev_src, dev_trg, batch_ids, cg);
           dev_loss.loss_ += as_scalar(cg.incremental_forward(loss_exp));
-          dev_loss.sents_++;
+          dev_loss.sents_ += batch_ids.size();
       }
       float elapsed = time.Elapsed();
       cerr << "Epoch " << epoch+1 << " dev: score=" << -dev_loss.CalcSentLoss() << ", rate=" << learning_scale*learning_rate << ", time=" << elapsed << " (" << dev_loss.sents_/elapsed << " sent/s)" << endl;
@@ -1002,14 +1261,13 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
     last_loss = my_loss;
     // Open the output stream
     if(best_loss > my_loss) {
-      ofstream out(model_out_file_.c_str());
-      if(!out) THROW_ERROR("Could not open output file: " << model_out_file_);
       cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
       // Write the model (TODO: move this to a separate file?)
+      ostringstream out;
       WriteDict(vocab_src, out);
       WriteDict(vocab_trg, out);
       encdec.Write(out);
-      ModelUtils::WriteModelText(out, model);
+      WriteCheckpoint(out.str(), model);
       best_loss = my_loss;
     }
     // If the rate is less than the threshold
@@ -1018,6 +1276,135 @@ void LamtramTrain::MinRiskTraining(const vector<Sentence> & train_src,
   }
 }
 
+void LamtramTrain::WriteCheckpoint(const std::string & header, const dynet::Model & mod) {
+  if(checkpoint_.get() == nullptr)
+    checkpoint_.reset(new CheckpointWriter(model_out_file_, model_format_, vm_["checkpoint_async"].as<bool>(), vm_["checkpoint_keep"].as<int>()));
+  checkpoint_->Write(header, mod);
+}
+
+void LamtramTrain::StartDevEval(AsyncEvaluator & dev_eval, int num_steps, int vocab,
+                                const std::function<void(int, LLStats &)> & eval,
+                                const std::function<void()> & save) {
+  // Forking while a checkpoint is being written on another thread is unsafe
+  if(checkpoint_.get() != nullptr) checkpoint_->Wait();
+  // The worker must finish writing the model before it exits
+  dev_eval.Start(dev_workers_, num_steps, vocab, eval, [&]() { save(); checkpoint_->Wait(); });
+}
+
+void LamtramTrain::FinishDevEval(AsyncEvaluator & dev_eval, LLStats & dev_ll, dynet::real best_loss) {
+  if(!dev_eval.IsRunning()) return;
+  dev_eval.Collect(dev_ll);
+  cerr << "Final dev: " << dev_ll.PrintStats() << endl;
+  bool is_best = (best_loss > dev_ll.loss_);
+  if(is_best)
+    cerr << "*** Found the best model yet! Printing model to " << model_out_file_ << endl;
+  dev_eval.Finish(is_best);
+}
+
+void LamtramTrain::HogwildTraining(int num_steps, dynet::Trainer & trainer,
+                                   const std::function<void(int, LLStats &)> & step,
+                                   LLStats & stats) {
+  // Forking while a checkpoint is being written on another thread is unsafe
+  if(checkpoint_.get() != nullptr) checkpoint_->Wait();
+  // The trainer allocates its state (momentum etc.) lazily in its first
+  // update. If that happened in a worker, each worker would get a private
+  // copy instead of the one in shared memory, so allocate it once here. The
+  // gradients and fresh state are zero, so this doesn't change the weights.
+  if(hogwild_trainer_ != &trainer) {
+    trainer.update(0.f);
+    hogwild_trainer_ = &trainer;
+  }
+  int num_workers = std::min(train_workers_, num_steps);
+  vector<pid_t> pids(num_workers);
+  vector<int> fds(num_workers);
+  for(int w = 0; w < num_workers; w++) {
+    unsigned seed = (*dynet::rndeng)();
+    int fd[2];
+    if(pipe(fd) != 0) THROW_ERROR("Could not create a pipe for training worker " << w);
+    pids[w] = fork();
+    if(pids[w] < 0) THROW_ERROR("Could not fork training worker " << w);
+    if(pids[w] == 0) {
+      close(fd[0]);
+      dynet::rndeng->seed(seed);
+      LLStats my_stats(stats.vocab_);
+      dynet::real start_updates = trainer.updates;
+      int ret = 0;
+      try {
+        for(int i = w; i < num_steps; i += num_workers)
+          step(i, my_stats);
+      } catch(std::exception & e) {
+        cerr << "Training worker " << w << " failed: " << e.what() << endl;
+        ret = 1;
+      }
+      // The trainer's counters are in private memory, so send back the
+      // number of updates along with the statistics
+      dynet::real my_updates = trainer.updates - start_updates;
+      if(!WriteStats(fd[1], my_stats) ||
+         write(fd[1], &my_updates, sizeof(my_updates)) != sizeof(my_updates))
+        ret = 1;
+      _exit(ret);
+    }
+    close(fd[1]);
+    fds[w] = fd[0];
+  }
+  // Collect the statistics and number of updates from every worker
+  bool failed = false;
+  for(int w = 0; w < num_workers; w++) {
+    LLStats my_stats(stats.vocab_);
+    dynet::real my_updates;
+    if(ReadStats(fds[w], my_stats) &&
+       read(fds[w], &my_updates, sizeof(my_updates)) == sizeof(my_updates)) {
+      stats += my_stats;
+      trainer.updates += my_updates;
+      trainer.updates_since_status += my_updates;
+    }
+    close(fds[w]);
+    int status;
+    waitpid(pids[w], &status, 0);
+    failed = failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+  }
+  if(failed) THROW_ERROR("Training worker failed, dying...");
+}
+
+template <class OutputType>
+std::shared_ptr<BilingualStream<OutputType> > LamtramTrain::OpenTrainStream(dynet::Dict & vocab_src, dynet::Dict & vocab_trg) {
+  std::shared_ptr<BilingualStream<OutputType> > ret;
+  int buffer_size = vm_["train_stream_buffer"].as<int>();
+  if(buffer_size <= 0) return ret;
+  if(train_files_weights_.size() || train_files_kickout_keep_.size())
+    THROW_ERROR("Instance weighting and kickout are not supported when streaming training data");
+  if(vm_["learning_criterion"].as<string>() != "ml")
+    THROW_ERROR("Only maximum likelihood training is supported when streaming training data");
+  // Look through any multilayer:N: wrappers for the softmax that sees the data
+  vector<string> sig_strs = Tokenize(softmax_sig_, ":");
+  size_t sig_start = 0;
+  while(sig_start+2 < sig_strs.size() && sig_strs[sig_start] == "multilayer")
+    sig_start += 2;
+  const string & inner_sig = sig_strs.size() ? sig_strs[sig_start] : softmax_sig_;
+  if(inner_sig == "mod" || inner_sig == "diff")
+    THROW_ERROR("Softmax " << softmax_sig_ << " caches the training data, and can't be used when streaming");
+  if(inner_sig == "sampled" && softmax_sig_.find("dist=uniform") == string::npos)
+    THROW_ERROR("Softmax " << softmax_sig_ << " counts the words in the training data for its unigram distribution, so use dist=uniform when streaming");
+  ret.reset(new BilingualStream<OutputType>(train_files_src_, train_files_trg_, vocab_src, vocab_trg, buffer_size, vm_["minibatch_size"].as<int>()));
+  Timer time;
+  size_t num_sents = ret->ScanFiles();
+  cerr << "Streaming " << num_sents << " training sentences, time=" << time.Elapsed() << endl;
+  return ret;
+}
+
+void LamtramTrain::LoadTrainFiles(const std::vector<std::string> & filenames, const std::string & bin_suffix, bool add_last, dynet::Dict & vocab, std::vector<Sentence> & sents, std::vector<int> & file_ids) {
+  if(train_bin_.size()) {
+    Timer time;
+    BinaryCorpus::Load(train_bin_ + bin_suffix, vocab, sents, file_ids);
+    cerr << "Loaded " << sents.size() << " sentences from " << train_bin_ << bin_suffix << ", time=" << time.Elapsed() << endl;
+    return;
+  }
+  for(size_t i = 0; i < filenames.size(); i++) {
+    LoadFile(filenames[i], add_last, vocab, sents);
+    file_ids.resize(sents.size(), i);
+  }
+}
+
 void LamtramTrain::LoadFile(const std::string filename, bool add_last, dynet::Dict & vocab, std::vector<Sentence> & sents) {
   ifstream iftrain(filename.c_str());
   if(!iftrain) THROW_ERROR("Could not find training file: " << filename);
@@ -3,6 +3,8 @@
 #include <lamtram/sentence.h>
 #include <dynet/tensor.h>
 #include <boost/program_options.hpp>
+#include <functional>
+#include <memory>
 #include <string>
 
 namespace dynet {
@@ -14,12 +16,16 @@ class Dict;
 namespace lamtram {
 
 class EvalMeasure;
+class LLStats;
+class CheckpointWriter;
+class AsyncEvaluator;
+template <class OutputType> class BilingualStream;
 
 
 class LamtramTrain {
 
 public:
-    LamtramTrain() { }
+    LamtramTrain() : hogwild_trainer_(nullptr) { }
     int main(int argc, char** argv);
     
     void TrainLM();
@@ -39,7 +45,8 @@ public:
                            const dynet::Dict & vocab_src,
                            const dynet::Dict & vocab_trg,
                            dynet::Model & mod,
-                           ModelType & encdec);
+                           ModelType & encdec,
+                           BilingualStream<OutputType> * train_stream = nullptr);
 
     // Minimum risk training
     template<class ModelType>
@@ -50,15 +57,45 @@ public:
                          const std::vector<Sentence> & dev_trg,
                          const dynet::Dict & vocab_src,
                          const dynet::Dict & vocab_trg,
-                         const EvalMeasure & eval,
+                         EvalMeasure & eval,
                          dynet::Model & model,
                          ModelType & encdec);
 
+    // Perform num_steps training steps over train_workers_ forked processes,
+    // which update the parameters in shared memory without locking (Hogwild).
+    // step(i, stats) trains on the i-th minibatch, and the statistics of all
+    // workers are added to stats. The workers' updates are added to the
+    // trainer's counters afterwards, so within a round each worker's step
+    // count (e.g. for Adam's bias correction) only includes its own updates.
+    void HogwildTraining(int num_steps, dynet::Trainer & trainer,
+                         const std::function<void(int, LLStats &)> & step,
+                         LLStats & stats);
+
+    // Write the model with header (the vocabularies and model specification)
+    // to model_out_file_, in the background if --checkpoint_async is set
+    void WriteCheckpoint(const std::string & header, const dynet::Model & mod);
+
+    // Start evaluating the development set in --dev_workers processes, where
+    // eval(i, stats) evaluates the i-th minibatch and save() writes the model
+    void StartDevEval(AsyncEvaluator & dev_eval, int num_steps, int vocab,
+                      const std::function<void(int, LLStats &)> & eval,
+                      const std::function<void()> & save);
+    // Collect an evaluation still running at the end of training into
+    // dev_ll, and save the model if it is better than best_loss
+    void FinishDevEval(AsyncEvaluator & dev_eval, LLStats & dev_ll, dynet::real best_loss);
+
     // Get the trainer to use
     typedef std::shared_ptr<dynet::Trainer> TrainerPtr;
     TrainerPtr GetTrainer(const std::string & trainer_id, const dynet::real learning_rate, dynet::Model & model);
 
-    // Load in the training data
+    // If --train_stream_buffer is set, open the training data to be streamed
+    // during training and add its words to the vocabularies
+    template <class OutputType>
+    std::shared_ptr<BilingualStream<OutputType> > OpenTrainStream(dynet::Dict & vocab_src, dynet::Dict & vocab_trg);
+
+    // Load in the training data, either from text files or from the corpus
+    // binarized with lamtram-binarize given by --train_bin
+    void LoadTrainFiles(const std::vector<std::string> & filenames, const std::string & bin_suffix, bool add_last, dynet::Dict & vocab, std::vector<Sentence> & sents, std::vector<int> & file_ids);
     void LoadFile(const std::string filename, bool add_last, dynet::Dict & vocab, std::vector<Sentence> & sents);
     void LoadLabels(const std::string filename, dynet::Dict & vocab, std::vector<int> & labs);
     void LoadWeights(const std::string filename, std::vector<float> & weights);
@@ -73,15 +110,19 @@ protected:
 
     // Variable settings
     dynet::real rate_thresh_, rate_decay_;
-    int epochs_, context_, eval_every_;
+    int epochs_, context_, eval_every_, train_workers_, dev_workers_, dev_minibatch_size_;
     float scheduled_samp_, dropout_;
-    std::string model_in_file_, model_out_file_;
+    std::string model_in_file_, model_out_file_, model_format_;
     std::vector<std::string> train_files_trg_, train_files_src_, train_files_weights_, train_files_kickout_keep_;
-    std::string dev_file_trg_, dev_file_src_;
+    std::string dev_file_trg_, dev_file_src_, train_bin_;
     std::string softmax_sig_;
 
     std::vector<std::string> wildcards_;
 
+    std::shared_ptr<CheckpointWriter> checkpoint_;
+    // The trainer whose state has been allocated for Hogwild training
+    const dynet::Trainer * hogwild_trainer_;
+
 };
 
 }
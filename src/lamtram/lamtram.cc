@@ -14,10 +14,23 @@
 #include <lamtram/mapping.h>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/stream.hpp>
 #include <dynet/dict.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+#include <unistd.h>
 
 using namespace std;
 using namespace lamtram;
@@ -47,6 +60,60 @@ void Lamtram::MapWords(const vector<string> & src_strs, const Sentence & trg_sen
   }
 }
 
+void Lamtram::PrintHyps(ostream & out, int id, const vector<string> & src_strs, const vector<EnsembleDecoderHypPtr> & trg_hyps, int nbest_size, dynet::Dict & vocab_trg, const UniqueStringMappingPtr & mapping) {
+  if(nbest_size == 1 && (trg_hyps.size() == 0 || trg_hyps[0].get() == nullptr)) {
+    out << endl;
+    return;
+  }
+  for(auto & trg_hyp : trg_hyps) {
+    if(trg_hyp.get() != nullptr) {
+      const Sentence & sent_trg = trg_hyp->GetSentence();
+      vector<string> str_trg = ConvertWords(vocab_trg, sent_trg, false);
+      MapWords(src_strs, sent_trg, trg_hyp->GetAlignment(), mapping, str_trg);
+      if(nbest_size == 1) {
+        out << PrintWords(str_trg) << endl;
+        return;
+      }
+      out << id << " ||| " << PrintWords(str_trg) << " ||| " << trg_hyp->GetScore() << endl;
+    }
+  }
+}
+
+void Lamtram::Serve(istream & in, ostream & out, EnsembleDecoder & decoder, dynet::Dict * vocab_src, dynet::Dict & vocab_trg, const UniqueStringMappingPtr & mapping, int nbest_size) {
+  string line;
+  vector<string> str_src;
+  Sentence sent_src;
+  for(int i = 0; getline(in, line); ++i) {
+    if(vocab_src != nullptr) {
+      str_src = SplitWords(line);
+      sent_src = ParseWords(*vocab_src, str_src, false);
+    }
+    PrintHyps(out, i, str_src, decoder.GenerateNbest(sent_src, nbest_size), nbest_size, vocab_trg, mapping);
+    if(nbest_size != 1) out << endl;
+    out.flush();
+  }
+}
+
+void Lamtram::ServeSocket(int sock, EnsembleDecoder & decoder, dynet::Dict * vocab_src, dynet::Dict & vocab_trg, const UniqueStringMappingPtr & mapping, int nbest_size) {
+  while(true) {
+    int conn = accept(sock, NULL, NULL);
+    if(conn < 0) {
+      if(errno == EINTR || errno == ECONNABORTED) continue;
+      THROW_ERROR("Could not accept connection: " << strerror(errno));
+    }
+    // A bad request or a client that goes away only ends its own connection
+    try {
+      boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_source> in_buffer(conn, boost::iostreams::never_close_handle);
+      boost::iostreams::stream_buffer<boost::iostreams::file_descriptor_sink> out_buffer(conn, boost::iostreams::close_handle);
+      istream conn_in(&in_buffer);
+      ostream conn_out(&out_buffer);
+      Serve(conn_in, conn_out, decoder, vocab_src, vocab_trg, mapping, nbest_size);
+    } catch(std::exception & e) {
+      cerr << "Error serving connection: " << e.what() << endl;
+    }
+  }
+}
+
 int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm) {
   // Models
   vector<NeuralLMPtr> lms;
@@ -134,6 +201,35 @@ int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm)
   decoder.SetEnsembleOperation(vm["ensemble_op"].as<string>());
   decoder.SetBeamSize(vm["beam"].as<int>());
   decoder.SetSizeLimit(vm["max_len"].as<int>());
+  decoder.SetBatchBeam(vm["beam_batch"].as<bool>());
+  decoder.SetBeamCands(vm["beam_cands"].as<int>());
+  decoder.SetEncoderCache(vm["encoder_cache"].as<int>());
+  if(vm["quantize"].as<string>() != "float" && !vm["graph_free"].as<bool>())
+    THROW_ERROR("--quantize can only be used with --graph_free");
+  if(vm["graph_free"].as<bool>() && !decoder.SetGraphFree(true, vm["quantize"].as<string>()))
+    cerr << "WARNING: --graph_free only supports models with lstm layers, a full or multilayer:*:full softmax and attention without a lexicon, using computation graphs" << endl;
+  int shortlist_size = vm["shortlist_size"].as<int>(), shortlist_trans = vm["shortlist_trans"].as<int>();
+  if(shortlist_size > 0 || shortlist_trans > 0) {
+    // Find the most frequent words in the target text
+    vector<WordId> shortlist_words;
+    if(shortlist_size > 0) {
+      string count_file = vm["shortlist_count"].as<string>();
+      ifstream count_in(count_file);
+      if(!count_in)
+        THROW_ERROR("Could not find shortlist_count file " << count_file);
+      vector<pair<int,WordId> > counts(vocab_size);
+      for(int i = 0; i < vocab_size; i++) counts[i].second = i;
+      string line;
+      while(getline(count_in, line))
+        for(WordId wid : ParseWords(*vocab_trg, line, false))
+          counts[wid].first++;
+      shortlist_size = min(shortlist_size, vocab_size);
+      partial_sort(counts.begin(), counts.begin() + shortlist_size, counts.end(), greater<pair<int,WordId> >());
+      for(int i = 0; i < shortlist_size && counts[i].first > 0; i++)
+        shortlist_words.push_back(counts[i].second);
+    }
+    decoder.SetShortlist(shortlist_words, shortlist_trans);
+  }
 
   
   // Perform operation
@@ -231,36 +327,124 @@ int Lamtram::SequenceOperation(const boost::program_options::variables_map & vm)
     }
   } else if(operation == "gen" || operation == "samp") {
     if(operation == "samp") THROW_ERROR("Sampling not implemented yet");
-    for(int i = 0; i < sent_range.second; ++i) {
-      if(encdecs.size() + encatts.size() > 0) {
-        if(!getline(*src_in, line)) break;
-        str_src = SplitWords(line);
-        sent_src = ParseWords(*vocab_src, str_src, false);
-      }
-      if(i >= sent_range.first) {
-        if(nbest_size == 1) {
-          EnsembleDecoderHypPtr trg_hyp = decoder.Generate(sent_src);
-          if(trg_hyp.get() == nullptr) {
-            cout << endl;
-          } else {
-            sent_trg = trg_hyp->GetSentence();
-            align = trg_hyp->GetAlignment();
-            str_trg = ConvertWords(*vocab_trg, sent_trg, false);
-            MapWords(str_src, sent_trg, align, mapping, str_trg);
-            cout << PrintWords(str_trg) << endl;
-          }
-        } else {
-          auto trg_hyps = decoder.GenerateNbest(sent_src, nbest_size);
-          for(auto & trg_hyp : trg_hyps) {
-            if(trg_hyp.get() != nullptr) {
-              sent_trg = trg_hyp->GetSentence();
-              align = trg_hyp->GetAlignment();
-              str_trg = ConvertWords(*vocab_trg, sent_trg, false);
-              MapWords(str_src, sent_trg, align, mapping, str_trg);
-              cout << i << " ||| " << PrintWords(str_trg) << " ||| " << trg_hyp->GetScore() << endl;
+    if(max_minibatch_size > 1 && encdecs.size() + encatts.size() > 0) {
+      // Read the sources in chunks of a few minibatches, and decode each chunk
+      // in batches of equal length so no padding is needed. Each chunk is
+      // printed in the original order before the next one is read.
+      int chunk_words = 10 * max_minibatch_size;
+      vector<vector<string> > strs_src;
+      vector<Sentence> sents_src;
+      size_t i = 0;
+      for(; i < sent_range.first && getline(*src_in, line); ++i) { }
+      bool more_input = true;
+      while(more_input) {
+        size_t chunk_start = i;
+        int curr_words = 0;
+        strs_src.resize(0); sents_src.resize(0);
+        while(curr_words < chunk_words && (more_input = (i < sent_range.second && getline(*src_in, line)))) {
+          ++i;
+          strs_src.push_back(SplitWords(line));
+          sents_src.push_back(ParseWords(*vocab_src, *strs_src.rbegin(), false));
+          curr_words += sents_src.rbegin()->size();
+        }
+        vector<int> order(sents_src.size());
+        for(size_t j = 0; j < order.size(); j++) order[j] = j;
+        stable_sort(order.begin(), order.end(), [&](int a, int b) { return sents_src[a].size() < sents_src[b].size(); });
+        vector<string> outputs(sents_src.size());
+        vector<int> batch_ids;
+        vector<Sentence> batch_srcs;
+        int batch_words = 0;
+        for(size_t j = 0; j <= order.size(); j++) {
+          // Decode the batch if it is full or the length changes
+          if(batch_ids.size() > 0 && (j == order.size() || sents_src[order[j]].size() != batch_srcs[0].size() || batch_words + (int)sents_src[order[j]].size() > max_minibatch_size)) {
+            vector<vector<EnsembleDecoderHypPtr> > trg_hyps = decoder.GenerateNbest(batch_srcs, nbest_size);
+            for(size_t k = 0; k < batch_ids.size(); k++) {
+              ostringstream oss;
+              PrintHyps(oss, batch_ids[k] + chunk_start, strs_src[batch_ids[k]], trg_hyps[k], nbest_size, *vocab_trg, mapping);
+              outputs[batch_ids[k]] = oss.str();
             }
+            batch_ids.resize(0); batch_srcs.resize(0); batch_words = 0;
+          }
+          if(j == order.size()) break;
+          batch_ids.push_back(order[j]);
+          batch_srcs.push_back(sents_src[order[j]]);
+          batch_words += sents_src[order[j]].size();
+        }
+        // Output in the original order
+        for(auto & output : outputs)
+          cout << output;
+        cout.flush();
+      }
+    } else {
+      for(int i = 0; i < sent_range.second; ++i) {
+        if(encdecs.size() + encatts.size() > 0) {
+          if(!getline(*src_in, line)) break;
+          str_src = SplitWords(line);
+          sent_src = ParseWords(*vocab_src, str_src, false);
+        }
+        if(i >= sent_range.first)
+          PrintHyps(cout, i, str_src, decoder.GenerateNbest(sent_src, nbest_size), nbest_size, *vocab_trg, mapping);
+      }
+    }
+  } else if(operation == "serve") {
+    string socket_path = vm["socket"].as<string>();
+    if(socket_path == "") {
+      Serve(cin, cout, decoder, vocab_src.get(), *vocab_trg, mapping, nbest_size);
+    } else {
+      // Listen on a local socket
+      int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(sock < 0) THROW_ERROR("Could not create socket: " << strerror(errno));
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if(socket_path.size() >= sizeof(addr.sun_path))
+        THROW_ERROR("Socket path is too long: " << socket_path);
+      strcpy(addr.sun_path, socket_path.c_str());
+      unlink(socket_path.c_str());
+      if(::bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0)
+        THROW_ERROR("Could not listen on socket " << socket_path << ": " << strerror(errno));
+      // Don't let a client that hangs up kill the worker
+      signal(SIGPIPE, SIG_IGN);
+      // Fork the workers only after the models are loaded, so they all share
+      // the same copy of the parameters. Each one has its own computation
+      // graph. The parent only supervises them, and reforks any that exit.
+      int num_workers = vm["workers"].as<int>();
+      if(num_workers <= 0) THROW_ERROR("--workers must be at least one");
+      cerr << "Listening on " << socket_path << " with " << num_workers << " workers" << endl;
+      pid_t parent = getpid();
+      auto start_worker = [&]() {
+        pid_t pid = fork();
+        if(pid < 0) THROW_ERROR("Could not fork worker: " << strerror(errno));
+        if(pid != 0) return;
+#ifdef __linux__
+        // Exit with the parent, rather than keep listening as an orphan
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+        int ret = 0;
+        if(getppid() == parent) {
+          try {
+            ServeSocket(sock, decoder, vocab_src.get(), *vocab_trg, mapping, nbest_size);
+          } catch(std::exception & e) {
+            cerr << "Worker failed: " << e.what() << endl;
+            ret = 1;
           }
         }
+        _exit(ret);
+      };
+      for(int i = 0; i < num_workers; ++i)
+        start_worker();
+      while(true) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if(pid < 0) {
+          if(errno == EINTR) continue;
+          THROW_ERROR("Could not wait for workers: " << strerror(errno));
+        }
+        cerr << "Worker " << pid << (WIFSIGNALED(status) ? " was killed by signal " : " exited with status ")
+             << (WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status)) << ", restarting" << endl;
+        // Don't refork in a tight loop if workers die right away
+        sleep(1);
+        start_worker();
       }
     }
   } else {
@@ -365,17 +549,27 @@ int Lamtram::main(int argc, char** argv) {
     ("help", "Produce help message")
     ("verbose", po::value<int>()->default_value(0), "How much verbose output to print")
     ("beam", po::value<int>()->default_value(1), "Number of hypotheses to expand")
+    ("beam_cands", po::value<int>()->default_value(0), "Maximum number of words to expand from each hypothesis in the beam (0 for the beam size)")
+    ("beam_batch", po::value<bool>()->default_value(false), "Calculate all hypotheses in the beam as a single minibatch")
     ("dynet_mem", po::value<int>()->default_value(512), "How much memory to allocate to dynet")
+    ("encoder_cache", po::value<int>()->default_value(0), "Number of recent source sentences to keep the encodings of, to avoid re-encoding them when each is scored several times (e.g. n-best lists)")
+    ("graph_free", po::value<bool>()->default_value(false), "When generating with models that have lstm layers, a full or multilayer:*:full softmax and attention without a lexicon, run the decoders on copies of their weights without building computation graphs (sources are still encoded with a graph)")
     ("ensemble_op", po::value<string>()->default_value("sum"), "The operation to use when ensembling probabilities (sum/logsum)")
     ("wordprob_out", po::value<string>()->default_value(""), "Output word log probabilities during perplexity calculation")
     ("map_in", po::value<string>()->default_value(""), "A file containing a mapping table (\"src trg prob\" format)")
-    ("minibatch_size", po::value<int>()->default_value(1), "Max size of a minibatch in words (may be exceeded if there are longer sentences)")
+    ("minibatch_size", po::value<int>()->default_value(1), "Max size of a minibatch in words (may be exceeded if there are longer sentences). When generating, the number of source words to translate at once")
     ("models_in", po::value<string>()->default_value(""), "Model files in format \"{encdec,encatt,nlm}=filename\" with encdec for encoder-decoders, encatt for attentional models, nlm for language models. When multiple, separate by a pipe.")
     ("nbest_size", po::value<int>()->default_value(1), "The size of an n-best to generate when generating n-best")
-    ("operation", po::value<string>()->default_value("ppl"), "Operations (ppl: measure perplexity, nbest: score n-best list, gen: generate most likely sentence, samp: sample sentences randomly)")
+    ("operation", po::value<string>()->default_value("ppl"), "Operations (ppl: measure perplexity, nbest: score n-best list, gen: generate most likely sentence, samp: sample sentences randomly, serve: keep the models loaded and translate requests one line at a time)")
+    ("quantize", po::value<string>()->default_value("float"), "With --graph_free, multiply the decoders' weight matrices with float, int8 (scaled per row, with the inputs also quantized to 8 bits) or fp16 values. This only applies to models --graph_free supports (lstm decoders with a full softmax and attention without a lexicon), and encoders always run in float in a graph")
     ("sent_range", po::value<string>()->default_value(""), "Optionally specify a comma-delimited range on how many sentences to process")
     ("max_len", po::value<int>()->default_value(200), "Limit on the max length of sentences")
+    ("shortlist_count", po::value<string>()->default_value(""), "A target language text to count frequent words for --shortlist_size")
+    ("shortlist_size", po::value<int>()->default_value(0), "When generating, only score this many of the most frequent words plus the words in --shortlist_trans")
+    ("shortlist_trans", po::value<int>()->default_value(0), "When generating, only score this many translations of each source word in the attentional lexicon (attention_lex) plus the words in --shortlist_size")
+    ("socket", po::value<string>()->default_value(""), "When serving, the path of a local socket to accept requests on, or read from stdin if empty")
     ("src_in", po::value<string>()->default_value("-"), "File to read the source from, if any")
+    ("workers", po::value<int>()->default_value(1), "When serving on a socket, the number of worker processes to handle requests, which are restarted if they exit")
     ("word_pen", po::value<float>()->default_value(0.f), "The \"word penalty\", a larger value favors longer sentences, shorter favors shorter")
     ("unk_pen", po::value<float>()->default_value(0.f), "A penalty for unknown words, larger will create fewer unknown words when decoding")
     ;
@@ -3,6 +3,9 @@
 #include <boost/program_options.hpp>
 #include <lamtram/sentence.h>
 #include <lamtram/mapping.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/ensemble-decoder.h>
+#include <iostream>
 
 namespace lamtram {
 
@@ -13,6 +16,17 @@ public:
 
   void MapWords(const std::vector<std::string> & src_strs, const Sentence & trg_sent, const Sentence & align, const UniqueStringMappingPtr & mapping, std::vector<std::string> & trg_strs);
 
+  // Print the 1-best sentence, or the n-best list in "id ||| words ||| score" format
+  void PrintHyps(std::ostream & out, int id, const std::vector<std::string> & src_strs, const std::vector<EnsembleDecoderHypPtr> & trg_hyps, int nbest_size, dynet::Dict & vocab_trg, const UniqueStringMappingPtr & mapping);
+
+  // Translate each line of the input as a source sentence, flushing after every
+  // result. N-best lists are terminated by an empty line.
+  void Serve(std::istream & in, std::ostream & out, EnsembleDecoder & decoder, dynet::Dict * vocab_src, dynet::Dict & vocab_trg, const UniqueStringMappingPtr & mapping, int nbest_size);
+
+  // Accept connections on a listening socket and Serve each one in turn.
+  // Errors in a connection are reported and only close that connection.
+  void ServeSocket(int sock, EnsembleDecoder & decoder, dynet::Dict * vocab_src, dynet::Dict & vocab_trg, const UniqueStringMappingPtr & mapping, int nbest_size);
+
   Lamtram() { }
   int main(int argc, char** argv);
 
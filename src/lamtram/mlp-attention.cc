@@ -0,0 +1,78 @@
+#include <lamtram/mlp-attention.h>
+#include <lamtram/macros.h>
+#include <dynet/tensor.h>
+#include <Eigen/Dense>
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+using namespace lamtram;
+
+// The values of batch element b, broadcasting tensors with a single element
+inline float* BatchPtr(const dynet::Tensor & t, unsigned b) {
+  return t.v + (b % t.d.bd) * t.d.batch_size();
+}
+
+dynet::Dim MLPAttentionNode::dim_forward(const std::vector<dynet::Dim> & xs) const {
+  if(xs.size() != 3)
+    THROW_ERROR("MLPAttention takes three arguments, but got " << xs.size());
+  unsigned hid = xs[0].rows();
+  if(xs[1].rows() != hid || xs[1].cols() != 1 || xs[2].rows() != 1 || xs[2].cols() != hid || xs[2].bd != 1)
+    THROW_ERROR("Bad dimensions in MLPAttention: " << xs[0] << ", " << xs[1] << ", " << xs[2]);
+  if(xs[0].bd != xs[1].bd && xs[0].bd != 1 && xs[1].bd != 1)
+    THROW_ERROR("Mismatched batch sizes in MLPAttention: " << xs[0].bd << " != " << xs[1].bd);
+  return dynet::Dim({(long)xs[0].cols(), 1}, max(xs[0].bd, xs[1].bd));
+}
+
+std::string MLPAttentionNode::as_string(const std::vector<std::string> & args) const {
+  ostringstream s;
+  s << "mlp_attention(" << args[0] << ", " << args[1] << ", " << args[2] << ')';
+  return s.str();
+}
+
+// The tanh activations of the hidden layer for batch element b
+inline Eigen::ArrayXXf Activations(const std::vector<const dynet::Tensor*> & xs, unsigned b) {
+  const unsigned hid = xs[0]->d.rows(), len = xs[0]->d.cols();
+  Eigen::Map<const Eigen::MatrixXf> hpart(BatchPtr(*xs[0], b), hid, len);
+  Eigen::Map<const Eigen::VectorXf> spart(BatchPtr(*xs[1], b), hid);
+  return (hpart.colwise() + spart).array().tanh();
+}
+
+void MLPAttentionNode::forward_impl(const std::vector<const dynet::Tensor*> & xs, dynet::Tensor & fx) const {
+#ifdef HAVE_CUDA
+  THROW_ERROR("MLPAttention is only implemented on the CPU");
+#endif
+  const unsigned hid = xs[0]->d.rows(), len = xs[0]->d.cols();
+  Eigen::Map<const Eigen::VectorXf> v(xs[2]->v, hid);
+  for(unsigned b = 0; b < fx.d.bd; ++b) {
+    Eigen::Map<Eigen::VectorXf> e(BatchPtr(fx, b), len);
+    e.noalias() = Activations(xs, b).matrix().transpose() * v;
+  }
+}
+
+void MLPAttentionNode::backward_impl(const std::vector<const dynet::Tensor*> & xs,
+                                     const dynet::Tensor & fx,
+                                     const dynet::Tensor & dEdf,
+                                     unsigned i,
+                                     dynet::Tensor & dEdxi) const {
+  const unsigned hid = xs[0]->d.rows(), len = xs[0]->d.cols();
+  Eigen::Map<const Eigen::VectorXf> v(xs[2]->v, hid);
+  // The activations are not kept, so recalculate them here
+  for(unsigned b = 0; b < fx.d.bd; ++b) {
+    Eigen::Map<const Eigen::VectorXf> de(BatchPtr(dEdf, b), len);
+    Eigen::ArrayXXf t = Activations(xs, b);
+    if(i == 2) {
+      Eigen::Map<Eigen::VectorXf> dv(dEdxi.v, hid);
+      dv.noalias() += t.matrix() * de;
+    } else {
+      // The gradient of the input to tanh
+      Eigen::ArrayXXf d = (1.f - t.square()) * (v * de.transpose()).array();
+      if(i == 0) Eigen::Map<Eigen::MatrixXf>(BatchPtr(dEdxi, b), hid, len) += d.matrix();
+      else       Eigen::Map<Eigen::VectorXf>(BatchPtr(dEdxi, b), hid) += d.rowwise().sum().matrix();
+    }
+  }
+}
+
+dynet::Expression lamtram::MLPAttention(const dynet::Expression & hpart, const dynet::Expression & spart, const dynet::Expression & v) {
+  return dynet::Expression(hpart.pg, hpart.pg->add_function<MLPAttentionNode>({hpart.i, spart.i, v.i}));
+}
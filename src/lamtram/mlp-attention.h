@@ -0,0 +1,33 @@
+#pragma once
+
+#include <dynet/dynet.h>
+#include <dynet/expr.h>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// Calculates the scores of MLP attention, v * tanh(hpart + spart), in a
+// single node. hpart is the precomputed {hidden_size, sent_len} projection of
+// the encoder states, spart is the {hidden_size} projection of the decoder
+// state, and v is {1, hidden_size}. hpart and spart may each hold one batch
+// element, which is broadcast, or one for each hypothesis, so a whole beam is
+// scored at once without expanding the {hidden_size, sent_len} activations
+// into the graph. The result is {sent_len, 1}.
+struct MLPAttentionNode : public dynet::Node {
+  explicit MLPAttentionNode(const std::initializer_list<dynet::VariableIndex> & a) : dynet::Node(a) { }
+  virtual dynet::Dim dim_forward(const std::vector<dynet::Dim> & xs) const override;
+  virtual std::string as_string(const std::vector<std::string> & args) const override;
+  virtual bool supports_multibatch() const override { return true; }
+  virtual void forward_impl(const std::vector<const dynet::Tensor*> & xs, dynet::Tensor & fx) const override;
+  virtual void backward_impl(const std::vector<const dynet::Tensor*> & xs,
+                             const dynet::Tensor & fx,
+                             const dynet::Tensor & dEdf,
+                             unsigned i,
+                             dynet::Tensor & dEdxi) const override;
+};
+
+// Add an MLPAttentionNode to the graph
+dynet::Expression MLPAttention(const dynet::Expression & hpart, const dynet::Expression & spart, const dynet::Expression & v);
+
+}
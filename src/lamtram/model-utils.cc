@@ -5,11 +5,16 @@
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/encoder-classifier.h>
 #include <lamtram/neural-lm.h>
+#include <lamtram/quantized-matrix.h>
 #include <dynet/model.h>
 #include <dynet/dict.h>
 #include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <cstdint>
 #include <fstream>
+#include <sstream>
 
 using namespace std;
 using namespace lamtram;
@@ -23,6 +28,152 @@ void ModelUtils::ReadModelText(istream & in, dynet::Model & mod) {
     ia >> mod;
 }
 
+// Each tensor is written as its number of values followed by the values in
+// the host's float format
+inline void WriteValuesBinary(ostream & out, const vector<float> & vals) {
+    uint64_t size = vals.size();
+    out.write((const char*)&size, sizeof(size));
+    out.write((const char*)vals.data(), sizeof(float)*size);
+}
+inline void ReadTensorBinary(istream & in, dynet::Tensor & tens) {
+    uint64_t size;
+    in.read((char*)&size, sizeof(size));
+    if(!in || size != tens.d.size())
+        THROW_ERROR("Parameter size in binary model (" << size << ") doesn't match model (" << tens.d.size() << ")");
+    vector<float> vals(size);
+    in.read((char*)vals.data(), sizeof(float)*size);
+    if(!in) THROW_ERROR("Binary model file was truncated");
+    dynet::TensorTools::SetElements(tens, vals);
+}
+
+// Quantized models write each tensor as its number of values followed by a
+// QuantizedMatrix, with only the weight matrices in reduced precision
+inline void WriteValuesQuantized(ostream & out, const vector<float> & vals, int rows, const string & quant) {
+    uint64_t size = vals.size();
+    out.write((const char*)&size, sizeof(size));
+    int cols = size / rows;
+    QuantizedMatrix(vals.data(), rows, cols, (cols > 1 ? quant : "float")).Write(out);
+}
+inline void ReadTensorQuantized(istream & in, dynet::Tensor & tens) {
+    uint64_t size;
+    in.read((char*)&size, sizeof(size));
+    if(!in || size != tens.d.size())
+        THROW_ERROR("Parameter size in binary model (" << size << ") doesn't match model (" << tens.d.size() << ")");
+    QuantizedMatrix mat;
+    mat.Read(in, tens.d.rows(), size / tens.d.rows());
+    dynet::TensorTools::SetElements(tens, mat.Dequantize());
+}
+
+void ModelUtils::SnapshotModel(const dynet::Model & mod, ModelSnapshot & snap) {
+    const auto & params = mod.parameters_list();
+    const auto & lookups = mod.lookup_parameters_list();
+    snap.num_params = params.size();
+    snap.values.resize(params.size() + lookups.size());
+    snap.rows.resize(params.size() + lookups.size());
+    size_t i = 0;
+    for(auto param : params) {
+        snap.values[i] = dynet::as_vector(param->values);
+        snap.rows[i++] = param->values.d.rows();
+    }
+    for(auto lookup : lookups) {
+        snap.values[i] = dynet::as_vector(lookup->all_values);
+        snap.rows[i++] = lookup->all_values.d.rows();
+    }
+}
+
+void ModelUtils::WriteSnapshotBinary(ostream & out, const ModelSnapshot & snap, const string & quant) {
+    size_t num_lookups = snap.values.size() - snap.num_params;
+    if(quant == "float") {
+        out << "lamtram_bin_001 " << snap.num_params << " " << num_lookups << endl;
+        for(auto & vals : snap.values) WriteValuesBinary(out, vals);
+    } else {
+        out << "lamtram_bin_002 " << snap.num_params << " " << num_lookups << endl;
+        for(size_t i = 0; i < snap.values.size(); i++)
+            WriteValuesQuantized(out, snap.values[i], snap.rows[i], (i < snap.num_params ? quant : "float"));
+    }
+}
+
+void ModelUtils::RestoreSnapshot(const ModelSnapshot & snap, dynet::Model & mod) {
+    const auto & params = mod.parameters_list();
+    const auto & lookups = mod.lookup_parameters_list();
+    if(snap.num_params != params.size() || snap.values.size() != params.size() + lookups.size())
+        THROW_ERROR("Number of parameters in snapshot (" << snap.num_params << ", " << snap.values.size() - snap.num_params << ") doesn't match model (" << params.size() << ", " << lookups.size() << ")");
+    size_t i = 0;
+    for(auto param : params) dynet::TensorTools::SetElements(param->values, snap.values[i++]);
+    for(auto lookup : lookups) dynet::TensorTools::SetElements(lookup->all_values, snap.values[i++]);
+}
+
+void ModelUtils::WriteModelBinary(ostream & out, const dynet::Model & mod, const string & quant) {
+    const auto & params = mod.parameters_list();
+    const auto & lookups = mod.lookup_parameters_list();
+    if(quant == "float") {
+        out << "lamtram_bin_001 " << params.size() << " " << lookups.size() << endl;
+        for(auto param : params) WriteValuesBinary(out, dynet::as_vector(param->values));
+        for(auto lookup : lookups) WriteValuesBinary(out, dynet::as_vector(lookup->all_values));
+    } else {
+        out << "lamtram_bin_002 " << params.size() << " " << lookups.size() << endl;
+        for(auto param : params) WriteValuesQuantized(out, dynet::as_vector(param->values), param->values.d.rows(), quant);
+        for(auto lookup : lookups) WriteValuesQuantized(out, dynet::as_vector(lookup->all_values), lookup->all_values.d.rows(), "float");
+    }
+}
+void ModelUtils::ReadModelBinary(istream & in, dynet::Model & mod) {
+    string line, version;
+    size_t num_params, num_lookups;
+    if(!getline(in, line))
+        THROW_ERROR("Premature end of model file");
+    istringstream iss(line);
+    iss >> version >> num_params >> num_lookups;
+    if(version != "lamtram_bin_001" && version != "lamtram_bin_002")
+        THROW_ERROR("Expecting a binary model of version lamtram_bin_001 or lamtram_bin_002, but got: " << line);
+    const auto & params = mod.parameters_list();
+    const auto & lookups = mod.lookup_parameters_list();
+    if(num_params != params.size() || num_lookups != lookups.size())
+        THROW_ERROR("Number of parameters in binary model (" << num_params << ", " << num_lookups << ") doesn't match model (" << params.size() << ", " << lookups.size() << ")");
+    if(version == "lamtram_bin_001") {
+        for(auto param : params) ReadTensorBinary(in, param->values);
+        for(auto lookup : lookups) ReadTensorBinary(in, lookup->all_values);
+    } else {
+        for(auto param : params) ReadTensorQuantized(in, param->values);
+        for(auto lookup : lookups) ReadTensorQuantized(in, lookup->all_values);
+    }
+}
+
+void ModelUtils::WriteModel(ostream & out, const dynet::Model & mod, const string & format) {
+    if(format == "text")
+        WriteModelText(out, mod);
+    else if(format == "binary")
+        WriteModelBinary(out, mod);
+    else if(format == "int8" || format == "fp16")
+        WriteModelBinary(out, mod, format);
+    else
+        THROW_ERROR("Illegal model format: " << format);
+}
+void ModelUtils::ReadModel(istream & in, dynet::Model & mod) {
+    // Text archives start with a number, binary models with the version
+    in >> ws;
+    if(in.peek() == 'l')
+        ReadModelBinary(in, mod);
+    else
+        ReadModelText(in, mod);
+}
+
+// Open a stream over a model file. Regular files are memory mapped, which
+// saves reading them through a stream buffer, but the values are still
+// copied into DyNet's memory, so processes don't share them. Files that
+// can't be mapped (pipes, /dev/stdin, empty files) are read with ifstream.
+inline shared_ptr<istream> OpenModelFile(const std::string & file) {
+    shared_ptr<istream> ret;
+    try {
+        ret.reset(new boost::iostreams::stream<boost::iostreams::mapped_file_source>(file));
+    } catch(std::exception &) {
+        ret.reset();
+    }
+    if(!ret.get() || !*ret)
+        ret.reset(new ifstream(file));
+    if(!*ret) THROW_ERROR("Could not open model file " << file);
+    return ret;
+}
+
 
 // Load a model from a stream
 // Will return a pointer to the model, and reset the passed shared pointers
@@ -35,20 +186,19 @@ ModelType* ModelUtils::LoadBilingualModel(std::istream & model_in,
     vocab_trg.reset(ReadDict(model_in));
     mod.reset(new dynet::Model);
     ModelType* ret = ModelType::Read(vocab_src, vocab_trg, model_in, *mod);
-    ModelUtils::ReadModelText(model_in, *mod);
+    ModelUtils::ReadModel(model_in, *mod);
     return ret;
 }
 
-// Load a model from a text file
+// Load a model from a file
 // Will return a pointer to the model, and reset the passed shared pointers
 // with dynet::Model, and input, output vocabularies (if necessary)
 template <class ModelType>
 ModelType* ModelUtils::LoadBilingualModel(const std::string & file,
                                           std::shared_ptr<dynet::Model> & mod,
                                           DictPtr & vocab_src, DictPtr & vocab_trg) {
-    ifstream model_in(file);
-    if(!model_in) THROW_ERROR("Could not open model file " << file);
-    return ModelUtils::LoadBilingualModel<ModelType>(model_in, mod, vocab_src, vocab_trg);
+    shared_ptr<istream> model_in = OpenModelFile(file);
+    return ModelUtils::LoadBilingualModel<ModelType>(*model_in, mod, vocab_src, vocab_trg);
 }
 
 // Load a model from a stream
@@ -61,20 +211,19 @@ ModelType* ModelUtils::LoadMonolingualModel(std::istream & model_in,
     vocab_trg.reset(ReadDict(model_in));
     mod.reset(new dynet::Model);
     ModelType* ret = ModelType::Read(vocab_trg, model_in, *mod);
-    ModelUtils::ReadModelText(model_in, *mod);
+    ModelUtils::ReadModel(model_in, *mod);
     return ret;
 }
 
-// Load a model from a text file
+// Load a model from a file
 // Will return a pointer to the model, and reset the passed shared pointers
 // with dynet::Model, and input, output vocabularies (if necessary)
 template <class ModelType>
 ModelType* ModelUtils::LoadMonolingualModel(const std::string & file,
                                           std::shared_ptr<dynet::Model> & mod,
                                           DictPtr & vocab_trg) {
-    ifstream model_in(file);
-    if(!model_in) THROW_ERROR("Could not open model file " << file);
-    return ModelUtils::LoadMonolingualModel<ModelType>(model_in, mod, vocab_trg);
+    shared_ptr<istream> model_in = OpenModelFile(file);
+    return ModelUtils::LoadMonolingualModel<ModelType>(*model_in, mod, vocab_trg);
 }
 
 // Instantiate LoadModel
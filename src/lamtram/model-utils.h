@@ -4,6 +4,8 @@
 #include <dynet/dynet.h>
 #include <iostream>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace dynet {
 class Model;
@@ -11,11 +13,38 @@ class Model;
 
 namespace lamtram {
 
+// A copy of the values of every parameter and lookup parameter in a model,
+// which can be written while the model itself keeps changing
+struct ModelSnapshot {
+    ModelSnapshot() : num_params(0) { }
+    // The first num_params entries are the parameters, the rest the lookups
+    size_t num_params;
+    std::vector<std::vector<float> > values;
+    std::vector<int> rows;
+};
+
 class ModelUtils {
 public:
     static void WriteModelText(std::ostream & out, const dynet::Model & mod);
     static void ReadModelText(std::istream & in, dynet::Model & mod);
 
+    // Write/read the raw parameter values, preceded by a "lamtram_bin_001" line.
+    // If quant is "int8" or "fp16", the weight matrices are written with
+    // reduced precision as a "lamtram_bin_002" model, and read back as floats.
+    static void WriteModelBinary(std::ostream & out, const dynet::Model & mod, const std::string & quant = "float");
+    static void ReadModelBinary(std::istream & in, dynet::Model & mod);
+
+    // Copy the parameter values of mod, and write them as WriteModelBinary would
+    static void SnapshotModel(const dynet::Model & mod, ModelSnapshot & snap);
+    static void WriteSnapshotBinary(std::ostream & out, const ModelSnapshot & snap, const std::string & quant = "float");
+    // Set the parameter values of mod, which must have the same structure as
+    // the snapshotted model, to those in snap
+    static void RestoreSnapshot(const ModelSnapshot & snap, dynet::Model & mod);
+
+    // Write in the format specified by "text", "binary", "int8" or "fp16", and read any format
+    static void WriteModel(std::ostream & out, const dynet::Model & mod, const std::string & format);
+    static void ReadModel(std::istream & in, dynet::Model & mod);
+
     // Load a model from a stream
     // Will return a pointer to the model, and reset the passed shared pointers
     // with dynet::Model, and input, output vocabularies (if necessary)
@@ -24,7 +53,8 @@ public:
                                 std::shared_ptr<dynet::Model> & mod,
                                 DictPtr & vocab_src, DictPtr & vocab_trg);
 
-    // Load a model from a text file
+    // Load a model from a file, which is memory mapped if possible to save
+    // reading it through a stream buffer (the parameters are still copied)
     template <class ModelType>
     static ModelType* LoadBilingualModel(const std::string & infile,
                                 std::shared_ptr<dynet::Model> & mod,
@@ -38,7 +68,8 @@ public:
                                 std::shared_ptr<dynet::Model> & mod,
                                 DictPtr & vocab_trg);
 
-    // Load a model from a text file
+    // Load a model from a file, which is memory mapped if possible to save
+    // reading it through a stream buffer (the parameters are still copied)
     template <class ModelType>
     static ModelType* LoadMonolingualModel(const std::string & infile,
                                 std::shared_ptr<dynet::Model> & mod,
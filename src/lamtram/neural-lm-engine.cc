@@ -0,0 +1,207 @@
+#include <lamtram/neural-lm-engine.h>
+#include <lamtram/neural-lm.h>
+#include <lamtram/softmax-full.h>
+#include <lamtram/softmax-multilayer.h>
+#include <lamtram/encoder-attentional.h>
+#include <lamtram/macros.h>
+#include <dynet/model.h>
+#include <dynet/lstm.h>
+#include <dynet/tensor.h>
+#include <cmath>
+
+using namespace std;
+using namespace lamtram;
+
+Eigen::MatrixXf NeuralLMEngine::CopyMatrix(const dynet::Tensor & tensor) {
+  vector<float> vals = dynet::as_vector(tensor);
+  unsigned rows = tensor.d.rows();
+  return Eigen::Map<Eigen::MatrixXf>(vals.data(), rows, vals.size() / rows);
+}
+
+// Find the full softmax of lm, going through any multilayer softmaxes and
+// adding them to layers, or return nullptr if there is none
+inline const SoftmaxFull * FindSoftmaxFull(const NeuralLM & lm, std::vector<const SoftmaxMultiLayer*> & layers) {
+  const SoftmaxBase * softmax = &lm.GetSoftmax();
+  const SoftmaxMultiLayer * layer;
+  while((layer = dynamic_cast<const SoftmaxMultiLayer*>(softmax)) != nullptr) {
+    layers.push_back(layer);
+    softmax = &layer->GetSoftmax();
+  }
+  return dynamic_cast<const SoftmaxFull*>(softmax);
+}
+
+bool NeuralLMEngine::IsSupported(const NeuralLM & lm, const ExternAttentional * attention) {
+  std::vector<const SoftmaxMultiLayer*> layers;
+  bool extern_ok = (attention == nullptr ?
+                    lm.GetExternalContext() == 0 && !lm.GetExternFeed() :
+                    attention->GetLexType() == "none" && lm.GetExternalContext() == attention->GetContextSize());
+  return extern_ok &&
+         lm.GetHiddenSpec().type == "lstm" &&
+         dynamic_cast<dynet::VanillaLSTMBuilder*>(lm.GetBuilder().get()) != nullptr &&
+         FindSoftmaxFull(lm, layers) != nullptr;
+}
+
+NeuralLMEngine::NeuralLMEngine(const NeuralLM & lm, const ExternAttentional * attention) :
+      ngram_context_(lm.GetNgramContext()), wordrep_size_(lm.GetWordrepSize()),
+      num_layers_(lm.GetNumLayers()), num_nodes_(lm.GetNumNodes()),
+      state_size_(lm.GetNumLayers() * lm.GetNumNodes() * lm.GetLayerMultiplier()),
+      use_shortlist_(false), context_size_(0), extern_feed_(false), align_sum_(false), align_sum_W_(0.f) {
+  if(!IsSupported(lm, attention))
+    THROW_ERROR("Only models with lstm layers, a full softmax and attention without a lexicon can be run without a computation graph");
+  if(attention != nullptr) {
+    attention_type_ = attention->GetAttentionType();
+    context_size_ = attention->GetContextSize();
+    extern_feed_ = lm.GetExternFeed();
+    align_sum_ = (attention->GetAttentionHist() == "sum");
+    if(attention->GetHiddenSize()) {
+      att_state_W_ = QuantizedMatrix(CopyMatrix(attention->GetStateWeights().get()->values), "float");
+      att_score_W_ = CopyMatrix(attention->GetScoreWeights().get()->values).row(0);
+    }
+    if(align_sum_)
+      align_sum_W_ = CopyMatrix(attention->GetAlignSumWeight().get()->values)(0,0);
+  }
+  wr_W_ = CopyMatrix(lm.GetWordrepParams().get()->all_values);
+  // The parameters of each layer are the input, recurrent and bias weights
+  // of the input, forget, output and candidate gates, in that order
+  const auto & params = dynamic_cast<dynet::VanillaLSTMBuilder*>(lm.GetBuilder().get())->params;
+  for(int l = 0; l < num_layers_; l++) {
+    x2h_W_.push_back(QuantizedMatrix(CopyMatrix(params[l][0].get()->values), "float"));
+    h2h_W_.push_back(QuantizedMatrix(CopyMatrix(params[l][1].get()->values), "float"));
+    h_b_.push_back(CopyMatrix(params[l][2].get()->values).col(0));
+  }
+  std::vector<const SoftmaxMultiLayer*> layers;
+  const SoftmaxFull & softmax = *FindSoftmaxFull(lm, layers);
+  for(auto layer : layers) {
+    ml_W_.push_back(QuantizedMatrix(CopyMatrix(layer->GetWeights().get()->values), "float"));
+    ml_b_.push_back(CopyMatrix(layer->GetBias().get()->values).col(0));
+  }
+  sm_W_ = QuantizedMatrix(CopyMatrix(softmax.GetWeights().get()->values), "float");
+  sm_b_ = CopyMatrix(softmax.GetBias().get()->values).col(0);
+}
+
+int NeuralLMEngine::GetStateSize() const {
+  return state_size_ + (extern_feed_ ? context_size_ : 0) + (align_sum_ ? src_states_.cols() : 0);
+}
+
+void NeuralLMEngine::SetSource(const Eigen::MatrixXf & word_states, const Eigen::MatrixXf & word_states_part) {
+  if(!HasAttention())
+    THROW_ERROR("Setting the source of a model without attention");
+  src_states_ = word_states;
+  src_part_ = word_states_part;
+}
+
+void NeuralLMEngine::SetShortlist(const std::vector<unsigned> & words) {
+  use_shortlist_ = (words.size() > 0);
+  sl_W_ = sm_W_.SelectRows(words);
+  sl_b_.resize(words.size());
+  for(size_t i = 0; i < words.size(); i++)
+    sl_b_(i) = sm_b_(words[i]);
+}
+
+// Re-create a matrix with a different type
+inline void Requantize(QuantizedMatrix & mat, const std::string & type) {
+  if(mat.GetType() == type) return;
+  vector<float> vals = mat.Dequantize();
+  mat = QuantizedMatrix(vals.data(), mat.rows(), mat.cols(), type);
+}
+
+void NeuralLMEngine::Quantize(const std::string & type) {
+  if(!QuantizedMatrix::IsType(type))
+    THROW_ERROR("Bad quantization type (must be float/int8/fp16): " << type);
+  for(auto & mat : x2h_W_) Requantize(mat, type);
+  for(auto & mat : h2h_W_) Requantize(mat, type);
+  for(auto & mat : ml_W_) Requantize(mat, type);
+  if(att_state_W_.rows()) Requantize(att_state_W_, type);
+  Requantize(sm_W_, type);
+  use_shortlist_ = false;
+}
+
+void NeuralLMEngine::Forward(const std::vector<Sentence> & sents, int t,
+                             const Eigen::MatrixXf & states_in,
+                             Eigen::MatrixXf & states_out,
+                             Eigen::MatrixXf & log_probs) {
+  int num = sents.size(), n = num_nodes_;
+  int feed_size = (extern_feed_ ? context_size_ : 0), src_len = src_states_.cols();
+  if(HasAttention() && src_len == 0)
+    THROW_ERROR("The source must be set before running an attentional model");
+  // Concatenate the representations of the previous words, and the previous
+  // context if it is fed to the input
+  input_.resize(ngram_context_ * wordrep_size_ + feed_size, num);
+  for(int i = 0; i < num; i++) {
+    for(int j = 0; j < ngram_context_; j++) {
+      int hist = t - ngram_context_ + j;
+      WordId wid = (hist >= 0 && hist < (int)sents[i].size() ? sents[i][hist] : 0);
+      input_.block(j * wordrep_size_, i, wordrep_size_, 1) = wr_W_.col(wid);
+    }
+  }
+  if(feed_size)
+    input_.bottomRows(feed_size) = states_in.middleRows(state_size_, feed_size);
+  // Run the layers, with the cells first and hidden values second in the state
+  states_out.resize(states_in.rows(), num);
+  int h_start = num_layers_ * n;
+  for(int l = 0; l < num_layers_; l++) {
+    if(l == 0) x2h_W_[l].Multiply(input_, gates_);
+    else       x2h_W_[l].Multiply(states_out.middleRows(h_start + (l-1) * n, n), gates_);
+    h2h_W_[l].Multiply(states_in.middleRows(h_start + l * n, n), gates_, true);
+    gates_.colwise() += h_b_[l];
+    // The forget gate has a bias of one, as in the builder
+    gates_.middleRows(n, n).array() += 1.f;
+    gates_.topRows(3 * n) = (1.f + (-gates_.topRows(3 * n).array()).exp()).inverse().matrix();
+    gates_.bottomRows(n) = gates_.bottomRows(n).array().tanh().matrix();
+    states_out.middleRows(l * n, n) =
+      (gates_.middleRows(n, n).array() * states_in.middleRows(l * n, n).array() +
+       gates_.topRows(n).array() * gates_.bottomRows(n).array()).matrix();
+    states_out.middleRows(h_start + l * n, n) =
+      (gates_.middleRows(2 * n, n).array() * states_out.middleRows(l * n, n).array().tanh()).matrix();
+  }
+  // Attend over the source with the last hidden layer, and concatenate the
+  // context to it
+  if(HasAttention()) {
+    const auto & h_last = states_out.middleRows(h_start + (num_layers_-1) * n, n);
+    if(att_state_W_.rows()) {
+      // mlp: v * tanh(part + W * h) for each hypothesis
+      att_state_W_.Multiply(h_last, att_hidden_);
+      aligns_.resize(src_len, num);
+      for(int i = 0; i < num; i++)
+        aligns_.col(i) = (att_score_W_ * (src_part_.colwise() + att_hidden_.col(i)).array().tanh().matrix()).transpose();
+    } else {
+      // dot/bilin: the part is the transposed (projected) states
+      aligns_.noalias() = src_part_ * h_last;
+    }
+    if(align_sum_)
+      aligns_ += align_sum_W_ * states_in.bottomRows(src_len);
+    for(int i = 0; i < num; i++) {
+      aligns_.col(i).array() = (aligns_.col(i).array() - aligns_.col(i).maxCoeff()).exp();
+      aligns_.col(i) /= aligns_.col(i).sum();
+    }
+    hidden_.resize(n + context_size_, num);
+    hidden_.topRows(n) = h_last;
+    hidden_.bottomRows(context_size_).noalias() = src_states_ * aligns_;
+    if(feed_size)
+      states_out.middleRows(state_size_, feed_size) = hidden_.bottomRows(context_size_);
+    if(align_sum_)
+      states_out.bottomRows(src_len) = states_in.bottomRows(src_len) + aligns_;
+  } else {
+    hidden_ = states_out.middleRows(h_start + (num_layers_-1) * n, n);
+  }
+  // Run the tanh layers before the softmax, if any
+  for(size_t l = 0; l < ml_W_.size(); l++) {
+    ml_W_[l].Multiply(hidden_, gates_);
+    gates_.colwise() += ml_b_[l];
+    hidden_ = gates_.array().tanh().matrix();
+  }
+  // Calculate the log probabilities over the vocabulary or shortlist
+  const QuantizedMatrix & sm_W = (use_shortlist_ ? sl_W_ : sm_W_);
+  const Eigen::VectorXf & sm_b = (use_shortlist_ ? sl_b_ : sm_b_);
+  sm_W.Multiply(hidden_, log_probs);
+  log_probs.colwise() += sm_b;
+  LogSoftmax(log_probs);
+}
+
+void NeuralLMEngine::LogSoftmax(Eigen::MatrixXf & scores) {
+  for(int i = 0; i < scores.cols(); i++) {
+    float max_score = scores.col(i).maxCoeff();
+    float log_sum = max_score + log((scores.col(i).array() - max_score).exp().sum());
+    scores.col(i).array() -= log_sum;
+  }
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <lamtram/quantized-matrix.h>
+#include <Eigen/Dense>
+#include <memory>
+#include <vector>
+
+namespace dynet { struct Tensor; }
+
+namespace lamtram {
+
+class NeuralLM;
+class ExternAttentional;
+
+// Runs a trained NeuralLM for inference without building a computation
+// graph. The weights are copied into plain matrices, and each step moves
+// a whole beam of hypotheses forward with one matrix product per layer,
+// keeping their states in columns of preallocated buffers. The decoders of
+// encoder-decoder models are run the same way, starting from the encoded
+// states, and those of attentional models attend over the encoded source
+// passed to SetSource.
+class NeuralLMEngine {
+
+public:
+    // Copy the weights of lm, which must be supported. If lm is the decoder
+    // of an attentional model, attention is its extern calculator.
+    NeuralLMEngine(const NeuralLM & lm, const ExternAttentional * attention = nullptr);
+    ~NeuralLMEngine() { }
+
+    // Whether lm can be run by the engine: models with lstm hidden layers
+    // and a full softmax, optionally over multilayer hidden layers (as in
+    // the default "multilayer:0:full"), and either no extern context or
+    // attention with no lexicon
+    static bool IsSupported(const NeuralLM & lm, const ExternAttentional * attention = nullptr);
+
+    // Set the source sentence to attend over, as the {context_size, len}
+    // word states and their part of the attention scores from the
+    // ExternAttentional. Must be called before Forward for attentional models.
+    void SetSource(const Eigen::MatrixXf & word_states, const Eigen::MatrixXf & word_states_part);
+
+    // The number of values in the state of one hypothesis: the lstm state in
+    // the same order as the builder's final_s(), then for attentional models
+    // the previous context if it is fed to the input, and the sum of the
+    // previous alignments if used. The latter depends on the source length.
+    int GetStateSize() const;
+    // The number of values of the lstm state
+    int GetLayerStateSize() const { return state_size_; }
+    int GetVocabSize() const { return sm_b_.size(); }
+
+    // Only calculate the log probabilities of these words, which must be
+    // sorted. If empty, use the full vocabulary.
+    void SetShortlist(const std::vector<unsigned> & words);
+
+    // Store the LSTM and softmax weight matrices as "float", "int8" or
+    // "fp16" (see QuantizedMatrix), and multiply them in that precision
+    void Quantize(const std::string & type);
+
+    // Move the hypotheses sents forward one step, predicting word t.
+    //   states_in: column i is the state of sents[i], zero at the start
+    //     except for the encoded lstm state of encoder-decoder models
+    //   states_out: column i is the next state of sents[i]
+    //   log_probs: column i is the log probabilities of the next word
+    void Forward(const std::vector<Sentence> & sents, int t,
+                 const Eigen::MatrixXf & states_in,
+                 Eigen::MatrixXf & states_out,
+                 Eigen::MatrixXf & log_probs);
+
+    // Whether the model attends over the source, and the alignments of the
+    // last Forward, where column i is the attention of sents[i]
+    bool HasAttention() const { return attention_type_.size() > 0; }
+    const Eigen::MatrixXf & GetAlignments() const { return aligns_; }
+
+    // Normalize each column of scores into log probabilities
+    static void LogSoftmax(Eigen::MatrixXf & scores);
+
+    // Copy the values of a (possibly GPU) tensor into a matrix
+    static Eigen::MatrixXf CopyMatrix(const dynet::Tensor & tensor);
+
+protected:
+    int ngram_context_, wordrep_size_, num_layers_, num_nodes_, state_size_;
+
+    // Word representations, one column per word
+    Eigen::MatrixXf wr_W_;
+    // Input, recurrent and bias weights of each layer
+    std::vector<QuantizedMatrix> x2h_W_, h2h_W_;
+    std::vector<Eigen::VectorXf> h_b_;
+    // Weights and bias of the tanh layers before the softmax, if any
+    std::vector<QuantizedMatrix> ml_W_;
+    std::vector<Eigen::VectorXf> ml_b_;
+    // Softmax weights over the vocabulary and over the shortlist
+    QuantizedMatrix sm_W_, sl_W_;
+    Eigen::VectorXf sm_b_, sl_b_;
+    bool use_shortlist_;
+
+    // The attention type ("dot", "bilin" or "mlp:N", empty if none), and
+    // whether the context is fed to the input and alignments are summed
+    std::string attention_type_;
+    int context_size_;
+    bool extern_feed_, align_sum_;
+    // The weights of the decoder state and the score for mlp attention, and
+    // of the alignment sum
+    QuantizedMatrix att_state_W_;
+    Eigen::RowVectorXf att_score_W_;
+    float align_sum_W_;
+    // The states of the current source and their part of the scores
+    Eigen::MatrixXf src_states_, src_part_;
+
+    // Buffers reused between steps
+    Eigen::MatrixXf input_, gates_, hidden_, att_hidden_, aligns_;
+
+};
+
+typedef std::shared_ptr<NeuralLMEngine> NeuralLMEnginePtr;
+
+}
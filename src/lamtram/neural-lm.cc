@@ -9,6 +9,7 @@
 #include <dynet/rnn.h>
 #include <dynet/globals.h>
 #include <boost/range/irange.hpp>
+#include <Eigen/Dense>
 #include <ctime>
 #include <fstream>
 
@@ -119,18 +120,30 @@ dynet::Expression NeuralLM::BuildSentGraph(
   return i_nerr;
 }
 
-inline size_t categorical_dist(std::vector<float>::const_iterator beg, std::vector<float>::const_iterator end) {
-  float sum = 0.f;
-  for(auto it = beg; it != end; it++)
-    sum += *it;
-  std::uniform_real_distribution<float> dist(0.f,sum);
-  sum = dist(*dynet::rndeng);
-  for(auto it = beg; it != end; it++) {
-    sum -= *it;
-    if(sum < 0) return it-beg;
+// Sample a word from each column of the vocab_size x words.size() matrix of
+// probabilities whose mask is non-zero. The column sums are calculated for
+// all columns at once.
+inline void SampleWords(const std::vector<float> & probs, size_t vocab_size,
+                        const std::vector<float> & mask,
+                        std::vector<unsigned> & words) {
+  Eigen::Map<const Eigen::MatrixXf> prob_mat(probs.data(), vocab_size, words.size());
+  Eigen::RowVectorXf sums = prob_mat.colwise().sum();
+  for(size_t i = 0; i < words.size(); i++) {
+    if(!mask[i]) continue;
+    std::uniform_real_distribution<float> dist(0.f, sums(i));
+    float left = dist(*dynet::rndeng);
+    const float * col = prob_mat.col(i).data();
+    size_t j = 0;
+    for(; j < vocab_size; j++) {
+      left -= col[j];
+      if(left < 0) break;
+    }
+    if(j == vocab_size) {
+      cerr << "WARNING: overflowed sample, returning zero" << endl;
+      j = 0;
+    }
+    words[i] = j;
   }
-  cerr << "WARNING: overflowed sample, returning zero" << endl;
-  return 0;
 }
 
 dynet::Expression NeuralLM::BuildSentGraph(
@@ -226,8 +239,7 @@ dynet::Expression NeuralLM::BuildSentGraph(
         softmax_->CalcProb(i_h_t, i_prior, ctxts, train));
       i_err = -log(pick(i_prob, words));
       vector<float> probs = as_vector(i_prob.value());
-      for(size_t i = 0; i < ngrams.size(); i++)
-        words[i] = categorical_dist(probs.begin()+i*vocab_->size(), probs.begin()+(i+1)*vocab_->size());
+      SampleWords(probs, vocab_->size(), vector<float>(ngrams.size(), 1.f), words);
     // Otherwise, create the correct
     } else {
       i_err = (
@@ -249,11 +261,11 @@ dynet::Expression NeuralLM::BuildSentGraph(
   return i_nerr;
 }
 
-// Acquire samples from this sentence and return their log probabilities as a vector
+// Acquire samples for these sentences and return their log probabilities as a vector
 Expression NeuralLM::SampleTrgSentences(
                         const ExternCalculator * extern_calc,
                         const std::vector<dynet::Expression> & layer_in,
-                        const Sentence * answer,
+                        const std::vector<const Sentence*> & answers,
                         int num_samples,
                         int max_len,
                         bool train,
@@ -262,6 +274,9 @@ Expression NeuralLM::SampleTrgSentences(
   size_t nt;
   if(&cg != curr_graph_)
     THROW_ERROR("Initialized computation graph and passed comptuation graph don't match.");
+  // Each sentence is sampled num_samples times in one batch
+  int num_sents = answers.size();
+  num_samples *= num_sents;
   builder_->start_new_sequence(layer_in);
   // First get all the word representations
   vector<unsigned> words(num_samples, 0);
@@ -306,15 +321,17 @@ Expression NeuralLM::SampleTrgSentences(
     // Perform sampling if necessary
     dynet::Expression i_prob = softmax_->CalcProb(i_h_t, i_prior, ctxts, train);
     vector<float> probs = as_vector(i_prob.value());
-    if(mask[0]) {
-      if(answer != NULL && t < (int)answer->size())
-        words[0] = (*answer)[t];
-      else
-        words[0] = categorical_dist(probs.begin(), probs.begin()+vocab_->size());
+    // The first sample of each sentence follows its answer if given
+    vector<float> samp_mask = mask;
+    for(int j = 0; j < num_sents; j++) {
+      const Sentence * answer = answers[j];
+      size_t first = j * num_samples / num_sents;
+      if(answer != NULL && t < (int)answer->size()) {
+        if(mask[first]) words[first] = (*answer)[t];
+        samp_mask[first] = 0.f;
+      }
     }
-    for(size_t i = 1; i < ctxts.size(); i++)
-      if(mask[i])
-        words[i] = categorical_dist(probs.begin()+i*vocab_->size(), probs.begin()+(i+1)*vocab_->size());
+    SampleWords(probs, vocab_->size(), samp_mask, words);
     // Get the word representations
     i_wr.push_back(lookup(cg, p_wr_W_, words));
     dynet::Expression i_log_pick = log(pick(i_prob, words));
@@ -74,11 +74,14 @@ public:
                                    dynet::ComputationGraph & cg,
                                    LLStats & ll);
 
-    // Acquire samples from this sentence and return their log probabilities as a vector
+    // Acquire num_samples samples for each of the sentences in layer_in and
+    // return their log probabilities as a vector, with the samples of each
+    // sentence next to each other. If answers[i] is not NULL, the first
+    // sample of sentence i follows it.
     dynet::Expression SampleTrgSentences(
                                    const ExternCalculator * extern_calc,
                                    const std::vector<dynet::Expression> & layer_in,
-                                   const Sentence * answer,                                   
+                                   const std::vector<const Sentence*> & answers,
                                    int num_samples,
                                    int max_len,
                                    bool train,
@@ -133,7 +136,12 @@ public:
     int GetNumLayers() const { return hidden_spec_.layers; }
     int GetNumNodes() const { return hidden_spec_.nodes; }
     int GetLayerMultiplier() const { return hidden_spec_.multiplier; }
+    bool GetExternFeed() const { return extern_feed_; }
+    const BuilderSpec & GetHiddenSpec() const { return hidden_spec_; }
+    const BuilderPtr & GetBuilder() const { return builder_; }
+    const dynet::LookupParameter & GetWordrepParams() const { return p_wr_W_; }
     SoftmaxBase & GetSoftmax() { return *softmax_; }
+    const SoftmaxBase & GetSoftmax() const { return *softmax_; }
 
     // Setters
     void SetDropout(float dropout);
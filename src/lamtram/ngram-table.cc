@@ -0,0 +1,196 @@
+#include <lamtram/ngram-table.h>
+#include <lamtram/macros.h>
+#include <algorithm>
+#include <future>
+#include <numeric>
+
+using namespace std;
+using namespace lamtram;
+
+// Compare the first len words of two n-grams
+inline int compare_words(const WordId * a, const WordId * b, size_t len) {
+  for(size_t i = 0; i < len; i++)
+    if(a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+  return 0;
+}
+
+void NgramTable::add_len(size_t len) {
+  if(len < sizes_.size()) return;
+  words_.resize(len+1, NULL);
+  values_.resize(len+1, NULL);
+  starts_.resize(len+1, NULL);
+  sizes_.resize(len+1, 0);
+  num_starts_.resize(len+1, 0);
+  own_words_.resize(len+1);
+  own_values_.resize(len+1);
+  own_starts_.resize(len+1);
+  sorted_.resize(len+1, 1);
+  external_.resize(len+1, 0);
+}
+
+void NgramTable::add(const Sentence & ngram, int value) {
+  size_t len = ngram.size();
+  add_len(len);
+  if(external_[len])
+    THROW_ERROR("Cannot add n-grams of length " << len << " to arrays set from outside the NgramTable");
+  for(WordId wid : ngram)
+    if(wid < 0) THROW_ERROR("Negative word id in NgramTable: " << ngram);
+  own_words_[len].insert(own_words_[len].end(), ngram.begin(), ngram.end());
+  own_values_[len].push_back(value);
+  sorted_[len] = 0;
+  size_++;
+}
+
+void NgramTable::reserve(size_t len, size_t num) {
+  add_len(len);
+  own_words_[len].reserve(own_words_[len].size() + num * len);
+  own_values_[len].reserve(own_values_[len].size() + num);
+}
+
+void NgramTable::set_arrays(size_t len, size_t num, const WordId * words, const int * values,
+                            size_t num_starts, const unsigned * starts) {
+  add_len(len);
+  size_ += num - sizes_[len];
+  vector<WordId>().swap(own_words_[len]);
+  vector<int>().swap(own_values_[len]);
+  vector<unsigned>().swap(own_starts_[len]);
+  words_[len] = words;
+  values_[len] = values;
+  starts_[len] = starts;
+  sizes_[len] = num;
+  num_starts_[len] = num_starts;
+  sorted_[len] = 1;
+  external_[len] = 1;
+}
+
+void NgramTable::finalize(int num_threads) {
+  // Hand out the lengths to the threads, longest first as they are usually
+  // the largest
+  vector<size_t> todo;
+  for(size_t len = sizes_.size(); len-- > 0; )
+    if(!sorted_[len]) todo.push_back(len);
+  num_threads = max(1, min(num_threads, (int)todo.size()));
+  auto sort_lens = [&](int thread) {
+    for(size_t i = thread; i < todo.size(); i += num_threads)
+      finalize_len(todo[i]);
+  };
+  if(num_threads == 1) {
+    sort_lens(0);
+  } else {
+    vector<future<void> > futures;
+    for(int thread = 0; thread < num_threads; thread++)
+      futures.push_back(async(launch::async, sort_lens, thread));
+    for(auto & fut : futures) fut.get();
+  }
+}
+
+void NgramTable::finalize_len(size_t len) {
+  vector<WordId> & words = own_words_[len];
+  vector<int> & values = own_values_[len];
+  size_t num = values.size();
+  // Sort the positions of the n-grams with a stable counting sort on
+  // each word from the last to the first
+  vector<unsigned> order(num), next_order(num), counts;
+  iota(order.begin(), order.end(), 0);
+  WordId max_wid = (words.size() ? *max_element(words.begin(), words.end()) : 0);
+  for(size_t col = len; col-- > 0; ) {
+    counts.assign(max_wid + 2, 0);
+    for(size_t i = 0; i < num; i++)
+      counts[words[i*len+col]+1]++;
+    partial_sum(counts.begin(), counts.end(), counts.begin());
+    for(unsigned pos : order)
+      next_order[counts[words[(size_t)pos*len+col]]++] = pos;
+    order.swap(next_order);
+  }
+  vector<unsigned>().swap(next_order);
+  vector<WordId> sorted_words(words.size());
+  vector<int> sorted_values(num);
+  for(size_t i = 0; i < num; i++) {
+    copy(words.begin() + (size_t)order[i]*len, words.begin() + (size_t)(order[i]+1)*len, sorted_words.begin() + i*len);
+    sorted_values[i] = values[order[i]];
+    if(i > 0 && compare_words(&sorted_words[(i-1)*len], &sorted_words[i*len], len) == 0)
+      THROW_ERROR("Found duplicate entry for ngram " << Sentence(sorted_words.begin() + i*len, sorted_words.begin() + (i+1)*len));
+  }
+  words.swap(sorted_words);
+  values.swap(sorted_values);
+  // Count the n-grams starting with each word, and sum them into positions
+  vector<unsigned> & starts = own_starts_[len];
+  starts.clear();
+  if(len > 0 && num > 0) {
+    starts.resize(words[(num-1)*len] + 2, 0);
+    for(size_t i = 0; i < num; i++)
+      starts[words[i*len]+1]++;
+    partial_sum(starts.begin(), starts.end(), starts.begin());
+  }
+  words_[len] = words.data();
+  values_[len] = values.data();
+  starts_[len] = starts.data();
+  sizes_[len] = num;
+  num_starts_[len] = starts.size();
+  sorted_[len] = 1;
+}
+
+void NgramTable::clear() {
+  words_.clear();
+  values_.clear();
+  starts_.clear();
+  sizes_.clear();
+  num_starts_.clear();
+  own_words_.clear();
+  own_values_.clear();
+  own_starts_.clear();
+  sorted_.clear();
+  external_.clear();
+  size_ = 0;
+}
+
+void NgramTable::find_first(size_t len, WordId wid, size_t & lo, size_t & hi) const {
+  const unsigned * starts = starts_[len];
+  if(wid < 0 || (size_t)wid + 1 >= num_starts_[len]) {
+    lo = hi = 0;
+  } else {
+    lo = starts[wid];
+    hi = starts[wid+1];
+  }
+}
+
+const int * NgramTable::find(const WordId * ngram, size_t len) const {
+  if(len >= sizes_.size() || sizes_[len] == 0) return NULL;
+  if(len == 0) return values_[0];
+  size_t lo, hi;
+  find_first(len, ngram[0], lo, hi);
+  // Binary search over the rest of the words
+  const WordId * words = words_[len];
+  while(lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    int cmp = compare_words(words + mid*len + 1, ngram + 1, len - 1);
+    if(cmp == 0) return &values_[len][mid];
+    if(cmp < 0) lo = mid + 1;
+    else        hi = mid;
+  }
+  return NULL;
+}
+
+std::pair<size_t,size_t> NgramTable::find_range(const WordId * ctxt, size_t len) const {
+  size_t ngram_len = len + 1;
+  if(ngram_len >= sizes_.size()) return make_pair(0, 0);
+  if(len == 0) return make_pair(0, sizes_[1]);
+  size_t lo, hi;
+  find_first(ngram_len, ctxt[0], lo, hi);
+  // Find the first n-gram not before the context, then the first after it
+  const WordId * words = words_[ngram_len];
+  size_t first = lo, last = hi;
+  while(first < last) {
+    size_t mid = (first + last) / 2;
+    if(compare_words(words + mid*ngram_len + 1, ctxt + 1, len - 1) < 0) first = mid + 1;
+    else                                                                 last = mid;
+  }
+  size_t end = first;
+  last = hi;
+  while(end < last) {
+    size_t mid = (end + last) / 2;
+    if(compare_words(words + mid*ngram_len + 1, ctxt + 1, len - 1) <= 0) end = mid + 1;
+    else                                                                  last = mid;
+  }
+  return make_pair(first, end);
+}
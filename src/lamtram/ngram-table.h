@@ -0,0 +1,84 @@
+#pragma once
+
+#include <lamtram/sentence.h>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+namespace lamtram {
+
+// A compact map from n-grams to integer values, which is filled once and
+// then only read. The n-grams of each length are kept in one sorted array
+// of word ids with a parallel array of values, and the position where each
+// first word starts. N-grams that only differ in their last word are next
+// to each other, so all the words following a context are found with one
+// search. The arrays can also be in memory owned by someone else, such as
+// a memory mapped file.
+class NgramTable {
+
+public:
+  NgramTable() : size_(0) { }
+
+  // Add an n-gram, which can only be found after finalize()
+  void add(const Sentence & ngram, int value);
+  // Make room for num more n-grams of length len before adding them
+  void reserve(size_t len, size_t num);
+  // Sort the n-grams, throwing an error if any was added twice. N-grams can
+  // be added again after finalizing, and only lengths with new n-grams are
+  // sorted again, each length on one of up to num_threads threads.
+  void finalize(int num_threads = 1);
+  void clear();
+  // Use sorted arrays for the n-grams of length len, as returned by
+  // get_words(), get_values() and get_starts(). They are not copied, so must
+  // stay valid while the table is used.
+  void set_arrays(size_t len, size_t num, const WordId * words, const int * values,
+                  size_t num_starts, const unsigned * starts);
+
+  // The value of an n-gram, or NULL if it does not exist
+  const int * find(const Sentence & ngram) const { return find(ngram.data(), ngram.size()); }
+  const int * find(const WordId * ngram, size_t len) const;
+  // The positions [first, second) of the n-grams of length len+1 starting
+  // with ctxt
+  std::pair<size_t,size_t> find_range(const WordId * ctxt, size_t len) const;
+
+  // The total number of n-grams, and the number of a single length once
+  // finalized
+  size_t size() const { return size_; }
+  size_t size(size_t len) const { return len < sizes_.size() ? sizes_[len] : 0; }
+  // The longest length that may have n-grams, plus one
+  size_t get_num_lens() const { return sizes_.size(); }
+  // The words and value of the n-gram of length len at position pos
+  const WordId * get_words(size_t len, size_t pos = 0) const { return words_[len] + pos * len; }
+  int get_value(size_t len, size_t pos) const { return values_[len][pos]; }
+  const int * get_values(size_t len) const { return values_[len]; }
+  // The positions where each first word starts, and how many there are
+  const unsigned * get_starts(size_t len) const { return starts_[len]; }
+  size_t get_num_starts(size_t len) const { return num_starts_[len]; }
+
+protected:
+  // The positions [lo, hi) of the n-grams of length len starting with wid
+  void find_first(size_t len, WordId wid, size_t & lo, size_t & hi) const;
+  // Sort the n-grams of a single length
+  void finalize_len(size_t len);
+  // Make room for n-grams of length len
+  void add_len(size_t len);
+
+  // For each length, the words of each n-gram one after another, the values,
+  // and the position of the first n-gram starting with each word id. These
+  // point into the arrays below, or memory set by set_arrays().
+  std::vector<const WordId*> words_;
+  std::vector<const int*> values_;
+  std::vector<const unsigned*> starts_;
+  std::vector<size_t> sizes_, num_starts_;
+  // The arrays of n-grams that were added to the table
+  std::vector<std::vector<WordId> > own_words_;
+  std::vector<std::vector<int> > own_values_;
+  std::vector<std::vector<unsigned> > own_starts_;
+  // Whether the n-grams of each length are already sorted, and whether they
+  // were set from outside
+  std::vector<char> sorted_, external_;
+  size_t size_;
+
+};
+
+}
@@ -0,0 +1,239 @@
+#include <lamtram/quantized-matrix.h>
+#include <lamtram/macros.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+using namespace lamtram;
+
+QuantizedMatrix::QuantizedMatrix(const float * vals, int rows, int cols, const std::string & type) :
+      rows_(rows), cols_(cols), type_(type) {
+  if(type_ == "float") {
+    floats_ = Eigen::Map<const Eigen::MatrixXf>(vals, rows, cols);
+  } else if(type_ == "int8") {
+    // Each row is scaled so its largest absolute value becomes 127
+    int8s_.resize((size_t)rows * cols);
+    scales_.resize(rows);
+    for(int r = 0; r < rows; r++) {
+      float max_val = 0.f;
+      for(int c = 0; c < cols; c++)
+        max_val = max(max_val, fabs(vals[(size_t)c * rows + r]));
+      scales_[r] = max_val / 127.f;
+      float mult = (max_val > 0.f ? 127.f / max_val : 0.f);
+      for(int c = 0; c < cols; c++)
+        int8s_[(size_t)r * cols + c] = (int8_t)max(-127.f, min(127.f, round(vals[(size_t)c * rows + r] * mult)));
+    }
+  } else if(type_ == "fp16") {
+    halfs_.resize((size_t)rows * cols);
+    for(int r = 0; r < rows; r++)
+      for(int c = 0; c < cols; c++)
+        halfs_[(size_t)r * cols + c] = FloatToHalf(vals[(size_t)c * rows + r]);
+  } else {
+    THROW_ERROR("Bad quantization type (must be float/int8/fp16): " << type_);
+  }
+}
+
+// A table of the float value of every half float
+inline const float * HalfTable() {
+  static vector<float> table = []() {
+    vector<float> ret(0x10000);
+    for(uint32_t i = 0; i < ret.size(); i++)
+      ret[i] = QuantizedMatrix::HalfToFloat(i);
+    return ret;
+  }();
+  return table.data();
+}
+
+void QuantizedMatrix::GetRow(int r, float * buf) const {
+  if(type_ == "int8") {
+    const int8_t * row = &int8s_[(size_t)r * cols_];
+    for(int c = 0; c < cols_; c++) buf[c] = row[c];
+  } else if(type_ == "fp16") {
+    const uint16_t * row = &halfs_[(size_t)r * cols_];
+    const float * table = HalfTable();
+    for(int c = 0; c < cols_; c++) buf[c] = table[row[c]];
+  } else {
+    for(int c = 0; c < cols_; c++) buf[c] = floats_(r, c);
+  }
+}
+
+// The number of rows of fp16 values converted to floats at once
+#define QUANTIZED_MATRIX_BLOCK 64
+
+void QuantizedMatrix::Multiply(const Eigen::Ref<const Eigen::MatrixXf> & in, Eigen::MatrixXf & out, bool accumulate) const {
+  if(in.rows() != cols_)
+    THROW_ERROR("Size mismatch in QuantizedMatrix::Multiply: " << in.rows() << " != " << cols_);
+  if(type_ == "float") {
+    if(accumulate) out.noalias() += floats_ * in;
+    else           out.noalias() = floats_ * in;
+    return;
+  }
+  if(!accumulate) out.setZero(rows_, in.cols());
+  if(type_ == "int8") {
+    MultiplyInt8(in, out);
+    return;
+  }
+  // Convert blocks of rows to floats, and multiply each block with all of in
+  Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> block(QUANTIZED_MATRIX_BLOCK, cols_);
+  for(int r = 0; r < rows_; r += QUANTIZED_MATRIX_BLOCK) {
+    int num = min(QUANTIZED_MATRIX_BLOCK, rows_ - r);
+    for(int i = 0; i < num; i++)
+      GetRow(r + i, block.row(i).data());
+    out.middleRows(r, num).noalias() += block.topRows(num) * in;
+  }
+}
+
+// The sum of the products of num 8-bit weights w with 16-bit values x
+inline int32_t DotInt8(const int8_t * w, const int16_t * x, int num) {
+  int32_t ret = 0;
+  int c = 0;
+#ifdef __SSE2__
+  __m128i acc = _mm_setzero_si128();
+  for( ; c + 16 <= num; c += 16) {
+    __m128i wv = _mm_loadu_si128((const __m128i*)(w + c));
+    // Sign extend the weights to 16 bits, and multiply-add pairs into 32 bits
+    __m128i wlo = _mm_srai_epi16(_mm_unpacklo_epi8(wv, wv), 8), whi = _mm_srai_epi16(_mm_unpackhi_epi8(wv, wv), 8);
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(wlo, _mm_loadu_si128((const __m128i*)(x + c))));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(whi, _mm_loadu_si128((const __m128i*)(x + c + 8))));
+  }
+  int32_t sums[4];
+  _mm_storeu_si128((__m128i*)sums, acc);
+  ret = sums[0] + sums[1] + sums[2] + sums[3];
+#endif
+  for( ; c < num; c++)
+    ret += w[c] * (int32_t)x[c];
+  return ret;
+}
+
+// Each column of in is also quantized to 8 bits with its own scale, so the
+// products are summed exactly as 32-bit integers
+void QuantizedMatrix::MultiplyInt8(const Eigen::Ref<const Eigen::MatrixXf> & in, Eigen::MatrixXf & out) const {
+  // The quantized columns, kept in 16 bits to be multiplied directly
+  vector<int16_t> cols((size_t)cols_ * in.cols());
+  vector<float> col_scales(in.cols());
+  for(int j = 0; j < in.cols(); j++) {
+    float max_val = in.col(j).cwiseAbs().maxCoeff();
+    col_scales[j] = max_val / 127.f;
+    float mult = (max_val > 0.f ? 127.f / max_val : 0.f);
+    for(int c = 0; c < cols_; c++)
+      cols[(size_t)j * cols_ + c] = (int16_t)max(-127.f, min(127.f, round(in(c, j) * mult)));
+  }
+  for(int r = 0; r < rows_; r++) {
+    const int8_t * w = &int8s_[(size_t)r * cols_];
+    for(int j = 0; j < in.cols(); j++)
+      out(r, j) += scales_[r] * col_scales[j] * DotInt8(w, &cols[(size_t)j * cols_], cols_);
+  }
+}
+
+QuantizedMatrix QuantizedMatrix::SelectRows(const std::vector<unsigned> & ids) const {
+  QuantizedMatrix ret;
+  ret.rows_ = ids.size(); ret.cols_ = cols_; ret.type_ = type_;
+  if(type_ == "float") {
+    ret.floats_.resize(ids.size(), cols_);
+    for(size_t i = 0; i < ids.size(); i++)
+      ret.floats_.row(i) = floats_.row(ids[i]);
+  } else if(type_ == "int8") {
+    for(unsigned id : ids) {
+      ret.int8s_.insert(ret.int8s_.end(), int8s_.begin() + (size_t)id * cols_, int8s_.begin() + (size_t)(id+1) * cols_);
+      ret.scales_.push_back(scales_[id]);
+    }
+  } else {
+    for(unsigned id : ids)
+      ret.halfs_.insert(ret.halfs_.end(), halfs_.begin() + (size_t)id * cols_, halfs_.begin() + (size_t)(id+1) * cols_);
+  }
+  return ret;
+}
+
+std::vector<float> QuantizedMatrix::Dequantize() const {
+  vector<float> ret((size_t)rows_ * cols_), row(cols_);
+  for(int r = 0; r < rows_; r++) {
+    GetRow(r, row.data());
+    float scale = (type_ == "int8" ? scales_[r] : 1.f);
+    for(int c = 0; c < cols_; c++)
+      ret[(size_t)c * rows_ + r] = row[c] * scale;
+  }
+  return ret;
+}
+
+// The matrix is written as a one-byte type (0=float, 1=int8, 2=fp16),
+// followed by the column-major floats, the row scales and row-major
+// integers, or the row-major half floats
+void QuantizedMatrix::Write(std::ostream & out) const {
+  uint8_t code = (type_ == "float" ? 0 : (type_ == "int8" ? 1 : 2));
+  out.write((const char*)&code, sizeof(code));
+  if(code == 0) {
+    out.write((const char*)floats_.data(), sizeof(float) * floats_.size());
+  } else if(code == 1) {
+    out.write((const char*)scales_.data(), sizeof(float) * scales_.size());
+    out.write((const char*)int8s_.data(), sizeof(int8_t) * int8s_.size());
+  } else {
+    out.write((const char*)halfs_.data(), sizeof(uint16_t) * halfs_.size());
+  }
+}
+
+void QuantizedMatrix::Read(std::istream & in, int rows, int cols) {
+  uint8_t code;
+  in.read((char*)&code, sizeof(code));
+  rows_ = rows; cols_ = cols;
+  floats_.resize(0, 0); int8s_.clear(); scales_.clear(); halfs_.clear();
+  if(code == 0) {
+    type_ = "float";
+    floats_.resize(rows, cols);
+    in.read((char*)floats_.data(), sizeof(float) * floats_.size());
+  } else if(code == 1) {
+    type_ = "int8";
+    scales_.resize(rows); int8s_.resize((size_t)rows * cols);
+    in.read((char*)scales_.data(), sizeof(float) * scales_.size());
+    in.read((char*)int8s_.data(), sizeof(int8_t) * int8s_.size());
+  } else if(code == 2) {
+    type_ = "fp16";
+    halfs_.resize((size_t)rows * cols);
+    in.read((char*)halfs_.data(), sizeof(uint16_t) * halfs_.size());
+  } else {
+    THROW_ERROR("Bad quantized matrix type " << (int)code);
+  }
+  if(!in) THROW_ERROR("Quantized matrix was truncated");
+}
+
+uint16_t QuantizedMatrix::FloatToHalf(float val) {
+  uint32_t x;
+  memcpy(&x, &val, sizeof(x));
+  uint16_t sign = (x >> 16) & 0x8000;
+  x &= 0x7fffffff;
+  // Infinity and NaN
+  if(x >= 0x7f800000) return sign | 0x7c00 | (x > 0x7f800000 ? 0x200 : 0);
+  // Too large, round to infinity
+  if(x >= 0x477ff000) return sign | 0x7c00;
+  // Subnormal halves, or zero if too small
+  if(x < 0x38800000) {
+    if(x < 0x33000000) return sign;
+    uint32_t mant = (x & 0x7fffff) | 0x800000;
+    int shift = 126 - (int)(x >> 23);
+    uint32_t ret = mant >> shift, rem = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+    if(rem > half || (rem == half && (ret & 1))) ret++;
+    return sign | ret;
+  }
+  // Normal halves, rebiasing the exponent and rounding to nearest even
+  uint32_t ret = (x - 0x38000000) >> 13, rem = x & 0x1fff;
+  if(rem > 0x1000 || (rem == 0x1000 && (ret & 1))) ret++;
+  return sign | ret;
+}
+
+float QuantizedMatrix::HalfToFloat(uint16_t val) {
+  uint32_t sign = (uint32_t)(val & 0x8000) << 16, exp = (val >> 10) & 0x1f, mant = val & 0x3ff, x;
+  if(exp == 0) {
+    float ret = mant / 16777216.f;
+    return sign ? -ret : ret;
+  } else if(exp == 31) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | ((exp + 112) << 23) | (mant << 13);
+  }
+  float ret;
+  memcpy(&ret, &x, sizeof(ret));
+  return ret;
+}
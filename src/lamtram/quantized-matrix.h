@@ -0,0 +1,65 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace lamtram {
+
+// A weight matrix stored for inference as floats, as 8-bit integers with one
+// scale per row ("int8"), or as half-precision floats ("fp16"). The reduced
+// precision types are stored row by row. int8 matrices are multiplied with
+// 8-bit inputs in integers, and fp16 matrices are converted to floats a block
+// of rows at a time.
+class QuantizedMatrix {
+
+public:
+    QuantizedMatrix() : rows_(0), cols_(0), type_("float") { }
+    // Store the column-major rows x cols matrix in vals as the type
+    QuantizedMatrix(const float * vals, int rows, int cols, const std::string & type);
+    QuantizedMatrix(const Eigen::MatrixXf & mat, const std::string & type) :
+        QuantizedMatrix(mat.data(), mat.rows(), mat.cols(), type) { }
+
+    int rows() const { return rows_; }
+    int cols() const { return cols_; }
+    const std::string & GetType() const { return type_; }
+    static bool IsType(const std::string & type) { return type == "float" || type == "int8" || type == "fp16"; }
+
+    // out = this * in, or out += this * in if accumulate
+    void Multiply(const Eigen::Ref<const Eigen::MatrixXf> & in, Eigen::MatrixXf & out, bool accumulate = false) const;
+
+    // A matrix with only the rows in ids
+    QuantizedMatrix SelectRows(const std::vector<unsigned> & ids) const;
+
+    // The (approximate) values in column-major order
+    std::vector<float> Dequantize() const;
+
+    // Write the type and values in binary, and read them for a matrix of
+    // the given size
+    void Write(std::ostream & out) const;
+    void Read(std::istream & in, int rows, int cols);
+
+    // Convert to and from IEEE half precision, rounding to the nearest
+    static uint16_t FloatToHalf(float val);
+    static float HalfToFloat(uint16_t val);
+
+protected:
+    // Fill buf with the values of row r, without the int8 scale
+    void GetRow(int r, float * buf) const;
+    // out += this * in for "int8"
+    void MultiplyInt8(const Eigen::Ref<const Eigen::MatrixXf> & in, Eigen::MatrixXf & out) const;
+
+    int rows_, cols_;
+    std::string type_;
+    // The values for "float"
+    Eigen::MatrixXf floats_;
+    // The row-major values and row scales for "int8", values for "fp16"
+    std::vector<int8_t> int8s_;
+    std::vector<float> scales_;
+    std::vector<uint16_t> halfs_;
+
+};
+
+}
@@ -49,6 +49,12 @@ public:
   virtual dynet::Expression CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, int cache_id,                       const Sentence & ctxt, bool train) { return CalcLogProb(in,prior,ctxt,train); }
   virtual dynet::Expression CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, const Sentence & cache_ids, const std::vector<Sentence> & ctxt, bool train) { return CalcLogProb(in,prior,ctxt,train); }
 
+  // Restrict the distributions calculated by CalcProb and CalcLogProb to a
+  // sorted shortlist of words, where element i is the probability of words[i].
+  // An empty list restores the full vocabulary. Returns false if shortlists
+  // are not supported by this softmax.
+  virtual bool SetShortlist(const std::vector<unsigned> & words) { return words.size() == 0; }
+
   // Cache data for the entire training corpus if necessary
   //  data is the data, set_ids is which data set the sentences belong to
   virtual void Cache(const std::vector<Sentence> & sents, const std::vector<int> & set_ids, std::vector<Sentence> & cache_ids) { }
@@ -18,7 +18,7 @@ void SoftmaxDiff::LoadDists(int id) {
     assert(id < (int)dist_files_.size());
     cerr << "Loading distribution: " << dist_files_[id] << "..." << endl;
     dist_ptr_ = DistFactory::from_file(dist_files_[id], vocab_);
-  } else if(dist_ptr_.get() != NULL) {
+  } else if(dist_ptr_.get() == NULL) {
     cerr << "Loading distribution: " << dist_files_[0] << "..." << endl;
     dist_ptr_ = DistFactory::from_file(dist_files_[0], vocab_);
   }
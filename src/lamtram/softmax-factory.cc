@@ -6,6 +6,7 @@
 #include <lamtram/softmax-mod.h>
 #include <lamtram/softmax-diff.h>
 #include <lamtram/softmax-hinge.h>
+#include <lamtram/softmax-sampled.h>
 #include <lamtram/sentence.h>
 #include <lamtram/macros.h>
 #include <fstream>
@@ -25,6 +26,8 @@ SoftmaxPtr SoftmaxFactory::CreateSoftmax(const std::string & sig, int input_size
     return SoftmaxPtr(new SoftmaxClass(sig, input_size, vocab, mod));
   } else if(sig.substr(0,3) == "mod") {
     return SoftmaxPtr(new SoftmaxMod(sig, input_size, vocab, mod));
+  } else if(sig.substr(0,7) == "sampled") {
+    return SoftmaxPtr(new SoftmaxSampled(sig, input_size, vocab, mod));
   } else if(sig.substr(0,4) == "diff") {
     return SoftmaxPtr(new SoftmaxDiff(sig, input_size, vocab, mod));
   } else {
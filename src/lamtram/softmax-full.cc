@@ -15,6 +15,7 @@ SoftmaxFull::SoftmaxFull(const std::string & sig, int input_size, const DictPtr
 void SoftmaxFull::NewGraph(dynet::ComputationGraph & cg) {
   i_sm_b_ = parameter(cg, p_sm_b_);
   i_sm_W_ = parameter(cg, p_sm_W_);
+  i_sl_W_ = i_sl_b_ = Expression();
 }
 
 // Calculate training loss for one word
@@ -35,23 +36,34 @@ dynet::Expression SoftmaxFull::CalcLoss(dynet::Expression & in, dynet::Expressio
 
 // Calculate the full probability distribution
 dynet::Expression SoftmaxFull::CalcProb(dynet::Expression & in, dynet::Expression & prior, const Sentence & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return softmax(CalcScores(in, prior));
 }
 dynet::Expression SoftmaxFull::CalcProb(dynet::Expression & in, dynet::Expression & prior, const vector<Sentence> & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return softmax(CalcScores(in, prior));
 }
 dynet::Expression SoftmaxFull::CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const Sentence & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return log_softmax(CalcScores(in, prior));
 }
 dynet::Expression SoftmaxFull::CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const vector<Sentence> & ctxt, bool train) {
-  return (prior.pg != nullptr ? 
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in}) + prior) :
-          log_softmax(affine_transform({i_sm_b_, i_sm_W_, in})));
+  return log_softmax(CalcScores(in, prior));
 }
 
+bool SoftmaxFull::SetShortlist(const std::vector<unsigned> & words) {
+  shortlist_ = words;
+  i_sl_W_ = i_sl_b_ = Expression();
+  return true;
+}
+
+dynet::Expression SoftmaxFull::CalcScores(dynet::Expression & in, dynet::Expression & prior) {
+  if(shortlist_.size() == 0)
+    return (prior.pg != nullptr ?
+            affine_transform({i_sm_b_, i_sm_W_, in}) + prior :
+            affine_transform({i_sm_b_, i_sm_W_, in}));
+  // Only pick out the rows once per graph
+  if(i_sl_W_.pg == nullptr) {
+    i_sl_W_ = select_rows(i_sm_W_, shortlist_);
+    i_sl_b_ = select_rows(i_sm_b_, shortlist_);
+  }
+  Expression score = affine_transform({i_sl_b_, i_sl_W_, in});
+  return (prior.pg != nullptr ? score + select_rows(prior, shortlist_) : score);
+}
@@ -30,13 +30,27 @@ public:
   virtual dynet::Expression CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const Sentence & ctxt, bool train) override;
   virtual dynet::Expression CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const std::vector<Sentence> & ctxt, bool train) override;
 
+  virtual bool SetShortlist(const std::vector<unsigned> & words) override;
+
+  // Accessors
+  const dynet::Parameter & GetWeights() const { return p_sm_W_; }
+  const dynet::Parameter & GetBias() const { return p_sm_b_; }
+
 protected:
+  // Calculate the scores over the shortlist, or the full vocabulary
+  dynet::Expression CalcScores(dynet::Expression & in, dynet::Expression & prior);
+
   dynet::Parameter p_sm_W_; // Softmax weights
   dynet::Parameter p_sm_b_; // Softmax bias
 
   dynet::Expression i_sm_W_;
   dynet::Expression i_sm_b_;
 
+  // The shortlist, and the rows of the weights/bias for it
+  std::vector<unsigned> shortlist_;
+  dynet::Expression i_sl_W_;
+  dynet::Expression i_sl_b_;
+
 };
 
 }
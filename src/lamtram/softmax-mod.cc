@@ -20,7 +20,7 @@ void SoftmaxMod::LoadDists(int id) {
       assert(id < (int)dist_files_[i].size());
       cerr << "Loading distribution: " << dist_files_[i][id] << "..." << endl;
       dist_ptrs_[i] = DistFactory::from_file(dist_files_[i][id], vocab_);
-    } else if(dist_ptrs_[i].get() != NULL) {
+    } else if(dist_ptrs_[i].get() == NULL) {
       cerr << "Loading distribution: " << dist_files_[i][0] << "..." << endl;
       dist_ptrs_[i] = DistFactory::from_file(dist_files_[i][0], vocab_);
     }
@@ -57,3 +57,29 @@ dynet::Expression SoftmaxMultiLayer::CalcLogProb(dynet::Expression & in, dynet::
   dynet::Expression h = tanh(affine_transform({i_sm_b_, i_sm_W_, in}));
   return softmax_->CalcLogProb(h,prior,ctxt,train);
 }
+
+// Calculate the loss and distributions using cached info
+dynet::Expression SoftmaxMultiLayer::CalcLossCache(dynet::Expression & in, dynet::Expression & prior, int cache_id, const Sentence & ngram, bool train) {
+  dynet::Expression h = tanh(affine_transform({i_sm_b_, i_sm_W_, in}));
+  return softmax_->CalcLossCache(h,prior,cache_id,ngram,train);
+}
+dynet::Expression SoftmaxMultiLayer::CalcLossCache(dynet::Expression & in, dynet::Expression & prior, const vector<int> & cache_ids, const vector<Sentence> & ngrams, bool train) {
+  dynet::Expression h = tanh(affine_transform({i_sm_b_, i_sm_W_, in}));
+  return softmax_->CalcLossCache(h,prior,cache_ids,ngrams,train);
+}
+dynet::Expression SoftmaxMultiLayer::CalcProbCache(dynet::Expression & in, dynet::Expression & prior, int cache_id, const Sentence & ctxt, bool train) {
+  dynet::Expression h = tanh(affine_transform({i_sm_b_, i_sm_W_, in}));
+  return softmax_->CalcProbCache(h,prior,cache_id,ctxt,train);
+}
+dynet::Expression SoftmaxMultiLayer::CalcProbCache(dynet::Expression & in, dynet::Expression & prior, const Sentence & cache_ids, const vector<Sentence> & ctxt, bool train) {
+  dynet::Expression h = tanh(affine_transform({i_sm_b_, i_sm_W_, in}));
+  return softmax_->CalcProbCache(h,prior,cache_ids,ctxt,train);
+}
+dynet::Expression SoftmaxMultiLayer::CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, int cache_id, const Sentence & ctxt, bool train) {
+  dynet::Expression h = tanh(affine_transform({i_sm_b_, i_sm_W_, in}));
+  return softmax_->CalcLogProbCache(h,prior,cache_id,ctxt,train);
+}
+dynet::Expression SoftmaxMultiLayer::CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, const Sentence & cache_ids, const vector<Sentence> & ctxt, bool train) {
+  dynet::Expression h = tanh(affine_transform({i_sm_b_, i_sm_W_, in}));
+  return softmax_->CalcLogProbCache(h,prior,cache_ids,ctxt,train);
+}
@@ -33,6 +33,24 @@ public:
   virtual dynet::Expression CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const Sentence & ctxt, bool train) override;
   virtual dynet::Expression CalcLogProb(dynet::Expression & in, dynet::Expression & prior, const std::vector<Sentence> & ctxt, bool train) override;
 
+  virtual dynet::Expression CalcLossCache(dynet::Expression & in, dynet::Expression & prior, int cache_id, const Sentence & ngram, bool train) override;
+  virtual dynet::Expression CalcLossCache(dynet::Expression & in, dynet::Expression & prior, const std::vector<int> & cache_ids, const std::vector<Sentence> & ngrams, bool train) override;
+  virtual dynet::Expression CalcProbCache(dynet::Expression & in, dynet::Expression & prior, int cache_id,                       const Sentence & ctxt, bool train) override;
+  virtual dynet::Expression CalcProbCache(dynet::Expression & in, dynet::Expression & prior, const Sentence & cache_ids, const std::vector<Sentence> & ctxt, bool train) override;
+  virtual dynet::Expression CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, int cache_id,                       const Sentence & ctxt, bool train) override;
+  virtual dynet::Expression CalcLogProbCache(dynet::Expression & in, dynet::Expression & prior, const Sentence & cache_ids, const std::vector<Sentence> & ctxt, bool train) override;
+
+  virtual bool SetShortlist(const std::vector<unsigned> & words) override { return softmax_->SetShortlist(words); }
+
+  // The wrapped softmax caches and updates its own data
+  virtual void Cache(const std::vector<Sentence> & sents, const std::vector<int> & set_ids, std::vector<Sentence> & cache_ids) override { softmax_->Cache(sents, set_ids, cache_ids); }
+  virtual void UpdateFold(int fold_id) override { softmax_->UpdateFold(fold_id); }
+
+  // The weights of the hidden layer, and the softmax over it
+  const dynet::Parameter & GetWeights() const { return p_sm_W_; }
+  const dynet::Parameter & GetBias() const { return p_sm_b_; }
+  const SoftmaxBase & GetSoftmax() const { return *softmax_; }
+
 protected:
   dynet::Parameter p_sm_W_; // Softmax weights
   dynet::Parameter p_sm_b_; // Softmax bias
@@ -0,0 +1,114 @@
+#include <lamtram/softmax-sampled.h>
+#include <lamtram/macros.h>
+#include <lamtram/string-util.h>
+#include <dynet/expr.h>
+#include <dynet/dict.h>
+#include <dynet/globals.h>
+#include <algorithm>
+#include <cmath>
+
+using namespace lamtram;
+using namespace dynet::expr;
+using namespace std;
+
+SoftmaxSampled::SoftmaxSampled(const std::string & sig, int input_size, const DictPtr & vocab, dynet::Model & mod) : SoftmaxFull(sig,input_size,vocab,mod), num_samples_(1024), dist_("unigram") {
+  vector<string> strs = Tokenize(sig, ":");
+  if(strs[0] != "sampled") THROW_ERROR("Bad signature in SoftmaxSampled: " << sig);
+  for(size_t i = 1; i < strs.size(); i++) {
+    if(strs[i].substr(0,4) == "num=") {
+      num_samples_ = stoi(strs[i].substr(4));
+      if(num_samples_ <= 0) THROW_ERROR("Number of samples must be larger than zero: " << sig);
+    } else if(strs[i].substr(0,5) == "dist=") {
+      dist_ = strs[i].substr(5);
+      if(dist_ != "unigram" && dist_ != "uniform") THROW_ERROR("Sampling distribution must be unigram or uniform: " << sig);
+    } else {
+      THROW_ERROR("Bad signature in SoftmaxSampled: " << sig);
+    }
+  }
+  // Start with a uniform distribution until the training data is counted
+  vector<int> counts(vocab->size(), 1);
+  sampler_ = discrete_distribution<int>(counts.begin(), counts.end());
+  log_inclusion_.resize(vocab->size(), LogInclusionProb(1.0 / vocab->size()));
+  pos_.resize(vocab->size(), -1);
+}
+
+// Log probability that a word with sampling probability p is drawn at least
+// once in num_samples_ draws, which is the chance that it is in the
+// deduplicated sample set
+float SoftmaxSampled::LogInclusionProb(double p) const {
+  return log(-expm1(num_samples_ * log1p(-p)));
+}
+
+void SoftmaxSampled::NewGraph(dynet::ComputationGraph & cg) {
+  SoftmaxFull::NewGraph(cg);
+  samples_.clear();
+}
+
+void SoftmaxSampled::Cache(const std::vector<Sentence> & sents, const std::vector<int> & set_ids, std::vector<Sentence> & cache_ids) {
+  if(dist_ != "unigram" || sents.size() == 0) return;
+  // Add-one smoothing so all words can be sampled
+  vector<float> counts(vocab_->size(), 1.f);
+  float total = counts.size();
+  for(auto & sent : sents) {
+    for(WordId wid : sent) {
+      counts[wid]++;
+      total++;
+    }
+  }
+  sampler_ = discrete_distribution<int>(counts.begin(), counts.end());
+  for(size_t i = 0; i < counts.size(); i++)
+    log_inclusion_[i] = LogInclusionProb(counts[i] / total);
+}
+
+void SoftmaxSampled::DrawSamples() {
+  vector<bool> used(vocab_->size(), false);
+  for(int i = 0; i < num_samples_; i++) {
+    int wid = sampler_(*dynet::rndeng);
+    if(!used[wid]) {
+      used[wid] = true;
+      samples_.push_back(wid);
+    }
+  }
+  i_samp_W_ = select_rows(i_sm_W_, samples_);
+  i_samp_b_ = select_rows(i_sm_b_, samples_);
+}
+
+// Calculate training loss for one word
+dynet::Expression SoftmaxSampled::CalcLoss(dynet::Expression & in, dynet::Expression & prior, const Sentence & ngram, bool train) {
+  if(!train) return SoftmaxFull::CalcLoss(in, prior, ngram, train);
+  return CalcLoss(in, prior, vector<Sentence>(1, ngram), train);
+}
+
+// Calculate training loss for multiple words
+dynet::Expression SoftmaxSampled::CalcLoss(dynet::Expression & in, dynet::Expression & prior, const std::vector<Sentence> & ngrams, bool train) {
+  if(!train) return SoftmaxFull::CalcLoss(in, prior, ngrams, train);
+  if(samples_.size() == 0) DrawSamples();
+  // The candidates are the correct words of this step, followed by the samples
+  vector<unsigned> corrects, wvec(ngrams.size());
+  for(size_t i = 0; i < ngrams.size(); i++) {
+    WordId wid = *ngrams[i].rbegin();
+    if(pos_[wid] == -1) {
+      pos_[wid] = corrects.size();
+      corrects.push_back(wid);
+    }
+    wvec[i] = pos_[wid];
+  }
+  // Correct the scores by the probability of being in the sample set, and
+  // remove samples that are already a correct word
+  vector<float> correction(corrects.size() + samples_.size());
+  for(size_t i = 0; i < corrects.size(); i++)
+    correction[i] = -log_inclusion_[corrects[i]];
+  for(size_t i = 0; i < samples_.size(); i++)
+    correction[corrects.size() + i] = (pos_[samples_[i]] == -1 ? -log_inclusion_[samples_[i]] : -1e10f);
+  for(WordId wid : corrects)
+    pos_[wid] = -1;
+  dynet::ComputationGraph & cg = *in.pg;
+  Expression correct_score = affine_transform({select_rows(i_sm_b_, corrects), select_rows(i_sm_W_, corrects), in});
+  Expression sample_score = affine_transform({i_samp_b_, i_samp_W_, in});
+  if(prior.pg != nullptr) {
+    correct_score = correct_score + select_rows(prior, corrects);
+    sample_score = sample_score + select_rows(prior, samples_);
+  }
+  Expression score = concatenate({correct_score, sample_score}) + input(cg, {(unsigned int)correction.size()}, correction);
+  return pickneglogsoftmax(score, wvec);
+}
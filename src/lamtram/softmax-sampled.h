@@ -0,0 +1,50 @@
+#pragma once
+
+#include <lamtram/softmax-full.h>
+#include <random>
+#include <vector>
+
+namespace lamtram {
+
+// A softmax that calculates the training loss over only the correct words and
+// a set of negative samples shared by the whole minibatch (sampled softmax,
+// Jean et al. 2015). The sampling distribution is specified in the signature
+// "sampled:num=N:dist=(unigram|uniform)". Probabilities are calculated exactly
+// over the full vocabulary, as are losses when not training.
+class SoftmaxSampled : public SoftmaxFull {
+
+public:
+  SoftmaxSampled(const std::string & sig, int input_size, const DictPtr & vocab, dynet::Model & mod);
+  ~SoftmaxSampled() { };
+
+  // Create a new graph
+  virtual void NewGraph(dynet::ComputationGraph & cg) override;
+
+  // Calculate training loss for one word
+  virtual dynet::Expression CalcLoss(dynet::Expression & in, dynet::Expression & prior, const Sentence & ngram, bool train) override;
+  // Calculate training loss for multiple words
+  virtual dynet::Expression CalcLoss(dynet::Expression & in, dynet::Expression & prior, const std::vector<Sentence> & ngrams, bool train) override;
+
+  // Count the words in the training data to create the unigram distribution
+  virtual void Cache(const std::vector<Sentence> & sents, const std::vector<int> & set_ids, std::vector<Sentence> & cache_ids) override;
+
+protected:
+  // Draw the negative samples for the current graph, without duplicates
+  void DrawSamples();
+  float LogInclusionProb(double p) const;
+
+  int num_samples_;
+  std::string dist_;
+  std::vector<float> log_inclusion_; // Log probability that each word is in the sample set
+  std::discrete_distribution<int> sampler_;
+
+  // The negative samples and their weights/bias
+  std::vector<unsigned> samples_;
+  dynet::Expression i_samp_W_;
+  dynet::Expression i_samp_b_;
+  // Position of each word in the correct words of the current step, or -1
+  std::vector<int> pos_;
+
+};
+
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cfloat>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace lamtram {
+
+// An entry in the top k: its score, row (e.g. hypothesis) and column (e.g. word)
+struct TopKEntry {
+  TopKEntry(float score, int row, int col) : score(score), row(row), col(col) { }
+  float score;
+  int row, col;
+};
+// Higher scores first, then lower rows/columns first
+inline bool operator<(const TopKEntry & lhs, const TopKEntry & rhs) {
+  if(lhs.score != rhs.score) return lhs.score > rhs.score;
+  if(lhs.row != rhs.row) return lhs.row < rhs.row;
+  return lhs.col < rhs.col;
+}
+
+// Select the k highest scoring entries over rows of scores (such as the
+// word log probabilities of all hypotheses in a beam) without sorting them.
+// Each row is scanned with a single comparison per element against the
+// current k-th best score, and only elements that pass are put in a heap.
+class TopK {
+
+public:
+  // max_per_row optionally limits the number of entries taken from a row
+  TopK(size_t k, size_t max_per_row = std::numeric_limits<size_t>::max()) :
+    k_(k), max_per_row_(std::min(k, max_per_row)) { }
+
+  // Add a row of size scores, where entry i's score is offset + (scores[i] + add),
+  // or for columns in adjust (a short list of column adjustments) offset +
+  // (scores[i] + each of their adjustments in order) instead. The additions
+  // are done in this order so the scores are the same as adding to each
+  // element before the offset.
+  void AddRow(int row, const float * scores, size_t size, float offset, float add = 0.f,
+              const std::vector<std::pair<int,float> > & adjust = std::vector<std::pair<int,float> >()) {
+    if(k_ == 0) return;
+    row_.clear();
+    for(size_t a = 0; a < adjust.size(); a++) {
+      int col = adjust[a].first;
+      if(col < 0 || col >= (int)size || IsAdjusted(adjust, a, col)) continue;
+      float value = scores[col];
+      for(size_t b = a; b < adjust.size(); b++)
+        if(adjust[b].first == col) value += adjust[b].second;
+      Push(row_, max_per_row_, TopKEntry(offset + value, row, col));
+    }
+    // Adjusted columns were added above, so skip them here
+    for(size_t i = 0; i < size; i++) {
+      float score = offset + (scores[i] + add);
+      if(score < Threshold() || IsAdjusted(adjust, adjust.size(), i)) continue;
+      Push(row_, max_per_row_, TopKEntry(score, row, i));
+    }
+    for(auto & entry : row_)
+      Push(heap_, k_, entry);
+  }
+
+  // Get the entries from best to worst, and clear them
+  std::vector<TopKEntry> Get() {
+    std::vector<TopKEntry> ret;
+    ret.swap(heap_);
+    std::sort(ret.begin(), ret.end());
+    return ret;
+  }
+
+protected:
+  // The score that new entries of the current row need to beat
+  float Threshold() const {
+    float ret = -FLT_MAX;
+    if(heap_.size() == k_) ret = heap_[0].score;
+    if(row_.size() == max_per_row_) ret = std::max(ret, row_[0].score);
+    return ret;
+  }
+
+  // Whether any of the first end adjustments is for column col
+  static bool IsAdjusted(const std::vector<std::pair<int,float> > & adjust, size_t end, int col) {
+    for(size_t a = 0; a < end; a++)
+      if(adjust[a].first == col) return true;
+    return false;
+  }
+
+  // Push onto a heap with the worst element at the front, keeping size max
+  static void Push(std::vector<TopKEntry> & heap, size_t max, const TopKEntry & entry) {
+    if(heap.size() == max) {
+      if(!(entry < heap[0])) return;
+      std::pop_heap(heap.begin(), heap.end());
+      heap.back() = entry;
+    } else {
+      heap.push_back(entry);
+    }
+    std::push_heap(heap.begin(), heap.end());
+  }
+
+  size_t k_, max_per_row_;
+  std::vector<TopKEntry> heap_, row_;
+
+};
+
+}
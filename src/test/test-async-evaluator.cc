@@ -0,0 +1,58 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/async-evaluator.h>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestAsyncEvaluator {
+
+  TestAsyncEvaluator() : save_file_("/tmp/lamtram-test-async-evaluator." + to_string(getpid())) { }
+  ~TestAsyncEvaluator() { unlink(save_file_.c_str()); }
+
+  // Evaluate num_steps steps in num_workers processes, where step i has
+  // i+1 words and a loss of i
+  LLStats Evaluate(int num_workers, int num_steps, bool save) {
+    AsyncEvaluator eval;
+    eval.Start(num_workers, num_steps, 10, [](int i, LLStats & ll) {
+      ll.words_ += i + 1;
+      ll.loss_ += i;
+    }, [&]() {
+      ofstream out(save_file_);
+      out << "saved" << endl;
+    });
+    LLStats ret(10);
+    eval.Collect(ret);
+    eval.Finish(save);
+    BOOST_CHECK(!eval.IsRunning());
+    return ret;
+  }
+
+  string save_file_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(async_evaluator, TestAsyncEvaluator)
+
+// Test whether the statistics of all workers are added up
+BOOST_AUTO_TEST_CASE(TestCollect) {
+  for(int workers : {1, 3, 10}) {
+    LLStats stats = Evaluate(workers, 5, false);
+    BOOST_CHECK_EQUAL(stats.words_, 15);
+    BOOST_CHECK_CLOSE(stats.loss_, 10.0, 1e-4);
+  }
+}
+
+// Test whether the model is saved only when asked
+BOOST_AUTO_TEST_CASE(TestSave) {
+  Evaluate(2, 5, false);
+  BOOST_CHECK(access(save_file_.c_str(), F_OK) != 0);
+  Evaluate(2, 5, true);
+  BOOST_CHECK(access(save_file_.c_str(), F_OK) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
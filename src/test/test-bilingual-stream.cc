@@ -0,0 +1,63 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/sentence.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/bilingual-stream.h>
+#include <dynet/dict.h>
+#include <fstream>
+#include <cstdio>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestBilingualStream {
+
+  TestBilingualStream() {
+    // Two shards of parallel data, where each target is the source reversed
+    files_src_ = {"/tmp/lamtram-stream-1.src", "/tmp/lamtram-stream-2.src"};
+    files_trg_ = {"/tmp/lamtram-stream-1.trg", "/tmp/lamtram-stream-2.trg"};
+    ofstream src1(files_src_[0]), trg1(files_trg_[0]), src2(files_src_[1]), trg2(files_trg_[1]);
+    src1 << "a b c\nb\nc a\n"; trg1 << "c b a\nb\na c\n";
+    src2 << "a a b b\nc\n";    trg2 << "b b a a\nc\n";
+  }
+  ~TestBilingualStream() {
+    for(auto & file : files_src_) std::remove(file.c_str());
+    for(auto & file : files_trg_) std::remove(file.c_str());
+  }
+
+  vector<string> files_src_, files_trg_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(bilingual_stream, TestBilingualStream)
+
+// Test whether every sentence is read exactly once in each epoch
+BOOST_AUTO_TEST_CASE(TestReadAllSentences) {
+  DictPtr vocab_src(CreateNewDict()), vocab_trg(CreateNewDict());
+  BilingualStream<Sentence> stream(files_src_, files_trg_, *vocab_src, *vocab_trg, 2, 8);
+  BOOST_CHECK_EQUAL(stream.ScanFiles(), 5);
+  vocab_src->freeze(); vocab_trg->freeze();
+  for(int epoch = 0; epoch < 2; epoch++) {
+    stream.Reset();
+    vector<Sentence> src, trg;
+    size_t num_sents = 0, num_words = 0;
+    while(stream.NextMinibatch(src, trg)) {
+      BOOST_CHECK_EQUAL(src.size(), trg.size());
+      for(size_t i = 0; i < src.size(); i++) {
+        // The target is the reversed source plus the end of sentence symbol
+        string src_str = PrintWords(*vocab_src, src[i]);
+        Sentence rev_trg(trg[i].rbegin()+1, trg[i].rend());
+        BOOST_CHECK_EQUAL(src_str, PrintWords(*vocab_trg, rev_trg));
+        num_words += src[i].size();
+      }
+      num_sents += src.size();
+    }
+    BOOST_CHECK_EQUAL(num_sents, 5);
+    BOOST_CHECK_EQUAL(num_words, 11);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
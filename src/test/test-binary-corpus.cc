@@ -0,0 +1,92 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/macros.h>
+#include <lamtram/sentence.h>
+#include <lamtram/dict-utils.h>
+#include <lamtram/binary-corpus.h>
+#include <dynet/dict.h>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestBinaryCorpus {
+
+  TestBinaryCorpus() {
+    files_ = {"/tmp/lamtram-bin-1.txt", "/tmp/lamtram-bin-2.txt"};
+    bin_file_ = "/tmp/lamtram-bin.trg";
+    ofstream f1(files_[0]), f2(files_[1]);
+    f1 << "a b c\nb\nc a\n";
+    f2 << "a a b b\nd\n";
+  }
+  ~TestBinaryCorpus() {
+    for(auto & file : files_) std::remove(file.c_str());
+    std::remove(bin_file_.c_str());
+  }
+
+  vector<string> files_;
+  string bin_file_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(binary_corpus, TestBinaryCorpus)
+
+// Test whether loading the binarized corpus gives the same sentences as the text
+BOOST_AUTO_TEST_CASE(TestBinarizeLoad) {
+  DictPtr vocab_bin(CreateNewDict());
+  BinaryCorpus::Binarize(files_, true, *vocab_bin, bin_file_);
+  // Read the text files with a vocabulary in a different order
+  DictPtr vocab_exp(CreateNewDict()), vocab_act(CreateNewDict());
+  vocab_exp->convert("d"); vocab_act->convert("d");
+  vector<Sentence> exp_sents;
+  vector<int> exp_ids = {0, 0, 0, 1, 1};
+  for(auto & file : files_) {
+    ifstream in(file);
+    string line;
+    while(getline(in, line))
+      exp_sents.push_back(ParseWords(*vocab_exp, line, true));
+  }
+  vector<Sentence> act_sents;
+  vector<int> act_ids;
+  BinaryCorpus::Load(bin_file_, *vocab_act, act_sents, act_ids);
+  BOOST_CHECK_EQUAL_COLLECTIONS(exp_ids.begin(), exp_ids.end(), act_ids.begin(), act_ids.end());
+  BOOST_CHECK_EQUAL(exp_sents.size(), act_sents.size());
+  for(size_t i = 0; i < min(exp_sents.size(), act_sents.size()); i++)
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_sents[i].begin(), exp_sents[i].end(), act_sents[i].begin(), act_sents[i].end());
+  BOOST_CHECK_EQUAL(vocab_exp->size(), vocab_act->size());
+}
+
+// Test whether truncated or corrupted files are rejected
+BOOST_AUTO_TEST_CASE(TestLoadCorrupted) {
+  DictPtr vocab_bin(CreateNewDict());
+  BinaryCorpus::Binarize(files_, true, *vocab_bin, bin_file_);
+  string data;
+  {
+    ifstream in(bin_file_, ios::binary);
+    data.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+  }
+  // Header size, then the tokens, starting with the first word of "a b c"
+  size_t header_size = 48;
+  vector<string> corrupted = {data.substr(0, 60), data, data};
+  int32_t bad_id = 1000;
+  memcpy(&corrupted[1][header_size], &bad_id, sizeof(bad_id));
+  uint64_t bad_tokens = 1ull << 40;
+  memcpy(&corrupted[2][16 + sizeof(uint64_t)], &bad_tokens, sizeof(bad_tokens));
+  for(const string & bad : corrupted) {
+    {
+      ofstream out(bin_file_, ios::binary);
+      out << bad;
+    }
+    DictPtr vocab(CreateNewDict());
+    vector<Sentence> sents;
+    vector<int> ids;
+    BOOST_CHECK_THROW(BinaryCorpus::Load(bin_file_, *vocab, sents, ids), std::runtime_error);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include <fstream>
+#include <numeric>
 
 #include <dynet/dict.h>
 #include <dynet/training.h>
@@ -11,6 +12,7 @@
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/ensemble-decoder.h>
 #include <lamtram/model-utils.h>
+#include <lamtram/mlp-attention.h>
 
 using namespace std;
 using namespace lamtram;
@@ -123,6 +125,32 @@ struct TestEncoderAttentional {
     BOOST_CHECK_CLOSE(train_ll, decode_ll, 0.01);
   }
 
+  void TestGraphFree(const std::string & attention_type, bool attention_feed, const std::string & attention_hist) {
+    shared_ptr<dynet::Model> mod;
+    EncoderAttentionalPtr encatt;
+    shared_ptr<EnsembleDecoder> ensdec;
+    CreateModel(mod, encatt, ensdec, attention_type, attention_feed, attention_hist, "none");
+    ensdec->SetBeamSize(3);
+    vector<EnsembleDecoderHypPtr> exp_hyps = ensdec->GenerateNbest(sent_src_, 3);
+    LLStats exp_ll(vocab_trg_->size()), act_ll(vocab_trg_->size());
+    vector<float> exp_wordll, act_wordll;
+    ensdec->CalcSentLL<Sentence,LLStats,vector<float> >(sent_src_, sent_trg_, exp_ll, exp_wordll);
+    BOOST_CHECK(ensdec->SetGraphFree(true));
+    vector<EnsembleDecoderHypPtr> act_hyps = ensdec->GenerateNbest(sent_src_, 3);
+    ensdec->CalcSentLL<Sentence,LLStats,vector<float> >(sent_src_, sent_trg_, act_ll, act_wordll);
+    BOOST_CHECK_EQUAL(exp_ll.words_, act_ll.words_);
+    BOOST_CHECK_CLOSE(exp_ll.loss_, act_ll.loss_, 0.01);
+    BOOST_CHECK_EQUAL(exp_wordll.size(), act_wordll.size());
+    BOOST_CHECK_EQUAL(exp_hyps.size(), act_hyps.size());
+    for(size_t i = 0; i < min(exp_hyps.size(), act_hyps.size()); i++) {
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyps[i]->GetSentence().begin(), exp_hyps[i]->GetSentence().end(),
+                                    act_hyps[i]->GetSentence().begin(), act_hyps[i]->GetSentence().end());
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyps[i]->GetAlignment().begin(), exp_hyps[i]->GetAlignment().end(),
+                                    act_hyps[i]->GetAlignment().begin(), act_hyps[i]->GetAlignment().end());
+      BOOST_CHECK_CLOSE(exp_hyps[i]->GetScore(), act_hyps[i]->GetScore(), 0.01);
+    }
+  }
+
   Sentence sent_src_, sent_trg_, sent_src2_, sent_trg2_, cache_;
   DictPtr vocab_src_, vocab_trg_;
 };
@@ -164,6 +192,36 @@ BOOST_AUTO_TEST_CASE(TestWriteRead) {
   BOOST_CHECK_EQUAL(first_string, second_string);
 }
 
+// Test whether reading and writing the binary format works.
+// The binary model is read back and written as text to compare with the original.
+BOOST_AUTO_TEST_CASE(TestWriteReadBinary) {
+  shared_ptr<dynet::Model> act_mod(new dynet::Model), exp_mod(new dynet::Model);
+  DictPtr exp_src_vocab(CreateNewDict()); exp_src_vocab->convert("hola");
+  DictPtr exp_trg_vocab(CreateNewDict()); exp_trg_vocab->convert("hello");
+  NeuralLMPtr exp_lm(new NeuralLM(exp_trg_vocab, 2, 2, false, 3, BuilderSpec("rnn:2:1"), -1, "full", *exp_mod));
+  vector<LinearEncoderPtr> exp_encs(1, LinearEncoderPtr(new LinearEncoder(3, 2, BuilderSpec("rnn:2:1"), -1, *exp_mod)));
+  ExternAttentionalPtr exp_ext(new ExternAttentional(exp_encs, "mlp:2", "none", 3, "none", vocab_src_, vocab_trg_, *exp_mod));
+  EncoderAttentional exp_encatt(exp_ext, exp_lm, *exp_mod);
+  // Write the Model in text and binary
+  ostringstream out, out_bin;
+  WriteDict(*exp_src_vocab, out); WriteDict(*exp_src_vocab, out_bin);
+  WriteDict(*exp_trg_vocab, out); WriteDict(*exp_trg_vocab, out_bin);
+  exp_encatt.Write(out); exp_encatt.Write(out_bin);
+  ModelUtils::WriteModelText(out, *exp_mod);
+  ModelUtils::WriteModelBinary(out_bin, *exp_mod);
+  // Read the binary Model
+  DictPtr act_src_vocab(new dynet::Dict), act_trg_vocab(new dynet::Dict);
+  istringstream in(out_bin.str());
+  EncoderAttentionalPtr act_lm(ModelUtils::LoadBilingualModel<EncoderAttentional>(in, act_mod, act_src_vocab, act_trg_vocab));
+  // Write to a second string
+  ostringstream out2;
+  WriteDict(*act_src_vocab, out2);
+  WriteDict(*act_trg_vocab, out2);
+  act_lm->Write(out2);
+  ModelUtils::WriteModelText(out2, *act_mod);
+  BOOST_CHECK_EQUAL(out.str(), out2.str());
+}
+
 // Test whether scores during likelihood calculation are the same as training
 BOOST_AUTO_TEST_CASE(TestLLScoresDotFalseNone)      { TestLLScores("dot",   false, "none", "none"); }
 BOOST_AUTO_TEST_CASE(TestLLScoresDotFalseNonePrior) { TestLLScores("dot",   false, "none", "prior"); }
@@ -259,5 +317,171 @@ BOOST_AUTO_TEST_CASE(TestBeamSearchImproves) {
   ensdec->SetBeamSize(1);
 }
 
+// Test whether batched beam search gives the same n-best as unbatched
+BOOST_AUTO_TEST_CASE(TestBeamBatchSame) {
+  shared_ptr<dynet::Model> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec);
+  ensdec->SetBeamSize(5);
+  ensdec->SetWordPen(0.3f);
+  vector<EnsembleDecoderHypPtr> exp_hyps = ensdec->GenerateNbest(sent_src_, 5);
+  ensdec->SetBatchBeam(true);
+  vector<EnsembleDecoderHypPtr> act_hyps = ensdec->GenerateNbest(sent_src_, 5);
+  ensdec->SetBatchBeam(false);
+  ensdec->SetWordPen(0.f);
+  ensdec->SetBeamSize(1);
+  BOOST_CHECK_EQUAL(exp_hyps.size(), act_hyps.size());
+  for(size_t i = 0; i < min(exp_hyps.size(), act_hyps.size()); i++) {
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyps[i]->GetSentence().begin(), exp_hyps[i]->GetSentence().end(),
+                                  act_hyps[i]->GetSentence().begin(), act_hyps[i]->GetSentence().end());
+    BOOST_CHECK_EQUAL(exp_hyps[i]->GetScore(), act_hyps[i]->GetScore());
+  }
+}
+
+// Test whether decoding several sentences at once gives the same n-best as one at a time
+BOOST_AUTO_TEST_CASE(TestMultiSentenceBeamSame) {
+  shared_ptr<dynet::Model> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "mlp:2", false, "none", "prior");
+  ensdec->SetBeamSize(3);
+  vector<Sentence> sents_src = {sent_src_, sent_src2_};
+  vector<vector<EnsembleDecoderHypPtr> > act_hyps = ensdec->GenerateNbest(sents_src, 3);
+  BOOST_CHECK_EQUAL(act_hyps.size(), sents_src.size());
+  for(size_t s = 0; s < min(act_hyps.size(), sents_src.size()); s++) {
+    vector<EnsembleDecoderHypPtr> exp_hyps = ensdec->GenerateNbest(sents_src[s], 3);
+    BOOST_CHECK_EQUAL(exp_hyps.size(), act_hyps[s].size());
+    for(size_t i = 0; i < min(exp_hyps.size(), act_hyps[s].size()); i++) {
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyps[i]->GetSentence().begin(), exp_hyps[i]->GetSentence().end(),
+                                    act_hyps[s][i]->GetSentence().begin(), act_hyps[s][i]->GetSentence().end());
+      BOOST_CHECK_CLOSE(exp_hyps[i]->GetScore(), act_hyps[s][i]->GetScore(), 0.01);
+    }
+  }
+  ensdec->SetBeamSize(1);
+}
+
+// Test whether scoring with cached encodings gives the same likelihood as encoding
+BOOST_AUTO_TEST_CASE(TestEncoderCacheSame) {
+  shared_ptr<dynet::Model> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec);
+  LLStats exp_stat(vocab_trg_->size()), act_stat(vocab_trg_->size()), cache_stat(vocab_trg_->size());
+  vector<float> exp_wordll, act_wordll, cache_wordll;
+  ensdec->CalcSentLL(sent_src_, sent_trg_, exp_stat, exp_wordll);
+  ensdec->SetEncoderCache(1);
+  ensdec->CalcSentLL(sent_src_, sent_trg_, cache_stat, cache_wordll);
+  ensdec->CalcSentLL(sent_src_, sent_trg_, act_stat, act_wordll);
+  ensdec->SetEncoderCache(0);
+  BOOST_CHECK_CLOSE(exp_stat.CalcPPL(), act_stat.CalcPPL(), 0.01);
+}
+
+// Test whether the least recently used sentence is removed from a full cache,
+// and whether the length of the encoding is kept
+BOOST_AUTO_TEST_CASE(TestEncoderCacheLRU) {
+  EncoderCache cache;
+  cache.SetSize(2);
+  dynet::ComputationGraph cg;
+  vector<dynet::Expression> exprs = {dynet::expr::input(cg, 1.f)};
+  cache.Add(sent_src_, exprs, 5);
+  cache.Add(sent_src2_, exprs, 6);
+  int len = 0;
+  BOOST_CHECK(cache.Find(sent_src_, cg, exprs, &len));
+  BOOST_CHECK_EQUAL(5, len);
+  cache.Add(sent_trg_, exprs, 7);
+  BOOST_CHECK(cache.Find(sent_src_, cg, exprs));
+  BOOST_CHECK(!cache.Find(sent_src2_, cg, exprs));
+  BOOST_CHECK(cache.Find(sent_trg_, cg, exprs, &len));
+  BOOST_CHECK_EQUAL(7, len);
+}
+
+// Test whether a shortlist of the whole vocabulary gives the same n-best as no shortlist
+BOOST_AUTO_TEST_CASE(TestShortlistAllSame) {
+  shared_ptr<dynet::Model> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec);
+  ensdec->SetBeamSize(3);
+  vector<EnsembleDecoderHypPtr> exp_hyps = ensdec->GenerateNbest(sent_src_, 3);
+  vector<WordId> all_words(encatt->GetDecoder().GetVocabSize());
+  std::iota(all_words.begin(), all_words.end(), 0);
+  ensdec->SetShortlist(all_words, 0);
+  vector<EnsembleDecoderHypPtr> act_hyps = ensdec->GenerateNbest(sent_src_, 3);
+  ensdec->SetShortlist(vector<WordId>(), 0);
+  ensdec->SetBeamSize(1);
+  BOOST_CHECK_EQUAL(exp_hyps.size(), act_hyps.size());
+  for(size_t i = 0; i < min(exp_hyps.size(), act_hyps.size()); i++) {
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyps[i]->GetSentence().begin(), exp_hyps[i]->GetSentence().end(),
+                                  act_hyps[i]->GetSentence().begin(), act_hyps[i]->GetSentence().end());
+    BOOST_CHECK_CLOSE(exp_hyps[i]->GetScore(), act_hyps[i]->GetScore(), 0.01);
+  }
+}
+
+// Test whether generating without a graph gives the same n-best as with one
+BOOST_AUTO_TEST_CASE(TestGraphFreeDotFalseNone)      { TestGraphFree("dot",   false, "none"); }
+BOOST_AUTO_TEST_CASE(TestGraphFreeDotTrueNone)       { TestGraphFree("dot",   true,  "none"); }
+BOOST_AUTO_TEST_CASE(TestGraphFreeDotFalseSum)       { TestGraphFree("dot",   false, "sum" ); }
+BOOST_AUTO_TEST_CASE(TestGraphFreeMLPFalseNone)      { TestGraphFree("mlp:5", false, "none"); }
+BOOST_AUTO_TEST_CASE(TestGraphFreeMLPTrueSum)        { TestGraphFree("mlp:5", true,  "sum" ); }
+BOOST_AUTO_TEST_CASE(TestGraphFreeBilinFalseNone)    { TestGraphFree("bilin", false, "none"); }
+
+// Test whether models with a lexicon keep using graphs
+BOOST_AUTO_TEST_CASE(TestGraphFreePriorUnsupported) {
+  shared_ptr<dynet::Model> mod;
+  EncoderAttentionalPtr encatt;
+  shared_ptr<EnsembleDecoder> ensdec;
+  CreateModel(mod, encatt, ensdec, "dot", false, "none", "prior");
+  BOOST_CHECK(!ensdec->SetGraphFree(true));
+  BOOST_CHECK(!ensdec->GetGraphFree());
+}
+
+// Test whether the fused MLP attention scores match those of separate nodes
+BOOST_AUTO_TEST_CASE(TestMLPAttentionSame) {
+  dynet::ComputationGraph cg;
+  vector<float> hpart_vals(4*3), spart_vals(4*2), v_vals(4);
+  for(size_t i = 0; i < hpart_vals.size(); i++) hpart_vals[i] = 0.13f * i - 0.5f;
+  for(size_t i = 0; i < spart_vals.size(); i++) spart_vals[i] = 0.4f - 0.1f * i;
+  for(size_t i = 0; i < v_vals.size(); i++) v_vals[i] = 0.2f * i - 0.25f;
+  dynet::Expression hpart = input(cg, {4, 3}, hpart_vals);
+  dynet::Expression spart = input(cg, dynet::Dim({4}, 2), spart_vals);
+  dynet::Expression v = input(cg, {1, 4}, v_vals);
+  dynet::Expression ones = input(cg, {1, 3}, vector<float>(3, 1.f));
+  vector<float> exp_vals = as_vector(cg.forward(transpose(v * tanh(affine_transform({hpart, spart, ones})))));
+  vector<float> act_vals = as_vector(cg.forward(MLPAttention(hpart, spart, v)));
+  BOOST_CHECK_EQUAL(exp_vals.size(), act_vals.size());
+  for(size_t i = 0; i < min(exp_vals.size(), act_vals.size()); i++)
+    BOOST_CHECK_CLOSE(exp_vals[i], act_vals[i], 0.01);
+}
+
+// Test whether the gradients of the fused MLP attention match those of
+// separate nodes, with the decoder states batched and the encoder states
+// broadcast
+BOOST_AUTO_TEST_CASE(TestMLPAttentionGradient) {
+  dynet::Model mod;
+  dynet::Parameter p_hpart = mod.add_parameters({4, 3}), p_spart = mod.add_parameters({4}), p_v = mod.add_parameters({1, 4});
+  vector<vector<float> > exp_grads, act_grads;
+  for(int fused = 0; fused < 2; fused++) {
+    dynet::ComputationGraph cg;
+    dynet::Expression hpart = parameter(cg, p_hpart);
+    dynet::Expression spart = parameter(cg, p_spart) + input(cg, dynet::Dim({4}, 2), {0.1f, -0.2f, 0.3f, 0.f, -0.4f, 0.5f, 0.2f, 0.1f});
+    dynet::Expression v = parameter(cg, p_v);
+    dynet::Expression ones = input(cg, {1, 3}, vector<float>(3, 1.f));
+    dynet::Expression scores = (fused ? MLPAttention(hpart, spart, v) : transpose(v * tanh(affine_transform({hpart, spart, ones}))));
+    dynet::Expression weights = input(cg, dynet::Dim({1, 3}, 2), {0.5f, -1.f, 0.25f, 1.f, 0.3f, -0.6f});
+    dynet::Expression loss = sum_batches(weights * scores);
+    cg.forward(loss);
+    cg.backward(loss);
+    vector<vector<float> > & grads = (fused ? act_grads : exp_grads);
+    for(auto & p : {p_hpart, p_spart, p_v})
+      grads.push_back(as_vector(p.get()->g));
+    mod.reset_gradient();
+  }
+  for(size_t i = 0; i < exp_grads.size(); i++) {
+    BOOST_CHECK_EQUAL(exp_grads[i].size(), act_grads[i].size());
+    for(size_t j = 0; j < min(exp_grads[i].size(), act_grads[i].size()); j++)
+      BOOST_CHECK_SMALL(exp_grads[i][j] - act_grads[i][j], 1e-4f);
+  }
+}
 
 BOOST_AUTO_TEST_SUITE_END()
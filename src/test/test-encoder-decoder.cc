@@ -5,6 +5,7 @@
 #include <lamtram/encoder-decoder.h>
 #include <lamtram/encoder-attentional.h>
 #include <lamtram/ensemble-decoder.h>
+#include <lamtram/lamtram.h>
 #include <lamtram/model-utils.h>
 #include <dynet/training.h>
 #include <dynet/dict.h>
@@ -149,5 +150,49 @@ BOOST_AUTO_TEST_CASE(TestBeamDecodingScores) {
   BOOST_CHECK_CLOSE(train_ll, decode_ll, 0.01);
 }
 
+// Test whether generating without a graph gives the same n-best as with one
+BOOST_AUTO_TEST_CASE(TestGraphFreeSame) {
+  ensdec_->SetBeamSize(3);
+  vector<EnsembleDecoderHypPtr> exp_hyps = ensdec_->GenerateNbest(sent_src_, 3);
+  BOOST_CHECK(ensdec_->SetGraphFree(true));
+  vector<EnsembleDecoderHypPtr> act_hyps = ensdec_->GenerateNbest(sent_src_, 3);
+  ensdec_->SetGraphFree(false);
+  ensdec_->SetBeamSize(1);
+  BOOST_CHECK_EQUAL(exp_hyps.size(), act_hyps.size());
+  for(size_t i = 0; i < min(exp_hyps.size(), act_hyps.size()); i++) {
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyps[i]->GetSentence().begin(), exp_hyps[i]->GetSentence().end(),
+                                  act_hyps[i]->GetSentence().begin(), act_hyps[i]->GetSentence().end());
+    BOOST_CHECK_CLOSE(exp_hyps[i]->GetScore(), act_hyps[i]->GetScore(), 0.01);
+  }
+}
+
+// Test whether serving requests from a stream gives the same results as
+// decoding each sentence directly
+BOOST_AUTO_TEST_CASE(TestServeSame) {
+  vector<string> lines = {"a b c", "c b", "", "b a a c"};
+  string input;
+  for(auto & line : lines) input += line + "\n";
+  Lamtram lamtram;
+  for(int nbest_size : {1, 3}) {
+    ostringstream exp_out;
+    for(size_t i = 0; i < lines.size(); i++) {
+      Sentence src = ParseWords(*vocab_src_, lines[i], false);
+      vector<EnsembleDecoderHypPtr> hyps = ensdec_->GenerateNbest(src, nbest_size);
+      for(auto & hyp : hyps) {
+        string words = PrintWords(ConvertWords(*vocab_trg_, hyp->GetSentence(), false));
+        if(nbest_size == 1) {
+          exp_out << words << endl;
+          break;
+        }
+        exp_out << i << " ||| " << words << " ||| " << hyp->GetScore() << endl;
+      }
+      if(nbest_size != 1) exp_out << endl;
+    }
+    istringstream in(input);
+    ostringstream act_out;
+    lamtram.Serve(in, act_out, *ensdec_, vocab_src_.get(), *vocab_trg_, UniqueStringMappingPtr(), nbest_size);
+    BOOST_CHECK_EQUAL(exp_out.str(), act_out.str());
+  }
+}
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,79 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/eval-measure-bleu.h>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestEvalMeasureBleu {
+
+  TestEvalMeasureBleu() {
+    // Sentences over a small vocabulary, so many n-grams match
+    srand(1);
+    for(int i = 0; i < 100; i++) {
+      Sentence sent(rand() % 20);
+      for(auto & word : sent) word = rand() % 5;
+      sents_.push_back(sent);
+    }
+  }
+  ~TestEvalMeasureBleu() { }
+
+  vector<Sentence> sents_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(eval_measure_bleu, TestEvalMeasureBleu)
+
+// Test whether the sorted n-grams give the same stats as ExtractNgrams
+BOOST_AUTO_TEST_CASE(TestSortedSame) {
+  EvalMeasureBleu bleu(4, 1, SENTENCE);
+  const EvalMeasureBleu & const_bleu = bleu;
+  for(size_t i = 0; i+1 < sents_.size(); i++) {
+    const Sentence & ref = sents_[i], & sys = sents_[i+1];
+    shared_ptr<EvalMeasureBleu::NgramStats> ref_s(bleu.ExtractNgrams(ref)), sys_s(bleu.ExtractNgrams(sys));
+    float exp_score = bleu.CalculateStats(*ref_s, ref.size(), *sys_s, sys.size())->ConvertToScore();
+    BOOST_CHECK_EQUAL(exp_score, const_bleu.CalculateStats(ref, sys)->ConvertToScore());
+    BOOST_CHECK_EQUAL(exp_score, bleu.CalculateCachedStats(ref, sys, i)->ConvertToScore());
+  }
+}
+
+// Test whether the corpus stats are the same
+BOOST_AUTO_TEST_CASE(TestCorpusSame) {
+  EvalMeasureBleu bleu;
+  const EvalMeasureBleu & const_bleu = bleu;
+  EvalStatsPtr exp_stats, act_stats;
+  for(size_t i = 0; i+1 < sents_.size(); i++) {
+    const Sentence & ref = sents_[i], & sys = sents_[i+1];
+    shared_ptr<EvalMeasureBleu::NgramStats> ref_s(bleu.ExtractNgrams(ref)), sys_s(bleu.ExtractNgrams(sys));
+    EvalStatsPtr exp = bleu.CalculateStats(*ref_s, ref.size(), *sys_s, sys.size());
+    EvalStatsPtr act = const_bleu.CalculateStats(ref, sys);
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp->GetVals().begin(), exp->GetVals().end(), act->GetVals().begin(), act->GetVals().end());
+  }
+}
+
+// Test whether the cached batch gives the same stats as uncached scoring,
+// with each reference scored against several outputs as in min risk training
+BOOST_AUTO_TEST_CASE(TestCachedBatchSame) {
+  EvalMeasureBleu bleu(4, 1, SENTENCE);
+  vector<const Sentence*> refs, syss;
+  vector<int> ref_ids;
+  for(size_t i = 0; i < 10; i++) {
+    for(size_t j = 10; j < sents_.size(); j++) {
+      refs.push_back(&sents_[i]);
+      syss.push_back(&sents_[j]);
+      ref_ids.push_back(i);
+    }
+  }
+  vector<EvalStatsPtr> exp = bleu.CalculateStatsBatch(refs, syss, 1);
+  vector<EvalStatsPtr> act = bleu.CalculateCachedStatsBatch(refs, syss, ref_ids, 4);
+  BOOST_CHECK_EQUAL(exp.size(), act.size());
+  for(size_t i = 0; i < exp.size(); i++)
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp[i]->GetVals().begin(), exp[i]->GetVals().end(), act[i]->GetVals().begin(), act[i]->GetVals().end());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
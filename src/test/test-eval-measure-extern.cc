@@ -0,0 +1,95 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/eval-measure-extern.h>
+#include <dynet/dict.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <unistd.h>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestEvalMeasureExtern {
+
+  TestEvalMeasureExtern() : prefix_("/tmp/lamtram-test-eval-measure-extern." + to_string(getpid())) {
+    vocab_.convert("<s>");
+    for(int i = 0; i < 5; i++)
+      vocab_.convert("w" + to_string(i));
+    // Sentences of 1 to 10 words, ending in <s>
+    for(int i = 0; i < 100; i++) {
+      Sentence sent(i % 10 + 2, 0);
+      for(int j = 0; j+1 < (int)sent.size(); j++)
+        sent[j] = 1 + (i + j) % 5;
+      sents_.push_back(sent);
+    }
+  }
+  ~TestEvalMeasureExtern() {
+    for(const string & file : files_)
+      unlink(file.c_str());
+  }
+
+  // Write a scorer that answers with the number of words in the output,
+  // running before before each line
+  string WriteScorer(const string & name, const string & before) {
+    string file = prefix_ + "." + name;
+    ofstream out(file);
+    out << "#!/bin/sh" << endl
+        << "n=0" << endl
+        << "while read line; do" << endl
+        << "  n=$((n+1))" << endl
+        << "  " << before << endl
+        << "  set -- ${line%%|||*}" << endl
+        << "  echo $#" << endl
+        << "done" << endl;
+    out.close();
+    chmod(file.c_str(), 0755);
+    files_.push_back(file);
+    return file;
+  }
+
+  // Check that every sentence is scored with its length
+  void CheckScores(const EvalMeasure & eval) {
+    vector<const Sentence*> refs, syss;
+    for(const Sentence & sent : sents_) {
+      refs.push_back(&sents_[0]);
+      syss.push_back(&sent);
+    }
+    vector<EvalStatsPtr> stats = eval.CalculateStatsBatch(refs, syss);
+    BOOST_CHECK_EQUAL(sents_.size(), stats.size());
+    for(size_t i = 0; i < stats.size(); i++)
+      BOOST_CHECK_EQUAL(sents_[i].size() - 1, stats[i]->ConvertToScore());
+    BOOST_CHECK_EQUAL(sents_[5].size() - 1, eval.CalculateStats(sents_[0], sents_[5])->ConvertToScore());
+  }
+
+  string prefix_;
+  dynet::Dict vocab_;
+  vector<Sentence> sents_;
+  vector<string> files_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(eval_measure_extern, TestEvalMeasureExtern)
+
+// Test whether a pool of scorers gives each sentence its score
+BOOST_AUTO_TEST_CASE(TestWorkers) {
+  string run = WriteScorer("workers", "");
+  CheckScores(EvalMeasureExtern("run=" + run + ",workers=3,pipeline=8", vocab_));
+}
+
+// Test whether scorers that exit are restarted
+BOOST_AUTO_TEST_CASE(TestRestart) {
+  string run = WriteScorer("restart", "if [ $n -gt 3 ]; then exit 0; fi");
+  CheckScores(EvalMeasureExtern("run=" + run + ",pipeline=4", vocab_));
+}
+
+// Test whether a scorer that stops answering is restarted
+BOOST_AUTO_TEST_CASE(TestTimeout) {
+  string mark = prefix_ + ".mark";
+  files_.push_back(mark);
+  string run = WriteScorer("timeout", "if [ ! -e " + mark + " ]; then touch " + mark + "; sleep 3; fi");
+  CheckScores(EvalMeasureExtern("run=" + run + ",timeout=0.5", vocab_));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,125 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/eval-measure-ribes.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestEvalMeasureRibes {
+
+  TestEvalMeasureRibes() {
+    // Sentences over small vocabularies, so many words are only told apart
+    // by their context, and reorderings of them so the rank correlation is
+    // not always close to zero
+    srand(1);
+    for(int i = 0; i < 60; i++) {
+      int vocab = (i % 3 == 0 ? 4 : 20);
+      Sentence sent(rand() % (i % 10 == 0 ? 100 : 25));
+      for(auto & word : sent) word = rand() % vocab;
+      sents_.push_back(sent);
+      for(size_t j = 0; j+1 < sent.size(); j += 1 + rand() % 3)
+        swap(sent[j], sent[j+1]);
+      if(sent.size() > 0 && rand() % 2)
+        sent.erase(sent.begin() + rand() % sent.size());
+      sents_.push_back(sent);
+    }
+  }
+  ~TestEvalMeasureRibes() { }
+
+  // The score calculated by the original algorithm, which finds the
+  // candidate positions of each word with hash maps of position lists and
+  // counts the ascending pairs over all pairs
+  static float OriginalRibes(const Sentence & ref, const Sentence & sys, float alpha, float beta) {
+    if(ref.size() == 0) return (sys.size() == 0 ? 1 : 0);
+    if(sys.size() == 0) return 0;
+    float bp = min(1.0, exp(1.0 - 1.0 * ref.size()/sys.size()));
+    vector<int> intlist;
+    std::unordered_map<WordId, vector<int> > ref_count, sys_count;
+    for(int i = 0; i < (int)ref.size(); i++)
+      ref_count[ref[i]].push_back(i);
+    for(int i = 0; i < (int)sys.size(); i++)
+      sys_count[sys[i]].push_back(i);
+    for(int i = 0; i < (int)sys.size(); i++) {
+      if(ref_count.find(sys[i]) == ref_count.end())
+        continue;
+      const vector<int> & ref_match = ref_count[sys[i]];
+      const vector<int> & sys_match = sys_count[sys[i]];
+      if (ref_match.size() == 1 && sys_match.size() == 1) {
+        intlist.push_back(ref_match[0]);
+      } else {
+        vector<int> left_ref = ref_match, left_sys = sys_match,
+                    right_ref = ref_match, right_sys = sys_match;
+        for(int window = 1; window < max(i, (int)sys.size()-i); window++) {
+          if(window <= i) {
+            vector<int> new_left_ref, new_left_sys;
+            for(int j : left_ref)
+              if(window <= j && ref[j-window] == sys[i-window])
+                new_left_ref.push_back(j);
+            for(int j : left_sys)
+              if(window <= j && sys[j-window] == sys[i-window])
+                new_left_sys.push_back(j);
+            if(new_left_ref.size() == 1 && new_left_sys.size() == 1) {
+              intlist.push_back(new_left_ref[0]);
+              break;
+            }
+            left_ref = new_left_ref; left_sys = new_left_sys;
+          }
+          if(i+window < (int)sys.size()) {
+            vector<int> new_right_ref, new_right_sys;
+            for(int j : right_ref)
+              if(j+window < (int)ref.size() && ref[j+window] == sys[i+window])
+                new_right_ref.push_back(j);
+            for(int j : right_sys)
+              if(j+window < (int)sys.size() && sys[j+window] == sys[i+window])
+                new_right_sys.push_back(j);
+            if(new_right_ref.size() == 1 && new_right_sys.size() == 1) {
+              intlist.push_back(new_right_ref[0]);
+              break;
+            }
+            right_ref = new_right_ref; right_sys = new_right_sys;
+          }
+        }
+      }
+    }
+    int n = intlist.size();
+    if (n == 1 && ref.size() == 1)
+      return 1.0 * (pow(1.0/sys.size(), alpha)) * (pow(bp, beta));
+    else if(n < 2)
+      return 0;
+    int ascending = 0;
+    for(int i = 0; i < (int)intlist.size()-1; i++)
+      for(int j = i+1; j < (int)intlist.size(); j++)
+        if(intlist[i] < intlist[j])
+          ascending++;
+    float nkt = float(ascending) / ((n * (n - 1))/2);
+    float precision = 1.0 * n / sys.size();
+    return nkt * (pow(precision, alpha)) * (pow(bp, beta));
+  }
+
+  vector<Sentence> sents_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(eval_measure_ribes, TestEvalMeasureRibes)
+
+// Test whether the scores are the same as those of the original algorithm
+BOOST_AUTO_TEST_CASE(TestOriginalSame) {
+  EvalMeasureRibes ribes;
+  for(size_t i = 0; i < sents_.size(); i++) {
+    for(size_t j = (i % 2 == 0 ? i+1 : i); j < sents_.size(); j += 5) {
+      const Sentence & ref = sents_[i], & sys = sents_[j];
+      float exp_score = OriginalRibes(ref, sys, 0.25, 0.10);
+      float act_score = ribes.CalculateStats(ref, sys)->ConvertToScore();
+      BOOST_CHECK_CLOSE(exp_score, act_score, 0.001);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
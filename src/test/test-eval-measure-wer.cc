@@ -0,0 +1,77 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/eval-measure-wer.h>
+#include <lamtram/eval-measure-ribes.h>
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestEvalMeasureWer {
+
+  TestEvalMeasureWer() {
+    // Sentences over a small vocabulary, some longer than one or two
+    // 64-word blocks of the bit-parallel edit distance
+    srand(1);
+    for(int i = 0; i < 100; i++) {
+      Sentence sent(rand() % (i % 10 == 0 ? 200 : 30));
+      for(auto & word : sent) word = rand() % 6;
+      sents_.push_back(sent);
+    }
+  }
+  ~TestEvalMeasureWer() { }
+
+  // The edit distance calculated over the full table
+  static int FullEditDistance(const Sentence & ref, const Sentence & sys) {
+    int rs = ref.size()+1, ss = sys.size()+1;
+    vector<int> dists(rs*ss);
+    for(int i = 0; i < rs; i++) dists[i*ss] = i;
+    for(int j = 1; j < ss; j++) dists[j] = j;
+    for(int i = 1; i < rs; i++)
+      for(int j = 1; j < ss; j++)
+        dists[i*ss+j] = min(min(dists[(i-1)*ss+j]+1, dists[i*ss+j-1]+1),
+                            dists[(i-1)*ss+j-1] + (ref[i-1] == sys[j-1] ? 0 : 1));
+    return dists[rs*ss-1];
+  }
+
+  vector<Sentence> sents_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(eval_measure_wer, TestEvalMeasureWer)
+
+// Test whether the bit-parallel distance is the same as the full table
+BOOST_AUTO_TEST_CASE(TestEditDistance) {
+  EvalMeasureWer wer;
+  for(size_t i = 0; i < sents_.size(); i++) {
+    for(size_t j = i; j < sents_.size(); j += 7) {
+      const Sentence & ref = sents_[i], & sys = sents_[j];
+      EvalStatsPtr stats = wer.CalculateStats(ref, sys);
+      BOOST_CHECK_EQUAL(FullEditDistance(ref, sys), stats->GetVals()[0]);
+      BOOST_CHECK_EQUAL(ref.size(), stats->GetVals()[1]);
+    }
+  }
+}
+
+// Test whether the batch stats are the same as those of single sentences
+BOOST_AUTO_TEST_CASE(TestBatchSame) {
+  EvalMeasureWer wer;
+  EvalMeasureRibes ribes;
+  vector<const Sentence*> refs, syss;
+  for(size_t i = 0; i+1 < sents_.size(); i++) {
+    refs.push_back(&sents_[i]);
+    syss.push_back(&sents_[i+1]);
+  }
+  for(const EvalMeasure * eval : vector<const EvalMeasure*>({&wer, &ribes})) {
+    vector<EvalStatsPtr> stats = eval->CalculateStatsBatch(refs, syss, 4);
+    BOOST_CHECK_EQUAL(refs.size(), stats.size());
+    for(size_t i = 0; i < stats.size(); i++)
+      BOOST_CHECK(*eval->CalculateStats(*refs[i], *syss[i]) == *stats[i]);
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,10 @@
 #include <lamtram/ensemble-decoder.h>
 #include <lamtram/model-utils.h>
 #include <dynet/dict.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace std;
 using namespace lamtram;
@@ -55,6 +59,45 @@ BOOST_AUTO_TEST_CASE(TestWriteRead) {
   BOOST_CHECK_EQUAL(first_string, second_string);
 }
 
+// Test whether models can be loaded from both regular files, which are
+// memory mapped, and pipes, which can't be
+BOOST_AUTO_TEST_CASE(TestReadFileAndPipe) {
+  std::shared_ptr<dynet::Model> exp_mod(new dynet::Model);
+  DictPtr exp_vocab(CreateNewDict()); exp_vocab->convert("hello");
+  NeuralLM exp_lm(exp_vocab, 2, 2, false, 3, BuilderSpec("rnn:2:1"), -1, "full", *exp_mod);
+  ostringstream out;
+  WriteDict(*exp_vocab, out);
+  exp_lm.Write(out);
+  ModelUtils::WriteModelBinary(out, *exp_mod);
+  const string file = "/tmp/test-neural-lm.model", fifo = "/tmp/test-neural-lm.fifo";
+  {
+    ofstream file_out(file);
+    file_out << out.str();
+  }
+  unlink(fifo.c_str());
+  BOOST_REQUIRE_EQUAL(mkfifo(fifo.c_str(), 0600), 0);
+  pid_t pid = fork();
+  BOOST_REQUIRE(pid >= 0);
+  if(pid == 0) {
+    ofstream fifo_out(fifo);
+    fifo_out << out.str();
+    fifo_out.close();
+    _exit(0);
+  }
+  for(const string & in_file : {file, fifo}) {
+    std::shared_ptr<dynet::Model> act_mod;
+    DictPtr act_vocab;
+    NeuralLMPtr act_lm(ModelUtils::LoadMonolingualModel<NeuralLM>(in_file, act_mod, act_vocab));
+    ostringstream out2;
+    WriteDict(*act_vocab, out2);
+    act_lm->Write(out2);
+    ModelUtils::WriteModelBinary(out2, *act_mod);
+    BOOST_CHECK_EQUAL(out.str(), out2.str());
+  }
+  waitpid(pid, nullptr, 0);
+  unlink(fifo.c_str());
+}
+
 // Test whether scores during decoding are the same as those during training
 BOOST_AUTO_TEST_CASE(TestDecodingScores) {
   std::shared_ptr<dynet::Model> mod(new dynet::Model);
@@ -80,4 +123,83 @@ BOOST_AUTO_TEST_CASE(TestDecodingScores) {
   BOOST_CHECK_CLOSE(train_stat.CalcPPL(), test_stat.CalcPPL(), 0.1);
 }
 
+// Test whether the sampled softmax gives the exact loss when every word is sampled
+BOOST_AUTO_TEST_CASE(TestSampledAllExact) {
+  std::shared_ptr<dynet::Model> mod(new dynet::Model);
+  DictPtr vocab(CreateNewDict()); vocab->convert("a"); vocab->convert("b"); vocab->convert("c");
+  NeuralLMPtr lmptr(new NeuralLM(vocab, 1, 0, false, 3, BuilderSpec("rnn:2:1"), -1, "sampled:num=1000:dist=uniform", *mod));
+  LLStats exp_stat(vocab->size()), act_stat(vocab->size());
+  vector<dynet::expr::Expression> layer_in;
+  dynet::real exp_loss, act_loss;
+  {
+    dynet::ComputationGraph cg;
+    lmptr->NewGraph(cg);
+    dynet::expr::Expression loss_expr = lmptr->BuildSentGraph(sent_trg_, cache_, nullptr, nullptr, layer_in, 0.f, false, cg, exp_stat);
+    exp_loss = as_scalar(cg.incremental_forward(loss_expr));
+  }
+  {
+    dynet::ComputationGraph cg;
+    lmptr->NewGraph(cg);
+    dynet::expr::Expression loss_expr = lmptr->BuildSentGraph(sent_trg_, cache_, nullptr, nullptr, layer_in, 0.f, true, cg, act_stat);
+    act_loss = as_scalar(cg.incremental_forward(loss_expr));
+  }
+  BOOST_CHECK_CLOSE(exp_loss, act_loss, 0.1);
+}
+
+// Test whether the sampled softmax gives the exact loss when every word is
+// sampled from a skewed unigram distribution, where the correction for each
+// word is different
+BOOST_AUTO_TEST_CASE(TestSampledUnigramExact) {
+  for(string softmax_sig : {"sampled:num=3000:dist=unigram", "multilayer:5:sampled:num=3000:dist=unigram"}) {
+    std::shared_ptr<dynet::Model> mod(new dynet::Model);
+    DictPtr vocab(CreateNewDict()); vocab->convert("a"); vocab->convert("b"); vocab->convert("c");
+    NeuralLMPtr lmptr(new NeuralLM(vocab, 1, 0, false, 3, BuilderSpec("rnn:2:1"), -1, softmax_sig, *mod));
+    // "a" is far more frequent than the other words
+    vector<Sentence> train_sents(50, Sentence({2, 2, 3}));
+    vector<int> train_ids(train_sents.size(), 0);
+    vector<Sentence> train_cache;
+    lmptr->GetSoftmax().Cache(train_sents, train_ids, train_cache);
+    LLStats exp_stat(vocab->size()), act_stat(vocab->size());
+    vector<dynet::expr::Expression> layer_in;
+    dynet::real exp_loss, act_loss;
+    {
+      dynet::ComputationGraph cg;
+      lmptr->NewGraph(cg);
+      dynet::expr::Expression loss_expr = lmptr->BuildSentGraph(sent_trg_, cache_, nullptr, nullptr, layer_in, 0.f, false, cg, exp_stat);
+      exp_loss = as_scalar(cg.incremental_forward(loss_expr));
+    }
+    {
+      dynet::ComputationGraph cg;
+      lmptr->NewGraph(cg);
+      dynet::expr::Expression loss_expr = lmptr->BuildSentGraph(sent_trg_, cache_, nullptr, nullptr, layer_in, 0.f, true, cg, act_stat);
+      act_loss = as_scalar(cg.incremental_forward(loss_expr));
+    }
+    BOOST_CHECK_CLOSE(exp_loss, act_loss, 0.1);
+  }
+}
+
+// Test whether generating without a graph gives the same n-best as with one
+BOOST_AUTO_TEST_CASE(TestGraphFreeSame) {
+  for(string softmax_sig : {"full", "multilayer:5:full"}) {
+    std::shared_ptr<dynet::Model> mod(new dynet::Model);
+    DictPtr vocab(CreateNewDict()); vocab->convert("a"); vocab->convert("b"); vocab->convert("c");
+    NeuralLMPtr lmptr(new NeuralLM(vocab, 2, 0, false, 3, BuilderSpec("lstm:4:2"), -1, softmax_sig, *mod));
+    vector<EncoderDecoderPtr> encdecs;
+    vector<EncoderAttentionalPtr> encatts;
+    vector<NeuralLMPtr> lms; lms.push_back(lmptr);
+    EnsembleDecoder ensdec(encdecs, encatts, lms);
+    ensdec.SetBeamSize(3);
+    ensdec.SetSizeLimit(10);
+    vector<EnsembleDecoderHypPtr> exp_hyps = ensdec.GenerateNbest(sent_src_, 3);
+    BOOST_CHECK(ensdec.SetGraphFree(true));
+    vector<EnsembleDecoderHypPtr> act_hyps = ensdec.GenerateNbest(sent_src_, 3);
+    BOOST_CHECK_EQUAL(exp_hyps.size(), act_hyps.size());
+    for(size_t i = 0; i < min(exp_hyps.size(), act_hyps.size()); i++) {
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_hyps[i]->GetSentence().begin(), exp_hyps[i]->GetSentence().end(),
+                                    act_hyps[i]->GetSentence().begin(), act_hyps[i]->GetSentence().end());
+      BOOST_CHECK_CLOSE(exp_hyps[i]->GetScore(), act_hyps[i]->GetScore(), 0.01);
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
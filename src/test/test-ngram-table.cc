@@ -0,0 +1,434 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/ngram-table.h>
+#include <lamtram/dist-ngram.h>
+#include <lamtram/dist-ngram-disk.h>
+#include <lamtram/dist-factory.h>
+#include <lamtram/dict-utils.h>
+#include <dynet/dict.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestNgramTable {
+
+  TestNgramTable() {
+    // Random n-grams of up to three words over a small vocabulary
+    srand(1);
+    for(int i = 0; i < 1000; i++) {
+      Sentence ngram(rand() % 4);
+      for(auto & word : ngram) word = rand() % 10;
+      if(ngrams_.find(ngram) == ngrams_.end())
+        ngrams_[ngram] = i;
+    }
+    for(const auto & ngram : ngrams_)
+      table_.add(ngram.first, ngram.second);
+    table_.finalize();
+    // Sentences to train n-gram distributions on
+    for(int i = 0; i < 200; i++) {
+      Sentence sent(rand() % 10 + 1);
+      for(auto & word : sent) word = 2 + rand() % 8;
+      sent.push_back(0);
+      sents_.push_back(sent);
+    }
+    // Sentences over a larger vocabulary with a skewed distribution, and
+    // words that appear one to four times, so no discount is NaN
+    for(int i = 0; i < 200; i++) {
+      Sentence sent(rand() % 10 + 1);
+      for(auto & word : sent) {
+        float u = rand() / (float)RAND_MAX;
+        word = 2 + (int)(38 * u * u * u);
+      }
+      sent.push_back(0);
+      disc_sents_.push_back(sent);
+    }
+    for(int k = 0; k < 8; k++) {
+      for(int c = 0; c <= k % 4; c++) {
+        Sentence & sent = disc_sents_[rand() % disc_sents_.size()];
+        sent.insert(sent.begin() + rand() % sent.size(), 40 + k);
+      }
+    }
+  }
+  ~TestNgramTable() { }
+
+  // Find the positions of the values and starts arrays of each length in a
+  // binary model written by DistNgram::write_binary, with discounts of
+  // disc_size bytes, and return the number of contexts
+  static uint64_t FindBinaryArrays(const string & data, size_t disc_size, vector<size_t> & values, vector<size_t> & starts) {
+    auto padded = [](size_t size) { return size + (8 - size % 8) % 8; };
+    // The magic string, then the signature length, lengths, contexts and vocabulary position
+    uint64_t header[4];
+    memcpy(header, &data[16], sizeof(header));
+    size_t pos = 16 + sizeof(header) + padded(header[0]) + padded(disc_size);
+    for(size_t len = 0; len < header[1]; len++) {
+      uint64_t sizes[2];
+      memcpy(sizes, &data[pos], sizeof(sizes));
+      pos += sizeof(sizes) + padded(sizeof(WordId) * len * sizes[0]);
+      values.push_back(pos);
+      pos += padded(sizeof(int) * sizes[0]);
+      starts.push_back(pos);
+      pos += padded(sizeof(unsigned) * sizes[1]);
+    }
+    return header[2];
+  }
+
+  // Split a text model into its lines, keyed by the n-gram before the tab
+  // or by the position of lines without one, and the values in each line
+  static map<string, vector<string> > ParseModel(const string & text) {
+    map<string, vector<string> > ret;
+    istringstream in(text);
+    string line, val;
+    for(int i = 0; getline(in, line); i++) {
+      if(line.empty()) continue;
+      size_t tab = line.find('\t');
+      string key = (tab == string::npos ? "line " + to_string(i) : line.substr(0, tab));
+      istringstream vals(tab == string::npos ? line : line.substr(tab+1));
+      while(vals >> val) ret[key].push_back(val);
+    }
+    return ret;
+  }
+
+  map<Sentence, int> ngrams_;
+  NgramTable table_;
+  vector<Sentence> sents_, disc_sents_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(ngram_table, TestNgramTable)
+
+// Test whether every n-gram is found with its value, and others are not
+BOOST_AUTO_TEST_CASE(TestFind) {
+  BOOST_CHECK_EQUAL(ngrams_.size(), table_.size());
+  for(int i = 0; i < 1000; i++) {
+    Sentence ngram(rand() % 5);
+    for(auto & word : ngram) word = rand() % 11;
+    auto it = ngrams_.find(ngram);
+    const int * val = table_.find(ngram);
+    if(it == ngrams_.end()) {
+      BOOST_CHECK(val == NULL);
+    } else {
+      BOOST_CHECK(val != NULL && *val == it->second);
+    }
+  }
+}
+
+// Test whether the range of a context holds exactly the n-grams starting
+// with it, in order
+BOOST_AUTO_TEST_CASE(TestFindRange) {
+  for(const auto & ctxt : ngrams_) {
+    if(ctxt.first.size() > 2) continue;
+    vector<pair<Sentence,int> > exp_ngrams, act_ngrams;
+    for(const auto & ngram : ngrams_)
+      if(ngram.first.size() == ctxt.first.size()+1 && equal(ctxt.first.begin(), ctxt.first.end(), ngram.first.begin()))
+        exp_ngrams.push_back(ngram);
+    size_t len = ctxt.first.size() + 1;
+    pair<size_t,size_t> range = table_.find_range(ctxt.first.data(), ctxt.first.size());
+    for(size_t pos = range.first; pos < range.second; pos++)
+      act_ngrams.push_back(make_pair(Sentence(table_.get_words(len, pos), table_.get_words(len, pos) + len), table_.get_value(len, pos)));
+    BOOST_CHECK(exp_ngrams == act_ngrams);
+  }
+}
+
+// Test whether adding an n-gram twice is an error
+BOOST_AUTO_TEST_CASE(TestDuplicate) {
+  NgramTable table;
+  table.add(Sentence({1, 2}), 0);
+  table.add(Sentence({1, 2}), 1);
+  BOOST_CHECK_THROW(table.finalize(), std::runtime_error);
+}
+
+// Test whether the distributions of all words are those of each word, and
+// are the same after writing and reading
+BOOST_AUTO_TEST_CASE(TestDistNgram) {
+  DictPtr dict(CreateNewDict());
+  for(int i = 2; i < 10; i++)
+    dict->convert("w" + to_string(i));
+  {
+    DistNgram exp_dist("ngram_lin_1_2");
+    for(const Sentence & sent : sents_)
+      exp_dist.add_stats(sent);
+    exp_dist.finalize_stats();
+    stringstream ss;
+    exp_dist.write(dict, ss);
+    DistNgram act_dist(exp_dist.get_sig());
+    act_dist.read(dict, ss);
+    for(int i = 0; i < 20; i++) {
+      Sentence ctxt = {rand() % 10, rand() % 10};
+      vector<float> exp_all(3 * 10), act_all(3 * 10);
+      int exp_offset = 0, act_offset = 0, sparse_offset = 0;
+      DistBase::BatchSparseData batch_sparse;
+      exp_dist.calc_all_word_dists(ctxt, 10, 0.1f, 1.f, exp_all, exp_offset, batch_sparse, sparse_offset);
+      act_dist.calc_all_word_dists(ctxt, 10, 0.1f, 1.f, act_all, act_offset, batch_sparse, sparse_offset);
+      BOOST_CHECK_EQUAL_COLLECTIONS(exp_all.begin(), exp_all.end(), act_all.begin(), act_all.end());
+      for(int wid = 0; wid < 10; wid++) {
+        Sentence ngram = ctxt;
+        ngram.push_back(wid);
+        vector<float> word(3);
+        int offset = 0;
+        DistBase::SparseData sparse;
+        exp_dist.calc_word_dists(ngram, 0.1f, 1.f, word, offset, sparse, sparse_offset);
+        for(int j = 0; j < 3; j++)
+          BOOST_CHECK_CLOSE(exp_all[wid*3+j], word[j], 1e-4);
+      }
+    }
+  }
+}
+
+// Test whether counting and finalizing with several threads writes the same
+// model as with one
+BOOST_AUTO_TEST_CASE(TestParallelStats) {
+  DictPtr dict(CreateNewDict());
+  for(int i = 2; i < 10; i++)
+    dict->convert("w" + to_string(i));
+  for(string sig : {"ngram_lin_1_2", "ngram_mabs_1_2", "ngram_mkn_1_2_3", "ngram_mkn_2_1"}) {
+    DistNgram exp_dist(sig), act_dist(sig);
+    for(const Sentence & sent : sents_)
+      exp_dist.add_stats(sent);
+    exp_dist.finalize_stats();
+    act_dist.add_corpus_stats(sents_, 3);
+    act_dist.finalize_stats(3);
+    stringstream exp_ss, act_ss;
+    exp_dist.write(dict, exp_ss);
+    act_dist.write(dict, act_ss);
+    BOOST_CHECK_EQUAL(exp_ss.str(), act_ss.str());
+  }
+}
+
+// Test whether the statistics of a small corpus match models written by the
+// original implementation, which wrote the n-grams in hash order
+BOOST_AUTO_TEST_CASE(TestGoldenStats) {
+  // ngram_mabs_1_2
+  const string kGoldenMabs =
+    "distngram_v2\n"
+    "discounts 3\n"
+    "-nan -nan -nan\n"
+    "0.272727 2 0.5\n"
+    "0.733333 2 -nan\n"
+    "\n"
+    "mapping 31 18\n"
+    "w4 w3\t0 2 2 0.533333\n"
+    "<s> <s>\t0 4 3 0.533333\n"
+    "<s> w3\t4 0 0 0\n"
+    "w3 w2 w2\t1\n"
+    "<s> <s> w2\t2\n"
+    "w3 w2 w4\t1\n"
+    "w3 w2\t1 2 2 0.533333\n"
+    "w4\t3 2 1 0\n"
+    "w2 w4\t1 1 1 0.266667\n"
+    "w4 w3 <s>\t1\n"
+    "\t0 15 4 -nan\n"
+    "<s> <s> w3\t1\n"
+    "w3\t4 3 2 0.727273\n"
+    "<s> w2\t2 0 0 0\n"
+    "w3 w4 <s>\t1\n"
+    "w2\t4 2 2 1.45455\n"
+    "w4 <s>\t2 1 1 0.266667\n"
+    "<s> <s> w4\t1\n"
+    "w3 <s> w4\t1\n"
+    "w2 <s> w3\t2\n"
+    "w4 w3 w2\t1\n"
+    "w2 w4 <s>\t1\n"
+    "w2 w2\t1 0 0 0\n"
+    "w3 <s>\t2 1 1 0.266667\n"
+    "<s> w4\t2 0 0 0\n"
+    "w4 <s> w3\t1\n"
+    "<s>\t4 8 3 3.5\n"
+    "w2 w3\t0 1 1 0.266667\n"
+    "w2 <s>\t0 2 1 0\n"
+    "w2 w3 <s>\t1\n"
+    "w3 w4\t0 1 1 0.266667\n";
+
+  // ngram_mkn_1_2
+  const string kGoldenMkn =
+    "distngram_v2\n"
+    "discounts 3\n"
+    "0.2 1.7 3\n"
+    "0.4 1.6 3\n"
+    "0.733333 2 -nan\n"
+    "\n"
+    "mapping 31 18\n"
+    "w4\t2 2 1 0.4\n"
+    "w3 <s> w4\t1\n"
+    "<s> w3\t3 0 0 0\n"
+    "w3 w2 w2\t1\n"
+    "w3 w2 w4\t1\n"
+    "w3 w2\t1 2 2 0.533333\n"
+    "w2 w4\t1 1 1 0.266667\n"
+    "w4 w3 <s>\t1\n"
+    "\t0 8 4 1.4\n"
+    "<s> <s>\t0 4 3 0.533333\n"
+    "<s> <s> w3\t1\n"
+    "w2 <s> w3\t2\n"
+    "w4 w3 w2\t1\n"
+    "<s> <s> w2\t2\n"
+    "w2 w3\t0 1 1 0.266667\n"
+    "<s>\t2 6 3 1\n"
+    "<s> w2\t1 0 0 0\n"
+    "w3 w4 <s>\t1\n"
+    "w4 <s>\t2 1 1 0.266667\n"
+    "<s> <s> w4\t1\n"
+    "w2\t3 2 2 1.2\n"
+    "w2 w4 <s>\t1\n"
+    "w2 w2\t1 0 0 0\n"
+    "<s> w4\t2 0 0 0\n"
+    "w3 <s>\t2 1 1 0.266667\n"
+    "w4 <s> w3\t1\n"
+    "w2 <s>\t0 2 1 0\n"
+    "w2 w3 <s>\t1\n"
+    "w3 w4\t0 1 1 0.266667\n"
+    "w4 w3\t0 2 2 0.533333\n"
+    "w3\t1 3 2 1\n";
+
+  DictPtr dict(CreateNewDict());
+  for(int i = 2; i < 5; i++)
+    dict->convert("w" + to_string(i));
+  vector<Sentence> sents = {{2,3,4,0}, {3,4,2,0}, {2,3,2,0}, {4,3,0}};
+  for(auto sig_exp : vector<pair<string,string> >({{"ngram_mabs_1_2", kGoldenMabs}, {"ngram_mkn_1_2", kGoldenMkn}})) {
+    for(int threads : {1, 3}) {
+      DistNgram dist(sig_exp.first);
+      dist.add_corpus_stats(sents, threads);
+      dist.finalize_stats(threads);
+      stringstream act_ss;
+      dist.write(dict, act_ss);
+      map<string, vector<string> > exp = ParseModel(sig_exp.second), act = ParseModel(act_ss.str());
+      BOOST_CHECK_EQUAL(exp.size(), act.size());
+      for(const auto & line : exp) {
+        auto it = act.find(line.first);
+        if(it == act.end()) {
+          BOOST_ERROR(sig_exp.first << ": missing line " << line.first);
+          continue;
+        }
+        BOOST_CHECK_EQUAL(line.second.size(), it->second.size());
+        for(size_t i = 0; i < min(line.second.size(), it->second.size()); i++) {
+          const string & exp_val = line.second[i], & act_val = it->second[i];
+          char *exp_end, *act_end;
+          float exp_f = strtof(exp_val.c_str(), &exp_end), act_f = strtof(act_val.c_str(), &act_end);
+          if(*exp_end != 0 || *act_end != 0)
+            BOOST_CHECK_EQUAL(exp_val, act_val);
+          else if(std::isnan(exp_f))
+            BOOST_CHECK_MESSAGE(std::isnan(act_f), sig_exp.first << " " << line.first << ": expected nan, got " << act_val);
+          else
+            BOOST_CHECK_SMALL(exp_f - act_f, 1e-5f);
+        }
+      }
+    }
+  }
+}
+
+// Test whether counting on disk writes the same model as in memory, with
+// few enough n-grams in memory that the runs are merged more than once
+BOOST_AUTO_TEST_CASE(TestDiskStats) {
+  DictPtr dict(CreateNewDict());
+  for(int i = 2; i < 10; i++)
+    dict->convert("w" + to_string(i));
+  for(string sig : {"ngram_lin_1_2", "ngram_mabs_1_2", "ngram_mkn_1_2_3", "ngram_mkn_2_1", "ngram_mkn"}) {
+    DistNgram exp_dist(sig);
+    DistNgramDisk act_dist(sig, ".", 10);
+    for(const Sentence & sent : sents_) {
+      exp_dist.add_stats(sent);
+      act_dist.add_stats(sent);
+    }
+    exp_dist.finalize_stats();
+    act_dist.finalize_stats();
+    stringstream exp_ss, act_ss;
+    exp_dist.write(dict, exp_ss);
+    act_dist.write(dict, act_ss);
+    BOOST_CHECK_EQUAL(exp_ss.str(), act_ss.str());
+  }
+}
+
+// Test whether binary models are read with the same distributions, both
+// mapped in place and with a vocabulary with different ids
+BOOST_AUTO_TEST_CASE(TestBinary) {
+  DictPtr dict(CreateNewDict()), other_dict(CreateNewDict());
+  for(int i = 2; i < 48; i++)
+    dict->convert("w" + to_string(i));
+  for(int i = 47; i > 2; i -= 2)
+    other_dict->convert("w" + to_string(i));
+  other_dict->freeze();
+  other_dict->set_unk("<unk>");
+  string file = "test-binary.dist";
+  for(string sig : {"ngram_lin_1_2", "ngram_mabs_1_2", "ngram_mkn_1_2_3"}) {
+    DistNgram exp_dist(sig);
+    for(const Sentence & sent : disc_sents_)
+      exp_dist.add_stats(sent);
+    exp_dist.finalize_stats();
+    {
+      ofstream out(file, ios::binary);
+      exp_dist.write_binary(dict, out);
+    }
+    BOOST_CHECK_EQUAL(exp_dist.get_sig(), DistNgram::get_binary_sig(file));
+    stringstream exp_ss, act_ss;
+    exp_dist.write(dict, exp_ss);
+    DistFactory::from_file(file, dict)->write(dict, act_ss);
+    BOOST_CHECK_EQUAL(exp_ss.str(), act_ss.str());
+    // The model should be the same as the text model read with the other
+    // vocabulary, which has different ids and is missing some words. This
+    // needs discounts that are not NaN, as NaN is not read back from text.
+    BOOST_CHECK(exp_ss.str().find("nan") == string::npos);
+    stringstream other_exp_ss, other_act_ss;
+    DistNgram other_exp_dist(sig);
+    other_exp_dist.read(other_dict, exp_ss);
+    other_exp_dist.write(other_dict, other_exp_ss);
+    DistFactory::from_file(file, other_dict)->write(other_dict, other_act_ss);
+    BOOST_CHECK_EQUAL(other_exp_ss.str(), other_act_ss.str());
+  }
+  remove(file.c_str());
+}
+
+// Test whether binary models used in place with context ids or word
+// positions out of range are rejected
+BOOST_AUTO_TEST_CASE(TestBinaryCorrupted) {
+  DictPtr dict(CreateNewDict());
+  for(int i = 2; i < 10; i++)
+    dict->convert("w" + to_string(i));
+  string file = "test-binary-corrupted.dist";
+  DistNgram exp_dist("ngram_lin_1_2");
+  for(const Sentence & sent : sents_)
+    exp_dist.add_stats(sent);
+  exp_dist.finalize_stats();
+  stringstream ss;
+  exp_dist.write_binary(dict, ss);
+  const string data = ss.str();
+  vector<size_t> values, starts;
+  uint64_t num_ctxts = FindBinaryArrays(data, 0, values, starts);
+  auto check_read = [&](const string & corrupted, bool ok) {
+    {
+      ofstream out(file, ios::binary);
+      out << corrupted;
+    }
+    DistNgram dist("ngram_lin_1_2");
+    if(ok)
+      BOOST_CHECK_NO_THROW(dist.read_binary(dict, file));
+    else
+      BOOST_CHECK_THROW(dist.read_binary(dict, file), std::runtime_error);
+  };
+  check_read(data, true);
+  // The id of the empty context
+  string bad_ctxt = data;
+  int ctxt_id = num_ctxts;
+  memcpy(&bad_ctxt[values[0]], &ctxt_id, sizeof(int));
+  check_read(bad_ctxt, false);
+  // The first position of the unigrams past the end, and before the previous
+  string bad_start = data;
+  unsigned start = 1000000;
+  memcpy(&bad_start[starts[1]], &start, sizeof(unsigned));
+  check_read(bad_start, false);
+  bad_start = data;
+  memcpy(&start, &bad_start[starts[1] + sizeof(unsigned)], sizeof(unsigned));
+  memcpy(&bad_start[starts[1]], &++start, sizeof(unsigned));
+  check_read(bad_start, false);
+  remove(file.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
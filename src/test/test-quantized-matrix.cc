@@ -0,0 +1,69 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/quantized-matrix.h>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestQuantizedMatrix {
+
+  TestQuantizedMatrix() {
+    srand(1);
+    mat_ = Eigen::MatrixXf::Random(7, 5);
+    mat_.row(3) *= 100.f;
+    in_ = Eigen::MatrixXf::Random(5, 3);
+  }
+  ~TestQuantizedMatrix() { }
+
+  // Check that the product is within tol of the float product
+  void CheckMultiply(const string & type, float tol) {
+    QuantizedMatrix quant(mat_, type);
+    Eigen::MatrixXf exp = mat_ * in_, act;
+    quant.Multiply(in_, act);
+    BOOST_CHECK_EQUAL(exp.rows(), act.rows());
+    BOOST_CHECK_EQUAL(exp.cols(), act.cols());
+    for(int r = 0; r < exp.rows(); r++)
+      for(int c = 0; c < exp.cols(); c++)
+        BOOST_CHECK_SMALL(exp(r, c) - act(r, c), tol * mat_.row(r).cwiseAbs().maxCoeff());
+  }
+
+  Eigen::MatrixXf mat_, in_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(quantized_matrix, TestQuantizedMatrix)
+
+// Test whether products are close to those with floats
+BOOST_AUTO_TEST_CASE(TestMultiply) {
+  CheckMultiply("float", 1e-5);
+  CheckMultiply("int8", 0.02);
+  CheckMultiply("fp16", 0.002);
+}
+
+// Test whether all half floats are converted back to themselves
+BOOST_AUTO_TEST_CASE(TestHalfRoundTrip) {
+  for(uint32_t val = 0; val < 0x10000; val++) {
+    // Skip NaNs
+    if((val & 0x7c00) == 0x7c00 && (val & 0x3ff)) continue;
+    BOOST_CHECK_EQUAL(val, QuantizedMatrix::FloatToHalf(QuantizedMatrix::HalfToFloat(val)));
+  }
+}
+
+// Test whether reading gives the same values as were written
+BOOST_AUTO_TEST_CASE(TestWriteRead) {
+  for(string type : {"float", "int8", "fp16"}) {
+    QuantizedMatrix exp_mat(mat_, type), act_mat;
+    stringstream ss;
+    exp_mat.Write(ss);
+    act_mat.Read(ss, mat_.rows(), mat_.cols());
+    BOOST_CHECK_EQUAL(exp_mat.GetType(), act_mat.GetType());
+    vector<float> exp_vals = exp_mat.Dequantize(), act_vals = act_mat.Dequantize();
+    BOOST_CHECK_EQUAL_COLLECTIONS(exp_vals.begin(), exp_vals.end(), act_vals.begin(), act_vals.end());
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
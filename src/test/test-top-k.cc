@@ -0,0 +1,89 @@
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include <lamtram/top-k.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace std;
+using namespace lamtram;
+
+// ****** The fixture *******
+struct TestTopK {
+
+  TestTopK() {
+    // Random scores with some ties
+    mt19937 gen(1);
+    uniform_int_distribution<int> dist(0, 50);
+    scores_.resize(rows_ * cols_);
+    for(auto & score : scores_) score = dist(gen) / -10.f;
+    offsets_ = {-1.3f, 0.f, -0.7f};
+    add_ = 0.1f;
+    adjust_ = {make_pair(0, 0.f), make_pair(5, 0.1f), make_pair(5, -2.3f)};
+  }
+  ~TestTopK() { }
+
+  // Find the best entries by sorting everything
+  vector<TopKEntry> SortAll(size_t k, size_t max_per_row) {
+    vector<TopKEntry> ret;
+    for(int r = 0; r < rows_; r++) {
+      vector<TopKEntry> row;
+      for(int c = 0; c < cols_; c++) {
+        // Add the same way as adding to each score before the offset
+        float score = scores_[r*cols_ + c];
+        bool adjusted = false;
+        for(auto & adj : adjust_) {
+          if(adj.first == c) {
+            score += adj.second;
+            adjusted = true;
+          }
+        }
+        if(!adjusted) score += add_;
+        row.push_back(TopKEntry(offsets_[r] + score, r, c));
+      }
+      sort(row.begin(), row.end());
+      ret.insert(ret.end(), row.begin(), row.begin() + min(max_per_row, row.size()));
+    }
+    sort(ret.begin(), ret.end());
+    ret.resize(min(k, ret.size()), TopKEntry(0.f, -1, -1));
+    return ret;
+  }
+
+  void CheckTopK(size_t k, size_t max_per_row) {
+    vector<TopKEntry> exp = SortAll(k, max_per_row);
+    TopK top(k, max_per_row);
+    for(int r = 0; r < rows_; r++)
+      top.AddRow(r, &scores_[r*cols_], cols_, offsets_[r], add_, adjust_);
+    vector<TopKEntry> act = top.Get();
+    BOOST_CHECK_EQUAL(exp.size(), act.size());
+    for(size_t i = 0; i < min(exp.size(), act.size()); i++) {
+      BOOST_CHECK_EQUAL(exp[i].row, act[i].row);
+      BOOST_CHECK_EQUAL(exp[i].col, act[i].col);
+      BOOST_CHECK_EQUAL(exp[i].score, act[i].score);
+    }
+  }
+
+  int rows_ = 3, cols_ = 40;
+  vector<float> scores_, offsets_;
+  float add_;
+  vector<pair<int,float> > adjust_;
+};
+
+// ****** The tests *******
+BOOST_FIXTURE_TEST_SUITE(top_k, TestTopK)
+
+// Test whether the top k are the same as when sorting all the entries
+BOOST_AUTO_TEST_CASE(TestTopKSorted) {
+  CheckTopK(1, 1);
+  CheckTopK(5, 5);
+  CheckTopK(500, 500);
+}
+
+// Test whether the number of entries from each row is limited
+BOOST_AUTO_TEST_CASE(TestTopKMaxPerRow) {
+  CheckTopK(5, 2);
+  CheckTopK(10, 3);
+}
+
+BOOST_AUTO_TEST_SUITE_END()